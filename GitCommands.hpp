@@ -1,7 +1,21 @@
+#include "git_objects/GitDiff.hpp"
+#include "git_objects/GitFSMonitor.hpp"
+#include "git_objects/GitIgnore.hpp"
 #include "git_objects/GitIndex.hpp"
 #include "git_objects/GitObject.hpp"
+#include "git_objects/GitObjectCache.hpp"
 #include "git_objects/GitObjectsFactory.hpp"
+#include "git_objects/GitPackWriter.hpp"
 #include "git_objects/GitRepository.hpp"
+#include "utilities/ThreadPool.hpp"
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <set>
+#include <sys/stat.h>
+#include <unordered_set>
 
 namespace GitCommands {
 void init(const std::string& pathToGitRepository)
@@ -15,26 +29,85 @@ void catFile(const std::string& objectFormat,
              const std::string& objectReference)
 {
     auto objectHash = Git::GitObject::findObject(objectReference, objectFormat);
-    auto object = GitObjectFactory::read(objectHash);
+    auto object = GitObjectCache::read(objectHash);
     std::cout << object->serialize().data();
 }
 
+/*
+    Long running cat-file, reads object names from input, one per line, and
+    writes for each of them:
+        |hash|| ||type|| ||size||\n|
+        |content||\n|
+    Content is left out when withContent is false, so only headers are read.
+    Names that don't resolve to an object give "<name> missing".
+*/
+void catFileBatch(std::istream& input, std::ostream& output, bool withContent)
+{
+    constexpr size_t FLUSH_THRESHOLD = 64 * 1024;
+
+    std::string buffered;
+    auto flush = [&]() {
+        output.write(buffered.data(), buffered.size());
+        output.flush();
+        buffered.clear();
+    };
+
+    std::string name;
+    while (true) {
+        // output is held back while more input is ready, but whoever is on
+        // the other side gets every answer before we wait for a new question
+        if (input.rdbuf()->in_avail() <= 0 ||
+            buffered.size() >= FLUSH_THRESHOLD) {
+            flush();
+        }
+        if (!std::getline(input, name)) {
+            break;
+        }
+
+        try {
+            auto objectHash = GitObject::findObject(name);
+            if (withContent) {
+                auto object = GitObjectFactory::readRaw(objectHash);
+                buffered += fmt::format("{} {} {}\n", objectHash.data(),
+                                        object.format, object.data.size());
+                buffered += object.data;
+                buffered += '\n';
+            }
+            else {
+                auto header = GitObjectFactory::readHeader(objectHash);
+                buffered += fmt::format("{} {} {}\n", objectHash.data(),
+                                        header.format, header.size);
+            }
+        }
+        catch (const std::runtime_error&) {
+            buffered += fmt::format("{} missing\n", name);
+        }
+    }
+    flush();
+}
+
 GitHash hashObject(const std::filesystem::path& path, const std::string& format,
                    bool write = true)
 {
+    if (format == "blob") {
+        return Git::GitObject::writeBlob(path, write);
+    }
+
     auto fileContent = Utilities::readFile(path);
-    auto gitObject = GitObjectFactory::create(format, fileContent);
+    auto gitObject =
+        GitObjectFactory::create(format, ObjectData(std::move(fileContent)));
 
     auto objectHash = Git::GitObject::write(gitObject.get(), write);
     return objectHash;
 }
 
-// TODO: figure out when commit can have multiple parents
+// Follows the first parent, like git log --first-parent: the commits of a
+// merged branch are only named by their merge.
 void displayLog(const GitHash& hash)
 {
-    auto gitObject = GitObjectFactory::read(hash);
+    auto gitObject = GitObjectCache::read(hash);
     assert(gitObject->format() == "commit");
-    GitCommit* commit = static_cast<GitCommit*>(gitObject.get());
+    auto commit = static_cast<const GitCommit*>(gitObject.get());
 
     auto& commitMessage = commit->commitMessage();
 
@@ -49,37 +122,50 @@ void displayLog(const GitHash& hash)
     // auto date =
     // Utilities::decodeDateIn(commitMessage.author.substr(authorEnds + 2));
     std::cout << "commit: " << hash << std::endl;
+    if (commitMessage.parents.size() > 1) {
+        std::cout << "Merge:";
+        for (const auto& parent : commitMessage.parents) {
+            std::cout << ' ' << parent.substr(0, 7);
+        }
+        std::cout << std::endl;
+    }
     std::cout << "Author: " << author << std::endl;
     // std::cout << "Date:   " << date << std::endl;
     std::cout << "\n\t" << commitMessage.message << std::endl;
 
-    if (commitMessage.parent.empty()) {
+    if (commitMessage.parents.empty()) {
         return;
     }
     else {
-        displayLog(GitHash(commitMessage.parent));
+        displayLog(GitHash(commitMessage.parents.front()));
     }
 }
 
 void listTree(const GitHash& objectHash, const std::string& parentDir,
               bool recursive)
 {
-    auto gitObject = GitObjectFactory::read(objectHash);
+    auto gitObject = GitObjectCache::read(objectHash);
     // TODO: don't assume that caller will pass right object hash
-    auto tree = static_cast<GitTree*>(gitObject.get());
+    auto tree = static_cast<const GitTree*>(gitObject.get());
 
-    for (const auto& treeLeaf : tree->tree()) {
+    for (const auto& entry : tree->entries()) {
         try {
-            auto childFormat = GitObjectFactory::read(treeLeaf.hash)->format();
+            // the mode is enough for well-formed trees, so blobs are never
+            // touched
+            auto childFormat = GitTree::formatOf(entry.mode);
+            if (childFormat.empty()) {
+                childFormat =
+                    GitObjectFactory::readHeader(entry.objectHash()).format;
+            }
+            auto childPath = std::filesystem::path(parentDir) / entry.name;
             if (recursive && childFormat == "tree") {
-                listTree(treeLeaf.hash, treeLeaf.filePath.filename(),
-                         recursive);
+                listTree(entry.objectHash(), childPath.string(), recursive);
             }
             else {
-                std::cout << fmt::format(
-                    "{0} {1} {2}\t{3}\n", treeLeaf.fileMode, childFormat,
-                    treeLeaf.hash.data(),
-                    (parentDir / treeLeaf.filePath).string());
+                std::cout << fmt::format("{:06o} {} {}\t{}\n", entry.mode,
+                                         childFormat,
+                                         entry.objectHash().data(),
+                                         childPath.string());
             }
         }
         catch (std::runtime_error e) {
@@ -88,81 +174,30 @@ void listTree(const GitHash& objectHash, const std::string& parentDir,
     }
 }
 
-void treeCheckout(const GitObject* object,
-                  const std::filesystem::path& checkoutDirectory)
+std::unordered_map<std::string, std::vector<std::filesystem::path>>
+getAll(const std::filesystem::path& refDir)
 {
-    auto treeObject = dynamic_cast<const GitTree*>(object);
-    for (const auto& treeLeaf : treeObject->tree()) {
-        auto childObject = GitObjectFactory::read(treeLeaf.hash);
-        auto destination = checkoutDirectory / treeLeaf.filePath;
-
-        if (childObject->format() == "tree") {
-            std::filesystem::create_directories(destination);
-            treeCheckout(childObject.get(), destination);
-        }
-        else if (childObject->format() == "blob") {
-            Utilities::writeToFile(destination,
-                                   childObject->serialize().data());
-        }
+    std::unordered_map<std::string, std::vector<std::filesystem::path>> refs;
+    if (refDir.empty()) {
+        return refs;
     }
-}
-
-void cleanDirectory()
-{
-    std::vector<std::filesystem::path> entriesToRemove;
-    for (const auto dirEntry : std::filesystem::directory_iterator(
-             GitRepository::findRoot().workTree())) {
-        auto dirEntryPath = dirEntry.path();
-        if (dirEntry.is_directory() &&
-            dirEntryPath.string().find("/.git") != std::string::npos) {
-            continue;
+    if (std::filesystem::exists(refDir)) {
+        for (auto const& dir_entry :
+             std::filesystem::recursive_directory_iterator{refDir}) {
+            if (dir_entry.is_regular_file()) {
+                auto hash = GitObject::resolveReference(dir_entry.path());
+                refs[hash].push_back(dir_entry.path());
+            }
         }
-        entriesToRemove.push_back(dirEntryPath);
-    }
-    for (const auto& entry : entriesToRemove) {
-        std::filesystem::remove_all(entry);
-    }
-}
-
-void checkout(const std::string& branchOrCommit)
-{
-    cleanDirectory();
-    auto commit = GitObject::findObject(branchOrCommit);
-    auto gitObject =
-        GitObjectFactory::read(GitObject::findObject(commit.data()));
-    auto workTree = GitRepository::findRoot().workTree();
-
-    // if is a branch
-    if (auto pathToBranch =
-            GitRepository::repoFile("refs", "heads", branchOrCommit);
-        std::filesystem::exists(pathToBranch)) {
-        std::cout << fmt::format("Switched to branch: `{}`\n", branchOrCommit);
-        GitRepository::setHEAD(branchOrCommit);
-    }
-    else {
-        GitRepository::setHEAD(commit);
-    }
-
-    if (gitObject->format() == "commit") {
-        auto gitCommit = static_cast<GitCommit*>(gitObject.get());
-        auto treeHash = GitHash(gitCommit->commitMessage().tree);
-        auto tree = GitObjectFactory::read(treeHash);
-        treeCheckout(tree.get(), workTree);
-    }
-    else if (gitObject->format() == "tree") {
-        treeCheckout(gitObject.get(), workTree);
     }
-}
 
-std::unordered_map<std::string, std::vector<std::filesystem::path>>
-getAll(const std::filesystem::path& refDir)
-{
-    std::unordered_map<std::string, std::vector<std::filesystem::path>> refs;
-    for (auto const& dir_entry :
-         std::filesystem::recursive_directory_iterator{refDir}) {
-        if (dir_entry.is_regular_file()) {
-            auto hash = GitObject::resolveReference(dir_entry.path());
-            refs[hash].push_back(dir_entry.path());
+    // refs git gc packed, unless a loose file took over
+    const auto& gitDir = GitRepository::findRoot().gitDir();
+    auto prefix = refDir.lexically_relative(gitDir).generic_string() + '/';
+    for (const auto& [name, hash] : GitRepository::packedRefs()) {
+        auto path = gitDir / name;
+        if (name.starts_with(prefix) && !std::filesystem::exists(path)) {
+            refs[hash].push_back(path);
         }
     }
     return refs;
@@ -196,102 +231,1907 @@ void createTag(const std::string& tagName, const GitHash& objectHash,
     }
 }
 
+// Takes index.lock. Commands that change the index hold it from before they
+// read the index until they write it back through it.
+Utilities::LockFile lockIndex()
+{
+    return Utilities::LockFile(GitRepository::repoPath("index"));
+}
+
+// The index of the repository, empty if nothing was staged yet.
+GitIndex readIndex()
+{
+    auto indexFile = GitRepository::repoPath("index");
+    if (!std::filesystem::exists(indexFile)) {
+        return GitIndex();
+    }
+    return GitIndex::read(indexFile,
+                          GitRepository::configNumber("index.threads", 0));
+}
+
 void listFiles()
 {
-    auto indexFile = GitRepository::repoFile("index");
+    auto index = readIndex();
+    for (size_t position = 0; position < index.size(); ++position) {
+        std::cout << index.path(position) << '\n';
+    }
+}
+
+// Path relative to the root of the worktree with '/' separators, as the index
+// stores it. The worktree itself is "".
+std::string worktreePath(const std::filesystem::path& path)
+{
+    auto root = std::filesystem::absolute(GitRepository::findRoot().workTree())
+                    .lexically_normal();
+    auto relative = std::filesystem::absolute(path).lexically_normal()
+                        .lexically_relative(root)
+                        .generic_string();
+    if (relative.starts_with("..") || relative.empty()) {
+        GENERATE_EXCEPTION("'{}' is outside repository", path.string());
+    }
+    if (relative == ".") {
+        return "";
+    }
+    if (relative.ends_with('/')) {
+        relative.pop_back();
+    }
+    return relative;
+}
 
-    auto res = GitIndex::parse(indexFile);
-    for (const auto& entry : res) {
-        std::cout << entry.objectName << std::endl;
+// Number of threads for jobs, 0 takes it from core.threads, whose default
+// of 0 means one thread per core.
+size_t numberOfThreads(size_t jobs)
+{
+    if (jobs == 0) {
+        jobs = GitRepository::configNumber("core.threads", 0);
     }
+    return jobs == 0 ? Utilities::ThreadPool::hardwareThreads() : jobs;
 }
 
-GitHash createTree(const std::filesystem::path& dirPath)
+// Whether path is prefix itself or inside of it, "" is the whole worktree.
+bool isInside(std::string_view path, std::string_view prefix)
 {
-    std::vector<GitTreeLeaf> leaves;
-    for (auto dirEntry : std::filesystem::directory_iterator(dirPath)) {
-        auto dirEntryPath = dirEntry.path();
-        if (dirEntry.is_regular_file()) {
-            leaves.push_back({.fileMode = GitTree::fileMode(dirEntry, "blob"),
-                              .filePath = dirEntryPath.filename(),
-                              .hash = hashObject(dirEntry.path(), "blob")});
+    return prefix.empty() || path == prefix ||
+           (path.starts_with(prefix) && path[prefix.size()] == '/');
+}
+
+// Blob of a file as the index records it, a symbolic link is stored as the
+// path it points to.
+GitHash writeWorktreeBlob(const std::filesystem::path& file,
+                          const IndexStat& stat, bool actuallyWrite = true)
+{
+    if (stat.mode == S_IFLNK) {
+        auto blob = GitObjectFactory::create(
+            "blob", ObjectData(std::filesystem::read_symlink(file).string()));
+        return GitObject::write(blob.get(), actuallyWrite);
+    }
+    return GitObject::writeBlob(file, actuallyWrite);
+}
+
+// What the filesystem monitor saw change since the entries of the index were
+// last checked, empty if it isn't enabled or doesn't run.
+std::optional<GitFSMonitor::Changes> monitoredChanges(const GitIndex& index)
+{
+    if (!GitFSMonitor::isEnabled()) {
+        return std::nullopt;
+    }
+    return GitFSMonitor::query(index.fsmonitorToken());
+}
+
+// Whether the monitor vouches that the entry still matches its file.
+bool isMonitoredClean(const std::optional<GitFSMonitor::Changes>& changes,
+                      const GitIndex& index, size_t position)
+{
+    return changes && !changes->everything &&
+           !index.isFSMonitorDirty(position) &&
+           !changes->contains(index.path(position));
+}
+
+// Appends the files under path that aren't ignored, relative to the
+// worktree, to files. A file named by path itself is taken even if it is
+// ignored.
+void collectFiles(const std::string& path, std::vector<std::string>& files,
+                  GitIgnore& ignore)
+{
+    auto fullPath = GitRepository::findRoot().workTree() / path;
+    auto status = std::filesystem::symlink_status(fullPath);
+    if (!std::filesystem::is_directory(status)) {
+        if (std::filesystem::exists(status)) {
+            files.push_back(path);
         }
-        else if (dirEntry.is_directory() && !dirPath.empty() &&
-                 !dirEntryPath.string().ends_with(".git")) {
-            // TODO: add support for the commit(submodules)
-            leaves.push_back({.fileMode = GitTree::fileMode(dirEntry, "tree"),
-                              .filePath = dirEntry,
-                              .hash = createTree(dirEntryPath)});
+        return;
+    }
+    ignore.walk(path, [&](const std::string& file, bool isDirectory) {
+        if (!isDirectory) {
+            files.push_back(file);
+        }
+        return true;
+    });
+}
+
+// Stages the files under paths. Untracked files that are ignored are left
+// out, tracked ones never are. Files whose stat data didn't change since they
+// were staged aren't read again, files that were deleted are removed from the
+// index. With a filesystem monitor, files of entries it saw no change in
+// aren't even stat'ed. Returns false if the index didn't change.
+bool addToIndex(GitIndex& index,
+                const std::vector<std::filesystem::path>& paths,
+                size_t jobs = 0)
+{
+    const auto& workTree = GitRepository::findRoot().workTree();
+    auto monitored = monitoredChanges(index);
+
+    std::vector<std::string> prefixes;
+    for (const auto& path : paths) {
+        prefixes.push_back(worktreePath(path));
+    }
+    // new files can't be told from the monitor, it only answers for the
+    // entries of the index, so the paths are walked anyway
+    GitIgnore ignore(workTree);
+    std::vector<std::string> files;
+    for (const auto& prefix : prefixes) {
+        collectFiles(prefix, files, ignore);
+    }
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    // tracked files the walk didn't find were deleted or are in an ignored
+    // directory, they are checked like the others
+    auto walked = files.size();
+    for (const auto& prefix : prefixes) {
+        for (auto position = index.lowerBound(prefix);
+             position < index.size() &&
+             index.path(position).starts_with(prefix);
+             ++position) {
+            auto path = index.path(position);
+            if (isInside(path, prefix) &&
+                !std::binary_search(files.begin(), files.begin() + walked,
+                                    path)) {
+                files.emplace_back(path);
+            }
         }
     }
+    std::sort(files.begin() + walked, files.end());
+    std::inplace_merge(files.begin(), files.begin() + walked, files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
 
-    GitTree tree(leaves);
-    auto treeHash = GitObject::write(&tree);
-    return treeHash;
+    // the stat data tells which files changed, only those are hashed. Files
+    // are stat'ed in batches, a task for each file would cost more than the
+    // lstat itself.
+    constexpr size_t BATCH_SIZE = 1024;
+    struct Checked {
+        std::vector<IndexEntry> changed;
+        std::vector<std::string> removed;
+    };
+    auto root = workTree.string() + '/';
+    std::vector<std::future<Checked>> batches;
+    std::vector<IndexEntry> entries;
+    std::vector<std::string> removed;
+    std::vector<std::future<GitHash>> hashes;
+    // declared after what its tasks use, so if a wait throws it joins its
+    // threads before any of that goes away
+    Utilities::ThreadPool pool(numberOfThreads(jobs) - 1);
+    for (size_t start = 0; start < files.size(); start += BATCH_SIZE) {
+        batches.push_back(pool.submit([&, start] {
+            Checked checked;
+            std::string file;
+            auto end = std::min(start + BATCH_SIZE, files.size());
+            for (auto i = start; i < end; ++i) {
+                auto position = index.find(files[i]);
+                if (position && isMonitoredClean(monitored, index, *position)) {
+                    continue;
+                }
+                file.assign(root).append(files[i]);
+                auto stat = GitIndex::tryStatOf(file.c_str());
+                // a directory that replaced a tracked file was walked already,
+                // an unmerged file that was deleted goes with all its stages
+                if (!stat || stat->mode == (S_IFDIR | S_IFLNK)) {
+                    auto first = index.lowerBound(files[i]);
+                    if (first < index.size() &&
+                        index.path(first) == files[i]) {
+                        checked.removed.push_back(files[i]);
+                    }
+                    continue;
+                }
+                if (position && index.isUpToDate(*position, *stat)) {
+                    continue;
+                }
+                checked.changed.push_back({.stat = *stat,
+                                           .hash = GitHash(),
+                                           .flags = 0,
+                                           .extendedFlags = 0,
+                                           .path = files[i]});
+            }
+            return checked;
+        }));
+    }
+    for (auto& batch : batches) {
+        auto checked = pool.wait(batch);
+        entries.insert(entries.end(), checked.changed.begin(),
+                       checked.changed.end());
+        removed.insert(removed.end(), checked.removed.begin(),
+                       checked.removed.end());
+    }
+    for (const auto& entry : entries) {
+        hashes.push_back(pool.submit([&] {
+            return writeWorktreeBlob(workTree / entry.path, entry.stat);
+        }));
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i].hash = pool.wait(hashes[i]);
+    }
+
+    // a deleted file still matches its entry
+    for (size_t i = 0; i < paths.size(); ++i) {
+        bool matched = std::filesystem::exists(
+            std::filesystem::symlink_status(paths[i]));
+        for (auto position = index.lowerBound(prefixes[i]);
+             !matched && position < index.size() &&
+             index.path(position).starts_with(prefixes[i]);
+             ++position) {
+            matched = isInside(index.path(position), prefixes[i]);
+        }
+        if (!matched) {
+            GENERATE_EXCEPTION("pathspec '{}' did not match any files",
+                               paths[i].string());
+        }
+    }
+
+    if (entries.empty() && removed.empty()) {
+        return false;
+    }
+    index.add(std::move(entries));
+    index.remove(removed);
+    // every entry was checked, the next add needs only what changes after
+    // the token
+    if (monitored && std::count(prefixes.begin(), prefixes.end(), "") > 0) {
+        index.setFSMonitor(monitored->token, {});
+    }
+    return true;
 }
 
-void commit(const std::string& message = "")
+void add(const std::vector<std::filesystem::path>& paths, size_t jobs = 0)
 {
-    auto rootRepo = GitRepository::findRoot();
-    auto numberOfFiles =
-        std::distance(std::filesystem::directory_iterator(rootRepo.workTree()),
-                      std::filesystem::directory_iterator{});
-    if (numberOfFiles == 1 && std::filesystem::exists(rootRepo.gitDir())) {
-        std::cout << "There is nothing to commit" << std::endl;
-        return;
+    auto lock = lockIndex();
+    auto index = readIndex();
+    if (addToIndex(index, paths, jobs)) {
+        index.write(lock);
     }
+}
 
-    auto getParent = [&]() {
+struct FileStatus {
+    // 'A' for added, 'M' for modified, 'D' for deleted, 'U' for unmerged
+    char change;
+    std::string path;
+
+    bool operator==(const FileStatus&) const = default;
+};
+
+struct Status {
+    // HEAD compared with the index
+    std::vector<FileStatus> staged;
+    // the index compared with the worktree
+    std::vector<FileStatus> unstaged;
+    // a directory without tracked files is listed once, with a trailing '/'
+    std::vector<std::string> untracked;
+};
+
+struct TrackedFile {
+    std::string path;
+    uint32_t mode;
+    GitHash hash;
+};
+
+void flattenTree(const GitHash& treeHash, const std::string& prefix,
+                 std::vector<TrackedFile>& files)
+{
+    auto tree = GitObjectCache::read(treeHash);
+    for (const auto& entry :
+         static_cast<const GitTree*>(tree.get())->entries()) {
+        auto path = prefix + std::string(entry.name);
+        if (GitTree::formatOf(entry.mode) == "tree") {
+            flattenTree(entry.objectHash(), path + '/', files);
+        }
+        else {
+            files.push_back({std::move(path), entry.mode, entry.objectHash()});
+        }
+    }
+}
+
+// Files of the commit HEAD points to sorted by path, as the index sorts them.
+// Empty when there are no commits yet.
+std::vector<TrackedFile> headFiles()
+{
+    std::vector<TrackedFile> files;
+    std::string head;
+    try {
+        head = GitRepository::HEAD();
+    }
+    catch (const std::runtime_error&) {
+        return files;
+    }
+    auto commit = GitObjectCache::read(GitHash(head));
+    flattenTree(GitHash(static_cast<const GitCommit*>(commit.get())
+                            ->commitMessage()
+                            .tree),
+                "", files);
+    std::sort(files.begin(), files.end(),
+              [](const auto& lhs, const auto& rhs) {
+                  return lhs.path < rhs.path;
+              });
+    return files;
+}
+
+std::vector<FileStatus> stagedChanges(const GitIndex& index)
+{
+    std::vector<FileStatus> changes;
+    auto head = headFiles();
+    size_t tracked = 0;
+    for (size_t position = 0; position < index.size(); ++position) {
+        auto path = index.path(position);
+        for (; tracked < head.size() && head[tracked].path < path; ++tracked) {
+            changes.push_back({'D', head[tracked].path});
+        }
+        // an unmerged file is only reported as such, by unstagedChanges
+        if (index.stage(position) != 0) {
+            if (tracked < head.size() && head[tracked].path == path) {
+                ++tracked;
+            }
+            continue;
+        }
+        if (tracked == head.size() || head[tracked].path != path) {
+            changes.push_back({'A', std::string(path)});
+            continue;
+        }
+        if (head[tracked].hash != index.hash(position) ||
+            head[tracked].mode != index.stat(position).mode) {
+            changes.push_back({'M', std::string(path)});
+        }
+        ++tracked;
+    }
+    for (; tracked < head.size(); ++tracked) {
+        changes.push_back({'D', head[tracked].path});
+    }
+    return changes;
+}
+
+/*
+    Stats every entry of the index, entries are split in batches that run on
+    the pool. Only files whose stat data changed are read, and only if their
+    size didn't already tell they were modified. Files that were read and
+    turned out unchanged get their new stat data, so the next status doesn't
+    read them again, if the caller holds the lock of the index. With a
+    filesystem monitor only the entries it saw change are stat'ed.
+*/
+std::vector<FileStatus> unstagedChanges(GitIndex& index,
+                                        Utilities::ThreadPool& pool,
+                                        Utilities::LockFile* lock)
+{
+    constexpr size_t BATCH_SIZE = 1024;
+    const auto& workTree = GitRepository::findRoot().workTree();
+    auto monitored = monitoredChanges(index);
+
+    std::vector<char> changes(index.size(), 0);
+    std::vector<std::optional<IndexStat>> refreshed(index.size());
+    // file is the worktree followed by '/', the path is appended to it
+    auto compare = [&](size_t position, std::string& file) {
+        file.append(index.path(position));
+        auto stat = GitIndex::tryStatOf(file.c_str());
+        if (!stat) {
+            changes[position] = 'D';
+            return;
+        }
+        if (index.isUpToDate(position, *stat)) {
+            return;
+        }
+        const auto& recorded = index.stat(position);
+        // a size of 0 may be a racy entry, its content has to be read
+        if (stat->mode != recorded.mode ||
+            (recorded.size != 0 && stat->size != recorded.size)) {
+            changes[position] = 'M';
+        }
+        else if (writeWorktreeBlob(file, *stat, false) !=
+                 index.hash(position)) {
+            changes[position] = 'M';
+        }
+        else {
+            refreshed[position] = stat;
+        }
+    };
+
+    auto root = workTree.string() + '/';
+    std::vector<std::future<void>> batches;
+    for (size_t start = 0; start < index.size(); start += BATCH_SIZE) {
+        batches.push_back(pool.submit([&, start] {
+            auto end = std::min(start + BATCH_SIZE, index.size());
+            std::string file;
+            for (auto position = start; position < end; ++position) {
+                if (index.stage(position) == 0 &&
+                    !isMonitoredClean(monitored, index, position)) {
+                    file.assign(root);
+                    compare(position, file);
+                }
+            }
+        }));
+    }
+    // every batch has to be done before what they use goes away, a file
+    // that vanished while it was read fails its batch
+    std::exception_ptr error;
+    for (auto& batch : batches) {
         try {
-            return GitRepository::HEAD();
+            pool.wait(batch);
         }
-        catch (std::runtime_error error) {
-            return std::string("");
+        catch (...) {
+            error = error ? error : std::current_exception();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    std::vector<FileStatus> unstaged;
+    bool refresh = false;
+    std::vector<bool> dirty(index.size());
+    for (size_t position = 0; position < index.size(); ++position) {
+        dirty[position] = changes[position] != 0 || index.stage(position) != 0;
+        if (index.stage(position) != 0) {
+            // once for all the stages of the file
+            auto path = index.path(position);
+            if (position == 0 || index.path(position - 1) != path) {
+                unstaged.push_back({'U', std::string(path)});
+            }
+        }
+        else if (changes[position] != 0) {
+            unstaged.push_back(
+                {changes[position], std::string(index.path(position))});
+        }
+        else if (refreshed[position]) {
+            index.setStat(position, *refreshed[position]);
+            refresh = true;
+        }
+    }
+    if (monitored && monitored->token != index.fsmonitorToken()) {
+        index.setFSMonitor(monitored->token, std::move(dirty));
+        refresh = true;
+    }
+    if (refresh && lock) {
+        try {
+            index.write(*lock);
         }
+        catch (const std::runtime_error&) {
+            // the refresh can wait for the next status
+        }
+    }
+    return unstaged;
+}
+
+// Files that aren't in the index and aren't ignored.
+std::vector<std::string> untrackedFiles(const GitIndex& index)
+{
+    GitIgnore ignore(GitRepository::findRoot().workTree());
+    auto isTracked = [&](const std::string& directory) {
+        auto position = index.lowerBound(directory);
+        return position < index.size() &&
+               index.path(position).starts_with(directory);
+    };
+    // only up to the first file that isn't ignored
+    auto containsFiles = [&](const std::string& directory) {
+        bool found = false;
+        ignore.walk(directory, [&](const std::string&, bool isDirectory) {
+            found = found || !isDirectory;
+            return !found;
+        });
+        return found;
     };
 
-    auto commitTree = createTree(rootRepo.workTree());
-    CommitMessage commitMessage{.tree = commitTree.data(),
-                                .parent = getParent(),
-                                // TODO: add date to the author field
-                                .author = "Joe Doe <joedoe@email.com>",
-                                .committer = "joe Doe <joedoe@email.com>",
-                                .gpgsig = "",
-                                .message = message};
+    std::vector<std::string> untracked;
+    ignore.walk("", [&](const std::string& path, bool isDirectory) {
+        if (isDirectory) {
+            if (isTracked(path + '/')) {
+                return true;
+            }
+            if (containsFiles(path)) {
+                untracked.push_back(path + '/');
+            }
+            return false;
+        }
+        // an unmerged file only has entries of other stages than 0
+        auto position = index.lowerBound(path);
+        if (position == index.size() || index.path(position) != path) {
+            untracked.push_back(path);
+        }
+        return false;
+    });
+    std::sort(untracked.begin(), untracked.end());
+    return untracked;
+}
 
-    GitCommit commitObject(commitMessage);
-    auto commitHash = GitObject::write(&commitObject);
-    GitRepository::commitToBranch(commitHash);
+Status collectStatus(size_t jobs = 0)
+{
+    std::optional<Utilities::LockFile> lock;
+    try {
+        lock.emplace(GitRepository::repoPath("index"));
+    }
+    catch (const std::runtime_error&) {
+        // another process holds it, status doesn't wait and the stat data it
+        // finds isn't written back
+    }
+    auto index = readIndex();
+    Utilities::ThreadPool pool(numberOfThreads(jobs) - 1);
+    Status status;
+    status.staged = stagedChanges(index);
+    status.unstaged = unstagedChanges(index, pool, lock ? &*lock : nullptr);
+    status.untracked = untrackedFiles(index);
+    return status;
+}
 
-    if (auto head = GitRepository::HEAD();
-        head.find("refs/") != std::string::npos) {
-        std::cout << fmt::format("  [{} {}] committing\n",
-                                 head.substr(head.find_last_of("/") + 1),
-                                 commitHash.data().substr(0, 7));
+void status(size_t jobs = 0)
+{
+    auto branch = GitRepository::currentBranch();
+    if (branch.empty()) {
+        std::cout << fmt::format("HEAD detached at {}\n",
+                                 GitRepository::HEAD().substr(0, 7));
+    }
+    else {
+        std::cout << fmt::format("On branch {}\n", branch);
+    }
+
+    auto status = collectStatus(jobs);
+    auto printChanges = [](const std::string& title,
+                           const std::vector<FileStatus>& changes) {
+        if (changes.empty()) {
+            return;
+        }
+        std::cout << fmt::format("\n{}:\n", title);
+        for (const auto& [change, path] : changes) {
+            auto description = change == 'A'   ? "new file:"
+                               : change == 'D' ? "deleted:"
+                               : change == 'U' ? "unmerged:"
+                                               : "modified:";
+            std::cout << fmt::format("\t{:<12}{}\n", description, path);
+        }
+    };
+    printChanges("Changes to be committed", status.staged);
+    printChanges("Changes not staged for commit", status.unstaged);
+    if (!status.untracked.empty()) {
+        std::cout << "\nUntracked files:\n";
+        for (const auto& path : status.untracked) {
+            std::cout << '\t' << path << '\n';
+        }
+    }
+    if (status.staged.empty() && status.unstaged.empty() &&
+        status.untracked.empty()) {
+        std::cout << "nothing to commit, working tree clean\n";
     }
 }
 
-void createBranch(const std::string& branchName)
+struct FileChange {
+    std::string path;
+    // empty when the file is only in the other tree
+    std::optional<TrackedFile> before;
+    std::optional<TrackedFile> after;
+};
+
+// Tree of a commit, or the tree itself.
+GitHash treeOf(const GitHash& hash)
 {
-    auto currentCommit = GitRepository::HEAD();
-    Utilities::writeToFile(GitRepository::repoFile("refs", "heads", branchName),
-                           currentCommit, true);
+    auto object = GitObjectCache::read(hash);
+    if (object->format() == "commit") {
+        return GitHash(
+            static_cast<const GitCommit*>(object.get())->commitMessage().tree);
+    }
+    if (object->format() != "tree") {
+        GENERATE_EXCEPTION("{} is neither a commit nor a tree", hash.data());
+    }
+    return hash;
 }
 
-void showBranches()
+/*
+    Appends the files that differ between two trees, the null hash stands for
+    an empty tree. Subtrees with the same hash are skipped without being read,
+    so the cost depends on what changed and not on the size of the trees. A
+    file replaced by a directory, or the other way around, is a deleted file
+    and added files.
+*/
+void diffTrees(const GitHash& before, const GitHash& after,
+               const std::string& prefix, std::vector<FileChange>& changes)
 {
-    std::string currentBranch = GitRepository::currentBranch();
-    if (currentBranch.empty()) {
-        std::cout << fmt::format("* (HEAD detached at {})\n",
-                                 GitRepository::HEAD().substr(0, 7));
+    if (before == after) {
+        return;
     }
+    std::map<std::string, std::pair<std::optional<TrackedFile>,
+                                    std::optional<TrackedFile>>>
+        entries;
+    auto collect = [&](const GitHash& treeHash, bool isAfter) {
+        if (treeHash == GitHash()) {
+            return;
+        }
+        auto tree = GitObjectCache::read(treeHash);
+        for (const auto& entry :
+             static_cast<const GitTree*>(tree.get())->entries()) {
+            auto& sides = entries[std::string(entry.name)];
+            (isAfter ? sides.second : sides.first) =
+                TrackedFile{prefix + std::string(entry.name), entry.mode,
+                            entry.objectHash()};
+        }
+    };
+    collect(before, false);
+    collect(after, true);
 
-    auto pathToBranches = GitRepository::repoPath("refs", "heads");
-    for (const auto& dirEntry :
-         std::filesystem::directory_iterator(pathToBranches)) {
-        auto otherBranch = dirEntry.path().filename().string();
-        std::cout << (currentBranch == otherBranch ? "* " : "  ") << otherBranch
-                  << std::endl;
+    auto isTree = [](const std::optional<TrackedFile>& file) {
+        return file && GitTree::formatOf(file->mode) == "tree";
+    };
+    for (auto& [name, sides] : entries) {
+        auto& [old, updated] = sides;
+        if (isTree(old) || isTree(updated)) {
+            diffTrees(isTree(old) ? old->hash : GitHash(),
+                      isTree(updated) ? updated->hash : GitHash(),
+                      prefix + name + '/', changes);
+        }
+        if (isTree(old)) {
+            old.reset();
+        }
+        if (isTree(updated)) {
+            updated.reset();
+        }
+        if (!old && !updated) {
+            continue;
+        }
+        if (old && updated && old->hash == updated->hash &&
+            old->mode == updated->mode) {
+            continue;
+        }
+        changes.push_back({.path = prefix + name,
+                           .before = std::move(old),
+                           .after = std::move(updated)});
+    }
+}
+
+enum class DiffFormat { PATCH, STAT, NAME_ONLY };
+
+// Content a file is compared by, for a submodule it is its commit, the way
+// git shows it.
+std::string diffContent(const std::optional<TrackedFile>& file)
+{
+    if (!file) {
+        return "";
+    }
+    if (GitTree::formatOf(file->mode) == "commit") {
+        return fmt::format("Subproject commit {}\n", file->hash.data());
+    }
+    return GitObjectFactory::readRaw(file->hash).data;
+}
+
+void printPatch(const FileChange& change, std::ostream& output)
+{
+    const auto& [path, before, after] = change;
+    std::string header = fmt::format("diff --git a/{0} b/{0}\n", path);
+    if (!before) {
+        header += fmt::format("new file mode {:o}\n", after->mode);
+    }
+    else if (!after) {
+        header += fmt::format("deleted file mode {:o}\n", before->mode);
     }
+    else if (before->mode != after->mode) {
+        header += fmt::format("old mode {:o}\nnew mode {:o}\n", before->mode,
+                              after->mode);
+    }
+    auto beforeHash = before ? before->hash : GitHash();
+    auto afterHash = after ? after->hash : GitHash();
+    if (beforeHash == afterHash) {
+        output << header;
+        return;
+    }
+    header += fmt::format("index {}..{}", beforeHash.data().substr(0, 7),
+                          afterHash.data().substr(0, 7));
+    if (before && after && before->mode == after->mode) {
+        header += fmt::format(" {:o}", after->mode);
+    }
+    output << header << '\n';
+
+    auto beforeContent = diffContent(before);
+    auto afterContent = diffContent(after);
+    auto beforeName = before ? "a/" + path : "/dev/null";
+    auto afterName = after ? "b/" + path : "/dev/null";
+    if (GitDiff::isBinary(beforeContent) || GitDiff::isBinary(afterContent)) {
+        output << fmt::format("Binary files {} and {} differ\n", beforeName,
+                              afterName);
+        return;
+    }
+    auto hunks = GitDiff::unified(beforeContent, afterContent);
+    if (!hunks.empty()) {
+        output << "--- " << beforeName << "\n+++ " << afterName << '\n'
+               << hunks;
+    }
+}
+
+struct DiffStat {
+    std::string path;
+    // lines, or the sizes in bytes of a binary file
+    size_t insertions = 0;
+    size_t deletions = 0;
+    bool isBinary = false;
+};
+
+DiffStat diffStatOf(const FileChange& change)
+{
+    DiffStat stat{.path = change.path};
+    auto isSameContent = change.before && change.after &&
+                         change.before->hash == change.after->hash;
+    if (isSameContent) {
+        return stat;
+    }
+    auto before = diffContent(change.before);
+    auto after = diffContent(change.after);
+    if (GitDiff::isBinary(before) || GitDiff::isBinary(after)) {
+        return {.path = change.path,
+                .insertions = after.size(),
+                .deletions = before.size(),
+                .isBinary = true};
+    }
+    auto changes =
+        GitDiff::compare(GitDiff::lines(before), GitDiff::lines(after));
+    stat.insertions =
+        std::count(changes.added.begin(), changes.added.end(), true);
+    stat.deletions =
+        std::count(changes.removed.begin(), changes.removed.end(), true);
+    return stat;
+}
+
+/*
+    Laid out like git does on an 80 columns terminal: the graph takes what
+    the names leave, but no more than 3/8 of the line when both don't fit,
+    and is scaled down to it. Names that don't fit keep their end.
+*/
+void printDiffStat(const std::vector<DiffStat>& stats, std::ostream& output)
+{
+    if (stats.empty()) {
+        return;
+    }
+    constexpr long WIDTH = 80;
+    auto decimalWidth = [](size_t number) {
+        return static_cast<long>(std::to_string(number).size());
+    };
+    long maxChange = 0, nameWidth = 0, binaryWidth = 0, numberWidth = 0;
+    for (const auto& stat : stats) {
+        nameWidth = std::max(nameWidth, static_cast<long>(stat.path.size()));
+        if (stat.isBinary) {
+            // "Bin X -> Y bytes", the counts are aligned with "Bin"
+            binaryWidth = std::max(binaryWidth,
+                                   14 + decimalWidth(stat.insertions) +
+                                       decimalWidth(stat.deletions));
+            numberWidth = 3;
+            continue;
+        }
+        maxChange = std::max(
+            maxChange, static_cast<long>(stat.insertions + stat.deletions));
+    }
+    numberWidth = std::max(numberWidth, decimalWidth(maxChange));
+    auto graphWidth = maxChange + 4 > binaryWidth ? maxChange : binaryWidth - 4;
+    if (nameWidth + numberWidth + 6 + graphWidth > WIDTH) {
+        graphWidth = std::min(graphWidth,
+                              std::max(WIDTH * 3 / 8 - numberWidth - 6, 6L));
+        if (nameWidth > WIDTH - numberWidth - 6 - graphWidth) {
+            nameWidth = WIDTH - numberWidth - 6 - graphWidth;
+        }
+        else {
+            graphWidth = WIDTH - numberWidth - 6 - nameWidth;
+        }
+    }
+    auto scale = [&](long change) {
+        return change == 0 ? 0 : 1 + change * (graphWidth - 1) / maxChange;
+    };
+
+    size_t insertions = 0, deletions = 0;
+    for (const auto& stat : stats) {
+        std::string_view name = stat.path;
+        std::string_view prefix;
+        auto width = nameWidth;
+        if (nameWidth < static_cast<long>(name.size())) {
+            prefix = "...";
+            width = std::max(nameWidth - 3, 0L);
+            name.remove_prefix(name.size() - width);
+            if (auto slash = name.find('/'); slash != std::string_view::npos) {
+                name.remove_prefix(slash);
+            }
+        }
+        auto line = fmt::format(" {}{:<{}} |", prefix, name, width);
+        if (stat.isBinary) {
+            line += fmt::format(" {:>{}}", "Bin", numberWidth);
+            if (stat.insertions != 0 || stat.deletions != 0) {
+                line += fmt::format(" {} -> {} bytes", stat.deletions,
+                                    stat.insertions);
+            }
+            output << line << '\n';
+            continue;
+        }
+        long added = stat.insertions;
+        long removed = stat.deletions;
+        if (graphWidth <= maxChange) {
+            auto total = scale(added + removed);
+            if (total < 2 && added != 0 && removed != 0) {
+                total = 2;
+            }
+            if (added < removed) {
+                added = scale(added);
+                removed = total - added;
+            }
+            else {
+                removed = scale(removed);
+                added = total - removed;
+            }
+        }
+        auto change = stat.insertions + stat.deletions;
+        line += fmt::format(" {:>{}}{}", change, numberWidth,
+                            change != 0 ? " " : "");
+        output << line << std::string(added, '+') << std::string(removed, '-')
+               << '\n';
+        insertions += stat.insertions;
+        deletions += stat.deletions;
+    }
+
+    auto plural = [](size_t count) { return count == 1 ? "" : "s"; };
+    output << fmt::format(" {} file{} changed", stats.size(),
+                          plural(stats.size()));
+    if (insertions != 0 || deletions == 0) {
+        output << fmt::format(", {} insertion{}(+)", insertions,
+                              plural(insertions));
+    }
+    if (deletions != 0 || insertions == 0) {
+        output << fmt::format(", {} deletion{}(-)", deletions,
+                              plural(deletions));
+    }
+    output << '\n';
+}
+
+// Compares two tree-ish revisions, commits or trees. Only the subtrees that
+// differ are read, and only the blobs that differ are compared line by line.
+void diff(const std::string& from, const std::string& to,
+          DiffFormat format = DiffFormat::PATCH,
+          std::ostream& output = std::cout)
+{
+    std::vector<FileChange> changes;
+    diffTrees(GitObject::findObject(from, "tree"),
+              GitObject::findObject(to, "tree"), "", changes);
+    // files come in the order of their whole path, not a directory before
+    // the files next to it that start with its name
+    std::stable_sort(changes.begin(), changes.end(),
+                     [](const FileChange& left, const FileChange& right) {
+                         return left.path < right.path;
+                     });
+
+    switch (format) {
+    case DiffFormat::NAME_ONLY:
+        for (const auto& change : changes) {
+            output << change.path << '\n';
+        }
+        break;
+    case DiffFormat::STAT: {
+        std::vector<DiffStat> stats;
+        stats.reserve(changes.size());
+        for (const auto& change : changes) {
+            stats.push_back(diffStatOf(change));
+        }
+        printDiffStat(stats, output);
+        break;
+    }
+    case DiffFormat::PATCH:
+        for (const auto& change : changes) {
+            // a file that became a symbolic link or a submodule, or the
+            // other way around, is deleted and added
+            if (change.before && change.after &&
+                (change.before->mode & S_IFMT) !=
+                    (change.after->mode & S_IFMT)) {
+                printPatch({change.path, change.before, std::nullopt}, output);
+                printPatch({change.path, std::nullopt, change.after}, output);
+                continue;
+            }
+            printPatch(change, output);
+        }
+        break;
+    }
+}
+
+// Whether replacing the file of change loses nothing: its index entry and
+// its file have to be either what the tree checked out has or already what
+// the new one has. A file that was deleted has nothing to lose, neither has
+// an untracked file that is ignored.
+bool isSafeToReplace(const GitIndex& index, const FileChange& change,
+                     GitIgnore& ignore)
+{
+    auto position = index.find(change.path);
+    auto isStaged = [&](const std::optional<TrackedFile>& file) {
+        if (!position) {
+            return !file;
+        }
+        return file && file->hash == index.hash(*position) &&
+               file->mode == index.stat(*position).mode;
+    };
+    if (!isStaged(change.before) && !isStaged(change.after)) {
+        return false;
+    }
+
+    auto path = GitRepository::findRoot().workTree() / change.path;
+    auto stat = GitIndex::tryStatOf(path.c_str());
+    // a directory in the way is checked file by file, modeOf reports it as
+    // a submodule
+    if (!stat || stat->mode == (S_IFDIR | S_IFLNK)) {
+        return true;
+    }
+    if (position && index.isUpToDate(*position, *stat)) {
+        return true;
+    }
+    if (!position && !change.before && ignore.isIgnored(change.path, false)) {
+        return true;
+    }
+    auto hash = writeWorktreeBlob(path, *stat, false);
+    for (const auto* file : {&change.before, &change.after}) {
+        if (*file && (*file)->mode == stat->mode && (*file)->hash == hash) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Writes the blob of a tree entry with the mode the entry has, its
+// directory has to exist. Returns the size of the blob.
+size_t checkoutFile(const std::filesystem::path& path, const TrackedFile& file)
+{
+    // submodules aren't cloned, they only get their directory
+    if (GitTree::formatOf(file.mode) == "commit") {
+        std::filesystem::create_directories(path);
+        return 0;
+    }
+    // the new file mustn't keep the permissions of the old one
+    std::filesystem::remove(path);
+    // blobs are written once, caching them would only push trees out of the
+    // cache
+    auto blob = GitObjectFactory::readRaw(file.hash);
+    if (file.mode == S_IFLNK) {
+        std::filesystem::create_symlink(blob.data, path);
+        return blob.data.size();
+    }
+    Utilities::writeToFile(path, blob.data);
+    if (file.mode & S_IXUSR) {
+        std::filesystem::permissions(path,
+                                     std::filesystem::perms::owner_exec |
+                                         std::filesystem::perms::group_exec |
+                                         std::filesystem::perms::others_exec,
+                                     std::filesystem::perm_options::add);
+    }
+    return blob.data.size();
+}
+
+struct CheckoutSummary {
+    size_t numberOfFiles = 0;
+    uintmax_t bytes = 0;
+    size_t numberOfRemoved = 0;
+};
+
+/*
+    Brings the worktree and the index from the before side of the changes to
+    their after side. Files are deleted first and directories left empty are
+    removed. Then the directories of the new files are created, and the files
+    are inflated, written and stat'ed by tasks of the pool, in batches, so
+    small files don't cost a task each.
+*/
+CheckoutSummary applyChanges(GitIndex& index,
+                             const std::vector<FileChange>& changes,
+                             Utilities::ThreadPool& pool)
+{
+    constexpr size_t BATCH_SIZE = 16;
+    const auto& workTree = GitRepository::findRoot().workTree();
+    std::vector<std::string> removed;
+    std::vector<const FileChange*> written;
+    for (const auto& change : changes) {
+        if (change.after) {
+            written.push_back(&change);
+            continue;
+        }
+        auto path = workTree / change.path;
+        std::filesystem::remove(path);
+        removed.push_back(change.path);
+        std::error_code error;
+        for (auto parent = path.parent_path();
+             parent != workTree && std::filesystem::is_empty(parent, error);
+             parent = parent.parent_path()) {
+            std::filesystem::remove(parent, error);
+        }
+    }
+
+    // changes are sorted, so files of a directory are next to each other
+    std::string_view directory;
+    for (const auto* change : written) {
+        auto slash = change->path.rfind('/');
+        if (slash != std::string::npos &&
+            std::string_view(change->path).substr(0, slash) != directory) {
+            directory = std::string_view(change->path).substr(0, slash);
+            std::filesystem::create_directories(workTree / directory);
+        }
+    }
+
+    std::vector<IndexEntry> entries(written.size());
+    std::vector<std::future<uintmax_t>> batches;
+    for (size_t start = 0; start < written.size(); start += BATCH_SIZE) {
+        batches.push_back(pool.submit([&, start] {
+            uintmax_t bytes = 0;
+            auto end = std::min(start + BATCH_SIZE, written.size());
+            for (auto i = start; i < end; ++i) {
+                const auto& change = *written[i];
+                auto path = workTree / change.path;
+                bytes += checkoutFile(path, *change.after);
+                entries[i] = {.stat = GitIndex::statOf(path),
+                              .hash = change.after->hash,
+                              .flags = 0,
+                              .extendedFlags = 0,
+                              .path = change.path};
+            }
+            return bytes;
+        }));
+    }
+    // every batch has to be done before what they write to goes away
+    CheckoutSummary summary{.numberOfFiles = written.size(),
+                            .numberOfRemoved = removed.size()};
+    std::exception_ptr error;
+    for (auto& batch : batches) {
+        try {
+            summary.bytes += pool.wait(batch);
+        }
+        catch (...) {
+            error = error ? error : std::current_exception();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    index.remove(removed);
+    index.add(std::move(entries));
+    return summary;
+}
+
+// Files of changes that aren't safe to replace, each on a line of its own
+// after a tab, empty when all of them are.
+std::string overwrittenFiles(const GitIndex& index,
+                             const std::vector<FileChange>& changes)
+{
+    GitIgnore ignore(GitRepository::findRoot().workTree());
+    std::string overwritten;
+    for (const auto& change : changes) {
+        if (!isSafeToReplace(index, change, ignore)) {
+            overwritten += fmt::format("\n\t{}", change.path);
+        }
+    }
+    return overwritten;
+}
+
+/*
+    Switches the worktree, the index and HEAD to a branch, a commit or a tree.
+    Only the files that differ between the tree of HEAD and the new one are
+    touched, and directories with the same tree aren't even read. Refuses to
+    overwrite local changes of those files, or untracked files in their way,
+    unless force is set. Other local changes are kept. Files are written on
+    jobs threads, 0 takes them from checkout.workers, then core.threads.
+*/
+void checkout(const std::string& branchOrCommit, bool force = false,
+              size_t jobs = 0)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto target = GitObject::findObject(branchOrCommit);
+    auto targetTree = treeOf(target);
+    GitHash currentTree;
+    try {
+        currentTree = treeOf(GitHash(GitRepository::HEAD()));
+    }
+    catch (const std::runtime_error&) {
+        // there are no commits yet
+    }
+
+    std::vector<FileChange> changes;
+    diffTrees(currentTree, targetTree, "", changes);
+    std::sort(changes.begin(), changes.end(),
+              [](const auto& lhs, const auto& rhs) {
+                  return lhs.path < rhs.path;
+              });
+
+    auto lock = lockIndex();
+    auto index = readIndex();
+    if (!force) {
+        if (auto overwritten = overwrittenFiles(index, changes);
+            !overwritten.empty()) {
+            GENERATE_EXCEPTION("Your local changes to the following files "
+                               "would be overwritten by checkout:{}\nCommit "
+                               "them, or checkout with --force to discard "
+                               "them",
+                               overwritten);
+        }
+    }
+    if (!changes.empty()) {
+        if (jobs == 0) {
+            jobs = GitRepository::configNumber("checkout.workers", 0);
+        }
+        Utilities::ThreadPool pool(numberOfThreads(jobs) - 1);
+        auto summary = applyChanges(index, changes, pool);
+        index.write(lock);
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        if (summary.numberOfRemoved != 0) {
+            std::cout << fmt::format("Removed {} files\n",
+                                     summary.numberOfRemoved);
+        }
+        if (summary.numberOfFiles != 0) {
+            auto megabytes = summary.bytes / (1024.0 * 1024.0);
+            std::cout << fmt::format(
+                "Wrote {} files ({:.1f} MB) in {:.3f}s: {:.0f} files/s, "
+                "{:.1f} MB/s\n",
+                summary.numberOfFiles, megabytes, elapsed.count(),
+                summary.numberOfFiles / elapsed.count(),
+                megabytes / elapsed.count());
+        }
+    }
+
+    // if is a branch
+    if (GitRepository::hasReference("refs/heads/" + branchOrCommit)) {
+        std::cout << fmt::format("Switched to branch: `{}`\n", branchOrCommit);
+        GitRepository::setHEAD(branchOrCommit);
+    }
+    else {
+        GitRepository::setHEAD(target);
+    }
+}
+
+// Files and subdirectories are written by tasks of the pool. Their hashes
+// are collected in the order of the directory listing, so the tree is the
+// same whatever order the tasks finish in.
+// directory is dirPath relative to the worktree, ignored files are left out.
+GitHash createTree(const std::filesystem::path& dirPath,
+                   const std::string& directory, GitIgnore& ignore,
+                   Utilities::ThreadPool& pool)
+{
+    struct PendingLeaf {
+        std::string fileMode;
+        std::filesystem::path filePath;
+        std::future<GitHash> hash;
+    };
+
+    std::vector<PendingLeaf> pending;
+    for (auto dirEntry : std::filesystem::directory_iterator(dirPath)) {
+        auto dirEntryPath = dirEntry.path();
+        auto path = directory.empty()
+                        ? dirEntryPath.filename().string()
+                        : directory + '/' + dirEntryPath.filename().string();
+        if (ignore.isIgnored(path, dirEntry.is_directory())) {
+            continue;
+        }
+        if (dirEntry.is_regular_file()) {
+            pending.push_back({.fileMode = GitTree::fileMode(dirEntry, "blob"),
+                               .filePath = dirEntryPath.filename(),
+                               .hash = pool.submit([dirEntryPath] {
+                                   return hashObject(dirEntryPath, "blob");
+                               })});
+        }
+        else if (dirEntry.is_directory() && !dirPath.empty() &&
+                 !dirEntryPath.string().ends_with(".git")) {
+            // TODO: add support for the commit(submodules)
+            pending.push_back(
+                {.fileMode = GitTree::fileMode(dirEntry, "tree"),
+                 .filePath = dirEntry,
+                 .hash = pool.submit([dirEntryPath, path, &ignore, &pool] {
+                     return createTree(dirEntryPath, path, ignore, pool);
+                 })});
+        }
+    }
+
+    std::vector<GitTreeLeaf> leaves;
+    leaves.reserve(pending.size());
+    for (auto& leaf : pending) {
+        leaves.push_back({.fileMode = std::move(leaf.fileMode),
+                          .filePath = std::move(leaf.filePath),
+                          .hash = pool.wait(leaf.hash)});
+    }
+
+    GitTree tree(leaves);
+    auto treeHash = GitObject::write(&tree);
+    return treeHash;
+}
+
+GitHash createTree(const std::filesystem::path& dirPath, size_t jobs = 0)
+{
+    GitIgnore ignore(GitRepository::findRoot().workTree());
+    // the calling thread works too while it waits
+    Utilities::ThreadPool pool(numberOfThreads(jobs) - 1);
+    return createTree(dirPath, worktreePath(dirPath), ignore, pool);
+}
+
+// Writes a commit object of the tree, signed by the one author there is.
+GitHash writeCommit(const GitHash& tree, std::vector<std::string> parents,
+                    const std::string& message)
+{
+    CommitMessage commitMessage{.tree = tree.data(),
+                                .parents = std::move(parents),
+                                // TODO: add date to the author field
+                                .author = "Joe Doe <joedoe@email.com>",
+                                .committer = "joe Doe <joedoe@email.com>",
+                                .gpgsig = "",
+                                .message = message};
+    GitCommit commitObject(commitMessage);
+    return GitObject::write(&commitObject);
+}
+
+// Records the whole worktree, its tree is built from the index. Concludes a
+// merge that stopped on conflicts once they are resolved with add, the merged
+// commit is its second parent.
+void commit(const std::string& message = "", size_t jobs = 0)
+{
+    auto rootRepo = GitRepository::findRoot();
+    auto numberOfFiles =
+        std::distance(std::filesystem::directory_iterator(rootRepo.workTree()),
+                      std::filesystem::directory_iterator{});
+    if (numberOfFiles == 1 && std::filesystem::exists(rootRepo.gitDir())) {
+        std::cout << "There is nothing to commit" << std::endl;
+        return;
+    }
+
+    auto getParent = [&]() {
+        try {
+            return GitRepository::HEAD();
+        }
+        catch (const std::runtime_error&) {
+            return std::string("");
+        }
+    };
+
+    // the worktree is staged as a whole, which only reads the files whose
+    // stat data changed, and only the trees of their directories are written
+    auto lock = lockIndex();
+    auto index = readIndex();
+    // staging the worktree would take the conflicted files as they are
+    for (size_t position = 0; position < index.size(); ++position) {
+        if (index.stage(position) != 0) {
+            GENERATE_EXCEPTION("{}", "Committing is not possible because you "
+                                     "have unmerged files");
+        }
+    }
+    addToIndex(index, {rootRepo.workTree()}, jobs);
+    auto commitTree = index.writeTree();
+    index.write(lock);
+    std::vector<std::string> parents;
+    if (auto parent = getParent(); !parent.empty()) {
+        parents.push_back(parent);
+    }
+    auto mergeHead = GitRepository::repoPath("MERGE_HEAD");
+    if (std::filesystem::exists(mergeHead)) {
+        parents.push_back(GitObject::resolveReference(mergeHead));
+    }
+    auto commitHash = writeCommit(commitTree, std::move(parents), message);
+    GitRepository::commitToBranch(commitHash);
+    std::filesystem::remove(mergeHead);
+
+    if (auto head = GitRepository::HEAD();
+        head.find("refs/") != std::string::npos) {
+        std::cout << fmt::format("  [{} {}] committing\n",
+                                 head.substr(head.find_last_of("/") + 1),
+                                 commitHash.data().substr(0, 7));
+    }
+}
+
+/*
+    Best common ancestors of two commits: those that aren't ancestors of
+    another common ancestor. The histories are walked from both commits at
+    once, every commit is painted with the sides it is reached from, and
+    the ancestors of a commit reached from both are painted stale. The walk
+    stops when only stale commits are left, so the cost depends on how far
+    the commits went apart, not on the length of the history. Only when
+    several candidates are found is the rest of the history walked, to drop
+    those that are ancestors of another one.
+    Commits carry no dates yet, so the walk is breadth first. Empty when the
+    histories are unrelated.
+*/
+std::vector<GitHash> mergeBases(const GitHash& one, const GitHash& two)
+{
+    constexpr uint8_t ONE = 1;
+    constexpr uint8_t TWO = 2;
+    constexpr uint8_t STALE = 4;
+
+    std::unordered_map<GitHash, uint8_t> flags;
+    // commits with the flags they had when they were queued
+    std::deque<std::pair<GitHash, uint8_t>> pending;
+    size_t active = 0;
+    auto paint = [&](const GitHash& commit, uint8_t added) {
+        auto& painted = flags[commit];
+        if ((painted & added) == added) {
+            return;
+        }
+        painted |= added;
+        pending.emplace_back(commit, painted);
+        active += (painted & STALE) == 0;
+    };
+    paint(one, ONE);
+    paint(two, TWO);
+
+    std::vector<GitHash> candidates;
+    while (!pending.empty() && (active != 0 || candidates.size() > 1)) {
+        auto [commit, queued] = pending.front();
+        pending.pop_front();
+        active -= (queued & STALE) == 0;
+        // it was queued again since with more flags
+        auto painted = flags[commit];
+        if (painted != queued) {
+            continue;
+        }
+        if ((painted & (ONE | TWO)) == (ONE | TWO) && !(painted & STALE)) {
+            candidates.push_back(commit);
+            painted |= STALE;
+        }
+        auto object = GitObjectCache::read(commit);
+        for (const auto& parent :
+             static_cast<const GitCommit*>(object.get())
+                 ->commitMessage()
+                 .parents) {
+            paint(GitHash(parent), painted);
+        }
+    }
+
+    std::vector<GitHash> bases;
+    for (const auto& candidate : candidates) {
+        if (!(flags[candidate] & STALE)) {
+            bases.push_back(candidate);
+        }
+    }
+    return bases;
+}
+
+// A file both sides of a merge changed in ways that couldn't be merged,
+// with what each side has. A side that deleted the file has nothing.
+struct MergeConflict {
+    std::string path;
+    std::optional<TrackedFile> base;
+    std::optional<TrackedFile> ours;
+    std::optional<TrackedFile> theirs;
+};
+
+struct TreeMerge {
+    // names the sides of conflicts in merged files
+    std::string oursLabel;
+    std::string theirsLabel;
+    std::vector<MergeConflict> conflicts;
+};
+
+GitHash mergeTrees(const GitHash& base, const GitHash& ours,
+                   const GitHash& theirs, const std::string& prefix,
+                   TreeMerge& merge);
+
+// Merged tree entry at path, empty if it is deleted. A conflict keeps what
+// ours has, or what the side that didn't delete it has, and its file gets the
+// lines of both sides when they could be merged otherwise.
+std::optional<TrackedFile> mergeEntry(std::optional<TrackedFile> base,
+                                      std::optional<TrackedFile> ours,
+                                      std::optional<TrackedFile> theirs,
+                                      const std::string& path,
+                                      TreeMerge& merge)
+{
+    auto isSame = [](const std::optional<TrackedFile>& lhs,
+                     const std::optional<TrackedFile>& rhs) {
+        return lhs.has_value() == rhs.has_value() &&
+               (!lhs || (lhs->mode == rhs->mode && lhs->hash == rhs->hash));
+    };
+    if (isSame(ours, theirs) || isSame(base, theirs)) {
+        return ours;
+    }
+    if (isSame(base, ours)) {
+        return theirs;
+    }
+
+    auto isTree = [](const std::optional<TrackedFile>& entry) {
+        return entry && GitTree::formatOf(entry->mode) == "tree";
+    };
+    // a directory that was deleted on a side is an empty one there
+    if (!(base && !isTree(base)) && !(ours && !isTree(ours)) &&
+        !(theirs && !isTree(theirs))) {
+        auto hashOf = [](const std::optional<TrackedFile>& entry) {
+            return entry ? entry->hash : GitHash();
+        };
+        auto tree = mergeTrees(hashOf(base), hashOf(ours), hashOf(theirs),
+                               path + '/', merge);
+        if (tree == GitHash()) {
+            return std::nullopt;
+        }
+        return TrackedFile{path, S_IFDIR, tree};
+    }
+
+    MergeConflict conflict{path, base, ours, theirs};
+    // a file in the way of a directory, only the files are staged
+    if (isTree(base) || isTree(ours) || isTree(theirs)) {
+        for (auto* side :
+             {&conflict.base, &conflict.ours, &conflict.theirs}) {
+            if (isTree(*side)) {
+                side->reset();
+            }
+        }
+        merge.conflicts.push_back(std::move(conflict));
+        return ours;
+    }
+    // modified on a side and deleted on the other
+    if (!ours || !theirs) {
+        merge.conflicts.push_back(std::move(conflict));
+        return ours ? ours : theirs;
+    }
+
+    auto merged = *ours;
+    bool isConflict = false;
+    if (ours->mode != theirs->mode) {
+        if (base && base->mode == ours->mode) {
+            merged.mode = theirs->mode;
+        }
+        else if (!base || base->mode != theirs->mode) {
+            isConflict = true;
+        }
+    }
+    auto isRegular = [](const TrackedFile& file) {
+        return (file.mode & S_IFMT) == S_IFREG;
+    };
+    if (ours->hash == theirs->hash || (base && base->hash == theirs->hash)) {
+        // ours has the content already
+    }
+    else if (base && base->hash == ours->hash) {
+        merged.hash = theirs->hash;
+    }
+    // the lines of symbolic links, submodules and binary files aren't
+    // merged, files that both sides added are merged from an empty one
+    else if (isRegular(*ours) && isRegular(*theirs) &&
+             (!base || isRegular(*base))) {
+        auto oursBlob = GitObjectFactory::readRaw(ours->hash);
+        auto theirsBlob = GitObjectFactory::readRaw(theirs->hash);
+        std::string baseText;
+        if (base) {
+            baseText = GitObjectFactory::readRaw(base->hash).data;
+        }
+        if (GitDiff::isBinary(baseText) ||
+            GitDiff::isBinary(oursBlob.data) ||
+            GitDiff::isBinary(theirsBlob.data)) {
+            isConflict = true;
+        }
+        else {
+            auto lines = GitDiff::merge(baseText, oursBlob.data,
+                                        theirsBlob.data, merge.oursLabel,
+                                        merge.theirsLabel);
+            auto blob =
+                GitObjectFactory::create("blob", ObjectData(lines.text));
+            merged.hash = GitObject::write(blob.get());
+            isConflict = isConflict || lines.numberOfConflicts != 0;
+        }
+    }
+    else {
+        isConflict = true;
+    }
+    if (isConflict) {
+        merge.conflicts.push_back(std::move(conflict));
+    }
+    return merged;
+}
+
+/*
+    Three-way merge of trees, the null hash stands for an empty tree. Like
+    diffTrees, a subtree that only one side changed is taken as it is,
+    without being read, so the cost depends on what both sides changed. The
+    merged trees are written, files are merged and written as blobs, the
+    worktree is never looked at. Returns the merged tree, the null hash if
+    it is empty, and appends what couldn't be merged to the conflicts of
+    merge.
+*/
+GitHash mergeTrees(const GitHash& base, const GitHash& ours,
+                   const GitHash& theirs, const std::string& prefix,
+                   TreeMerge& merge)
+{
+    if (ours == theirs || base == theirs) {
+        return ours;
+    }
+    if (base == ours) {
+        return theirs;
+    }
+
+    std::map<std::string, std::array<std::optional<TrackedFile>, 3>> entries;
+    auto collect = [&](const GitHash& treeHash, size_t side) {
+        if (treeHash == GitHash()) {
+            return;
+        }
+        auto tree = GitObjectCache::read(treeHash);
+        for (const auto& entry :
+             static_cast<const GitTree*>(tree.get())->entries()) {
+            entries[std::string(entry.name)][side] =
+                TrackedFile{prefix + std::string(entry.name), entry.mode,
+                            entry.objectHash()};
+        }
+    };
+    collect(base, 0);
+    collect(ours, 1);
+    collect(theirs, 2);
+
+    std::vector<GitTreeLeaf> leaves;
+    for (auto& [name, sides] : entries) {
+        auto merged = mergeEntry(std::move(sides[0]), std::move(sides[1]),
+                                 std::move(sides[2]), prefix + name, merge);
+        if (merged) {
+            leaves.push_back({.fileMode = fmt::format("{:o}", merged->mode),
+                              .filePath = name,
+                              .hash = merged->hash});
+        }
+    }
+    if (leaves.empty()) {
+        return GitHash();
+    }
+    // git sorts the name of a tree as if it ended with '/'
+    auto sortName = [](const GitTreeLeaf& leaf) {
+        return leaf.fileMode == "40000" ? leaf.filePath.string() + '/'
+                                        : leaf.filePath.string();
+    };
+    std::sort(leaves.begin(), leaves.end(),
+              [&](const GitTreeLeaf& lhs, const GitTreeLeaf& rhs) {
+                  return sortName(lhs) < sortName(rhs);
+              });
+    GitTree tree(leaves);
+    return GitObject::write(&tree);
+}
+
+/*
+    Merges a branch or a commit into the current branch, or into the branch
+    into without checking it out. Merge bases are found first: nothing is
+    done when the commit is one of them, and the branch is fast-forwarded
+    when it is. Otherwise the trees are merged in memory and the merge commit
+    is written with both commits as parents, which is all a merge into
+    another branch does, it refuses when there are conflicts.
+    On the current branch only the files the merge changed are written,
+    after the same check for local changes as checkout. Conflicts are left
+    in the worktree between markers and in the index as stages 1, 2 and 3
+    of their paths, and the merge is concluded by commit once they are
+    resolved.
+*/
+void merge(const std::string& branchOrCommit, const std::string& message = "",
+           const std::string& into = "", size_t jobs = 0)
+{
+    auto theirs = GitObject::findObject(branchOrCommit, "commit");
+    bool isCheckedOut = into.empty() || into == GitRepository::currentBranch();
+    auto mergeHead = GitRepository::repoPath("MERGE_HEAD");
+    GitHash ours;
+    std::filesystem::path branch;
+    if (isCheckedOut) {
+        if (std::filesystem::exists(mergeHead)) {
+            GENERATE_EXCEPTION("You have not concluded your merge of {}, "
+                               "commit the resolved files first",
+                               GitObject::resolveReference(mergeHead));
+        }
+        ours = GitHash(GitRepository::HEAD());
+    }
+    else {
+        branch = GitRepository::repoPath("refs", "heads", into);
+        if (!GitRepository::hasReference("refs/heads/" + into)) {
+            GENERATE_EXCEPTION("'{}' is not a branch", into);
+        }
+        ours = GitHash(GitObject::resolveReference(branch));
+    }
+
+    auto bases = mergeBases(ours, theirs);
+    if (bases.empty()) {
+        GENERATE_EXCEPTION("{}", "refusing to merge unrelated histories");
+    }
+    // without a virtual base made of the others, the first one is used
+    const auto& base = bases.front();
+    if (base == theirs) {
+        std::cout << "Already up to date.\n";
+        return;
+    }
+
+    auto result = theirs;
+    TreeMerge treeMerge{.oursLabel = isCheckedOut ? "HEAD" : into,
+                        .theirsLabel = branchOrCommit,
+                        .conflicts = {}};
+    auto resultTree = treeOf(theirs);
+    if (base != ours) {
+        resultTree = mergeTrees(treeOf(base), treeOf(ours), treeOf(theirs), "",
+                                treeMerge);
+        if (resultTree == GitHash()) {
+            GitTree emptyTree;
+            resultTree = GitObject::write(&emptyTree);
+        }
+    }
+    const auto& conflicts = treeMerge.conflicts;
+    auto writeMergeCommit = [&] {
+        return writeCommit(
+            resultTree, {ours.data(), theirs.data()},
+            !message.empty() ? message
+            : isCheckedOut
+                ? fmt::format("Merge branch '{}'", branchOrCommit)
+                : fmt::format("Merge branch '{}' into {}", branchOrCommit,
+                              into));
+    };
+
+    if (!isCheckedOut) {
+        if (!conflicts.empty()) {
+            std::string paths;
+            for (const auto& conflict : conflicts) {
+                paths += fmt::format("\n\t{}", conflict.path);
+            }
+            GENERATE_EXCEPTION("Merging {} into {} has conflicts in:{}\nMerge "
+                               "it on the checked out branch to resolve them",
+                               branchOrCommit, into, paths);
+        }
+        if (base != ours) {
+            result = writeMergeCommit();
+        }
+        Utilities::writeToFile(branch, result);
+        std::cout << fmt::format("{} {} into {}: {}\n",
+                                 base == ours ? "Fast-forwarded" : "Merged",
+                                 branchOrCommit, into,
+                                 result.data().substr(0, 7));
+        return;
+    }
+
+    std::vector<FileChange> changes;
+    diffTrees(treeOf(ours), resultTree, "", changes);
+    std::sort(changes.begin(), changes.end(),
+              [](const auto& lhs, const auto& rhs) {
+                  return lhs.path < rhs.path;
+              });
+    auto lock = lockIndex();
+    auto index = readIndex();
+    if (auto overwritten = overwrittenFiles(index, changes);
+        !overwritten.empty()) {
+        GENERATE_EXCEPTION("Your local changes to the following files would "
+                           "be overwritten by merge:{}\nCommit them before "
+                           "you merge",
+                           overwritten);
+    }
+    if (jobs == 0) {
+        jobs = GitRepository::configNumber("checkout.workers", 0);
+    }
+    Utilities::ThreadPool pool(numberOfThreads(jobs) - 1);
+    applyChanges(index, changes, pool);
+
+    std::vector<std::string> unmerged;
+    std::vector<IndexEntry> stages;
+    for (const auto& conflict : conflicts) {
+        unmerged.push_back(conflict.path);
+        uint16_t stage = 1;
+        for (const auto* side :
+             {&conflict.base, &conflict.ours, &conflict.theirs}) {
+            if (*side) {
+                IndexStat stat{};
+                stat.mode = (*side)->mode;
+                stages.push_back({.stat = stat,
+                                  .hash = (*side)->hash,
+                                  .flags = static_cast<uint16_t>(stage << 12),
+                                  .extendedFlags = 0,
+                                  .path = conflict.path});
+            }
+            ++stage;
+        }
+    }
+    index.remove(unmerged);
+    index.add(std::move(stages));
+    index.write(lock);
+
+    if (!conflicts.empty()) {
+        Utilities::writeToFile(mergeHead, theirs);
+        for (const auto& conflict : conflicts) {
+            auto kind = !conflict.ours || !conflict.theirs ? "modify/delete"
+                        : !conflict.base                  ? "add/add"
+                                                          : "content";
+            std::cout << fmt::format("CONFLICT ({}): Merge conflict in {}\n",
+                                     kind, conflict.path);
+        }
+        std::cout << "Automatic merge failed; fix conflicts and then commit "
+                     "the result.\n";
+        return;
+    }
+    if (base != ours) {
+        result = writeMergeCommit();
+    }
+    GitRepository::commitToBranch(result);
+    std::cout << fmt::format("{} {}: {}\n",
+                             base == ours ? "Fast-forwarded to" : "Merged",
+                             branchOrCommit, result.data().substr(0, 7));
+}
+
+void createBranch(const std::string& branchName)
+{
+    auto currentCommit = GitRepository::HEAD();
+    Utilities::writeToFile(GitRepository::repoFile("refs", "heads", branchName),
+                           currentCommit, true);
+}
+
+void showBranches()
+{
+    std::string currentBranch = GitRepository::currentBranch();
+    if (currentBranch.empty()) {
+        std::cout << fmt::format("* (HEAD detached at {})\n",
+                                 GitRepository::HEAD().substr(0, 7));
+    }
+
+    auto pathToBranches = GitRepository::repoPath("refs", "heads");
+    std::set<std::string> branches;
+    for (const auto& dirEntry :
+         std::filesystem::directory_iterator(pathToBranches)) {
+        branches.insert(dirEntry.path().filename().string());
+    }
+    for (const auto& [name, _] : GitRepository::packedRefs()) {
+        if (name.starts_with("refs/heads/")) {
+            branches.insert(name.substr(std::string("refs/heads/").size()));
+        }
+    }
+    for (const auto& otherBranch : branches) {
+        std::cout << (currentBranch == otherBranch ? "* " : "  ") << otherBranch
+                  << std::endl;
+    }
+}
+
+// Objects reachable from references, packed ones included, HEAD, MERGE_HEAD
+// and the index, each with the name of the tree entry it was found by.
+std::vector<PackEntry> reachableObjects()
+{
+    std::vector<PackEntry> pending;
+    for (const auto& [hash, _] : getAll(GitRepository::repoDir("refs"))) {
+        pending.push_back({.hash = GitHash(hash), .name = ""});
+    }
+    try {
+        pending.push_back({.hash = GitHash(GitRepository::HEAD()), .name = ""});
+    }
+    catch (const std::runtime_error&) {
+        // there are no commits yet
+    }
+    if (auto mergeHead = GitRepository::repoPath("MERGE_HEAD");
+        std::filesystem::exists(mergeHead)) {
+        pending.push_back(
+            {.hash = GitHash(GitObject::resolveReference(mergeHead)),
+             .name = ""});
+    }
+
+    // staged files and the trees the cache tree wrote aren't committed yet,
+    // but add and commit rely on them being there
+    auto index = readIndex();
+    for (size_t position = 0; position < index.size(); ++position) {
+        // intent-to-add entries have no content, submodule commits live in
+        // another repository
+        if ((index.extendedFlags(position) & GitIndex::FLAG_INTENT_TO_ADD) ||
+            index.stat(position).mode == 0160000) {
+            continue;
+        }
+        auto path = index.path(position);
+        pending.push_back(
+            {.hash = index.hash(position),
+             .name = std::string(path.substr(path.find_last_of('/') + 1))});
+    }
+    std::vector<const GitCacheTree*> cacheTrees = {&index.cacheTree()};
+    while (!cacheTrees.empty()) {
+        auto cacheTree = cacheTrees.back();
+        cacheTrees.pop_back();
+        if (cacheTree->isValid()) {
+            pending.push_back(
+                {.hash = cacheTree->hash(), .name = cacheTree->name()});
+        }
+        for (const auto& subtree : cacheTree->subtrees()) {
+            cacheTrees.push_back(&subtree);
+        }
+    }
+
+    std::vector<PackEntry> objects;
+    std::unordered_set<GitHash> visited;
+    while (!pending.empty()) {
+        auto entry = pending.back();
+        pending.pop_back();
+        if (!visited.insert(entry.hash).second) {
+            continue;
+        }
+
+        objects.push_back(entry);
+        // blobs have nothing to follow, their content isn't needed
+        if (GitObjectFactory::readHeader(entry.hash).format == "blob") {
+            continue;
+        }
+
+        auto object = GitObjectFactory::read(entry.hash);
+        if (object->format() == "commit") {
+            auto& commitMessage =
+                static_cast<GitCommit*>(object.get())->commitMessage();
+            pending.push_back(
+                {.hash = GitHash(commitMessage.tree), .name = ""});
+            for (const auto& parent : commitMessage.parents) {
+                pending.push_back({.hash = GitHash(parent), .name = ""});
+            }
+        }
+        else if (object->format() == "tree") {
+            auto tree = static_cast<GitTree*>(object.get());
+            for (const auto& leaf : tree->entries()) {
+                // submodule commits live in another repository
+                if (GitTree::formatOf(leaf.mode) != "commit") {
+                    pending.push_back({.hash = leaf.objectHash(),
+                                       .name = std::string(leaf.name)});
+                }
+            }
+        }
+        else if (object->format() == "tag") {
+            auto& tagMessage = static_cast<GitTag*>(object.get())->tagMessage();
+            pending.push_back({.hash = GitHash(tagMessage.object), .name = ""});
+        }
+    }
+    return objects;
+}
+
+uintmax_t directorySize(const std::filesystem::path& directory)
+{
+    uintmax_t size = 0;
+    for (const auto& dirEntry :
+         std::filesystem::recursive_directory_iterator(directory)) {
+        if (dirEntry.is_regular_file()) {
+            size += dirEntry.file_size();
+        }
+    }
+    return size;
+}
+
+void repack(bool removeRedundant, int window, int depth)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto objectsDir = GitRepository::repoDir("objects");
+    auto sizeBefore = directorySize(objectsDir);
+
+    auto objects = reachableObjects();
+    if (objects.empty()) {
+        std::cout << "Nothing to pack" << std::endl;
+        return;
+    }
+    auto packDir = objectsDir / "pack";
+    auto summary = GitPackWriter::write(objects, packDir, window, depth);
+
+    if (removeRedundant) {
+        for (const auto& object : objects) {
+            auto looseDir =
+                objectsDir / Utilities::getObjectDirectory(object.hash);
+            std::filesystem::remove(
+                looseDir / Utilities::getObjectFileName(object.hash));
+            if (std::filesystem::exists(looseDir) &&
+                std::filesystem::is_empty(looseDir)) {
+                std::filesystem::remove(looseDir);
+            }
+        }
+        // an old pack goes only if the new one has every object of it,
+        // unreachable objects are kept
+        std::unordered_set<GitHash> packed;
+        for (const auto& object : objects) {
+            packed.insert(object.hash);
+        }
+        std::vector<std::filesystem::path> redundantIndexes;
+        for (const auto& dirEntry :
+             std::filesystem::directory_iterator(packDir)) {
+            auto indexPath = dirEntry.path();
+            if (indexPath.extension() != ".idx" ||
+                indexPath == summary.indexPath) {
+                continue;
+            }
+            GitPack pack(indexPath);
+            bool redundant = true;
+            for (uint32_t position = 0;
+                 redundant && position < pack.numberOfObjects(); ++position) {
+                redundant = packed.contains(pack.hash(position));
+            }
+            if (redundant) {
+                redundantIndexes.push_back(indexPath);
+            }
+        }
+        // the index goes first, so the pack is never visible without it
+        for (auto& indexPath : redundantIndexes) {
+            std::filesystem::remove(indexPath);
+            std::filesystem::remove(indexPath.replace_extension(".pack"));
+        }
+    }
+
+    auto sizeAfter = directorySize(objectsDir);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << fmt::format("Packed {} objects ({} deltas) into {}\n",
+                             summary.numberOfObjects, summary.numberOfDeltas,
+                             summary.packPath.filename().string());
+    std::cout << fmt::format("Object database: {} bytes -> {} bytes\n",
+                             sizeBefore, sizeAfter);
+    std::cout << fmt::format("Done in {:.3f}s\n", elapsed.count());
 }
 }; // namespace GitCommands
\ No newline at end of file
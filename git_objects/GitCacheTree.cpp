@@ -0,0 +1,177 @@
+#include "GitCacheTree.hpp"
+#include "../utilities/Common.hpp"
+#include "GitIndex.hpp"
+#include "GitObject.hpp"
+
+#include <algorithm>
+#include <charconv>
+
+namespace {
+[[noreturn]] void corrupted(std::string_view reason)
+{
+    GENERATE_EXCEPTION("Corrupted cache tree: {}", reason);
+}
+
+int readNumber(std::string_view data, size_t& offset, char terminator)
+{
+    auto end = data.find(terminator, offset);
+    if (end == std::string_view::npos) {
+        corrupted("truncated entry");
+    }
+    int number;
+    auto [last, error] =
+        std::from_chars(data.data() + offset, data.data() + end, number);
+    if (error != std::errc() || last != data.data() + end) {
+        corrupted("malformed number");
+    }
+    offset = end + 1;
+    return number;
+}
+}; // namespace
+
+namespace Git {
+GitCacheTree GitCacheTree::parse(std::string_view data)
+{
+    GitCacheTree root;
+    size_t offset = 0;
+    root.parse(data, offset);
+    if (offset != data.size()) {
+        corrupted("trailing data");
+    }
+    return root;
+}
+
+void GitCacheTree::parse(std::string_view data, size_t& offset)
+{
+    auto nameEnd = data.find('\0', offset);
+    if (nameEnd == std::string_view::npos) {
+        corrupted("truncated entry");
+    }
+    m_name = data.substr(offset, nameEnd - offset);
+    offset = nameEnd + 1;
+    m_entryCount = readNumber(data, offset, ' ');
+    auto numberOfSubtrees = readNumber(data, offset, '\n');
+    if (m_entryCount < -1 || numberOfSubtrees < 0) {
+        corrupted("negative count");
+    }
+    if (isValid()) {
+        if (data.size() - offset < BinaryHash::SIZE) {
+            corrupted("truncated hash");
+        }
+        m_hash = GitHash::fromBytes(data.data() + offset);
+        offset += BinaryHash::SIZE;
+    }
+    m_subtrees.resize(numberOfSubtrees);
+    for (auto& subtree : m_subtrees) {
+        subtree.parse(data, offset);
+    }
+}
+
+std::string GitCacheTree::serialize() const
+{
+    std::string data;
+    serialize(data);
+    return data;
+}
+
+void GitCacheTree::serialize(std::string& data) const
+{
+    data += m_name;
+    data += '\0';
+    data += fmt::format("{} {}\n", m_entryCount, m_subtrees.size());
+    if (isValid()) {
+        data += m_hash.bytes();
+    }
+    // git keeps subtrees ordered by the length of their name first
+    std::vector<const GitCacheTree*> ordered;
+    for (const auto& subtree : m_subtrees) {
+        ordered.push_back(&subtree);
+    }
+    std::sort(ordered.begin(), ordered.end(), [](auto lhs, auto rhs) {
+        if (lhs->m_name.size() != rhs->m_name.size()) {
+            return lhs->m_name.size() < rhs->m_name.size();
+        }
+        return lhs->m_name < rhs->m_name;
+    });
+    for (auto subtree : ordered) {
+        subtree->serialize(data);
+    }
+}
+
+void GitCacheTree::invalidate(std::string_view path)
+{
+    m_entryCount = -1;
+    auto slash = path.find('/');
+    if (slash == std::string_view::npos) {
+        return;
+    }
+    auto name = path.substr(0, slash);
+    for (auto& subtree : m_subtrees) {
+        if (subtree.m_name == name) {
+            subtree.invalidate(path.substr(slash + 1));
+            return;
+        }
+    }
+}
+
+GitHash GitCacheTree::update(const GitIndex& index)
+{
+    update(index, 0, "");
+    return m_hash;
+}
+
+size_t GitCacheTree::update(const GitIndex& index, size_t position,
+                            const std::string& prefix)
+{
+    if (isValid()) {
+        return position + m_entryCount;
+    }
+
+    auto begin = position;
+    std::vector<GitTreeLeaf> leaves;
+    std::vector<GitCacheTree> subtrees;
+    while (position < index.size()) {
+        auto path = index.path(position);
+        if (!path.starts_with(prefix)) {
+            break;
+        }
+        if (index.stage(position) != 0) {
+            GENERATE_EXCEPTION("{} is unmerged", path);
+        }
+
+        auto name = path.substr(prefix.size());
+        auto slash = name.find('/');
+        if (slash == std::string_view::npos) {
+            // intent-to-add entries have no content yet
+            if (!(index.extendedFlags(position) &
+                  GitIndex::FLAG_INTENT_TO_ADD)) {
+                leaves.push_back(
+                    {.fileMode = fmt::format("{:o}", index.stat(position).mode),
+                     .filePath = std::string(name),
+                     .hash = index.hash(position)});
+            }
+            ++position;
+            continue;
+        }
+
+        // a directory that didn't change keeps its hash
+        auto directory = std::string(name.substr(0, slash));
+        auto existing = std::find_if(
+            m_subtrees.begin(), m_subtrees.end(),
+            [&](const auto& subtree) { return subtree.m_name == directory; });
+        auto& subtree = existing != m_subtrees.end()
+                            ? subtrees.emplace_back(std::move(*existing))
+                            : subtrees.emplace_back(GitCacheTree(directory));
+        position = subtree.update(index, position, prefix + directory + '/');
+        leaves.push_back({.fileMode = "40000",
+                          .filePath = directory,
+                          .hash = subtree.m_hash});
+    }
+
+    GitTree tree(leaves);
+    m_hash = GitObject::write(&tree);
+    m_entryCount = static_cast<int>(position - begin);
+    m_subtrees = std::move(subtrees);
+    return position;
+}
+}; // namespace Git
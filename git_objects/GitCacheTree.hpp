@@ -0,0 +1,63 @@
+#pragma once
+
+#include "GitHash.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Git {
+class GitIndex;
+
+/*
+    Tree hashes of the directories of the index, so writing a tree only writes
+    the directories an entry changed in. It is stored in the index as the TREE
+    extension, directories in pre-order:
+        |name||0||entry count|| ||number of subtrees||\n||20 bytes tree hash|
+    The root's name is empty. An entry count of -1 marks a directory that
+    changed since its tree was written, it has no hash.
+*/
+class GitCacheTree {
+  public:
+    static constexpr std::string_view SIGNATURE = "TREE";
+
+  public:
+    GitCacheTree() = default;
+
+    // Throws if the data is corrupted.
+    static GitCacheTree parse(std::string_view data);
+    std::string serialize() const;
+
+    // Marks the directories leading to the file at path as changed.
+    void invalidate(std::string_view path);
+    // Writes the trees of the changed directories of the index and returns
+    // the hash of the root tree. Throws if the index has unmerged entries.
+    GitHash update(const GitIndex& index);
+
+    bool isValid() const { return m_entryCount >= 0; }
+    // Nothing is known about any directory.
+    bool empty() const { return !isValid() && m_subtrees.empty(); }
+    const std::string& name() const { return m_name; }
+    // Number of index entries under the directory, -1 if it is invalid.
+    int entryCount() const { return m_entryCount; }
+    const GitHash& hash() const { return m_hash; }
+    const std::vector<GitCacheTree>& subtrees() const { return m_subtrees; }
+
+  private:
+    explicit GitCacheTree(std::string name) : m_name(std::move(name)) {}
+
+    void parse(std::string_view data, size_t& offset);
+    void serialize(std::string& data) const;
+    // Entries under prefix start at position, returns the position after
+    // them.
+    size_t update(const GitIndex& index, size_t position,
+                  const std::string& prefix);
+
+  private:
+    std::string m_name;
+    int m_entryCount = -1;
+    GitHash m_hash;
+    std::vector<GitCacheTree> m_subtrees;
+};
+}; // namespace Git
+
+using GitCacheTree = Git::GitCacheTree;
@@ -0,0 +1,205 @@
+#include "GitDelta.hpp"
+#include "../utilities/Common.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+
+namespace {
+// base is indexed in blocks of this size, shorter matches aren't worth a copy
+constexpr size_t BLOCK_SIZE = 16;
+constexpr size_t MAX_INSERT_SIZE = 0x7f;
+constexpr size_t MAX_COPY_SIZE = 0xffffff;
+
+void writeSize(std::string& delta, size_t size)
+{
+    do {
+        uint8_t byte = size & 0x7f;
+        size >>= 7;
+        if (size != 0) {
+            byte |= 0x80;
+        }
+        delta.push_back(byte);
+    } while (size != 0);
+}
+
+void writeInsert(std::string& delta, std::string_view literal)
+{
+    while (!literal.empty()) {
+        auto chunk = std::min(literal.size(), MAX_INSERT_SIZE);
+        delta.push_back(static_cast<char>(chunk));
+        delta.append(literal.substr(0, chunk));
+        literal.remove_prefix(chunk);
+    }
+}
+
+void writeCopy(std::string& delta, size_t offset, size_t size)
+{
+    while (size > 0) {
+        auto chunk = std::min(size, MAX_COPY_SIZE);
+        uint8_t instruction = 0x80;
+        std::string arguments;
+        // only non zero bytes are stored
+        for (int i = 0; i < 4; ++i) {
+            if (uint8_t byte = (offset >> (i * 8)) & 0xff; byte != 0) {
+                instruction |= 1 << i;
+                arguments.push_back(byte);
+            }
+        }
+        for (int i = 0; i < 3; ++i) {
+            if (uint8_t byte = (chunk >> (i * 8)) & 0xff; byte != 0) {
+                instruction |= 0x10 << i;
+                arguments.push_back(byte);
+            }
+        }
+        delta.push_back(instruction);
+        delta.append(arguments);
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+size_t readSize(std::string_view delta, size_t& pos)
+{
+    size_t size = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        if (pos >= delta.size()) {
+            GENERATE_EXCEPTION("{}", "Truncated delta header");
+        }
+        byte = delta[pos++];
+        size |= static_cast<size_t>(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return size;
+}
+}; // namespace
+
+namespace Git {
+
+size_t GitDelta::resultSize(std::string_view delta)
+{
+    size_t pos = 0;
+    readSize(delta, pos);
+    return readSize(delta, pos);
+}
+
+std::string GitDelta::create(std::string_view base, std::string_view target,
+                             size_t maxSize)
+{
+    if (base.size() < BLOCK_SIZE || base.size() > UINT32_MAX) {
+        return {};
+    }
+
+    std::unordered_map<std::string_view, size_t> blocks;
+    blocks.reserve(base.size() / BLOCK_SIZE);
+    for (size_t offset = 0; offset + BLOCK_SIZE <= base.size();
+         offset += BLOCK_SIZE) {
+        blocks.try_emplace(base.substr(offset, BLOCK_SIZE), offset);
+    }
+
+    std::string delta;
+    writeSize(delta, base.size());
+    writeSize(delta, target.size());
+
+    size_t insertStart = 0;
+    size_t position = 0;
+    while (position + BLOCK_SIZE <= target.size()) {
+        auto block = blocks.find(target.substr(position, BLOCK_SIZE));
+        if (block == blocks.end()) {
+            ++position;
+            continue;
+        }
+
+        // grow the match in both directions, backwards only over bytes that
+        // would otherwise be inserted
+        auto matchStart = position;
+        auto baseStart = block->second;
+        while (matchStart > insertStart && baseStart > 0 &&
+               base[baseStart - 1] == target[matchStart - 1]) {
+            --matchStart;
+            --baseStart;
+        }
+        auto matchEnd = position + BLOCK_SIZE;
+        auto baseEnd = block->second + BLOCK_SIZE;
+        while (matchEnd < target.size() && baseEnd < base.size() &&
+               base[baseEnd] == target[matchEnd]) {
+            ++matchEnd;
+            ++baseEnd;
+        }
+
+        writeInsert(delta,
+                    target.substr(insertStart, matchStart - insertStart));
+        writeCopy(delta, baseStart, matchEnd - matchStart);
+        if (delta.size() > maxSize) {
+            return {};
+        }
+        position = insertStart = matchEnd;
+    }
+    writeInsert(delta, target.substr(insertStart));
+
+    if (delta.size() > maxSize) {
+        return {};
+    }
+    return delta;
+}
+
+std::string GitDelta::apply(std::string_view base, std::string_view delta)
+{
+    size_t pos = 0;
+    if (auto baseSize = readSize(delta, pos); baseSize != base.size()) {
+        GENERATE_EXCEPTION("Delta expects base of {} bytes, got {}", baseSize,
+                           base.size());
+    }
+    auto resultSize = readSize(delta, pos);
+
+    std::string result;
+    result.reserve(resultSize);
+    while (pos < delta.size()) {
+        uint8_t instruction = delta[pos++];
+        if (instruction & 0x80) {
+            // bits 0-3 say which offset bytes are present, bits 4-6 which
+            // size bytes are present
+            size_t offset = 0;
+            size_t size = 0;
+            for (int i = 0; i < 4; ++i) {
+                if (instruction & (1 << i)) {
+                    offset |= static_cast<size_t>(
+                                  static_cast<uint8_t>(delta.at(pos++)))
+                              << (i * 8);
+                }
+            }
+            for (int i = 0; i < 3; ++i) {
+                if (instruction & (0x10 << i)) {
+                    size |= static_cast<size_t>(
+                                static_cast<uint8_t>(delta.at(pos++)))
+                            << (i * 8);
+                }
+            }
+            if (size == 0) {
+                size = 0x10000;
+            }
+            if (offset + size > base.size()) {
+                GENERATE_EXCEPTION("{}", "Delta copies outside of its base");
+            }
+            result.append(base.substr(offset, size));
+        }
+        else if (instruction != 0) {
+            if (pos + instruction > delta.size()) {
+                GENERATE_EXCEPTION("{}", "Truncated delta instruction");
+            }
+            result.append(delta.substr(pos, instruction));
+            pos += instruction;
+        }
+        else {
+            GENERATE_EXCEPTION("{}", "Unexpected delta instruction 0");
+        }
+    }
+
+    if (result.size() != resultSize) {
+        GENERATE_EXCEPTION("Delta produced {} bytes instead of {}",
+                           result.size(), resultSize);
+    }
+    return result;
+}
+}; // namespace Git
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace Git {
+/*
+    Git delta format, used by OFS_DELTA and REF_DELTA packfile entries:
+        |base size varint||result size varint|
+        |instruction ...|
+    Instruction with the highest bit set copies a range of the base object,
+    otherwise the lower 7 bits are the number of literal bytes that follow.
+*/
+class GitDelta {
+  public:
+    static std::string apply(std::string_view base, std::string_view delta);
+
+    // Encodes target as copies from base and literal inserts. The delta is
+    // never larger than maxSize, an empty string is returned when it would be.
+    static std::string create(std::string_view base, std::string_view target,
+                              size_t maxSize);
+
+    // Size of the object produced by the delta, read from its header.
+    static size_t resultSize(std::string_view delta);
+
+  private:
+    GitDelta() = delete;
+};
+}; // namespace Git
+
+using GitDelta = Git::GitDelta;
@@ -0,0 +1,479 @@
+#include "GitDiff.hpp"
+#include "../utilities/Common.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+
+namespace {
+constexpr size_t BINARY_CHECK_SIZE = 8000;
+// git shows at most this much of the function a hunk is in
+constexpr size_t FUNCTION_LINE_SIZE = 80;
+
+/*
+    Myers' algorithm on lines numbered so that equal lines have the same
+    number. Every call compares a range of each sequence: the middle snake
+    splits them in two smaller ranges with shortest edit scripts of their
+    own, until one range is empty and the other is all changed.
+*/
+class Comparison {
+  public:
+    Comparison(const std::vector<uint32_t>& before,
+               const std::vector<uint32_t>& after)
+        : m_before(before), m_after(after), m_removed(before.size()),
+          m_added(after.size())
+    {
+    }
+
+    void compare(size_t beforeBegin, size_t beforeEnd, size_t afterBegin,
+                 size_t afterEnd);
+
+    const std::vector<bool>& removed() const { return m_removed; }
+    const std::vector<bool>& added() const { return m_added; }
+
+  private:
+    // A point of a shortest edit script of the ranges, relative to their
+    // beginning, that is neither their beginning nor their end.
+    std::pair<ptrdiff_t, ptrdiff_t> split(size_t beforeBegin, size_t beforeEnd,
+                                          size_t afterBegin, size_t afterEnd);
+
+  private:
+    const std::vector<uint32_t>& m_before;
+    const std::vector<uint32_t>& m_after;
+    std::vector<bool> m_removed;
+    std::vector<bool> m_added;
+    // furthest x reached on each diagonal, from the beginning and from the
+    // end of the ranges, shared by every call
+    std::vector<ptrdiff_t> m_forward;
+    std::vector<ptrdiff_t> m_backward;
+};
+
+void Comparison::compare(size_t beforeBegin, size_t beforeEnd,
+                         size_t afterBegin, size_t afterEnd)
+{
+    while (beforeBegin < beforeEnd && afterBegin < afterEnd &&
+           m_before[beforeBegin] == m_after[afterBegin]) {
+        ++beforeBegin;
+        ++afterBegin;
+    }
+    while (beforeBegin < beforeEnd && afterBegin < afterEnd &&
+           m_before[beforeEnd - 1] == m_after[afterEnd - 1]) {
+        --beforeEnd;
+        --afterEnd;
+    }
+    if (beforeBegin == beforeEnd || afterBegin == afterEnd) {
+        std::fill(m_removed.begin() + beforeBegin,
+                  m_removed.begin() + beforeEnd, true);
+        std::fill(m_added.begin() + afterBegin, m_added.begin() + afterEnd,
+                  true);
+        return;
+    }
+    auto [x, y] = split(beforeBegin, beforeEnd, afterBegin, afterEnd);
+    compare(beforeBegin, beforeBegin + x, afterBegin, afterBegin + y);
+    compare(beforeBegin + x, beforeEnd, afterBegin + y, afterEnd);
+}
+
+std::pair<ptrdiff_t, ptrdiff_t> Comparison::split(size_t beforeBegin,
+                                                  size_t beforeEnd,
+                                                  size_t afterBegin,
+                                                  size_t afterEnd)
+{
+    ptrdiff_t n = beforeEnd - beforeBegin;
+    ptrdiff_t m = afterEnd - afterBegin;
+    // diagonal k holds the points with x - y == k, the end is on delta
+    ptrdiff_t delta = n - m;
+    bool isOdd = delta % 2 != 0;
+    ptrdiff_t maxD = (n + m + 1) / 2;
+    ptrdiff_t offset = maxD + 1;
+    ptrdiff_t size = 2 * maxD + 3;
+    m_forward.assign(size, -1);
+    m_backward.assign(size, -1);
+    m_forward[offset + 1] = 0;
+    m_backward[offset + 1] = 0;
+
+    auto isEqual = [&](ptrdiff_t x, ptrdiff_t y) {
+        return m_before[beforeBegin + x] == m_after[afterBegin + y];
+    };
+    // diagonals whose paths left the grid are skipped from then on
+    ptrdiff_t forwardStart = 0, forwardEnd = 0;
+    ptrdiff_t backwardStart = 0, backwardEnd = 0;
+    for (ptrdiff_t d = 0; d <= maxD; ++d) {
+        for (auto k = -d + forwardStart; k <= d - forwardEnd; k += 2) {
+            auto i = offset + k;
+            auto x = k == -d || (k != d && m_forward[i - 1] < m_forward[i + 1])
+                         ? m_forward[i + 1]
+                         : m_forward[i - 1] + 1;
+            auto y = x - k;
+            while (x < n && y < m && isEqual(x, y)) {
+                ++x;
+                ++y;
+            }
+            m_forward[i] = x;
+            if (x > n) {
+                forwardEnd += 2;
+            }
+            else if (y > m) {
+                forwardStart += 2;
+            }
+            else if (isOdd) {
+                // the backward diagonal that reaches the same points
+                auto j = offset + delta - k;
+                if (j >= 0 && j < size && m_backward[j] != -1 &&
+                    x >= n - m_backward[j]) {
+                    return {x, y};
+                }
+            }
+        }
+        for (auto k = -d + backwardStart; k <= d - backwardEnd; k += 2) {
+            auto i = offset + k;
+            auto x =
+                k == -d || (k != d && m_backward[i - 1] < m_backward[i + 1])
+                    ? m_backward[i + 1]
+                    : m_backward[i - 1] + 1;
+            auto y = x - k;
+            while (x < n && y < m && isEqual(n - x - 1, m - y - 1)) {
+                ++x;
+                ++y;
+            }
+            m_backward[i] = x;
+            if (x > n) {
+                backwardEnd += 2;
+            }
+            else if (y > m) {
+                backwardStart += 2;
+            }
+            else if (!isOdd) {
+                auto j = offset + delta - k;
+                if (j >= 0 && j < size && m_forward[j] != -1 &&
+                    m_forward[j] >= n - x) {
+                    return {m_forward[j], m_forward[j] - (j - offset)};
+                }
+            }
+        }
+    }
+    // the paths always meet, a script of d changes can't be longer than n+m
+    GENERATE_EXCEPTION("No middle snake between {} and {} lines", n, m);
+}
+
+// Consecutive removed and added lines, between unchanged ones.
+struct Region {
+    size_t beforeBegin, beforeEnd;
+    size_t afterBegin, afterEnd;
+};
+
+std::vector<Region> regionsOf(const Git::GitDiff::Changes& changes)
+{
+    std::vector<Region> regions;
+    auto beforeSize = changes.removed.size();
+    auto afterSize = changes.added.size();
+    for (size_t i = 0, j = 0; i < beforeSize || j < afterSize;) {
+        if ((i < beforeSize && changes.removed[i]) ||
+            (j < afterSize && changes.added[j])) {
+            auto beforeBegin = i;
+            auto afterBegin = j;
+            while (i < beforeSize && changes.removed[i]) {
+                ++i;
+            }
+            while (j < afterSize && changes.added[j]) {
+                ++j;
+            }
+            regions.push_back({.beforeBegin = beforeBegin,
+                               .beforeEnd = i,
+                               .afterBegin = afterBegin,
+                               .afterEnd = j});
+        }
+        else {
+            ++i;
+            ++j;
+        }
+    }
+    return regions;
+}
+
+bool isFunctionLine(std::string_view line)
+{
+    return !line.empty() &&
+           (std::isalpha(static_cast<unsigned char>(line.front())) ||
+            line.front() == '_' || line.front() == '$');
+}
+
+// "start,count" of a hunk header, the start is 1-based unless the range is
+// empty, then it is the line before it.
+std::string hunkRange(size_t start, size_t count)
+{
+    if (count == 1) {
+        return std::to_string(start + 1);
+    }
+    return fmt::format("{},{}", count == 0 ? start : start + 1, count);
+}
+}; // namespace
+
+namespace Git {
+std::vector<std::string_view> GitDiff::lines(std::string_view text)
+{
+    std::vector<std::string_view> lines;
+    while (!text.empty()) {
+        auto end = text.find('\n');
+        end = end == std::string_view::npos ? text.size() : end + 1;
+        lines.push_back(text.substr(0, end));
+        text.remove_prefix(end);
+    }
+    return lines;
+}
+
+GitDiff::Changes GitDiff::compare(const std::vector<std::string_view>& before,
+                                  const std::vector<std::string_view>& after)
+{
+    // lines are compared by number, each distinct line is hashed once
+    std::unordered_map<std::string_view, uint32_t> numbers;
+    numbers.reserve(before.size() + after.size());
+    // how many times each line is in before and in after
+    std::vector<std::pair<size_t, size_t>> counts;
+    auto numberLines = [&](const std::vector<std::string_view>& lines,
+                           bool isAfter) {
+        std::vector<uint32_t> numbered;
+        numbered.reserve(lines.size());
+        for (auto line : lines) {
+            auto [number, isNew] = numbers.try_emplace(line, counts.size());
+            if (isNew) {
+                counts.emplace_back(0, 0);
+            }
+            auto& count = counts[number->second];
+            ++(isAfter ? count.second : count.first);
+            numbered.push_back(number->second);
+        }
+        return numbered;
+    };
+    auto numberedBefore = numberLines(before, false);
+    auto numberedAfter = numberLines(after, true);
+
+    // a line that is in only one of the texts is changed whatever the
+    // script is, only the others are given to Myers' algorithm
+    Changes changes{.removed = std::vector<bool>(before.size()),
+                    .added = std::vector<bool>(after.size())};
+    auto keepCommon = [&](const std::vector<uint32_t>& numbered,
+                          std::vector<bool>& changed, bool isAfter) {
+        std::pair<std::vector<uint32_t>, std::vector<size_t>> kept;
+        for (size_t i = 0; i < numbered.size(); ++i) {
+            const auto& count = counts[numbered[i]];
+            if ((isAfter ? count.first : count.second) == 0) {
+                changed[i] = true;
+                continue;
+            }
+            kept.first.push_back(numbered[i]);
+            kept.second.push_back(i);
+        }
+        return kept;
+    };
+    auto [keptBefore, beforeLines] =
+        keepCommon(numberedBefore, changes.removed, false);
+    auto [keptAfter, afterLines] =
+        keepCommon(numberedAfter, changes.added, true);
+
+    Comparison comparison(keptBefore, keptAfter);
+    comparison.compare(0, keptBefore.size(), 0, keptAfter.size());
+    for (size_t i = 0; i < keptBefore.size(); ++i) {
+        if (comparison.removed()[i]) {
+            changes.removed[beforeLines[i]] = true;
+        }
+    }
+    for (size_t i = 0; i < keptAfter.size(); ++i) {
+        if (comparison.added()[i]) {
+            changes.added[afterLines[i]] = true;
+        }
+    }
+    return changes;
+}
+
+std::string GitDiff::unified(std::string_view before, std::string_view after,
+                             size_t context)
+{
+    auto beforeLines = lines(before);
+    auto afterLines = lines(after);
+    auto regions = regionsOf(compare(beforeLines, afterLines));
+
+    std::string diff;
+    auto emit = [&](char marker, std::string_view line) {
+        diff += marker;
+        diff += line;
+        if (!line.ends_with('\n')) {
+            diff += "\n\\ No newline at end of file\n";
+        }
+    };
+    // each hunk searches for its function only up to where the previous
+    // one started, above it the answer is the same
+    std::optional<std::string_view> function;
+    size_t searched = 0;
+    for (size_t first = 0; first < regions.size();) {
+        // regions whose contexts touch or overlap share a hunk
+        auto last = first;
+        while (last + 1 < regions.size() &&
+               regions[last + 1].beforeBegin - regions[last].beforeEnd <=
+                   2 * context) {
+            ++last;
+        }
+        auto beforeBegin = regions[first].beforeBegin -
+                           std::min(context, regions[first].beforeBegin);
+        auto afterBegin = regions[first].afterBegin -
+                          (regions[first].beforeBegin - beforeBegin);
+        auto beforeEnd =
+            std::min(beforeLines.size(), regions[last].beforeEnd + context);
+        auto afterEnd =
+            regions[last].afterEnd + (beforeEnd - regions[last].beforeEnd);
+
+        for (auto line = beforeBegin; line > searched; --line) {
+            if (isFunctionLine(beforeLines[line - 1])) {
+                function = beforeLines[line - 1];
+                break;
+            }
+        }
+        searched = beforeBegin;
+        diff += fmt::format("@@ -{} +{} @@",
+                            hunkRange(beforeBegin, beforeEnd - beforeBegin),
+                            hunkRange(afterBegin, afterEnd - afterBegin));
+        if (function) {
+            auto text = function->substr(0, FUNCTION_LINE_SIZE);
+            while (!text.empty() &&
+                   std::isspace(static_cast<unsigned char>(text.back()))) {
+                text.remove_suffix(1);
+            }
+            diff += ' ';
+            diff += text;
+        }
+        diff += '\n';
+
+        auto i = beforeBegin;
+        auto j = afterBegin;
+        for (auto region = first; region <= last; ++region) {
+            for (; i < regions[region].beforeBegin; ++i, ++j) {
+                emit(' ', beforeLines[i]);
+            }
+            for (; i < regions[region].beforeEnd; ++i) {
+                emit('-', beforeLines[i]);
+            }
+            for (; j < regions[region].afterEnd; ++j) {
+                emit('+', afterLines[j]);
+            }
+        }
+        for (; i < beforeEnd; ++i) {
+            emit(' ', beforeLines[i]);
+        }
+        first = last + 1;
+    }
+    return diff;
+}
+
+GitDiff::Merge GitDiff::merge(std::string_view base, std::string_view ours,
+                              std::string_view theirs,
+                              std::string_view oursLabel,
+                              std::string_view theirsLabel)
+{
+    auto baseLines = lines(base);
+    auto oursLines = lines(ours);
+    auto theirsLines = lines(theirs);
+    auto oursRegions = regionsOf(compare(baseLines, oursLines));
+    auto theirsRegions = regionsOf(compare(baseLines, theirsLines));
+
+    Merge merge;
+    auto append = [&](const std::vector<std::string_view>& lines,
+                      size_t begin, size_t end) {
+        for (auto i = begin; i < end; ++i) {
+            merge.text += lines[i];
+        }
+    };
+    // a side's lines, found from the base ones with its delta
+    struct Side {
+        const std::vector<std::string_view>& lines;
+        const std::vector<Region>& regions;
+        size_t next = 0;
+        ptrdiff_t delta = 0;
+    };
+    Side oursSide{oursLines, oursRegions};
+    Side theirsSide{theirsLines, theirsRegions};
+
+    size_t position = 0;
+    while (oursSide.next < oursRegions.size() ||
+           theirsSide.next < theirsRegions.size()) {
+        auto beginningOf = [](const Side& side) {
+            return side.next < side.regions.size()
+                       ? side.regions[side.next].beforeBegin
+                       : std::numeric_limits<size_t>::max();
+        };
+        // regions of both sides that overlap or touch make up one chunk
+        auto chunkBegin = std::min(beginningOf(oursSide),
+                                   beginningOf(theirsSide));
+        auto chunkEnd = chunkBegin;
+        auto oursBegin = chunkBegin + oursSide.delta;
+        auto theirsBegin = chunkBegin + theirsSide.delta;
+        bool oursChanged = false;
+        bool theirsChanged = false;
+        for (bool grew = true; grew;) {
+            grew = false;
+            for (auto* side : {&oursSide, &theirsSide}) {
+                while (beginningOf(*side) <= chunkEnd) {
+                    const auto& region = side->regions[side->next++];
+                    chunkEnd = std::max(chunkEnd, region.beforeEnd);
+                    side->delta =
+                        static_cast<ptrdiff_t>(region.afterEnd) -
+                        static_cast<ptrdiff_t>(region.beforeEnd);
+                    (side == &oursSide ? oursChanged : theirsChanged) = true;
+                    grew = true;
+                }
+            }
+        }
+        auto oursEnd = chunkEnd + oursSide.delta;
+        auto theirsEnd = chunkEnd + theirsSide.delta;
+
+        append(baseLines, position, chunkBegin);
+        position = chunkEnd;
+        auto isSame = std::equal(
+            oursLines.begin() + oursBegin, oursLines.begin() + oursEnd,
+            theirsLines.begin() + theirsBegin, theirsLines.begin() + theirsEnd);
+        if (!theirsChanged || isSame) {
+            append(oursLines, oursBegin, oursEnd);
+            continue;
+        }
+        if (!oursChanged) {
+            append(theirsLines, theirsBegin, theirsEnd);
+            continue;
+        }
+
+        // lines both sides changed the same way stay out of the conflict
+        while (oursBegin < oursEnd && theirsBegin < theirsEnd &&
+               oursLines[oursBegin] == theirsLines[theirsBegin]) {
+            merge.text += oursLines[oursBegin++];
+            ++theirsBegin;
+        }
+        auto suffix = oursEnd;
+        while (oursBegin < suffix && theirsBegin < theirsEnd &&
+               oursLines[suffix - 1] == theirsLines[theirsEnd - 1]) {
+            --suffix;
+            --theirsEnd;
+        }
+        auto appendSide = [&](const std::vector<std::string_view>& lines,
+                              size_t begin, size_t end) {
+            append(lines, begin, end);
+            if (begin < end && !lines[end - 1].ends_with('\n')) {
+                merge.text += '\n';
+            }
+        };
+        merge.text += fmt::format("<<<<<<< {}\n", oursLabel);
+        appendSide(oursLines, oursBegin, suffix);
+        merge.text += "=======\n";
+        appendSide(theirsLines, theirsBegin, theirsEnd);
+        merge.text += fmt::format(">>>>>>> {}\n", theirsLabel);
+        append(oursLines, suffix, oursEnd);
+        ++merge.numberOfConflicts;
+    }
+    append(baseLines, position, baseLines.size());
+    return merge;
+}
+
+bool GitDiff::isBinary(std::string_view data)
+{
+    return data.substr(0, BINARY_CHECK_SIZE).find('\0') !=
+           std::string_view::npos;
+}
+}; // namespace Git
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Git {
+/*
+    Line diff of two texts, the way git diff shows changed blobs. The lines
+    that differ are found with Myers' algorithm in linear space: the middle
+    snake of the shortest edit script splits the texts, and each half is
+    compared on its own, so only two diagonal vectors are ever allocated.
+    Before that the common prefix and suffix are dropped, and lines found in
+    only one of the texts are marked as changed without being searched for.
+    The same line diffs, from a common base to each side, drive merges.
+*/
+class GitDiff {
+  public:
+    // One flag per line, set for the lines of before that were removed and
+    // for the lines of after that were added.
+    struct Changes {
+        std::vector<bool> removed;
+        std::vector<bool> added;
+    };
+
+    struct Merge {
+        std::string text;
+        size_t numberOfConflicts = 0;
+    };
+
+  public:
+    // Lines with their '\n', the last one lacks it if the text does.
+    static std::vector<std::string_view> lines(std::string_view text);
+    // Changes with as few removed and added lines as possible.
+    static Changes compare(const std::vector<std::string_view>& before,
+                           const std::vector<std::string_view>& after);
+
+    // Hunks of a unified diff, each with context unchanged lines around its
+    // changes and the function it is in after its "@@ -a,b +c,d @@" header.
+    // Empty when the texts are the same.
+    static std::string unified(std::string_view before, std::string_view after,
+                               size_t context = 3);
+
+    // Three-way merge of the lines of ours and theirs, which both come from
+    // base. A part of base changed by one side only takes that change, parts
+    // changed by both sides in different ways are conflicts, written between
+    // "<<<<<<< oursLabel", "=======" and ">>>>>>> theirsLabel" lines.
+    static Merge merge(std::string_view base, std::string_view ours,
+                       std::string_view theirs, std::string_view oursLabel,
+                       std::string_view theirsLabel);
+
+    // Same test as git: a NUL byte among the first 8000 bytes.
+    static bool isBinary(std::string_view data);
+
+  private:
+    GitDiff() = delete;
+};
+}; // namespace Git
+
+using GitDiff = Git::GitDiff;
@@ -0,0 +1,532 @@
+#include "GitFSMonitor.hpp"
+#include "../utilities/Common.hpp"
+#include "GitRepository.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+constexpr uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CREATE |
+                                IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR |
+                                IN_DONT_FOLLOW;
+constexpr std::string_view EVERYTHING = "/";
+constexpr std::string_view QUIT = "quit";
+// older events are forgotten, tokens from before them get EVERYTHING
+constexpr size_t MAX_EVENTS = 1 << 20;
+constexpr int TIMEOUT_SECONDS = 5;
+
+class FileDescriptor {
+  public:
+    explicit FileDescriptor(int fd) : m_fd(fd) {}
+    ~FileDescriptor()
+    {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+    }
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int get() const { return m_fd; }
+
+  private:
+    int m_fd;
+};
+
+sockaddr_un socketAddress(const std::filesystem::path& socketPath)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.native().size() >= sizeof(address.sun_path)) {
+        GENERATE_EXCEPTION("Socket path is too long: {}", socketPath.string());
+    }
+    std::copy(socketPath.native().begin(), socketPath.native().end(),
+              address.sun_path);
+    return address;
+}
+
+// A peer that stops answering doesn't block the other side for ever.
+void setTimeouts(int fd)
+{
+    timeval timeout{.tv_sec = TIMEOUT_SECONDS, .tv_usec = 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// Connected socket, or -1 if nothing listens.
+int connectToMonitor()
+{
+    auto address = socketAddress(Git::GitFSMonitor::socketPath());
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address),
+                  sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    setTimeouts(fd);
+    return fd;
+}
+
+bool sendAll(int fd, std::string_view data)
+{
+    while (!data.empty()) {
+        auto sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data.remove_prefix(sent);
+    }
+    return true;
+}
+
+// Reads until the other side closes, or up to the first terminator.
+std::optional<std::string> receive(int fd, char terminator = '\0')
+{
+    std::string data;
+    char buffer[64 * 1024];
+    while (true) {
+        auto received = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (received < 0) {
+            return std::nullopt;
+        }
+        if (received == 0) {
+            return data;
+        }
+        data.append(buffer, received);
+        if (terminator != '\0' && data.find(terminator) != std::string::npos) {
+            return data;
+        }
+    }
+}
+
+std::string join(const std::string& directory, std::string_view name)
+{
+    return directory.empty() ? std::string(name)
+                             : directory + '/' + std::string(name);
+}
+
+/*
+    Every event of the worktree gets the next sequence number, a token is the
+    sequence number of the last event it has seen. The instance tells tokens
+    of previous daemons apart, it changes too when the kernel dropped events.
+    A directory that couldn't be watched, because there are no watches left
+    for example, makes every answer report that everything changed.
+*/
+class Monitor {
+  public:
+    explicit Monitor(std::filesystem::path workTree)
+        : m_workTree(std::move(workTree)),
+          m_inotify(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    {
+        if (m_inotify.get() < 0) {
+            GENERATE_EXCEPTION("{}", "Unable to initialize inotify");
+        }
+        reset();
+        watch("");
+        if (!m_unwatched.empty()) {
+            GENERATE_EXCEPTION("Unable to watch {}: {}",
+                               (m_workTree / m_unwatched).string(),
+                               std::strerror(m_watchError));
+        }
+    }
+
+    void run(int listener)
+    {
+        while (true) {
+            pollfd descriptors[] = {{m_inotify.get(), POLLIN, 0},
+                                    {listener, POLLIN, 0}};
+            if (::poll(descriptors, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                GENERATE_EXCEPTION("{}", "Filesystem monitor failed to poll");
+            }
+            if (descriptors[0].revents & POLLIN) {
+                readEvents();
+            }
+            if (descriptors[1].revents & POLLIN) {
+                FileDescriptor client(::accept4(listener, nullptr, nullptr,
+                                                SOCK_CLOEXEC));
+                if (client.get() < 0) {
+                    continue;
+                }
+                setTimeouts(client.get());
+                if (!answer(client.get())) {
+                    return;
+                }
+            }
+        }
+    }
+
+  private:
+    std::string token() const
+    {
+        return fmt::format("{}:{}", m_instance, m_sequence);
+    }
+
+    // Anything may have changed, every token handed out so far is stale.
+    void reset()
+    {
+        m_instance = fmt::format(
+            "{}.{}", ::getpid(),
+            std::chrono::system_clock::now().time_since_epoch().count());
+        m_events.clear();
+        m_firstKept = m_sequence + 1;
+    }
+
+    void record(std::string path)
+    {
+        m_events.push_back(std::move(path));
+        ++m_sequence;
+        if (m_events.size() > MAX_EVENTS) {
+            m_events.pop_front();
+            ++m_firstKept;
+        }
+    }
+
+    void watch(const std::string& directory)
+    {
+        auto path = directory.empty() ? m_workTree : m_workTree / directory;
+        int wd = ::inotify_add_watch(m_inotify.get(), path.c_str(), WATCH_MASK);
+        if (wd < 0) {
+            // it is gone already, the event of its parent tells that
+            if (errno != ENOENT && errno != ENOTDIR && m_unwatched.empty()) {
+                m_unwatched = directory.empty() ? "." : directory;
+                m_watchError = errno;
+            }
+            return;
+        }
+        m_directories[wd] = directory;
+
+        std::error_code error;
+        for (auto it = std::filesystem::directory_iterator(path, error);
+             !error && it != std::filesystem::directory_iterator();
+             it.increment(error)) {
+            auto name = it->path().filename().string();
+            if (it->is_directory(error) && !it->is_symlink(error) &&
+                !(directory.empty() && name == ".git")) {
+                watch(join(directory, name));
+            }
+        }
+    }
+
+    // A directory moved away keeps its watches, they would report paths
+    // under its old name.
+    void unwatch(const std::string& directory)
+    {
+        for (auto it = m_directories.begin(); it != m_directories.end();) {
+            if (it->second == directory ||
+                it->second.starts_with(directory + '/')) {
+                ::inotify_rm_watch(m_inotify.get(), it->first);
+                it = m_directories.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    void readEvents()
+    {
+        alignas(inotify_event) char buffer[64 * 1024];
+        while (true) {
+            auto length = ::read(m_inotify.get(), buffer, sizeof(buffer));
+            if (length <= 0) {
+                return;
+            }
+            for (auto data = buffer; data < buffer + length;) {
+                auto event = reinterpret_cast<const inotify_event*>(data);
+                data += sizeof(inotify_event) + event->len;
+                handle(*event);
+            }
+        }
+    }
+
+    void handle(const inotify_event& event)
+    {
+        if (event.mask & IN_Q_OVERFLOW) {
+            reset();
+            return;
+        }
+        auto directory = m_directories.find(event.wd);
+        if (directory == m_directories.end()) {
+            return;
+        }
+        if (event.mask & IN_IGNORED) {
+            m_directories.erase(directory);
+            return;
+        }
+        if (event.len == 0) {
+            // the directory itself was deleted or moved
+            if (directory->second.empty()) {
+                reset();
+            }
+            else {
+                record(directory->second);
+            }
+            return;
+        }
+
+        std::string_view name = event.name;
+        if (directory->second.empty() && name == ".git") {
+            return;
+        }
+        auto path = join(directory->second, name);
+        if (event.mask & IN_ISDIR) {
+            if (event.mask & IN_MOVED_FROM) {
+                unwatch(path);
+            }
+            else if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+                // files created before the watch are covered by the
+                // directory's path
+                watch(path);
+            }
+        }
+        record(std::move(path));
+    }
+
+    // Returns false when asked to quit.
+    bool answer(int client)
+    {
+        auto request = receive(client, '\n');
+        if (!request) {
+            return true;
+        }
+        auto token = std::string_view(*request).substr(0, request->find('\n'));
+        if (token == QUIT) {
+            return false;
+        }
+
+        // events of changes made before the question are in the queue
+        // already
+        readEvents();
+        std::string response = this->token();
+        response += '\0';
+        auto separator = token.rfind(':');
+        uint64_t sequence = 0;
+        bool known = separator != std::string_view::npos &&
+                     token.substr(0, separator) == m_instance;
+        if (known) {
+            auto number = token.substr(separator + 1);
+            auto [end, error] = std::from_chars(
+                number.data(), number.data() + number.size(), sequence);
+            known = error == std::errc() &&
+                    end == number.data() + number.size() &&
+                    sequence + 1 >= m_firstKept && sequence <= m_sequence;
+        }
+        if (!known || !m_unwatched.empty()) {
+            response += EVERYTHING;
+            response += '\0';
+        }
+        else {
+            std::vector<std::string_view> paths(
+                m_events.begin() + (sequence + 1 - m_firstKept),
+                m_events.end());
+            std::sort(paths.begin(), paths.end());
+            paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+            for (auto path : paths) {
+                response += path;
+                response += '\0';
+            }
+        }
+        sendAll(client, response);
+        return true;
+    }
+
+  private:
+    std::filesystem::path m_workTree;
+    FileDescriptor m_inotify;
+    // watch descriptor to the directory it watches, relative to the worktree
+    std::unordered_map<int, std::string> m_directories;
+    std::string m_instance;
+    uint64_t m_sequence = 0;
+    // sequence number of m_events.front()
+    uint64_t m_firstKept = 1;
+    std::deque<std::string> m_events;
+    // the first directory without a watch, and why
+    std::string m_unwatched;
+    int m_watchError = 0;
+};
+}; // namespace
+
+namespace Git {
+bool GitFSMonitor::Changes::contains(std::string_view path) const
+{
+    if (everything) {
+        return true;
+    }
+    auto changed = [&](std::string_view candidate) {
+        return std::binary_search(paths.begin(), paths.end(), candidate);
+    };
+    if (changed(path)) {
+        return true;
+    }
+    for (auto slash = path.find('/'); slash != std::string_view::npos;
+         slash = path.find('/', slash + 1)) {
+        if (changed(path.substr(0, slash))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool GitFSMonitor::isEnabled()
+{
+    return GitRepository::configBool("core.fsmonitor", false);
+}
+
+std::filesystem::path GitFSMonitor::socketPath()
+{
+    return std::filesystem::absolute(GitRepository::repoPath("fsmonitor.ipc"));
+}
+
+std::optional<GitFSMonitor::Changes>
+GitFSMonitor::query(const std::string& token)
+{
+    FileDescriptor monitor(connectToMonitor());
+    if (monitor.get() < 0 || !sendAll(monitor.get(), token + '\n')) {
+        return std::nullopt;
+    }
+    auto response = receive(monitor.get());
+    if (!response) {
+        return std::nullopt;
+    }
+    auto tokenEnd = response->find('\0');
+    if (tokenEnd == std::string::npos) {
+        return std::nullopt;
+    }
+
+    Changes changes{.token = response->substr(0, tokenEnd),
+                    .paths = {},
+                    .everything = false};
+    for (auto start = tokenEnd + 1; start < response->size();) {
+        auto end = response->find('\0', start);
+        if (end == std::string::npos) {
+            return std::nullopt;
+        }
+        changes.paths.push_back(response->substr(start, end - start));
+        start = end + 1;
+    }
+    if (changes.paths.size() == 1 && changes.paths[0] == EVERYTHING) {
+        changes.paths.clear();
+        changes.everything = true;
+    }
+    std::sort(changes.paths.begin(), changes.paths.end());
+    return changes;
+}
+
+bool GitFSMonitor::isRunning()
+{
+    FileDescriptor monitor(connectToMonitor());
+    return monitor.get() >= 0;
+}
+
+void GitFSMonitor::run()
+{
+    auto workTree =
+        std::filesystem::absolute(GitRepository::findRoot().workTree());
+    auto socket = socketPath();
+    if (isRunning()) {
+        GENERATE_EXCEPTION("A filesystem monitor already runs for {}",
+                           workTree.string());
+    }
+    // left by a monitor that was killed
+    std::filesystem::remove(socket);
+
+    // the worktree is watched before anyone can ask, a monitor that can't
+    // watch all of it never listens
+    Monitor monitor(workTree);
+    auto address = socketAddress(socket);
+    FileDescriptor listener(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (listener.get() < 0 ||
+        ::bind(listener.get(), reinterpret_cast<sockaddr*>(&address),
+               sizeof(address)) != 0 ||
+        ::listen(listener.get(), SOMAXCONN) != 0) {
+        GENERATE_EXCEPTION("Unable to listen on {}", socket.string());
+    }
+
+    try {
+        monitor.run(listener.get());
+    }
+    catch (...) {
+        std::filesystem::remove(socket);
+        throw;
+    }
+    std::filesystem::remove(socket);
+}
+
+void GitFSMonitor::start()
+{
+    if (isRunning()) {
+        GENERATE_EXCEPTION("A filesystem monitor already runs for {}",
+                           GitRepository::findRoot().workTree().string());
+    }
+
+    // the daemon is forked twice, so it isn't a child of anyone waiting
+    auto child = ::fork();
+    if (child < 0) {
+        GENERATE_EXCEPTION("{}", "Unable to start the filesystem monitor");
+    }
+    if (child == 0) {
+        ::setsid();
+        if (::fork() != 0) {
+            ::_exit(EXIT_SUCCESS);
+        }
+        int null = ::open("/dev/null", O_RDWR);
+        for (int fd : {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO}) {
+            ::dup2(null, fd);
+        }
+        try {
+            run();
+        }
+        catch (...) {
+            ::_exit(EXIT_FAILURE);
+        }
+        ::_exit(EXIT_SUCCESS);
+    }
+    ::waitpid(child, nullptr, 0);
+
+    using namespace std::chrono_literals;
+    auto deadline = std::chrono::steady_clock::now() + 10s;
+    while (!isRunning()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            GENERATE_EXCEPTION("{}", "The filesystem monitor didn't start");
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+}
+
+void GitFSMonitor::stop()
+{
+    FileDescriptor monitor(connectToMonitor());
+    if (monitor.get() < 0) {
+        GENERATE_EXCEPTION("No filesystem monitor runs for {}",
+                           GitRepository::findRoot().workTree().string());
+    }
+    sendAll(monitor.get(), std::string(QUIT) + '\n');
+    receive(monitor.get());
+
+    using namespace std::chrono_literals;
+    auto deadline = std::chrono::steady_clock::now() + 10s;
+    while (isRunning() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(10ms);
+    }
+}
+}; // namespace Git
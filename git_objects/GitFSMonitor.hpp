@@ -0,0 +1,52 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Git {
+/*
+    Filesystem monitor: a daemon that watches the worktree with inotify and
+    tells which paths changed since a token it handed out before, so the
+    index entries of files that didn't change don't have to be stat'ed.
+    Commands ask it over a Unix socket in the repository:
+        request:  |token||\n|
+        response: |new token||0||path||0||path||0|...
+    A token the daemon can't answer for, e.g. one of a previous daemon or an
+    empty one, gets the single path "/", which means anything may have
+    changed. A changed directory stands for everything inside of it.
+*/
+class GitFSMonitor {
+  public:
+    struct Changes {
+        // token to ask with next time
+        std::string token;
+        // sorted, paths are relative to the worktree
+        std::vector<std::string> paths;
+        bool everything = false;
+
+        // Whether the file at path or a directory containing it changed.
+        bool contains(std::string_view path) const;
+    };
+
+  public:
+    // core.fsmonitor, commands ask the monitor only when it is set.
+    static bool isEnabled();
+    // Empty if no monitor runs for the repository or it didn't answer.
+    static std::optional<Changes> query(const std::string& token);
+
+    // Watches the worktree until stop() is called, throws if a monitor
+    // already runs.
+    static void run();
+    // Runs the monitor in a background process, returns once it answers.
+    static void start();
+    static void stop();
+    static bool isRunning();
+
+    static std::filesystem::path socketPath();
+};
+}; // namespace Git
+
+using GitFSMonitor = Git::GitFSMonitor;
@@ -1,9 +1,95 @@
 #include "GitHash.hpp"
+#include "../utilities/Common.hpp"
 
 #include <assert.h>
-#include <iomanip>
 #include <iostream>
-#include <sstream>
+#include <type_traits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+static_assert(std::is_trivially_copyable_v<Git::GitHash>);
+static_assert(sizeof(Git::GitHash) == Git::BinaryHash::SIZE);
+
+constexpr int8_t INVALID_DIGIT = -1;
+
+constexpr auto DECODE_TABLE = [] {
+    std::array<int8_t, 256> table{};
+    table.fill(INVALID_DIGIT);
+    for (int digit = 0; digit < 10; ++digit) {
+        table['0' + digit] = digit;
+    }
+    for (int digit = 0; digit < 6; ++digit) {
+        table['a' + digit] = 10 + digit;
+        table['A' + digit] = 10 + digit;
+    }
+    return table;
+}();
+
+// Both digits of every byte value, so encoding is one lookup per byte.
+constexpr auto ENCODE_TABLE = [] {
+    constexpr std::string_view hexDigits = "0123456789abcdef";
+    std::array<std::array<char, 2>, 256> table{};
+    for (int byte = 0; byte < 256; ++byte) {
+        table[byte] = {hexDigits[byte >> 4], hexDigits[byte & 0xf]};
+    }
+    return table;
+}();
+
+constexpr bool decode(std::string_view hex, unsigned char* bytes)
+{
+    if (hex.size() != Git::GitHash::READABLE_HASH_SIZE) {
+        return false;
+    }
+    int8_t invalid = 0;
+    for (size_t i = 0; i < Git::BinaryHash::SIZE; ++i) {
+        auto high = DECODE_TABLE[static_cast<unsigned char>(hex[i * 2])];
+        auto low = DECODE_TABLE[static_cast<unsigned char>(hex[i * 2 + 1])];
+        // checked once at the end, invalid digits have every bit set
+        invalid |= high | low;
+        bytes[i] = static_cast<unsigned char>((high << 4) | low);
+    }
+    return invalid >= 0;
+}
+
+static_assert([] {
+    unsigned char bytes[Git::BinaryHash::SIZE]{};
+    return decode("00ff10aB000000000000000000000000000000c9", bytes) &&
+           bytes[1] == 0xff && bytes[3] == 0xab && bytes[19] == 0xc9 &&
+           !decode("g000000000000000000000000000000000000000", bytes);
+}());
+
+void encode(const unsigned char* bytes, char* hex)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    // digit = nibble + '0', plus the distance to 'a' for nibbles above 9
+    auto input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+    auto lowMask = _mm_set1_epi8(0x0f);
+    auto high = _mm_and_si128(_mm_srli_epi16(input, 4), lowMask);
+    auto low = _mm_and_si128(input, lowMask);
+    auto toDigits = [](__m128i nibbles) {
+        auto letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                                     _mm_set1_epi8('a' - '0' - 10));
+        return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')),
+                            letters);
+    };
+    auto highDigits = toDigits(high);
+    auto lowDigits = toDigits(low);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(hex),
+                     _mm_unpacklo_epi8(highDigits, lowDigits));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(hex + 16),
+                     _mm_unpackhi_epi8(highDigits, lowDigits));
+    i = 16;
+#endif
+    for (; i < Git::BinaryHash::SIZE; ++i) {
+        hex[i * 2] = ENCODE_TABLE[bytes[i]][0];
+        hex[i * 2 + 1] = ENCODE_TABLE[bytes[i]][1];
+    }
+}
+}; // namespace
 
 namespace Git {
 
@@ -16,48 +102,58 @@ const std::string& BinaryHash::data() const { return m_data; }
 
 BinaryHash GitHash::convertToBinary(const GitHash& hash)
 {
-    std::string res;
-    res.reserve(BinaryHash::SIZE);
-    auto& data = hash.data();
-    for (int blobIndex = 0; blobIndex < data.size(); blobIndex += 2) {
-        uint8_t blob = std::stoi(data.substr(blobIndex, 2), nullptr, 16);
-        res.push_back(blob);
+    return BinaryHash(std::string(hash.bytes()));
+}
+
+GitHash::GitHash(std::string_view hash)
+{
+    if (!decode(hash, m_bytes.data())) {
+        GENERATE_EXCEPTION("Not a valid object name: {}", hash);
     }
-    return BinaryHash(res);
 }
 
-GitHash convertFromBinary(const BinaryHash& hash)
+GitHash::GitHash(const BinaryHash& hash)
+    : GitHash(fromBytes(hash.data().data()))
 {
-    auto& data = hash.data();
-    assert(data.size() == BinaryHash::SIZE);
-    std::ostringstream oss;
-    oss << std::hex;
-    for (int blobIndex = 0; blobIndex < data.size(); blobIndex += 1) {
-        oss << std::setw(2) << std::setfill('0')
-            << ((uint16_t)data[blobIndex] & 0xff);
+}
+
+GitHash GitHash::fromBytes(const void* bytes)
+{
+    GitHash hash;
+    std::memcpy(hash.m_bytes.data(), bytes, BinaryHash::SIZE);
+    return hash;
+}
+
+std::optional<GitHash> GitHash::fromHex(std::string_view hash)
+{
+    GitHash result;
+    if (!decode(hash, result.m_bytes.data())) {
+        return std::nullopt;
     }
-    return GitHash(oss.str());
+    return result;
 }
 
-GitHash::GitHash(const std::string& hash) : m_data(hash)
+std::string GitHash::data() const
 {
-    assert(m_data.size() == READABLE_HASH_SIZE);
+    std::string hex(READABLE_HASH_SIZE, '\0');
+    toHex(hex.data());
+    return hex;
 }
 
-GitHash::GitHash(const BinaryHash& hash)
-    : m_data(convertFromBinary(hash).data())
+void GitHash::toHex(char* destination) const
 {
+    encode(m_bytes.data(), destination);
 }
 
-const std::string& GitHash::data() const { return m_data; }
-std::string& GitHash::data() { return m_data; }
-std::ostream& operator<<(std::ostream& stream, GitHash hash)
+std::string_view GitHash::bytes() const
 {
-    stream << hash.data();
-    return stream;
+    return {reinterpret_cast<const char*>(m_bytes.data()), m_bytes.size()};
 }
-bool operator==(const GitHash& lhs, const GitHash& rhs)
+
+std::ostream& operator<<(std::ostream& stream, const GitHash& hash)
 {
-    return lhs.data() == rhs.data();
+    char hex[GitHash::READABLE_HASH_SIZE];
+    hash.toHex(hex);
+    return stream.write(hex, sizeof(hex));
 }
-}; // namespace Git
\ No newline at end of file
+}; // namespace Git
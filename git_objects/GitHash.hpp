@@ -1,7 +1,12 @@
 #pragma once
 
-#include <bitset>
+#include <array>
+#include <compare>
+#include <cstring>
+#include <fmt/core.h>
+#include <optional>
 #include <string>
+#include <string_view>
 
 namespace Git {
 
@@ -17,27 +22,67 @@ class BinaryHash {
     std::string m_data;
 };
 
+// SHA1 of an object, kept as its 20 raw bytes. The hexadecimal form is only
+// produced when asked for, so hashes can be copied, compared and used as keys
+// without allocating.
 class GitHash {
   public:
-    explicit GitHash(const std::string& hash);
+    static constexpr uint8_t READABLE_HASH_SIZE = 40;
+
+    // All zeros, like git's null hash.
+    GitHash() = default;
+    explicit GitHash(std::string_view hash);
     explicit GitHash(const BinaryHash& hash);
 
+    static GitHash fromBytes(const void* bytes);
+    // Doesn't throw, for names that may or may not be a hash.
+    static std::optional<GitHash> fromHex(std::string_view hash);
+
     // Converts 40 bytes string representation of SHA1 hash to 20 bytes binary
     // representation
     static BinaryHash convertToBinary(const GitHash& hash);
 
-    const std::string& data() const;
-    std::string& data();
+    // 40 bytes hexadecimal representation.
+    std::string data() const;
+    // Writes the 40 hexadecimal digits, without a terminating zero.
+    void toHex(char* destination) const;
+    std::string_view bytes() const;
 
-  private:
-    std::string m_data;
+    auto operator<=>(const GitHash&) const = default;
+    bool operator==(const GitHash&) const = default;
 
   private:
-    static constexpr uint8_t READABLE_HASH_SIZE = 40;
+    std::array<unsigned char, BinaryHash::SIZE> m_bytes{};
 };
 
-std::ostream& operator<<(std::ostream& stream, GitHash hash);
-bool operator==(const GitHash& lhs, const GitHash& rhs);
+std::ostream& operator<<(std::ostream& stream, const GitHash& hash);
 }; // namespace Git
 
-using GitHash = Git::GitHash;
\ No newline at end of file
+template <>
+struct std::hash<Git::GitHash> {
+    // SHA1 is uniformly distributed, any of its bytes make a good hash.
+    size_t operator()(const Git::GitHash& hash) const noexcept
+    {
+        size_t value;
+        std::memcpy(&value, hash.bytes().data(), sizeof(value));
+        return value;
+    }
+};
+
+template <>
+struct fmt::formatter<Git::GitHash> {
+    constexpr auto parse(format_parse_context& context)
+    {
+        return context.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(const Git::GitHash& hash, FormatContext& context) const
+    {
+        char hex[Git::GitHash::READABLE_HASH_SIZE];
+        hash.toHex(hex);
+        return std::copy(std::begin(hex), std::end(hex), context.out());
+    }
+};
+
+using GitHash = Git::GitHash;
@@ -0,0 +1,342 @@
+#include "GitIgnore.hpp"
+#include "../utilities/Common.hpp"
+
+#include <optional>
+
+namespace {
+constexpr std::string_view GLOB_CHARACTERS = "*?[\\";
+
+// Whether text from t on matches pattern from p on, the way git's wildmatch
+// does. With pathname, '*', '?' and classes don't match '/', but "**"
+// between slashes matches any number of directories. Named classes like
+// [:alpha:] aren't supported.
+bool wildmatch(std::string_view pattern, size_t p, std::string_view text,
+               size_t t, bool pathname)
+{
+    for (; p < pattern.size(); ++p) {
+        switch (pattern[p]) {
+        case '?':
+            if (t == text.size() || (pathname && text[t] == '/')) {
+                return false;
+            }
+            ++t;
+            break;
+        case '*': {
+            auto stars = p;
+            while (p < pattern.size() && pattern[p] == '*') {
+                ++p;
+            }
+            bool anyDepth = pathname && p - stars >= 2 &&
+                            (stars == 0 || pattern[stars - 1] == '/') &&
+                            (p == pattern.size() || pattern[p] == '/');
+            if (anyDepth) {
+                // "/**" at the end matches everything inside
+                if (p == pattern.size()) {
+                    return true;
+                }
+                // "**/" matches no directory or any number of them
+                for (auto from = t;;) {
+                    if (wildmatch(pattern, p + 1, text, from, pathname)) {
+                        return true;
+                    }
+                    auto slash = text.find('/', from);
+                    if (slash == std::string_view::npos) {
+                        return false;
+                    }
+                    from = slash + 1;
+                }
+            }
+            if (p == pattern.size()) {
+                return !pathname ||
+                       text.find('/', t) == std::string_view::npos;
+            }
+            for (auto from = t; from <= text.size(); ++from) {
+                if (wildmatch(pattern, p, text, from, pathname)) {
+                    return true;
+                }
+                if (from < text.size() && pathname && text[from] == '/') {
+                    return false;
+                }
+            }
+            return false;
+        }
+        case '[': {
+            if (t == text.size() || (pathname && text[t] == '/')) {
+                return false;
+            }
+            auto character = static_cast<unsigned char>(text[t]);
+            auto q = p + 1;
+            bool negated =
+                q < pattern.size() && (pattern[q] == '!' || pattern[q] == '^');
+            if (negated) {
+                ++q;
+            }
+            bool matched = false;
+            // a ']' right after the '[' is part of the class
+            for (bool first = true;
+                 q < pattern.size() && (first || pattern[q] != ']');
+                 first = false, ++q) {
+                if (pattern[q] == '\\' && q + 1 < pattern.size()) {
+                    ++q;
+                }
+                auto low = static_cast<unsigned char>(pattern[q]);
+                auto high = low;
+                if (q + 2 < pattern.size() && pattern[q + 1] == '-' &&
+                    pattern[q + 2] != ']') {
+                    q += 2;
+                    if (pattern[q] == '\\' && q + 1 < pattern.size()) {
+                        ++q;
+                    }
+                    high = static_cast<unsigned char>(pattern[q]);
+                }
+                matched = matched || (low <= character && character <= high);
+            }
+            // without its ']' the '[' is an ordinary character
+            if (q == pattern.size()) {
+                if (text[t] != '[') {
+                    return false;
+                }
+                ++t;
+                break;
+            }
+            if (matched == negated) {
+                return false;
+            }
+            p = q;
+            ++t;
+            break;
+        }
+        case '\\':
+            if (p + 1 < pattern.size()) {
+                ++p;
+            }
+            [[fallthrough]];
+        default:
+            if (t == text.size() || text[t] != pattern[p]) {
+                return false;
+            }
+            ++t;
+        }
+    }
+    return t == text.size();
+}
+}; // namespace
+
+namespace Git {
+GitIgnore::GitIgnore(std::filesystem::path workTree)
+    : m_workTree(std::move(workTree))
+{
+    auto exclude = m_workTree / ".git" / "info" / "exclude";
+    if (std::filesystem::is_regular_file(exclude)) {
+        parse(Utilities::readFile(exclude), m_excludes);
+    }
+}
+
+void GitIgnore::addPatterns(std::string_view text,
+                            const std::string& directory)
+{
+    patternsOf(directory);
+    std::lock_guard lock(m_mutex);
+    parse(text, m_patterns.find(directory)->second);
+}
+
+void GitIgnore::parse(std::string_view text, std::vector<Pattern>& patterns)
+{
+    while (!text.empty()) {
+        auto end = text.find('\n');
+        auto line = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size()
+                                                         : end + 1);
+        if (line.ends_with('\r')) {
+            line.remove_suffix(1);
+        }
+        // trailing spaces are dropped, unless they are escaped
+        while (line.ends_with(' ') && !line.ends_with("\\ ")) {
+            line.remove_suffix(1);
+        }
+        if (line.empty() || line.front() == '#') {
+            continue;
+        }
+
+        Pattern pattern;
+        if (line.front() == '!') {
+            pattern.negated = true;
+            line.remove_prefix(1);
+        }
+        if (line.ends_with('/')) {
+            pattern.directoryOnly = true;
+            line.remove_suffix(1);
+        }
+        pattern.matchesPath = line.find('/') != std::string_view::npos;
+        if (line.starts_with('/')) {
+            line.remove_prefix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        auto special = line.find_first_of(GLOB_CHARACTERS);
+        if (special == std::string_view::npos) {
+            pattern.kind = Pattern::Kind::LITERAL;
+        }
+        else if (special == line.size() - 1 && line.back() == '*') {
+            pattern.kind = Pattern::Kind::PREFIX;
+            line.remove_suffix(1);
+        }
+        else if (special == 0 && line.front() == '*' &&
+                 line.find_first_of(GLOB_CHARACTERS, 1) ==
+                     std::string_view::npos) {
+            pattern.kind = Pattern::Kind::SUFFIX;
+            line.remove_prefix(1);
+        }
+        else {
+            pattern.kind = Pattern::Kind::GLOB;
+        }
+        pattern.text = line;
+        patterns.push_back(std::move(pattern));
+    }
+}
+
+bool GitIgnore::Pattern::matches(std::string_view path, std::string_view name,
+                                 bool isDirectory) const
+{
+    if (directoryOnly && !isDirectory) {
+        return false;
+    }
+    auto subject = matchesPath ? path : name;
+    // the '*' of a prefix or a suffix doesn't match a '/' either
+    auto noSlash = [&](std::string_view rest) {
+        return !matchesPath || rest.find('/') == std::string_view::npos;
+    };
+    switch (kind) {
+    case Kind::LITERAL:
+        return subject == text;
+    case Kind::PREFIX:
+        return subject.starts_with(text) &&
+               noSlash(subject.substr(text.size()));
+    case Kind::SUFFIX:
+        return subject.ends_with(text) &&
+               noSlash(subject.substr(0, subject.size() - text.size()));
+    case Kind::GLOB:
+        return wildmatch(text, 0, subject, 0, matchesPath);
+    }
+    return false;
+}
+
+const std::vector<GitIgnore::Pattern>&
+GitIgnore::patternsOf(std::string_view directory)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        auto found = m_patterns.find(directory);
+        if (found != m_patterns.end()) {
+            return found->second;
+        }
+    }
+    std::vector<Pattern> patterns;
+    auto file = m_workTree / directory / ".gitignore";
+    if (std::filesystem::is_regular_file(file)) {
+        parse(Utilities::readFile(file), patterns);
+    }
+    // another thread may have loaded it meanwhile, its patterns are kept
+    std::lock_guard lock(m_mutex);
+    return m_patterns.try_emplace(std::string(directory), std::move(patterns))
+        .first->second;
+}
+
+void GitIgnore::pushLevel(std::string_view directory,
+                          std::vector<Level>& levels)
+{
+    const auto& patterns = patternsOf(directory);
+    if (!patterns.empty()) {
+        levels.push_back(
+            {.baseLength = directory.empty() ? 0 : directory.size() + 1,
+             .patterns = &patterns});
+    }
+}
+
+bool GitIgnore::descend(std::string_view path, std::vector<Level>& levels)
+{
+    pushLevel("", levels);
+    for (auto slash = path.find('/'); slash != std::string_view::npos;
+         slash = path.find('/', slash + 1)) {
+        auto directory = path.substr(0, slash);
+        if (isMatched(directory, true, levels)) {
+            return false;
+        }
+        pushLevel(directory, levels);
+    }
+    return true;
+}
+
+bool GitIgnore::isMatched(std::string_view path, bool isDirectory,
+                          const std::vector<Level>& levels) const
+{
+    auto slash = path.rfind('/');
+    auto name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+    auto decide = [&](const std::vector<Pattern>& patterns,
+                      std::string_view relative) -> std::optional<bool> {
+        for (auto it = patterns.rbegin(); it != patterns.rend(); ++it) {
+            if (it->matches(relative, name, isDirectory)) {
+                return !it->negated;
+            }
+        }
+        return std::nullopt;
+    };
+    for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+        if (auto ignored =
+                decide(*level->patterns, path.substr(level->baseLength))) {
+            return *ignored;
+        }
+    }
+    return decide(m_excludes, path).value_or(false);
+}
+
+bool GitIgnore::isIgnored(std::string_view path, bool isDirectory)
+{
+    std::vector<Level> levels;
+    return !descend(path, levels) || isMatched(path, isDirectory, levels);
+}
+
+void GitIgnore::walk(const std::string& directory, const Visitor& visit)
+{
+    std::vector<Level> levels;
+    if (!directory.empty() && (!descend(directory, levels) ||
+                               isMatched(directory, true, levels))) {
+        return;
+    }
+    walkDirectory(directory, levels, visit);
+}
+
+void GitIgnore::walkDirectory(const std::string& directory,
+                              std::vector<Level>& levels, const Visitor& visit)
+{
+    auto depth = levels.size();
+    pushLevel(directory, levels);
+    auto prefix = directory.empty() ? directory : directory + '/';
+    std::string path;
+    // the type comes with the directory listing, nothing is stat'ed
+    for (const auto& entry :
+         std::filesystem::directory_iterator(m_workTree / directory)) {
+        bool isSymlink = entry.is_symlink();
+        bool isDirectory = !isSymlink && entry.is_directory();
+        if (!isSymlink && !isDirectory && !entry.is_regular_file()) {
+            continue;
+        }
+        const auto& fullPath = entry.path().native();
+        auto name =
+            std::string_view(fullPath).substr(fullPath.rfind('/') + 1);
+        if (name == ".git") {
+            continue;
+        }
+        path.assign(prefix).append(name);
+        if (isMatched(path, isDirectory, levels)) {
+            continue;
+        }
+        if (visit(path, isDirectory) && isDirectory) {
+            walkDirectory(path, levels, visit);
+        }
+    }
+    levels.resize(depth);
+}
+}; // namespace Git
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Git {
+/*
+    Patterns of the .gitignore files and of .git/info/exclude, they tell which
+    untracked files add, commit, status and checkout leave alone. Patterns are
+    compiled when their file is loaded: most of them are a name, a prefix or a
+    suffix like "*.o", which are compared as they are, only the others go
+    through the glob matcher. Like in git, the last pattern that matches a
+    path decides, patterns of a deeper .gitignore come before those of its
+    parents, and a file can't be included again once a directory containing it
+    is ignored.
+    The .gitignore of a directory is loaded when a path inside of it is first
+    looked at. Loading is guarded, so threads can share the patterns.
+*/
+class GitIgnore {
+  public:
+    // Paths are relative to the worktree, the worktree itself is "".
+    using Visitor = std::function<bool(const std::string& path,
+                                       bool isDirectory)>;
+
+  public:
+    explicit GitIgnore(std::filesystem::path workTree);
+
+    bool isIgnored(std::string_view path, bool isDirectory);
+    // Adds patterns the way a .gitignore in directory has them.
+    void addPatterns(std::string_view text, const std::string& directory);
+
+    // Calls visit for every regular file, symbolic link and directory under
+    // directory that isn't ignored, in no particular order. A directory is
+    // only entered if visit returns true for it, .git never is.
+    void walk(const std::string& directory, const Visitor& visit);
+
+  private:
+    struct Pattern {
+        enum class Kind { LITERAL, PREFIX, SUFFIX, GLOB };
+
+        // without the leading '!' and '/' and the trailing '/', only the
+        // part around the '*' for PREFIX and SUFFIX
+        std::string text;
+        Kind kind = Kind::LITERAL;
+        bool negated = false;
+        bool directoryOnly = false;
+        // a pattern with a '/' matches the path relative to the directory of
+        // its .gitignore, the others match the name of the file
+        bool matchesPath = false;
+
+        bool matches(std::string_view path, std::string_view name,
+                     bool isDirectory) const;
+    };
+
+    // Patterns of a .gitignore, paths they match are relative to it.
+    struct Level {
+        size_t baseLength;
+        const std::vector<Pattern>* patterns;
+    };
+
+    static void parse(std::string_view text, std::vector<Pattern>& patterns);
+    const std::vector<Pattern>& patternsOf(std::string_view directory);
+    void pushLevel(std::string_view directory, std::vector<Level>& levels);
+    // Pushes the levels of the directories leading to path, false if one of
+    // them is ignored.
+    bool descend(std::string_view path, std::vector<Level>& levels);
+    bool isMatched(std::string_view path, bool isDirectory,
+                   const std::vector<Level>& levels) const;
+    void walkDirectory(const std::string& directory,
+                       std::vector<Level>& levels, const Visitor& visit);
+
+  private:
+    std::filesystem::path m_workTree;
+    // .git/info/exclude, below every .gitignore
+    std::vector<Pattern> m_excludes;
+    std::map<std::string, std::vector<Pattern>, std::less<>> m_patterns;
+    std::mutex m_mutex;
+};
+}; // namespace Git
+
+using GitIgnore = Git::GitIgnore;
@@ -1,113 +1,895 @@
 #include "GitIndex.hpp"
 #include "../utilities/Common.hpp"
+#include "../utilities/MappedFile.hpp"
+#include "../utilities/SHA1.hpp"
+#include "../utilities/TemporaryFile.hpp"
+#include "../utilities/ThreadPool.hpp"
 
-#include <cmath>
-#include <fstream>
-#include <iostream>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <ctime>
+#include <future>
+#include <endian.h>
+#include <sys/stat.h>
 
 namespace {
-using OneByte = uint8_t;
-using TwoBytes = uint16_t;
-using FourBytes = uint32_t;
-using EightBytes = uint64_t;
+constexpr std::string_view SIGNATURE = "DIRC";
+constexpr size_t HEADER_SIZE = 12;
+// stats, hash and flags, everything before the path
+constexpr size_t ENTRY_FIXED_SIZE = 10 * 4 + Git::BinaryHash::SIZE + 2;
+constexpr size_t EXTENSION_HEADER_SIZE = 8;
+constexpr std::string_view FSMONITOR_SIGNATURE = "FSMN";
+constexpr std::string_view OFFSET_TABLE_SIGNATURE = "IEOT";
+constexpr std::string_view END_OF_ENTRIES_SIGNATURE = "EOIE";
+constexpr size_t END_OF_ENTRIES_SIZE =
+    EXTENSION_HEADER_SIZE + 4 + Git::BinaryHash::SIZE;
+// indexes of fewer entries are decoded faster than threads start
+constexpr size_t ENTRIES_PER_BLOCK = 10000;
 
-template <class T> T convert(T bigEndian)
+uint16_t readBigEndian16(const char* data)
 {
-    T numberOfBytes = sizeof(T);
-    T res = 0;
-    char* data = reinterpret_cast<char*>(&bigEndian);
-    for (int i = numberOfBytes - 1, byte = 0; i > 0; --i, ++byte) {
-        res |= (data[i] << i * byte);
+    uint16_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return be16toh(value);
+}
+
+uint32_t readBigEndian32(const char* data)
+{
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return be32toh(value);
+}
+
+void writeBigEndian16(std::string& data, uint16_t value)
+{
+    value = htobe16(value);
+    data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void writeBigEndian32(std::string& data, uint32_t value)
+{
+    value = htobe32(value);
+    data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Inverse of readVarint.
+void writeVarint(std::string& data, size_t value)
+{
+    char bytes[16];
+    size_t position = sizeof(bytes) - 1;
+    bytes[position] = static_cast<char>(value & 0x7f);
+    while (value >>= 7) {
+        bytes[--position] = static_cast<char>(0x80 | (--value & 0x7f));
     }
-    res |= (unsigned)(data[0] << (numberOfBytes - 1) * 8);
-    return res;
+    data.append(bytes + position, sizeof(bytes) - position);
 }
 
-template <class T> T read(std::fstream& ifs)
+uint64_t readBigEndian64(const char* data)
 {
-    T res;
-    ifs.read(reinterpret_cast<char*>(&res), sizeof(T));
-    return res;
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return be64toh(value);
+}
+
+void writeBigEndian64(std::string& data, uint64_t value)
+{
+    value = htobe64(value);
+    data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/*
+    EWAH compressed bitmap, the way git stores the dirty entries of FSMN:
+        |4 bytes number of bits||4 bytes number of words||words...|
+        |4 bytes position of the last marker word|
+    Words are 64 bits. A marker word tells how many words of only 0 or only
+    1 bits follow, then how many words are stored as they are:
+        |31 bits literal words||32 bits running words||1 bit running bit|
+*/
+std::vector<bool> readEwah(std::string_view data, size_t numberOfBits)
+{
+    constexpr size_t HEADER_SIZE = 8;
+    if (data.size() < HEADER_SIZE) {
+        GENERATE_EXCEPTION("{}", "truncated bitmap");
+    }
+    auto bitSize = readBigEndian32(data.data());
+    auto numberOfWords = readBigEndian32(data.data() + 4);
+    if (bitSize > numberOfBits ||
+        (data.size() - HEADER_SIZE) / 8 < numberOfWords) {
+        GENERATE_EXCEPTION("{}", "malformed bitmap");
+    }
+
+    std::vector<bool> bits(numberOfBits);
+    auto setBit = [&](size_t bit) {
+        if (bit >= bitSize) {
+            GENERATE_EXCEPTION("{}", "malformed bitmap");
+        }
+        bits[bit] = true;
+    };
+    size_t bit = 0;
+    for (size_t word = 0; word < numberOfWords;) {
+        auto marker = readBigEndian64(data.data() + HEADER_SIZE + word++ * 8);
+        auto runningWords = (marker >> 1) & 0xffffffff;
+        auto literalWords = marker >> 33;
+        if (marker & 1) {
+            for (size_t i = 0; i < runningWords * 64; ++i) {
+                setBit(bit + i);
+            }
+        }
+        bit += runningWords * 64;
+        for (size_t i = 0; i < literalWords && word < numberOfWords; ++i) {
+            auto literal =
+                readBigEndian64(data.data() + HEADER_SIZE + word++ * 8);
+            for (; literal != 0; literal &= literal - 1) {
+                setBit(bit + std::countr_zero(literal));
+            }
+            bit += 64;
+        }
+    }
+    return bits;
 }
 
-uint16_t read2(std::fstream& ifs) { return read<uint16_t>(ifs); }
+// Runs of 0 words are compressed, everything else is stored literally.
+void writeEwah(std::string& data, const std::vector<bool>& bits)
+{
+    size_t bitSize = bits.size();
+    while (bitSize > 0 && !bits[bitSize - 1]) {
+        --bitSize;
+    }
+    std::vector<uint64_t> words((bitSize + 63) / 64);
+    for (size_t bit = 0; bit < bitSize; ++bit) {
+        if (bits[bit]) {
+            words[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+    }
 
-uint32_t read4(std::fstream& ifs) { return read<uint32_t>(ifs); }
+    std::vector<uint64_t> encoded;
+    size_t lastMarker = 0;
+    size_t word = 0;
+    do {
+        uint64_t runningWords = 0;
+        for (; word < words.size() && words[word] == 0; ++word) {
+            ++runningWords;
+        }
+        auto literalStart = word;
+        for (; word < words.size() && words[word] != 0; ++word) {
+        }
+        lastMarker = encoded.size();
+        encoded.push_back((runningWords << 1) |
+                          (uint64_t(word - literalStart) << 33));
+        encoded.insert(encoded.end(), words.begin() + literalStart,
+                       words.begin() + word);
+    } while (word < words.size());
 
-uint64_t read8(std::fstream& ifs) { return read<uint64_t>(ifs); }
+    writeBigEndian32(data, static_cast<uint32_t>(bitSize));
+    writeBigEndian32(data, static_cast<uint32_t>(encoded.size()));
+    for (auto value : encoded) {
+        writeBigEndian64(data, value);
+    }
+    writeBigEndian32(data, static_cast<uint32_t>(lastMarker));
+}
 
-std::string readString(std::fstream& ifs, size_t stringSize)
+[[noreturn]] void corrupted(std::string_view reason)
 {
-    std::string res(stringSize, '\0');
-    ifs.read(&res[0], stringSize);
-    return res;
+    GENERATE_EXCEPTION("Corrupted index file: {}", reason);
 }
 
-std::string readStringUntilZero(std::fstream& ifs)
+// Variable length integer of version 4, the same encoding as the offset of
+// OFS_DELTA entries in packs.
+size_t readVarint(std::string_view data, size_t& offset)
 {
-    std::string res;
-    std::getline(ifs, res, '\0');
-    return res;
+    if (offset >= data.size()) {
+        corrupted("truncated entry");
+    }
+    unsigned char byte = data[offset++];
+    size_t value = byte & 0x7f;
+    while (byte & 0x80) {
+        if (offset >= data.size()) {
+            corrupted("truncated entry");
+        }
+        byte = data[offset++];
+        value = ((value + 1) << 7) | (byte & 0x7f);
+    }
+    return value;
 }
 
-void padByByteBoundary(std::fstream& ifs, int numberOfZeros)
+struct EntryBlock {
+    size_t offset;
+    size_t numberOfEntries;
+};
+
+// Blocks of the entry offset table, found through the end of entries
+// extension. Empty if the index has none or they don't add up, its entries
+// are then decoded one after another, like git does.
+std::vector<EntryBlock> entryBlocks(std::string_view data,
+                                    size_t numberOfEntries)
 {
-    std::string padding(numberOfZeros, '\0');
-    ifs.read(&padding[0], numberOfZeros);
+    if (data.size() < HEADER_SIZE + END_OF_ENTRIES_SIZE) {
+        return {};
+    }
+    auto endOfEntries = data.size() - END_OF_ENTRIES_SIZE;
+    if (data.substr(endOfEntries, 4) != END_OF_ENTRIES_SIGNATURE ||
+        readBigEndian32(data.data() + endOfEntries + 4) !=
+            END_OF_ENTRIES_SIZE - EXTENSION_HEADER_SIZE) {
+        return {};
+    }
+    size_t offset = readBigEndian32(data.data() + endOfEntries + 8);
+    if (offset < HEADER_SIZE || offset > endOfEntries) {
+        return {};
+    }
+
+    // the headers of the extensions are hashed, so the offset can't point
+    // into the entries by chance
+    std::string headers;
+    std::string_view table;
+    while (offset < endOfEntries) {
+        if (endOfEntries - offset < EXTENSION_HEADER_SIZE) {
+            return {};
+        }
+        auto size = readBigEndian32(data.data() + offset + 4);
+        if (size > endOfEntries - offset - EXTENSION_HEADER_SIZE) {
+            return {};
+        }
+        headers += data.substr(offset, EXTENSION_HEADER_SIZE);
+        if (data.substr(offset, 4) == OFFSET_TABLE_SIGNATURE) {
+            table = data.substr(offset + EXTENSION_HEADER_SIZE, size);
+        }
+        offset += EXTENSION_HEADER_SIZE + size;
+    }
+    if (SHA1::computeHash(headers) !=
+            Git::GitHash::fromBytes(data.data() + endOfEntries + 12) ||
+        table.size() < 4 || (table.size() - 4) % 8 != 0 ||
+        readBigEndian32(table.data()) != 1) {
+        return {};
+    }
+
+    std::vector<EntryBlock> blocks;
+    size_t total = 0;
+    for (size_t position = 4; position < table.size(); position += 8) {
+        EntryBlock block{
+            .offset = readBigEndian32(table.data() + position),
+            .numberOfEntries = readBigEndian32(table.data() + position + 4)};
+        bool ordered = blocks.empty() ? block.offset == HEADER_SIZE
+                                      : block.offset > blocks.back().offset;
+        if (!ordered || block.numberOfEntries == 0) {
+            return {};
+        }
+        total += block.numberOfEntries;
+        blocks.push_back(block);
+    }
+    if (total != numberOfEntries) {
+        return {};
+    }
+    return blocks;
 }
+}; // namespace
 
-} // namespace
 namespace Git {
 
-std::vector<IndexEntry> GitIndex::parse(const std::string& indexFilePath)
+GitIndex GitIndex::read(const std::filesystem::path& indexFile,
+                        size_t numberOfThreads)
 {
-    std::fstream ifs(indexFilePath, std::ios::binary | std::ios::in);
-    if (!ifs.is_open()) {
-        GENERATE_EXCEPTION("Couldn't find index file: {}", indexFilePath);
+    Utilities::MappedFile file(indexFile);
+    auto data = file.view();
+    if (data.size() < HEADER_SIZE + BinaryHash::SIZE) {
+        corrupted("too short");
     }
-    if (auto signature = readString(ifs, 4); signature != "DIRC") {
+    if (auto signature = data.substr(0, 4); signature != SIGNATURE) {
         GENERATE_EXCEPTION("Wrong file signature expected 'DIRC', got {}",
                            signature);
     }
 
-    if (auto version = convert<FourBytes>(read4(ifs)); version >= 0) {
-        std::cout << "Current Git Index Version: " << version << std::endl;
+    GitIndex index;
+    index.m_version = readBigEndian32(data.data() + 4);
+    if (index.m_version < 2 || index.m_version > 4) {
+        GENERATE_EXCEPTION("Unsupported index version {}", index.m_version);
+    }
+
+    // an all zero checksum means it was skipped on write, as with
+    // index.skipHash
+    auto content = data.substr(0, data.size() - BinaryHash::SIZE);
+    auto checksum = GitHash::fromBytes(data.data() + content.size());
+    auto verify = [content, checksum] {
+        return checksum == GitHash() || SHA1::computeHash(content) == checksum;
+    };
+    // hashing a big index takes about as long as decoding it, so it is done
+    // meanwhile on another thread, the parser doesn't trust the data anyway
+    auto numberOfEntries = readBigEndian32(data.data() + 8);
+    if (numberOfThreads == 0) {
+        numberOfThreads = Utilities::ThreadPool::hardwareThreads();
+    }
+    std::future<bool> verified;
+    if (numberOfThreads > 1 && numberOfEntries >= 2 * ENTRIES_PER_BLOCK) {
+        verified = std::async(std::launch::async, verify);
+    }
+    else if (!verify()) {
+        corrupted("checksum mismatch");
+    }
+
+    size_t offset = HEADER_SIZE;
+    index.parseEntries(content, numberOfEntries, offset, numberOfThreads);
+    index.parseExtensions(content, offset);
+    if (verified.valid() && !verified.get()) {
+        corrupted("checksum mismatch");
+    }
+
+    struct stat indexStat;
+    if (::stat(indexFile.c_str(), &indexStat) == 0) {
+        index.m_timestamp = {indexStat.st_mtim.tv_sec,
+                             indexStat.st_mtim.tv_nsec};
+    }
+    return index;
+}
+
+void GitIndex::write(const std::filesystem::path& indexFile) const
+{
+    Utilities::LockFile lock(indexFile);
+    write(lock);
+}
+
+void GitIndex::write(Utilities::LockFile& lock) const
+{
+    lock.write(serialize());
+    lock.commit();
+}
+
+std::string GitIndex::serialize() const
+{
+    // extended flags need at least version 3
+    auto version = m_version;
+    if (version < 3 && std::any_of(m_extendedFlags.begin(),
+                                   m_extendedFlags.end(),
+                                   [](auto flags) { return flags != 0; })) {
+        version = 3;
+    }
+    // Files modified in the same clock tick the index is written could change
+    // again without changing their stat data, so their size is recorded as 0.
+    // The entry is then never up to date, unless the file is actually empty.
+    // File timestamps come from the coarse clock, so it is the one compared.
+    timespec now;
+    ::clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    auto racyFrom = std::make_pair(static_cast<uint32_t>(now.tv_sec),
+                                   static_cast<uint32_t>(now.tv_nsec));
+
+    std::string data(SIGNATURE);
+    data.reserve(HEADER_SIZE + size() * (ENTRY_FIXED_SIZE + 8) +
+                 m_paths.size() + BinaryHash::SIZE);
+    writeBigEndian32(data, version);
+    writeBigEndian32(data, static_cast<uint32_t>(size()));
+
+    // the offset table is only worth it when the entries are decoded on
+    // more than one thread
+    std::string offsetTable;
+    if (size() >= 2 * ENTRIES_PER_BLOCK) {
+        writeBigEndian32(offsetTable, 1);
+    }
+
+    std::string_view previousPath;
+    for (size_t position = 0; position < size(); ++position) {
+        auto entryStart = data.size();
+        bool blockStart =
+            !offsetTable.empty() && position % ENTRIES_PER_BLOCK == 0;
+        if (blockStart) {
+            writeBigEndian32(offsetTable, static_cast<uint32_t>(entryStart));
+            writeBigEndian32(offsetTable,
+                             static_cast<uint32_t>(std::min(
+                                 ENTRIES_PER_BLOCK, size() - position)));
+        }
+        auto stat = m_stats[position];
+        if (std::make_pair(stat.mtimeSeconds, stat.mtimeNanoseconds) >=
+            racyFrom) {
+            stat.size = 0;
+        }
+        for (auto field : {stat.ctimeSeconds, stat.ctimeNanoseconds,
+                           stat.mtimeSeconds, stat.mtimeNanoseconds, stat.dev,
+                           stat.ino, stat.mode, stat.uid, stat.gid,
+                           stat.size}) {
+            writeBigEndian32(data, field);
+        }
+        data += m_hashes[position].bytes();
+
+        auto path = this->path(position);
+        auto flags = static_cast<uint16_t>(
+            (m_flags[position] & ~(FLAG_EXTENDED | NAME_LENGTH_MASK)) |
+            std::min<size_t>(path.size(), NAME_LENGTH_MASK));
+        if (m_extendedFlags[position] != 0) {
+            flags |= FLAG_EXTENDED;
+        }
+        writeBigEndian16(data, flags);
+        if (flags & FLAG_EXTENDED) {
+            writeBigEndian16(data, m_extendedFlags[position]);
+        }
+
+        if (version >= 4) {
+            // a block is decoded without the path before it
+            auto common = blockStart ? 0
+                                     : std::mismatch(previousPath.begin(),
+                                                     previousPath.end(),
+                                                     path.begin(), path.end())
+                                               .first -
+                                           previousPath.begin();
+            writeVarint(data, previousPath.size() - common);
+            data += path.substr(common);
+            data += '\0';
+            previousPath = path;
+        }
+        else {
+            data += path;
+            data.append(8 - (data.size() - entryStart) % 8, '\0');
+        }
+    }
+
+    auto extensionsStart = data.size();
+    if (!offsetTable.empty()) {
+        data += OFFSET_TABLE_SIGNATURE;
+        writeBigEndian32(data, static_cast<uint32_t>(offsetTable.size()));
+        data += offsetTable;
+    }
+    if (!m_cacheTree.empty()) {
+        auto cacheTree = m_cacheTree.serialize();
+        data += GitCacheTree::SIGNATURE;
+        writeBigEndian32(data, static_cast<uint32_t>(cacheTree.size()));
+        data += cacheTree;
+    }
+    for (const auto& extension : m_extensions) {
+        data += extension.signature;
+        writeBigEndian32(data, static_cast<uint32_t>(extension.data.size()));
+        data += extension.data;
+    }
+    if (!m_fsmonitorToken.empty()) {
+        serializeFSMonitor(data);
+    }
+    if (!offsetTable.empty()) {
+        std::string headers;
+        for (auto offset = extensionsStart; offset < data.size();) {
+            headers.append(data, offset, EXTENSION_HEADER_SIZE);
+            offset += EXTENSION_HEADER_SIZE +
+                      readBigEndian32(data.data() + offset + 4);
+        }
+        data += END_OF_ENTRIES_SIGNATURE;
+        writeBigEndian32(data, static_cast<uint32_t>(END_OF_ENTRIES_SIZE -
+                                                     EXTENSION_HEADER_SIZE));
+        writeBigEndian32(data, static_cast<uint32_t>(extensionsStart));
+        data += SHA1::computeHash(headers).bytes();
+    }
+    data += SHA1::computeHash(data).bytes();
+    return data;
+}
+
+IndexStat GitIndex::statOf(const std::filesystem::path& filePath)
+{
+    auto stat = tryStatOf(filePath.c_str());
+    if (!stat) {
+        GENERATE_EXCEPTION("No such file or directory: {}", filePath.string());
+    }
+    return *stat;
+}
+
+std::optional<IndexStat> GitIndex::tryStatOf(const char* filePath)
+{
+    struct stat fileStat;
+    if (::lstat(filePath, &fileStat) != 0) {
+        return std::nullopt;
+    }
+    // only the lower 32 bits are kept, like git does
+    IndexStat stat{
+        .ctimeSeconds = static_cast<uint32_t>(fileStat.st_ctim.tv_sec),
+        .ctimeNanoseconds = static_cast<uint32_t>(fileStat.st_ctim.tv_nsec),
+        .mtimeSeconds = static_cast<uint32_t>(fileStat.st_mtim.tv_sec),
+        .mtimeNanoseconds = static_cast<uint32_t>(fileStat.st_mtim.tv_nsec),
+        .dev = static_cast<uint32_t>(fileStat.st_dev),
+        .ino = static_cast<uint32_t>(fileStat.st_ino),
+        .mode = static_cast<uint32_t>(fileStat.st_mode),
+        .uid = fileStat.st_uid,
+        .gid = fileStat.st_gid,
+        .size = static_cast<uint32_t>(fileStat.st_size)};
+    stat.mode = modeOf(stat);
+    return stat;
+}
+
+uint32_t GitIndex::modeOf(const IndexStat& stat)
+{
+    switch (stat.mode & S_IFMT) {
+    case S_IFLNK:
+        return S_IFLNK;
+    case S_IFDIR:
+        return S_IFDIR | S_IFLNK;
+    default:
+        return S_IFREG | ((stat.mode & S_IXUSR) ? 0755 : 0644);
+    }
+}
+
+void GitIndex::parseEntries(std::string_view data, uint32_t numberOfEntries,
+                            size_t& offset, size_t numberOfThreads)
+{
+    // every entry takes more than ENTRY_FIXED_SIZE bytes, so a corrupted
+    // count can't make us allocate more than the file size
+    if (numberOfEntries > data.size() / ENTRY_FIXED_SIZE) {
+        corrupted("too many entries");
+    }
+    m_stats.resize(numberOfEntries);
+    m_hashes.resize(numberOfEntries);
+    m_flags.resize(numberOfEntries);
+    m_extendedFlags.resize(numberOfEntries);
+    m_pathOffsets.resize(numberOfEntries + 1);
+
+    auto blocks = numberOfThreads > 1 ? entryBlocks(data, numberOfEntries)
+                                      : std::vector<EntryBlock>();
+    if (blocks.size() < 2) {
+        m_paths.reserve(data.size());
+        offset = parseBlock(data, 0, numberOfEntries, offset, m_paths);
+        return;
+    }
+
+    std::vector<std::string> paths(blocks.size());
+    std::vector<size_t> ends(blocks.size());
+    {
+        Utilities::ThreadPool pool(
+            std::min(numberOfThreads, blocks.size()) - 1);
+        std::vector<std::future<size_t>> parsed;
+        size_t begin = 0;
+        for (size_t block = 0; block < blocks.size(); ++block) {
+            auto end = begin + blocks[block].numberOfEntries;
+            parsed.push_back(pool.submit([&, block, begin, end] {
+                return parseBlock(data, begin, end, blocks[block].offset,
+                                  paths[block]);
+            }));
+            begin = end;
+        }
+        // every block has to be done before the buffers go away
+        std::exception_ptr error;
+        for (size_t block = 0; block < blocks.size(); ++block) {
+            try {
+                ends[block] = pool.wait(parsed[block]);
+            }
+            catch (...) {
+                error = error ? error : std::current_exception();
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    size_t totalSize = 0;
+    for (const auto& blockPaths : paths) {
+        totalSize += blockPaths.size();
+    }
+    m_paths.reserve(totalSize);
+    size_t begin = 0;
+    for (size_t block = 0; block < blocks.size(); ++block) {
+        auto end = begin + blocks[block].numberOfEntries;
+        if (block + 1 < blocks.size() &&
+            ends[block] != blocks[block + 1].offset) {
+            corrupted("entry offset table doesn't match the entries");
+        }
+        // the first path of a block was decoded without the one before,
+        // it has to replace all of it
+        if (m_version >= 4 && block > 0) {
+            auto varint = blocks[block].offset + ENTRY_FIXED_SIZE +
+                          (m_flags[begin] & FLAG_EXTENDED ? 2 : 0);
+            if (readVarint(data, varint) !=
+                m_pathOffsets[begin] - m_pathOffsets[begin - 1]) {
+                corrupted("block shares a path prefix with the previous one");
+            }
+        }
+        auto base = static_cast<uint32_t>(m_paths.size());
+        m_paths += paths[block];
+        for (auto position = begin; position < end; ++position) {
+            m_pathOffsets[position + 1] += base;
+        }
+        begin = end;
+    }
+    offset = ends.back();
+}
+
+size_t GitIndex::parseBlock(std::string_view data, size_t begin, size_t end,
+                            size_t offset, std::string& paths)
+{
+    size_t previousPathSize = 0;
+    for (auto position = begin; position < end; ++position) {
+        auto entryStart = offset;
+        if (offset + ENTRY_FIXED_SIZE > data.size()) {
+            corrupted("truncated entry");
+        }
+        auto fields = data.data() + offset;
+        auto& stat = m_stats[position];
+        uint32_t* statFields[] = {
+            &stat.ctimeSeconds, &stat.ctimeNanoseconds, &stat.mtimeSeconds,
+            &stat.mtimeNanoseconds, &stat.dev, &stat.ino, &stat.mode,
+            &stat.uid, &stat.gid, &stat.size};
+        for (auto* field : statFields) {
+            *field = readBigEndian32(fields);
+            fields += 4;
+        }
+        m_hashes[position] = GitHash::fromBytes(fields);
+        fields += BinaryHash::SIZE;
+        auto flags = readBigEndian16(fields);
+        m_flags[position] = flags;
+        offset += ENTRY_FIXED_SIZE;
+
+        if (flags & FLAG_EXTENDED) {
+            if (m_version < 3) {
+                corrupted("extended flags in a version 2 index");
+            }
+            if (offset + 2 > data.size()) {
+                corrupted("truncated entry");
+            }
+            m_extendedFlags[position] = readBigEndian16(data.data() + offset);
+            offset += 2;
+        }
+
+        // version 4 only stores what differs from the previous path
+        auto pathStart = paths.size();
+        if (m_version >= 4) {
+            auto removed = readVarint(data, offset);
+            // checked against the previous block once it is decoded
+            if (position == begin && begin != 0) {
+                removed = 0;
+            }
+            if (removed > previousPathSize) {
+                corrupted("path prefix longer than the previous path");
+            }
+            paths.append(paths, pathStart - previousPathSize,
+                         previousPathSize - removed);
+        }
+        auto nameEnd = data.find('\0', offset);
+        if (nameEnd == std::string_view::npos) {
+            corrupted("truncated entry");
+        }
+        paths.append(data.substr(offset, nameEnd - offset));
+        m_pathOffsets[position + 1] = static_cast<uint32_t>(paths.size());
+        previousPathSize = paths.size() - pathStart;
+
+        // versions 2 and 3 pad entries with 1 to 8 zeros to a multiple of 8
+        offset = nameEnd + 1;
+        if (m_version < 4) {
+            offset = entryStart + ((nameEnd - entryStart + 8) & ~size_t(7));
+            if (offset > data.size()) {
+                corrupted("truncated entry");
+            }
+        }
+    }
+    return offset;
+}
+
+void GitIndex::parseExtensions(std::string_view data, size_t offset)
+{
+    while (offset + EXTENSION_HEADER_SIZE <= data.size()) {
+        auto signature = data.substr(offset, 4);
+        auto size = readBigEndian32(data.data() + offset + 4);
+        offset += EXTENSION_HEADER_SIZE;
+        if (size > data.size() - offset) {
+            corrupted("truncated extension");
+        }
+        auto extension = data.substr(offset, size);
+        offset += size;
+        if (signature == GitCacheTree::SIGNATURE && m_cacheTree.empty()) {
+            try {
+                m_cacheTree = GitCacheTree::parse(extension);
+                continue;
+            }
+            catch (const std::runtime_error&) {
+                // git ignores a broken cache tree too, it is kept as it is
+            }
+        }
+        if (signature == FSMONITOR_SIGNATURE) {
+            parseFSMonitor(extension);
+            continue;
+        }
+        // they describe where the entries are, they are written again
+        if (signature == OFFSET_TABLE_SIGNATURE ||
+            signature == END_OF_ENTRIES_SIGNATURE) {
+            continue;
+        }
+        // like git, only extensions that start with an upper case letter are
+        // optional, the others, e.g. the split index, change what the
+        // entries mean
+        if (signature[0] < 'A' || signature[0] > 'Z') {
+            GENERATE_EXCEPTION("index uses {} extension, which we do not "
+                               "understand",
+                               signature);
+        }
+        m_extensions.push_back({.signature = std::string(signature),
+                                .data = std::string(extension)});
+    }
+    if (offset != data.size()) {
+        corrupted("truncated extension");
+    }
+}
+
+/*
+    |4 bytes version 2||token||0||4 bytes bitmap size||EWAH bitmap|
+    The bitmap has the dirty entries set.
+*/
+void GitIndex::parseFSMonitor(std::string_view data)
+{
+    constexpr uint32_t VERSION = 2;
+    auto tokenEnd = data.find('\0', 4);
+    if (data.size() < 4 || readBigEndian32(data.data()) != VERSION ||
+        tokenEnd == std::string_view::npos || data.size() - tokenEnd < 5) {
+        // only a full check is lost, so it isn't worth failing for
+        return;
+    }
+    auto bitmapSize = readBigEndian32(data.data() + tokenEnd + 1);
+    try {
+        m_fsmonitorDirty =
+            readEwah(data.substr(tokenEnd + 5, bitmapSize), size());
+        m_fsmonitorToken = data.substr(4, tokenEnd - 4);
+    }
+    catch (const std::runtime_error&) {
+        m_fsmonitorDirty.clear();
+    }
+}
+
+void GitIndex::serializeFSMonitor(std::string& data) const
+{
+    std::string extension;
+    writeBigEndian32(extension, 2);
+    extension += m_fsmonitorToken;
+    extension += '\0';
+    std::string bitmap;
+    writeEwah(bitmap, m_fsmonitorDirty);
+    writeBigEndian32(extension, static_cast<uint32_t>(bitmap.size()));
+    extension += bitmap;
+
+    data += FSMONITOR_SIGNATURE;
+    writeBigEndian32(data, static_cast<uint32_t>(extension.size()));
+    data += extension;
+}
+
+void GitIndex::setFSMonitor(std::string token, std::vector<bool> dirty)
+{
+    m_fsmonitorToken = std::move(token);
+    m_fsmonitorDirty = std::move(dirty);
+    m_fsmonitorDirty.resize(size());
+}
+
+size_t GitIndex::lowerBound(std::string_view path) const
+{
+    size_t low = 0, high = size();
+    while (low < high) {
+        auto middle = low + (high - low) / 2;
+        if (this->path(middle) < path) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+std::optional<size_t> GitIndex::find(std::string_view path, int stage) const
+{
+    for (auto position = lowerBound(path);
+         position < size() && this->path(position) == path; ++position) {
+        if (this->stage(position) == stage) {
+            return position;
+        }
+    }
+    return std::nullopt;
+}
+
+bool GitIndex::isUpToDate(size_t position, const IndexStat& stat) const
+{
+    const auto& recorded = m_stats[position];
+    if (std::memcmp(&recorded, &stat, sizeof(IndexStat)) != 0) {
+        return false;
     }
-    else {
-        GENERATE_EXCEPTION("Wrong version number {}", version);
+    if (!m_timestamp) {
+        return true;
     }
+    return std::make_pair(recorded.mtimeSeconds, recorded.mtimeNanoseconds) <
+           *m_timestamp;
+}
+
+void GitIndex::setStat(size_t position, const IndexStat& stat)
+{
+    m_stats[position] = stat;
+}
 
-    if (auto numberOfIndices = convert<FourBytes>(read4(ifs));
-        numberOfIndices >= 0) {
-        std::cout << "Number of Git Indices: " << numberOfIndices << std::endl;
-        std::vector<GitIndex> indices;
-        indices.reserve(numberOfIndices);
+void GitIndex::add(std::vector<IndexEntry> entries)
+{
+    auto less = [](const IndexEntry& lhs, const IndexEntry& rhs) {
+        auto lhsStage = (lhs.flags & FLAG_STAGE_MASK);
+        auto rhsStage = (rhs.flags & FLAG_STAGE_MASK);
+        return std::tie(lhs.path, lhsStage) < std::tie(rhs.path, rhsStage);
+    };
+    // the last one of duplicates wins
+    std::stable_sort(entries.begin(), entries.end(), less);
+    auto last = std::unique(entries.rbegin(), entries.rend(),
+                            [&](const auto& lhs, const auto& rhs) {
+                                return !less(lhs, rhs) && !less(rhs, lhs);
+                            });
+    entries.erase(entries.begin(), last.base());
 
-        std::vector<IndexEntry> res;
-        for (int i = 0; i < numberOfIndices; ++i) {
-            int beginningOfTheEntry = ifs.tellp();
-            res.push_back({.ctime = read8(ifs),
-                           .mtime = read8(ifs),
-                           .dev = read4(ifs),
-                           .ino = read4(ifs),
-                           .mode = read4(ifs),
-                           .uid = read4(ifs),
-                           .gid = read4(ifs),
-                           .fsize = convert<FourBytes>(read4(ifs)),
-                           .hash = GitHash(BinaryHash(
-                               readString(ifs, BinaryHash::SIZE))),
-                           .flags = read2(ifs),
-                           .objectName = readStringUntilZero(ifs)});
-            int endOfTheEntry = ifs.tellp();
-            int entrySize = endOfTheEntry - beginningOfTheEntry;
-            int numberOfBytesToPad =
-                (8 * std::ceil(entrySize / 8.0)) - entrySize;
-            padByByteBoundary(ifs, numberOfBytesToPad);
+    GitIndex merged;
+    merged.m_version = m_version;
+    merged.m_timestamp = m_timestamp;
+    merged.m_cacheTree = std::move(m_cacheTree);
+    // added entries were just checked, they aren't dirty
+    merged.m_fsmonitorToken = m_fsmonitorToken;
+    bool monitored = !m_fsmonitorToken.empty();
+    auto keep = [&](size_t position) {
+        merged.append(entry(position));
+        if (monitored) {
+            merged.m_fsmonitorDirty.push_back(m_fsmonitorDirty[position]);
         }
-        return res;
+    };
+    size_t position = 0;
+    for (const auto& added : entries) {
+        for (; position < size() && less(entry(position), added); ++position) {
+            keep(position);
+        }
+        bool changed = true;
+        if (position < size() && !less(added, entry(position))) {
+            changed = added.hash != hash(position) ||
+                      added.stat.mode != stat(position).mode ||
+                      added.extendedFlags != extendedFlags(position);
+            ++position;
+        }
+        // staging a file resolves its conflict, the stages of the merge go
+        if ((added.flags & FLAG_STAGE_MASK) == 0) {
+            while (position < size() && path(position) == added.path) {
+                ++position;
+            }
+        }
+        if (changed) {
+            merged.m_cacheTree.invalidate(added.path);
+        }
+        merged.append(added);
+        if (monitored) {
+            merged.m_fsmonitorDirty.push_back(false);
+        }
+    }
+    for (; position < size(); ++position) {
+        keep(position);
     }
-    else {
-        GENERATE_EXCEPTION("Wrong number of indices: {}", numberOfIndices);
+    // other extensions describe the old entries
+    *this = std::move(merged);
+}
+
+void GitIndex::remove(const std::vector<std::string>& paths)
+{
+    std::vector<std::string_view> sorted(paths.begin(), paths.end());
+    std::sort(sorted.begin(), sorted.end());
+
+    GitIndex kept;
+    kept.m_version = m_version;
+    kept.m_timestamp = m_timestamp;
+    kept.m_cacheTree = std::move(m_cacheTree);
+    kept.m_fsmonitorToken = m_fsmonitorToken;
+    for (size_t position = 0; position < size(); ++position) {
+        if (!std::binary_search(sorted.begin(), sorted.end(), path(position))) {
+            kept.append(entry(position));
+            if (!m_fsmonitorToken.empty()) {
+                kept.m_fsmonitorDirty.push_back(m_fsmonitorDirty[position]);
+            }
+        }
+        else {
+            kept.m_cacheTree.invalidate(path(position));
+        }
     }
+    *this = std::move(kept);
+}
+
+void GitIndex::append(const IndexEntry& entry)
+{
+    m_stats.push_back(entry.stat);
+    m_hashes.push_back(entry.hash);
+    m_flags.push_back(entry.flags);
+    m_extendedFlags.push_back(entry.extendedFlags);
+    m_paths += entry.path;
+    m_pathOffsets.push_back(static_cast<uint32_t>(m_paths.size()));
+}
+
+IndexEntry GitIndex::entry(size_t position) const
+{
+    return {.stat = m_stats[position],
+            .hash = m_hashes[position],
+            .flags = m_flags[position],
+            .extendedFlags = m_extendedFlags[position],
+            .path = path(position)};
 }
-} // namespace Git
\ No newline at end of file
+} // namespace Git
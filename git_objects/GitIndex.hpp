@@ -1,52 +1,205 @@
 #pragma once
 
+#include "GitCacheTree.hpp"
 #include "GitHash.hpp"
+#include "../utilities/TemporaryFile.hpp"
 #include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <vector>
 
 namespace Git {
 
-struct IndexHeader {
-    uint32_t signature;
-    uint32_t versionNumber;
-    uint32_t numberOfIndexEntries;
-};
-
-struct IndexEntry {
-    // The last time a file's metadata changed.  This is a tuple (seconds,
-    // nanoseconds)
-    uint64_t ctime;
-    // The last time a file's data changed.  This is a tuple (seconds,
-    // nanoseconds)
-    uint64_t mtime;
+// What stat(2) reported when the entry was last updated, used to tell if the
+// file changed without reading it. Git keeps only the lower 32 bits of each
+// field.
+struct IndexStat {
+    uint32_t ctimeSeconds;
+    uint32_t ctimeNanoseconds;
+    uint32_t mtimeSeconds;
+    uint32_t mtimeNanoseconds;
     // The ID of device containing this file
     uint32_t dev;
     // The file's inode number
     uint32_t ino;
     // The object type, either b1000 (regular), b1010 (symlink), b1110
-    // (gitlink).
+    // (gitlink), followed by the unix permissions.
     uint32_t mode;
-    // User ID of owner//
+    // User ID of owner
     uint32_t uid;
-    // Group ID of owner (according to stat 2.  Isn'th)
+    // Group ID of owner
     uint32_t gid;
-    // Size of this object, in bytes
-    uint32_t fsize;
-    // The object's hash as a hex string
+    // Size of the file, in bytes
+    uint32_t size;
+};
+
+struct IndexEntry {
+    IndexStat stat;
     GitHash hash;
+    // |1 bit assume-valid||1 bit extended||2 bits stage||12 bits name length|
     uint16_t flags;
-    std::string objectName;
+    // Only in version 3 and later:
+    // |1 bit reserved||1 bit skip-worktree||1 bit intent-to-add||13 bits 0|
+    uint16_t extendedFlags;
+    std::string_view path;
 };
 
+// Optional extensions are kept as they are, so they can be written back.
+struct IndexExtension {
+    std::string signature;
+    std::string data;
+};
+
+/*
+    The index (staging area) as a structure of arrays: entries are looked at
+    one field at a time, e.g. all paths or all stats, so each field is stored
+    contiguously. Paths are stored back to back in a single buffer.
+
+    |"DIRC"||4 bytes version||4 bytes number of entries|
+    |entries...||extensions...||SHA1 of everything before it|
+
+    Entries have variable length, so finding one means decoding all before
+    it. Big indexes are written with two more extensions, as git does, so
+    blocks of entries can be decoded in parallel:
+        IEOT |4 bytes version 1|(|4 bytes offset||4 bytes number of entries|)*
+            where each block of entries starts, in version 4 the first path
+            of a block doesn't share a prefix with the previous one
+        EOIE |4 bytes offset of the extensions||SHA1 of extension headers|
+            always the last one, to find the others without the entries
+*/
 class GitIndex {
   public:
-    static std::vector<IndexEntry> parse(const std::string& indexFilePath);
+    static constexpr uint16_t FLAG_EXTENDED = 0x4000;
+    static constexpr uint16_t FLAG_STAGE_MASK = 0x3000;
+    static constexpr uint16_t NAME_LENGTH_MASK = 0x0fff;
+    static constexpr uint16_t FLAG_INTENT_TO_ADD = 0x2000;
+
+  public:
+    GitIndex() = default;
+
+    // Supports versions 2, 3 and 4. Throws if the file is corrupted, its
+    // checksum doesn't match or it needs an extension that isn't supported.
+    // Big indexes written with an entry offset table are decoded on
+    // numberOfThreads threads, 0 is one per core.
+    static GitIndex read(const std::filesystem::path& indexFile,
+                         size_t numberOfThreads = 0);
+    // Writes under index.lock, so readers never see a partial index. A
+    // command that reads the index, changes it and writes it back has to hold
+    // the lock from before the read, and write through it, so concurrent
+    // writers fail instead of losing each other's changes.
+    void write(const std::filesystem::path& indexFile) const;
+    void write(Utilities::LockFile& lock) const;
+    std::string serialize() const;
+
+    // Stat data of the file as the index stores it, for a symbolic link its
+    // own and not its target's. Throws if the file doesn't exist.
+    static IndexStat statOf(const std::filesystem::path& filePath);
+    // Same as statOf, but empty if the file doesn't exist and no path object
+    // is made, for callers that stat every file of the worktree.
+    static std::optional<IndexStat> tryStatOf(const char* filePath);
+    // Mode git records for the file: 100644, 100755, 120000 or 160000.
+    static uint32_t modeOf(const IndexStat& stat);
+
+    uint32_t version() const { return m_version; }
+    size_t size() const { return m_hashes.size(); }
+    bool empty() const { return m_hashes.empty(); }
+
+    std::string_view path(size_t position) const
+    {
+        return std::string_view(m_paths).substr(
+            m_pathOffsets[position],
+            m_pathOffsets[position + 1] - m_pathOffsets[position]);
+    }
+    const GitHash& hash(size_t position) const { return m_hashes[position]; }
+    const IndexStat& stat(size_t position) const { return m_stats[position]; }
+    uint16_t flags(size_t position) const { return m_flags[position]; }
+    uint16_t extendedFlags(size_t position) const
+    {
+        return m_extendedFlags[position];
+    }
+    int stage(size_t position) const
+    {
+        return (m_flags[position] & FLAG_STAGE_MASK) >> 12;
+    }
+    IndexEntry entry(size_t position) const;
+
+    // Position of the first entry whose path isn't less than path.
+    size_t lowerBound(std::string_view path) const;
+    std::optional<size_t> find(std::string_view path, int stage = 0) const;
+
+    // True when the file still has the stat data the entry recorded, so its
+    // content doesn't need to be hashed again. Entries written in the same
+    // timestamp as the index itself are never trusted: the file could have
+    // changed right after it was hashed without changing its stat data.
+    bool isUpToDate(size_t position, const IndexStat& stat) const;
+    // Records new stat data for a file whose content didn't change.
+    void setStat(size_t position, const IndexStat& stat);
+
+    // Adds the entries or replaces those with the same path and stage, an
+    // entry of stage 0 replaces every stage of its path. Entries are kept
+    // sorted by path and stage, as git expects. Paths are copied. Directories
+    // whose content changed are invalidated in the cache tree.
+    void add(std::vector<IndexEntry> entries);
+    void remove(const std::vector<std::string>& paths);
+
+    // Writes the tree objects of the entries, only those of directories that
+    // changed since the last call, and returns the root tree.
+    GitHash writeTree() { return m_cacheTree.update(*this); }
+    const GitCacheTree& cacheTree() const { return m_cacheTree; }
+
+    // Token of the filesystem monitor the entries were last checked against,
+    // empty if they weren't. Stored as the FSMN extension.
+    const std::string& fsmonitorToken() const { return m_fsmonitorToken; }
+    // An entry that differed from its file when it was last checked has to
+    // be checked again, even if the monitor saw no change since.
+    bool isFSMonitorDirty(size_t position) const
+    {
+        return m_fsmonitorToken.empty() || m_fsmonitorDirty[position];
+    }
+    // dirty has a flag for each entry.
+    void setFSMonitor(std::string token, std::vector<bool> dirty);
+
+    const std::vector<IndexExtension>& extensions() const
+    {
+        return m_extensions;
+    }
+
+  private:
+    void append(const IndexEntry& entry);
+    void parseEntries(std::string_view data, uint32_t numberOfEntries,
+                      size_t& offset, size_t numberOfThreads);
+    // Decodes the entries [begin, end) starting at offset, their paths are
+    // appended to paths and their path offsets are relative to it. Returns
+    // the offset after them.
+    size_t parseBlock(std::string_view data, size_t begin, size_t end,
+                      size_t offset, std::string& paths);
+    void parseExtensions(std::string_view data, size_t offset);
+    void parseFSMonitor(std::string_view data);
+    void serializeFSMonitor(std::string& data) const;
 
   private:
-    GitIndex();
-    IndexHeader m_header;
-    std::vector<IndexEntry> m_entries;
+    uint32_t m_version = 2;
+    std::vector<IndexStat> m_stats;
+    std::vector<GitHash> m_hashes;
+    std::vector<uint16_t> m_flags;
+    std::vector<uint16_t> m_extendedFlags;
+    // path i is m_paths[m_pathOffsets[i], m_pathOffsets[i + 1])
+    std::vector<uint32_t> m_pathOffsets = {0};
+    std::string m_paths;
+    // extensions other than the cache tree, or a cache tree that couldn't
+    // be parsed
+    std::vector<IndexExtension> m_extensions;
+    GitCacheTree m_cacheTree;
+    std::string m_fsmonitorToken;
+    std::vector<bool> m_fsmonitorDirty;
+    // modification time of the index file, entries modified at or after it
+    // are racy
+    std::optional<std::pair<uint32_t, uint32_t>> m_timestamp;
 };
 }; // namespace Git
 
-using GitIndex = Git::GitIndex;
\ No newline at end of file
+using GitIndex = Git::GitIndex;
+using IndexEntry = Git::IndexEntry;
+using IndexStat = Git::IndexStat;
@@ -1,10 +1,16 @@
 #include "GitObject.hpp"
+#include "../utilities/TemporaryFile.hpp"
 #include "../utilities/Zlib.hpp"
+#include "GitObjectCache.hpp"
 #include "GitObjectsFactory.hpp"
+#include "GitPack.hpp"
 
 #include <assert.h>
 #include <fstream>
+#include <functional>
+#include <mutex>
 #include <regex>
+#include <sys/stat.h>
 
 namespace {
 std::vector<GitHash> resolveObject(const std::string& name)
@@ -17,6 +23,11 @@ std::vector<GitHash> resolveObject(const std::string& name)
             GitHash(GitObject::resolveReference(GitRepository::pathToHead()))};
     }
 
+    // full hashes are the common case for scripts, they skip the regex
+    if (auto hash = GitHash::fromHex(name)) {
+        return {*hash};
+    }
+
     std::regex shaSignature("[0-9A-Fa-f]{4,40}");
     std::smatch cm;
 
@@ -36,37 +47,136 @@ std::vector<GitHash> resolveObject(const std::string& name)
             for (std::filesystem::directory_entry dirEntry :
                  std::filesystem::directory_iterator{objectPath}) {
                 auto hashSuffix = dirEntry.path().filename().string();
-                if (dirEntry.is_regular_file() &&
+                // skips temporary files of objects being written
+                auto hash = GitHash::fromHex(hashPrefix + hashSuffix);
+                if (hash && dirEntry.is_regular_file() &&
                     hashSuffix.starts_with(beginningOfHash)) {
-                    candidates.push_back(GitHash(hashPrefix + hashSuffix));
+                    candidates.push_back(*hash);
                 }
             }
         }
+
+        for (const auto& packedHash : GitPackStore::findByPrefix(sha)) {
+            if (std::find(candidates.begin(), candidates.end(), packedHash) ==
+                candidates.end()) {
+                candidates.push_back(packedHash);
+            }
+        }
     }
     else {
         // if name is not hash, than it's tag or branch
-        auto branchesPath = GitRepository::repoDir("refs", "heads");
-        for (std::filesystem::directory_entry dirEntry :
-             std::filesystem::directory_iterator{branchesPath}) {
-            if (dirEntry.path().filename().string() == name) {
-                candidates.push_back(
-                    GitHash(GitObject::resolveReference(branchesPath / name)));
-            }
-        }
-
-        auto tagsPath = GitRepository::repoDir("refs", "tags");
-        if (candidates.empty()) {
-            for (std::filesystem::directory_entry dirEntry :
-                 std::filesystem::directory_iterator{tagsPath}) {
-                if (dirEntry.path().filename().string() == name) {
-                    candidates.push_back(
-                        GitHash(GitObject::resolveReference(tagsPath / name)));
-                }
+        for (auto kind : {"heads", "tags"}) {
+            auto reference = fmt::format("refs/{}/{}", kind, name);
+            if (GitRepository::hasReference(reference)) {
+                candidates.emplace_back(GitObject::resolveReference(
+                    GitRepository::repoPath(reference)));
+                break;
             }
         }
     }
     return candidates;
 }
+
+constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+std::filesystem::path objectPath(const GitHash& hash)
+{
+    return GitRepository::repoPath("objects",
+                                   Utilities::getObjectDirectory(hash),
+                                   Utilities::getObjectFileName(hash));
+}
+
+// Unchanged files hash to objects that are already there, checking that is
+// much cheaper than compressing them again.
+bool objectExists(const GitHash& hash, const std::filesystem::path& objectFile)
+{
+    return std::filesystem::exists(objectFile) || GitPackStore::contains(hash);
+}
+
+// Hashes the header followed by the file, read in fixed size chunks, which
+// are also passed to consume. Memory use doesn't depend on the file size.
+GitHash streamFile(const std::filesystem::path& filePath,
+                   std::string_view header, uintmax_t size,
+                   const std::function<void(std::string_view)>& consume)
+{
+    std::ifstream file(filePath, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        GENERATE_EXCEPTION("No such file or directory: {}", filePath.string());
+    }
+
+    SHA1::Hasher hasher;
+    hasher.update(header);
+    consume(header);
+
+    std::vector<char> chunk(CHUNK_SIZE);
+    uintmax_t streamed = 0;
+    while (file.read(chunk.data(), chunk.size()) || file.gcount() != 0) {
+        auto data = std::string_view(chunk.data(), file.gcount());
+        hasher.update(data);
+        consume(data);
+        streamed += data.size();
+    }
+    if (streamed != size) {
+        GENERATE_EXCEPTION("{} changed while it was read", filePath.string());
+    }
+    return hasher.finalize();
+}
+
+std::string objectHeader(std::string_view format, uintmax_t size)
+{
+    auto header = fmt::format("{} {}", format, size);
+    header += '\0';
+    return header;
+}
+
+// Level set by a compression option, -1 is zlib's default.
+std::optional<int> compressionLevel(const std::string& key)
+{
+    if (!GitRepository::config(key)) {
+        return std::nullopt;
+    }
+    auto level = GitRepository::configInt(key, Zlib::BEST_SPEED);
+    if (level < -1 || level > Zlib::BEST_COMPRESSION) {
+        GENERATE_EXCEPTION("Bad zlib compression level {} for {}", level, key);
+    }
+    return level == -1 ? Zlib::DEFAULT_COMPRESSION : level;
+}
+
+struct LooseCompression {
+    std::mutex mutex;
+    std::filesystem::path configPath;
+    std::filesystem::file_time_type lastWriteTime;
+    int level = Zlib::BEST_SPEED;
+    bool loaded = false;
+};
+
+LooseCompression& looseCompression()
+{
+    static LooseCompression compression;
+    return compression;
+}
+
+// Same as git, core.looseCompression falls back to core.compression and then
+// to the fastest level, loose objects are repacked later anyway. The config
+// is only parsed again when it changes or another repository is used.
+int looseCompressionLevel()
+{
+    auto& compression = looseCompression();
+    std::lock_guard lock(compression.mutex);
+    auto configPath = GitRepository::repoPath("config");
+    std::error_code error;
+    auto lastWriteTime = std::filesystem::last_write_time(configPath, error);
+    if (!compression.loaded || compression.configPath != configPath ||
+        compression.lastWriteTime != lastWriteTime) {
+        auto fallback = compressionLevel("core.compression");
+        compression.level = compressionLevel("core.looseCompression")
+                                .value_or(fallback.value_or(Zlib::BEST_SPEED));
+        compression.configPath = configPath;
+        compression.lastWriteTime = lastWriteTime;
+        compression.loaded = true;
+    }
+    return compression.level;
+}
 }; // namespace
 
 namespace Git {
@@ -76,21 +186,72 @@ GitObject::~GitObject() {}
 GitHash GitObject::write(GitObject* gitObject, bool actuallyWrite)
 {
     auto objectData = gitObject->serialize();
-    auto fileContent = gitObject->format() + " " +
-                       std::to_string(objectData.data().size()) + '\0' +
-                       objectData.data();
-
-    auto fileHash = SHA1::computeHash(fileContent);
-    if (actuallyWrite) {
-        auto objectFile =
-            GitRepository::repoFile(GitRepository::CreateDir::YES, "objects",
-                                    Utilities::getObjectDirectory(fileHash),
-                                    Utilities::getObjectFileName(fileHash));
-        Zlib::compress(objectFile, fileContent);
+    auto content = objectData.data();
+    auto header = objectHeader(gitObject->format(), content.size());
+
+    // header and content are never joined, big objects aren't copied again
+    SHA1::Hasher hasher;
+    hasher.update(header);
+    hasher.update(content);
+    auto fileHash = hasher.finalize();
+    if (!actuallyWrite) {
+        return fileHash;
     }
+
+    auto objectFile = objectPath(fileHash);
+    if (objectExists(fileHash, objectFile)) {
+        return fileHash;
+    }
+
+    std::filesystem::create_directories(objectFile.parent_path());
+    Utilities::TemporaryFile temporaryFile(objectFile.parent_path());
+    Zlib::Deflater deflater(looseCompressionLevel());
+    auto sink = [&](std::string_view compressed) {
+        temporaryFile.write(compressed);
+    };
+    deflater.write(header, sink);
+    deflater.write(content, sink);
+    deflater.finish(sink);
+    temporaryFile.commit(objectFile, true);
     return fileHash;
 }
 
+GitHash GitObject::writeBlob(const std::filesystem::path& filePath,
+                             bool actuallyWrite)
+{
+    auto size = std::filesystem::file_size(filePath);
+    auto header = objectHeader("blob", size);
+
+    auto blobHash = streamFile(filePath, header, size, [](std::string_view) {});
+    if (!actuallyWrite) {
+        return blobHash;
+    }
+    auto objectFile = objectPath(blobHash);
+    if (objectExists(blobHash, objectFile)) {
+        return blobHash;
+    }
+
+    // the file is read a second time, so objects that already exist are
+    // never compressed
+    std::filesystem::create_directories(objectFile.parent_path());
+    Utilities::TemporaryFile temporaryFile(objectFile.parent_path());
+    Zlib::Deflater deflater(looseCompressionLevel());
+    auto sink = [&](std::string_view compressed) {
+        temporaryFile.write(compressed);
+    };
+    auto writtenHash = streamFile(filePath, header, size, [&](auto chunk) {
+        deflater.write(chunk, sink);
+    });
+    deflater.finish(sink);
+
+    if (writtenHash != blobHash) {
+        GENERATE_EXCEPTION("{} changed while it was written",
+                           filePath.string());
+    }
+    temporaryFile.commit(objectFile, true);
+    return blobHash;
+}
+
 GitHash GitObject::findObject(const std::string& name, const std::string& fmt)
 {
     auto shas = resolveObject(name);
@@ -109,18 +270,18 @@ GitHash GitObject::findObject(const std::string& name, const std::string& fmt)
     }
 
     while (true) {
-        auto object = GitObjectFactory::read(sha);
-
-        if (object->format() == fmt) {
+        if (GitObjectFactory::readHeader(sha).format == fmt) {
             return sha;
         }
 
+        // only tags and commits are read in full, to follow them
+        auto object = GitObjectCache::read(sha);
         if (object->format() == "tag") {
-            auto tag = static_cast<GitTag*>(object.get());
+            auto tag = static_cast<const GitTag*>(object.get());
             sha = GitHash(tag->tagMessage().object);
         }
         else if (object->format() == "commit") {
-            auto commit = static_cast<GitCommit*>(object.get());
+            auto commit = static_cast<const GitCommit*>(object.get());
             sha = GitHash(commit->commitMessage().tree);
         }
         else {
@@ -156,7 +317,7 @@ GitHash GitObject::findObject(const std::string& name, const std::string& fmt)
         Create first draft
 */
 KeyValuesWithMessage
-GitObject::parseKeyValuesWithMessage(const std::string& data)
+GitObject::parseKeyValuesWithMessage(std::string_view data)
 {
     KeyValuesWithMessage objectData;
 
@@ -173,7 +334,7 @@ GitObject::parseKeyValuesWithMessage(const std::string& data)
         auto keyEnds = data.find(' ', start);
         auto valueEnds = data.find('\n', keyEnds);
 
-        auto key = data.substr(start, keyEnds - start);
+        auto key = std::string(data.substr(start, keyEnds - start));
         if (key == "gpgsig") {
             auto gpgsigEnds = data.find("\n\n");
             objectData[key] += data.substr(start + key.size(),
@@ -184,7 +345,11 @@ GitObject::parseKeyValuesWithMessage(const std::string& data)
         }
 
         auto value = data.substr(keyEnds + 1, valueEnds - keyEnds - 1);
-        objectData[key] = value;
+        auto& values = objectData[key];
+        if (!values.empty()) {
+            values += '\n';
+        }
+        values += value;
         start = valueEnds + 1;
     }
     return objectData;
@@ -194,15 +359,24 @@ std::string
 GitObject::resolveReference(const std::filesystem::path& referenceDir,
                             bool dereference)
 {
+    // refs without a loose file may have been packed by git gc
+    if (!std::filesystem::exists(referenceDir)) {
+        auto name = referenceDir
+                        .lexically_relative(GitRepository::findRoot().gitDir())
+                        .generic_string();
+        auto packedRefs = GitRepository::packedRefs();
+        if (auto packed = packedRefs.find(name); packed != packedRefs.end()) {
+            return packed->second;
+        }
+    }
+
     auto referenceContent = Utilities::readFile(referenceDir);
     if (referenceContent.back() == '\n') {
         referenceContent.erase(referenceContent.end() - 1);
     }
     if (referenceContent.starts_with("ref: ") && dereference) {
         auto indirectReference = referenceContent.substr(5);
-        auto fullPathToIndirectReference =
-            GitRepository::repoFile(indirectReference);
-        return resolveReference(fullPathToIndirectReference);
+        return resolveReference(GitRepository::repoPath(indirectReference));
     }
     else {
         return referenceContent;
@@ -214,15 +388,15 @@ GitCommit::GitCommit(const CommitMessage& commitMessage)
 {
 }
 
-ObjectData GitCommit::serialize()
+ObjectData GitCommit::serialize() const
 {
     std::ostringstream oss;
 
     oss << "tree"
         << " " << m_commitMessage.tree << std::endl;
-    if (!m_commitMessage.parent.empty()) {
+    for (const auto& parent : m_commitMessage.parents) {
         oss << "parent"
-            << " " << m_commitMessage.parent << std::endl;
+            << " " << parent << std::endl;
     }
     oss << "author"
         << " " << m_commitMessage.author << std::endl;
@@ -242,10 +416,17 @@ ObjectData GitCommit::serialize()
 void GitCommit::deserialize(const ObjectData& data)
 {
     auto commitMessage = GitObject::parseKeyValuesWithMessage(data.data());
+    std::vector<std::string> parents;
+    std::string_view values = commitMessage["parent"];
+    while (!values.empty()) {
+        auto end = std::min(values.find('\n'), values.size());
+        parents.emplace_back(values.substr(0, end));
+        values.remove_prefix(std::min(end + 1, values.size()));
+    }
     // NOTE: use [], so if the element is not present empty string will be
     // returned:)
     m_commitMessage = {.tree = commitMessage["tree"],
-                       .parent = commitMessage["parent"],
+                       .parents = std::move(parents),
                        .author = commitMessage["author"],
                        .committer = commitMessage["committer"],
                        .gpgsig = commitMessage["gpgsig"],
@@ -259,54 +440,98 @@ const CommitMessage& GitCommit::commitMessage() const
     return m_commitMessage;
 }
 
-GitTree::GitTree(const std::vector<GitTreeLeaf>& leaves) : m_tree(leaves) {}
-
-ObjectData GitTree::serialize()
+GitHash GitTreeEntry::objectHash() const
 {
-    std::string data;
-
-    for (const auto& leaf : m_tree) {
-        data += leaf.fileMode;
-        data += ' ';
-        data += leaf.filePath;
-        data += '\0';
-        data += GitHash::convertToBinary(leaf.hash).data();
-    }
-    return ObjectData(data);
+    return GitHash::fromBytes(hash.data());
 }
 
-std::vector<GitTreeLeaf> GitTree::parseGitTree(const std::string& data)
+GitTreeView::Iterator::Iterator(std::string_view remaining)
+    : m_remaining(remaining)
 {
-    std::vector<GitTreeLeaf> tree;
+    parseEntry();
+}
 
-    auto maxPos = data.size();
-    size_t start = 0;
+GitTreeView::Iterator& GitTreeView::Iterator::operator++()
+{
+    m_remaining.remove_prefix(m_entrySize);
+    parseEntry();
+    return *this;
+}
 
-    while (start < maxPos) {
-        auto fileModeEnds = data.find(' ', start);
-        auto fileMode = data.substr(start, fileModeEnds - start);
-        assert(fileMode.size() == 5 || fileMode.size() == 6);
+GitTreeView::Iterator GitTreeView::Iterator::operator++(int)
+{
+    auto current = *this;
+    ++*this;
+    return current;
+}
 
-        auto pathEnds = data.find('\0', fileModeEnds);
-        auto path = data.substr(fileModeEnds + 1, pathEnds - fileModeEnds - 1);
+void GitTreeView::Iterator::parseEntry()
+{
+    if (m_remaining.empty()) {
+        return;
+    }
 
-        auto sha = GitHash(
-            BinaryHash(data.substr(pathEnds + 1, BinaryHash::SIZE)));
+    uint32_t mode = 0;
+    size_t position = 0;
+    while (position < m_remaining.size() && m_remaining[position] != ' ') {
+        auto digit = m_remaining[position++];
+        if (digit < '0' || digit > '7') {
+            GENERATE_EXCEPTION("{}", "Malformed tree entry mode");
+        }
+        mode = (mode << 3) | (digit - '0');
+    }
 
-        start = pathEnds + BinaryHash::SIZE + 1;
-        tree.push_back({.fileMode = fileMode, .filePath = path, .hash = sha});
+    auto nameEnds = m_remaining.find('\0', position);
+    if (position == 0 || nameEnds == std::string_view::npos ||
+        nameEnds + 1 + BinaryHash::SIZE > m_remaining.size()) {
+        GENERATE_EXCEPTION("{}", "Truncated tree entry");
     }
-    return tree;
+    m_entry = {.mode = mode,
+               .name = m_remaining.substr(position + 1,
+                                          nameEnds - position - 1),
+               .hash = m_remaining.substr(nameEnds + 1, BinaryHash::SIZE)};
+    m_entrySize = nameEnds + 1 + BinaryHash::SIZE;
+}
+
+GitTree::GitTree(const std::vector<GitTreeLeaf>& leaves)
+    : m_data(serializeLeaves(leaves)), m_tree(leaves)
+{
+    std::call_once(m_parsed, [] {});
 }
 
-void GitTree::deserialize(const ObjectData& data)
+std::string GitTree::serializeLeaves(const std::vector<GitTreeLeaf>& leaves)
 {
-    m_tree = parseGitTree(data.data());
+    std::string data;
+
+    for (const auto& leaf : leaves) {
+        data += leaf.fileMode;
+        data += ' ';
+        data += leaf.filePath;
+        data += '\0';
+        data += leaf.hash.bytes();
+    }
+    return data;
 }
 
+ObjectData GitTree::serialize() const { return m_data; }
+
+void GitTree::deserialize(const ObjectData& data) { m_data = data; }
+
 std::string GitTree::format() const { return "tree"; }
 
-const std::vector<GitTreeLeaf>& GitTree::tree() const { return m_tree; }
+GitTreeView GitTree::entries() const { return GitTreeView(m_data.data()); }
+
+const std::vector<GitTreeLeaf>& GitTree::tree() const
+{
+    std::call_once(m_parsed, [this] {
+        for (const auto& entry : entries()) {
+            m_tree.push_back({.fileMode = fmt::format("{:06o}", entry.mode),
+                              .filePath = entry.name,
+                              .hash = entry.objectHash()});
+        }
+    });
+    return m_tree;
+}
 
 /*
 The file mode; one of 100644 for file (blob), 100755 for executable (blob),
@@ -350,9 +575,25 @@ std::string GitTree::fileMode(const std::filesystem::directory_entry& entry,
         entry.path().string(), format);
 }
 
+std::string GitTree::formatOf(uint32_t mode)
+{
+    switch (mode & S_IFMT) {
+    case S_IFDIR:
+        return "tree";
+    // gitlinks, commits of submodules
+    case S_IFDIR | S_IFLNK:
+        return "commit";
+    case S_IFREG:
+    case S_IFLNK:
+        return "blob";
+    default:
+        return {};
+    }
+}
+
 GitTag::GitTag(const TagMessage& tagMessage) : m_tagMessage(tagMessage) {}
 
-ObjectData GitTag::serialize()
+ObjectData GitTag::serialize() const
 {
     std::ostringstream oss;
 
@@ -390,7 +631,7 @@ std::string GitTag::format() const { return "tag"; }
 
 const TagMessage& GitTag::tagMessage() const { return m_tagMessage; }
 
-ObjectData GitBlob::serialize() { return m_blob; }
+ObjectData GitBlob::serialize() const { return m_blob; }
 
 void GitBlob::deserialize(const ObjectData& data) { m_blob = data; }
 
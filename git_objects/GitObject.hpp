@@ -1,6 +1,9 @@
 #pragma once
 
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -9,19 +12,33 @@
 
 namespace Git {
 
+// Object content in a buffer shared by all of its copies, so passing it
+// around, e.g. from the inflated object to a blob and back, never copies
+// the bytes.
 class ObjectData {
   public:
     ObjectData() = default;
-    ObjectData(const std::string& data) : m_data(data) {}
-    const std::string& data() const { return m_data; }
+    ObjectData(std::string data)
+        : m_buffer(std::make_shared<const std::string>(std::move(data))),
+          m_data(*m_buffer)
+    {
+    }
+    ObjectData(std::shared_ptr<const std::string> buffer, std::string_view data)
+        : m_buffer(std::move(buffer)), m_data(data)
+    {
+    }
+
+    std::string_view data() const { return m_data; }
 
   private:
-    std::string m_data;
+    std::shared_ptr<const std::string> m_buffer;
+    std::string_view m_data;
 };
 
 struct CommitMessage {
     std::string tree;
-    std::string parent;
+    // the first one is the commit the branch was on, a merge has more
+    std::vector<std::string> parents;
     std::string author;
     std::string committer;
     std::string gpgsig;
@@ -37,6 +54,8 @@ struct TagMessage {
     std::string message;
 };
 
+// Values of a key that is repeated, like the parents of a merge, are kept
+// one per line.
 using KeyValuesWithMessage = std::unordered_map<std::string, std::string>;
 
 struct GitTreeLeaf {
@@ -45,20 +64,80 @@ struct GitTreeLeaf {
     GitHash hash;
 };
 
+// Tree entry that points into the serialized tree, it is valid as long as
+// the tree data is.
+struct GitTreeEntry {
+    uint32_t mode;
+    std::string_view name;
+    // 20 bytes binary hash
+    std::string_view hash;
+
+    GitHash objectHash() const;
+};
+
+/*
+    Iterates over entries straight from the serialized tree, without
+    allocating anything:
+        |mode in octal|| ||name||0||20 bytes hash| ...
+*/
+class GitTreeView {
+  public:
+    class Iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = GitTreeEntry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const GitTreeEntry*;
+        using reference = const GitTreeEntry&;
+
+        Iterator() = default;
+        explicit Iterator(std::string_view remaining);
+
+        reference operator*() const { return m_entry; }
+        pointer operator->() const { return &m_entry; }
+        Iterator& operator++();
+        Iterator operator++(int);
+        bool operator==(const Iterator& other) const
+        {
+            return m_remaining.data() == other.m_remaining.data();
+        }
+
+      private:
+        void parseEntry();
+
+      private:
+        // starts with the current entry
+        std::string_view m_remaining;
+        size_t m_entrySize = 0;
+        GitTreeEntry m_entry{};
+    };
+
+    explicit GitTreeView(std::string_view data) : m_data(data) {}
+
+    Iterator begin() const { return Iterator(m_data); }
+    Iterator end() const { return Iterator(m_data.substr(m_data.size())); }
+
+  private:
+    std::string_view m_data;
+};
+
 class GitObject;
 class GitObject {
   public:
     static GitHash write(GitObject* gitObject, bool actuallyWrite = true);
+    // Streams the file into a blob, without holding it in memory.
+    static GitHash writeBlob(const std::filesystem::path& filePath,
+                             bool actuallyWrite = true);
 
     static GitHash findObject(const std::string& name,
                               const std::string& format = "");
     static KeyValuesWithMessage
-    parseKeyValuesWithMessage(const std::string& data);
+    parseKeyValuesWithMessage(std::string_view data);
 
     static std::string resolveReference(const std::filesystem::path& reference, bool dereference = true);
 
   public:
-    virtual ObjectData serialize() = 0;
+    virtual ObjectData serialize() const = 0;
     virtual void deserialize(const ObjectData& data) = 0;
     virtual std::string format() const = 0;
     virtual ~GitObject();
@@ -69,7 +148,7 @@ class GitCommit : public GitObject {
     GitCommit(const CommitMessage& commitMessage);
     GitCommit() = default;
 
-    ObjectData serialize() override;
+    ObjectData serialize() const override;
     void deserialize(const ObjectData& data) override;
 
     std::string format() const override;
@@ -85,21 +164,29 @@ class GitTree : public GitObject {
     GitTree() = default;
     GitTree(const std::vector<GitTreeLeaf>& leaves);
 
-    ObjectData serialize() override;
+    ObjectData serialize() const override;
     void deserialize(const ObjectData& data) override;
     std::string format() const override;
 
+    // Entries read straight from the tree data, the cheap way to walk a tree.
+    GitTreeView entries() const;
+    // Same entries as separate objects, parsed on first use.
     const std::vector<GitTreeLeaf>& tree() const;
 
   public:
     static std::string fileMode(const std::filesystem::directory_entry& entry,
                                 const std::string& format);
+    // Format of the object a tree entry points to, empty for unknown modes.
+    static std::string formatOf(uint32_t mode);
 
   private:
-    std::vector<GitTreeLeaf> parseGitTree(const std::string& data);
+    static std::string serializeLeaves(const std::vector<GitTreeLeaf>& leaves);
 
   private:
-    std::vector<GitTreeLeaf> m_tree;
+    ObjectData m_data;
+    // trees are shared between threads by the object cache
+    mutable std::once_flag m_parsed;
+    mutable std::vector<GitTreeLeaf> m_tree;
 };
 
 class GitTag : public GitObject {
@@ -107,7 +194,7 @@ class GitTag : public GitObject {
     GitTag(const TagMessage& tagMessage);
     GitTag() = default;
 
-    ObjectData serialize() override;
+    ObjectData serialize() const override;
     void deserialize(const ObjectData& data) override;
     std::string format() const override;
 
@@ -119,7 +206,7 @@ class GitTag : public GitObject {
 
 class GitBlob : public GitObject {
   public:
-    ObjectData serialize() override;
+    ObjectData serialize() const override;
     void deserialize(const ObjectData& data) override;
     std::string format() const override;
 
@@ -136,5 +223,7 @@ using GitTag = Git::GitTag;
 using GitBlob = Git::GitBlob;
 using ObjectData = Git::ObjectData;
 using GitTreeLeaf = Git::GitTreeLeaf;
+using GitTreeEntry = Git::GitTreeEntry;
+using GitTreeView = Git::GitTreeView;
 using TagMessage = Git::TagMessage;
 using CommitMessage = Git::CommitMessage;
\ No newline at end of file
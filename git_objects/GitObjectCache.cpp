@@ -0,0 +1,136 @@
+#include "GitObjectCache.hpp"
+#include "GitObjectsFactory.hpp"
+
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+namespace {
+constexpr size_t DEFAULT_CACHE_LIMIT = 64 * 1024 * 1024;
+// bookkeeping of a single entry: the key, the list node and the object
+constexpr size_t ENTRY_OVERHEAD = 256;
+
+// Parsed objects take more memory than their content, mostly trees, which
+// may become a vector of leaves.
+size_t approximateSize(const Git::GitObject& object, size_t contentSize)
+{
+    auto size = contentSize + ENTRY_OVERHEAD;
+    if (auto tree = dynamic_cast<const Git::GitTree*>(&object)) {
+        auto entries = tree->entries();
+        size += std::distance(entries.begin(), entries.end()) *
+                sizeof(Git::GitTreeLeaf);
+    }
+    return size;
+}
+
+class ObjectCache {
+  public:
+    using Value = std::shared_ptr<const Git::GitObject>;
+
+    Value get(const GitHash& hash)
+    {
+        std::lock_guard lock(m_mutex);
+        auto it = m_entries.find(hash);
+        if (it == m_entries.end()) {
+            ++m_misses;
+            return nullptr;
+        }
+        ++m_hits;
+        m_lru.splice(m_lru.begin(), m_lru, it->second.position);
+        return it->second.value;
+    }
+
+    void put(const GitHash& hash, Value value, size_t size)
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_limit) {
+            m_limit = Git::GitRepository::configNumber("core.objectCacheLimit",
+                                                       DEFAULT_CACHE_LIMIT);
+        }
+        // another thread may have read the same object in the meantime
+        if (size > *m_limit || m_entries.contains(hash)) {
+            return;
+        }
+        m_lru.push_front(hash);
+        m_size += size;
+        m_entries[hash] = {std::move(value), size, m_lru.begin()};
+
+        while (m_size > *m_limit) {
+            auto evicted = m_entries.find(m_lru.back());
+            m_size -= evicted->second.size;
+            m_entries.erase(evicted);
+            m_lru.pop_back();
+            ++m_evictions;
+        }
+    }
+
+    Git::ObjectCacheStatistics statistics()
+    {
+        std::lock_guard lock(m_mutex);
+        return {.hits = m_hits,
+                .misses = m_misses,
+                .evictions = m_evictions,
+                .size = m_size,
+                .limit = m_limit.value_or(0)};
+    }
+
+    void clear()
+    {
+        std::lock_guard lock(m_mutex);
+        m_entries.clear();
+        m_lru.clear();
+        m_size = m_hits = m_misses = m_evictions = 0;
+        m_limit.reset();
+    }
+
+  private:
+    struct Entry {
+        Value value;
+        size_t size;
+        std::list<GitHash>::iterator position;
+    };
+
+    std::mutex m_mutex;
+    std::list<GitHash> m_lru;
+    std::unordered_map<GitHash, Entry> m_entries;
+    std::optional<size_t> m_limit;
+    size_t m_size = 0;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+    size_t m_evictions = 0;
+};
+
+ObjectCache& objectCache()
+{
+    static ObjectCache cache;
+    return cache;
+}
+}; // namespace
+
+namespace Git {
+
+std::shared_ptr<const GitObject> GitObjectCache::read(const GitHash& hash)
+{
+    auto& cache = objectCache();
+    if (auto cached = cache.get(hash)) {
+        return cached;
+    }
+
+    // reading happens outside of the lock, so a slow read doesn't hold up
+    // other threads
+    auto rawObject = GitObjectFactory::readRaw(hash);
+    auto contentSize = rawObject.data.size();
+    std::shared_ptr<const GitObject> object = GitObjectFactory::create(
+        rawObject.format, ObjectData(std::move(rawObject.data)));
+    cache.put(hash, object, approximateSize(*object, contentSize));
+    return object;
+}
+
+ObjectCacheStatistics GitObjectCache::statistics()
+{
+    return objectCache().statistics();
+}
+
+void GitObjectCache::clear() { objectCache().clear(); }
+}; // namespace Git
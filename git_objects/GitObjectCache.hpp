@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+
+#include "GitObject.hpp"
+
+namespace Git {
+
+struct ObjectCacheStatistics {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    // approximate memory taken by the cached objects
+    size_t size;
+    size_t limit;
+};
+
+/*
+    Parsed objects shared by everything that reads them during a command, so
+    walking history or trees doesn't go back to disk for objects it has just
+    seen. Objects are immutable, and since they are addressed by their
+    content a cached object never goes stale.
+    Least recently used objects are evicted once the total size is over
+    core.objectCacheLimit, 64m by default.
+*/
+class GitObjectCache {
+  public:
+    static std::shared_ptr<const GitObject> read(const GitHash& hash);
+
+    static ObjectCacheStatistics statistics();
+    // Drops every object and resets the counters, the limit is read from the
+    // config again on the next read.
+    static void clear();
+
+  private:
+    GitObjectCache() = delete;
+};
+}; // namespace Git
+
+using GitObjectCache = Git::GitObjectCache;
+using ObjectCacheStatistics = Git::ObjectCacheStatistics;
@@ -2,6 +2,114 @@
 
 #include "../utilities/Zlib.hpp"
 
+#include <charconv>
+#include <cstring>
+#include <fstream>
+
+namespace {
+// "commit" is the longest format, followed by up to 20 digits of size
+constexpr size_t MAX_HEADER_SIZE = 32;
+// a dynamic deflate block starts with its code tables, which rarely take
+// more than a few hundred bytes
+constexpr size_t HEADER_READ_SIZE = 512;
+
+// Parses "type size\0" at the beginning of an inflated object, headerSize is
+// set to the number of bytes it takes.
+Git::ObjectHeader parseHeader(std::string_view inflated,
+                              const GitHash& objectHash, size_t& headerSize)
+{
+    auto formatEnds = inflated.find(' ');
+    auto sizeEnds = inflated.find('\0');
+    size_t size = 0;
+    if (formatEnds == std::string_view::npos || sizeEnds < formatEnds ||
+        sizeEnds == std::string_view::npos ||
+        std::from_chars(inflated.data() + formatEnds + 1,
+                        inflated.data() + sizeEnds, size)
+                .ec != std::errc()) {
+        GENERATE_EXCEPTION("Malformed object: {}", objectHash.data());
+    }
+    headerSize = sizeEnds + 1;
+    return {.format = std::string(inflated.substr(0, formatEnds)),
+            .size = size};
+}
+
+Zlib::Inflater& threadInflater()
+{
+    // inflate state is big enough for its allocation to show up when
+    // reading many small objects
+    thread_local Zlib::Inflater inflater;
+    inflater.reset();
+    return inflater;
+}
+
+/*
+    |object type|| ||size||0|
+    |content ...|
+    The header is inflated first, then the content goes straight into a
+    buffer of the size it declares.
+*/
+Git::RawObject inflateLooseObject(std::string_view compressed,
+                                  const GitHash& objectHash)
+{
+    auto& inflater = threadInflater();
+    inflater.setInput(compressed);
+
+    char header[MAX_HEADER_SIZE];
+    auto inflated =
+        std::string_view(header, inflater.inflate(header, MAX_HEADER_SIZE));
+    size_t headerSize;
+    auto [format, size] = parseHeader(inflated, objectHash, headerSize);
+    Git::RawObject object{.format = std::move(format),
+                          .data = std::string(size, '\0')};
+
+    // the first chunk may already contain the beginning of the content
+    auto content = inflated.substr(headerSize);
+    if (content.size() > size) {
+        GENERATE_EXCEPTION("Malformed object: {}", objectHash.data());
+    }
+    std::memcpy(object.data.data(), content.data(), content.size());
+    auto produced =
+        content.size() + inflater.inflate(object.data.data() + content.size(),
+                                          size - content.size());
+
+    char sink;
+    if (produced != size || inflater.inflate(&sink, 1) != 0 ||
+        !inflater.finished()) {
+        GENERATE_EXCEPTION("Malformed object: {}", objectHash.data());
+    }
+    return object;
+}
+
+// Reads the compressed file in small chunks and stops as soon as the header
+// is inflated, so the size of the object doesn't matter.
+std::optional<Git::ObjectHeader>
+inflateLooseHeader(const std::filesystem::path& path, const GitHash& objectHash)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return std::nullopt;
+    }
+
+    auto& inflater = threadInflater();
+    char compressed[HEADER_READ_SIZE];
+    char header[MAX_HEADER_SIZE];
+    size_t inflated = 0;
+    while (inflated < MAX_HEADER_SIZE && !inflater.finished() &&
+           std::memchr(header, '\0', inflated) == nullptr) {
+        file.read(compressed, sizeof compressed);
+        if (file.gcount() == 0) {
+            break;
+        }
+        inflater.setInput({compressed, size_t(file.gcount())});
+        inflated += inflater.inflate(header + inflated,
+                                     MAX_HEADER_SIZE - inflated);
+    }
+
+    size_t headerSize;
+    return parseHeader({header, inflated}, objectHash, headerSize);
+}
+}; // namespace
+
 namespace Git {
 
 std::unique_ptr<GitObject>
@@ -23,28 +131,41 @@ GitObjectFactory::create(const std::string& format,
     GENERATE_EXCEPTION("Wrong Git Object format: {}", format);
 }
 
-std::unique_ptr<GitObject> GitObjectFactory::read(const GitHash& objectHash)
+RawObject GitObjectFactory::readRaw(const GitHash& objectHash)
 {
-    auto path = GitRepository::repoFile(
+    auto path = GitRepository::repoPath(
         "objects", Utilities::getObjectDirectory(objectHash),
         Utilities::getObjectFileName(objectHash));
 
-    auto objectContent = Zlib::decompressFile(path);
-    /*
-        |object type|| ||size||0|
-        |content ...|
-    */
-    auto formatEnds = objectContent.find_first_of(' ');
-    auto format = objectContent.substr(0, formatEnds);
+    thread_local std::string compressed;
+    if (!Utilities::tryReadFile(path, compressed)) {
+        if (auto packedObject = GitPackStore::read(objectHash)) {
+            return std::move(*packedObject);
+        }
+        GENERATE_EXCEPTION("No such object: {}", objectHash.data());
+    }
+    return inflateLooseObject(compressed, objectHash);
+}
 
-    auto sizeEnds = objectContent.find_first_of('\0', formatEnds);
-    auto size = std::stoi(objectContent.substr(formatEnds, sizeEnds));
+ObjectHeader GitObjectFactory::readHeader(const GitHash& objectHash)
+{
+    auto path = GitRepository::repoPath(
+        "objects", Utilities::getObjectDirectory(objectHash),
+        Utilities::getObjectFileName(objectHash));
 
-    if (size != objectContent.size() - sizeEnds - 1) {
-        GENERATE_EXCEPTION("Malformed object: {}", objectHash.data());
+    if (auto header = inflateLooseHeader(path, objectHash)) {
+        return std::move(*header);
     }
+    if (auto header = GitPackStore::readHeader(objectHash)) {
+        return std::move(*header);
+    }
+    GENERATE_EXCEPTION("No such object: {}", objectHash.data());
+}
 
-    auto objectData = ObjectData(objectContent.substr(sizeEnds + 1));
-    return GitObjectFactory::create(format, objectData);
+std::unique_ptr<GitObject> GitObjectFactory::read(const GitHash& objectHash)
+{
+    auto rawObject = readRaw(objectHash);
+    return GitObjectFactory::create(rawObject.format,
+                                    ObjectData(std::move(rawObject.data)));
 }
-}; // namespace Git
\ No newline at end of file
+}; // namespace Git
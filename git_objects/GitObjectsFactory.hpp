@@ -1,6 +1,7 @@
 #pragma once
 
 #include "GitObject.hpp"
+#include "GitPack.hpp"
 #include "GitRepository.hpp"
 
 namespace Git {
@@ -10,6 +11,10 @@ class GitObjectFactory {
                                              const ObjectData& data);
 
     static std::unique_ptr<GitObject> read(const GitHash& sha1);
+    // Object content exactly as stored, without parsing it.
+    static RawObject readRaw(const GitHash& sha1);
+    // Type and size of the object, only its first bytes are inflated.
+    static ObjectHeader readHeader(const GitHash& sha1);
 
   private:
     template <class T>
@@ -0,0 +1,568 @@
+#include "GitPack.hpp"
+#include "../utilities/Zlib.hpp"
+#include "GitDelta.hpp"
+#include "GitRepository.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+
+namespace {
+constexpr uint32_t INDEX_SIGNATURE = 0xff744f63;
+constexpr uint32_t INDEX_VERSION = 2;
+constexpr size_t FANOUT_OFFSET = 8;
+constexpr size_t FANOUT_SIZE = 256 * 4;
+constexpr size_t PACK_HEADER_SIZE = 12;
+// same default as git's core.deltaBaseCacheLimit
+constexpr size_t DELTA_BASE_CACHE_LIMIT = 96 * 1024 * 1024;
+
+uint32_t readBigEndian32(const unsigned char* data)
+{
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) |
+           (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+}
+
+uint64_t readBigEndian64(const unsigned char* data)
+{
+    return (uint64_t(readBigEndian32(data)) << 32) |
+           readBigEndian32(data + 4);
+}
+
+std::string formatOf(Git::PackObjectType type)
+{
+    switch (type) {
+    case Git::PackObjectType::COMMIT:
+        return "commit";
+    case Git::PackObjectType::TREE:
+        return "tree";
+    case Git::PackObjectType::BLOB:
+        return "blob";
+    case Git::PackObjectType::TAG:
+        return "tag";
+    default:
+        GENERATE_EXCEPTION("Object type {} has no format",
+                           static_cast<int>(type));
+    }
+}
+
+// Objects that served as delta bases, so walking a chain of deltas that share
+// a base doesn't inflate the base over and over again. Least recently used
+// bases are evicted once the total size is over the limit.
+class DeltaBaseCache {
+  public:
+    using Key = std::pair<const Git::GitPack*, uint64_t>;
+    using Value = std::shared_ptr<const Git::RawObject>;
+
+    Value get(const Key& key)
+    {
+        std::lock_guard lock(m_mutex);
+        auto it = m_entries.find(key);
+        if (it == m_entries.end()) {
+            return nullptr;
+        }
+        m_lru.splice(m_lru.begin(), m_lru, it->second.position);
+        return it->second.value;
+    }
+
+    void put(const Key& key, Value value)
+    {
+        std::lock_guard lock(m_mutex);
+        if (value->data.size() > DELTA_BASE_CACHE_LIMIT ||
+            m_entries.contains(key)) {
+            return;
+        }
+        m_lru.push_front(key);
+        m_size += value->data.size();
+        m_entries[key] = {std::move(value), m_lru.begin()};
+
+        while (m_size > DELTA_BASE_CACHE_LIMIT) {
+            auto evicted = m_entries.find(m_lru.back());
+            m_size -= evicted->second.value->data.size();
+            m_entries.erase(evicted);
+            m_lru.pop_back();
+        }
+    }
+
+    void forget(const Git::GitPack* pack)
+    {
+        std::lock_guard lock(m_mutex);
+        for (auto it = m_lru.begin(); it != m_lru.end();) {
+            if (it->first == pack) {
+                auto entry = m_entries.find(*it);
+                m_size -= entry->second.value->data.size();
+                m_entries.erase(entry);
+                it = m_lru.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+  private:
+    struct Entry {
+        Value value;
+        std::list<Key>::iterator position;
+    };
+
+    std::mutex m_mutex;
+    std::list<Key> m_lru;
+    std::map<Key, Entry> m_entries;
+    size_t m_size = 0;
+};
+
+DeltaBaseCache& deltaBaseCache()
+{
+    static DeltaBaseCache cache;
+    return cache;
+}
+
+struct PackDirectory {
+    std::mutex mutex;
+    std::filesystem::path path;
+    std::filesystem::file_time_type lastWriteTime;
+    std::vector<std::shared_ptr<Git::GitPack>> packs;
+    bool loaded = false;
+};
+
+PackDirectory& packDirectory()
+{
+    static PackDirectory directory;
+    return directory;
+}
+
+// Rescans objects/pack if it changed since the last scan. Packs that are
+// still present are kept open.
+void rescan(PackDirectory& directory)
+{
+    auto packDir = Git::GitRepository::repoDir("objects", "pack");
+    if (packDir.empty()) {
+        for (const auto& pack : directory.packs) {
+            deltaBaseCache().forget(pack.get());
+        }
+        directory.packs.clear();
+        directory.path.clear();
+        directory.loaded = true;
+        return;
+    }
+
+    auto lastWriteTime = std::filesystem::last_write_time(packDir);
+    if (directory.loaded && directory.path == packDir &&
+        directory.lastWriteTime == lastWriteTime) {
+        return;
+    }
+
+    std::vector<std::shared_ptr<Git::GitPack>> packs;
+    for (const auto& dirEntry : std::filesystem::directory_iterator(packDir)) {
+        auto indexPath = dirEntry.path();
+        if (indexPath.extension() != ".idx" ||
+            !std::filesystem::exists(
+                std::filesystem::path(indexPath).replace_extension(".pack"))) {
+            continue;
+        }
+        auto opened = std::find_if(
+            directory.packs.begin(), directory.packs.end(),
+            [&](const auto& pack) { return pack->indexPath() == indexPath; });
+        if (opened != directory.packs.end()) {
+            packs.push_back(*opened);
+        }
+        else {
+            packs.push_back(std::make_shared<Git::GitPack>(indexPath));
+        }
+    }
+    for (const auto& pack : directory.packs) {
+        if (std::find(packs.begin(), packs.end(), pack) == packs.end()) {
+            deltaBaseCache().forget(pack.get());
+        }
+    }
+
+    directory.packs = std::move(packs);
+    directory.path = packDir;
+    directory.lastWriteTime = lastWriteTime;
+    directory.loaded = true;
+}
+
+std::vector<std::shared_ptr<Git::GitPack>> packs(bool reload = false)
+{
+    auto& directory = packDirectory();
+    std::lock_guard lock(directory.mutex);
+    if (!directory.loaded || reload) {
+        rescan(directory);
+    }
+    return directory.packs;
+}
+
+template <class Visitor> bool visitPacks(Visitor&& visitor)
+{
+    for (const auto& pack : packs()) {
+        if (visitor(*pack)) {
+            return true;
+        }
+    }
+    for (const auto& pack : packs(true)) {
+        if (visitor(*pack)) {
+            return true;
+        }
+    }
+    return false;
+}
+}; // namespace
+
+namespace Git {
+
+GitPack::GitPack(const std::filesystem::path& indexPath)
+    : m_indexPath(indexPath), m_index(indexPath),
+      m_pack(std::filesystem::path(indexPath).replace_extension(".pack"))
+{
+    auto index = m_index.data();
+    if (m_index.size() < FANOUT_OFFSET + FANOUT_SIZE ||
+        readBigEndian32(index) != INDEX_SIGNATURE ||
+        readBigEndian32(index + 4) != INDEX_VERSION) {
+        GENERATE_EXCEPTION("Unsupported pack index: {}", indexPath.string());
+    }
+
+    // every fanout entry counts the objects of the ones before it too
+    auto fanout = index + FANOUT_OFFSET;
+    for (size_t i = 1; i < 256; ++i) {
+        if (readBigEndian32(fanout + (i - 1) * 4) >
+            readBigEndian32(fanout + i * 4)) {
+            GENERATE_EXCEPTION("Corrupted pack index fanout: {}",
+                               indexPath.string());
+        }
+    }
+
+    m_numberOfObjects = readBigEndian32(fanout + 255 * 4);
+    // hashes, crc32 and 4 bytes offsets, followed by two checksums
+    size_t minimalIndexSize = FANOUT_OFFSET + FANOUT_SIZE +
+                              size_t(m_numberOfObjects) * (20 + 4 + 4) +
+                              2 * BinaryHash::SIZE;
+    if (m_index.size() < minimalIndexSize) {
+        GENERATE_EXCEPTION("Truncated pack index: {}", indexPath.string());
+    }
+
+    auto pack = m_pack.data();
+    if (m_pack.size() < PACK_HEADER_SIZE + BinaryHash::SIZE ||
+        std::memcmp(pack, "PACK", 4) != 0) {
+        GENERATE_EXCEPTION("Not a packfile: {}",
+                           std::filesystem::path(indexPath)
+                               .replace_extension(".pack")
+                               .string());
+    }
+    if (auto version = readBigEndian32(pack + 4);
+        version != 2 && version != 3) {
+        GENERATE_EXCEPTION("Unsupported packfile version {}", version);
+    }
+    if (readBigEndian32(pack + 8) != m_numberOfObjects) {
+        GENERATE_EXCEPTION("Pack and its index disagree on number of objects: "
+                           "{}",
+                           indexPath.string());
+    }
+}
+
+uint32_t GitPack::numberOfObjects() const { return m_numberOfObjects; }
+
+const std::filesystem::path& GitPack::indexPath() const { return m_indexPath; }
+
+GitHash GitPack::hash(uint32_t position) const
+{
+    return GitHash::fromBytes(hashAt(position));
+}
+
+std::pair<uint32_t, uint32_t> GitPack::fanoutRange(uint8_t firstByte) const
+{
+    auto fanout = m_index.data() + FANOUT_OFFSET;
+    uint32_t begin =
+        firstByte == 0 ? 0 : readBigEndian32(fanout + (firstByte - 1) * 4);
+    uint32_t end = readBigEndian32(fanout + firstByte * 4);
+    return {begin, end};
+}
+
+const unsigned char* GitPack::hashAt(uint32_t position) const
+{
+    return m_index.data() + FANOUT_OFFSET + FANOUT_SIZE +
+           size_t(position) * BinaryHash::SIZE;
+}
+
+uint64_t GitPack::offsetAt(uint32_t position) const
+{
+    auto offsets = m_index.data() + FANOUT_OFFSET + FANOUT_SIZE +
+                   size_t(m_numberOfObjects) * (BinaryHash::SIZE + 4);
+    uint32_t offset = readBigEndian32(offsets + size_t(position) * 4);
+    if (!(offset & 0x80000000)) {
+        return offset;
+    }
+
+    // the most significant bit marks an index into the 8 bytes offsets table
+    auto largeOffsets = offsets + size_t(m_numberOfObjects) * 4;
+    auto largeOffset = largeOffsets + size_t(offset & 0x7fffffff) * 8;
+    if (largeOffset + 8 > m_index.data() + m_index.size()) {
+        GENERATE_EXCEPTION("Corrupted pack index: {}", m_indexPath.string());
+    }
+    return readBigEndian64(largeOffset);
+}
+
+std::optional<uint64_t> GitPack::find(const GitHash& hash) const
+{
+    auto needle = reinterpret_cast<const unsigned char*>(hash.bytes().data());
+    auto [low, high] = fanoutRange(needle[0]);
+
+    while (low < high) {
+        auto middle = low + (high - low) / 2;
+        auto compared = std::memcmp(hashAt(middle), needle, BinaryHash::SIZE);
+        if (compared == 0) {
+            return offsetAt(middle);
+        }
+        if (compared < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return std::nullopt;
+}
+
+void GitPack::findByPrefix(const std::string& hexPrefix,
+                           std::vector<GitHash>& candidates) const
+{
+    if (hexPrefix.size() < 2) {
+        return;
+    }
+    auto firstByte =
+        static_cast<uint8_t>(std::stoi(hexPrefix.substr(0, 2), nullptr, 16));
+    auto [begin, end] = fanoutRange(firstByte);
+    for (auto position = begin; position < end; ++position) {
+        auto hash = GitHash::fromBytes(hashAt(position));
+        if (hash.data().starts_with(hexPrefix)) {
+            candidates.push_back(hash);
+        }
+    }
+}
+
+/*
+    Every entry starts with a variable length header:
+        |1 bit more||3 bits type||4 bits size| |1 bit more||7 bits size| ...
+    OFS_DELTA entries follow it with a negative offset to their base, REF_DELTA
+    entries with the 20 bytes hash of their base.
+*/
+GitPack::EntryHeader GitPack::readEntryHeader(uint64_t offset) const
+{
+    auto pack = m_pack.data();
+    auto packEnd = m_pack.size() - BinaryHash::SIZE;
+    auto next = [&]() -> uint8_t {
+        if (offset >= packEnd) {
+            GENERATE_EXCEPTION("Truncated packfile: {}", m_indexPath.string());
+        }
+        return pack[offset++];
+    };
+
+    auto entryOffset = offset;
+    uint8_t byte = next();
+    EntryHeader header{.type = static_cast<PackObjectType>((byte >> 4) & 0x7),
+                       .size = size_t(byte & 0x0f),
+                       .dataOffset = 0,
+                       .baseOffset = 0};
+    int shift = 4;
+    while (byte & 0x80) {
+        byte = next();
+        header.size |= size_t(byte & 0x7f) << shift;
+        shift += 7;
+    }
+
+    if (header.type == PackObjectType::OFS_DELTA) {
+        byte = next();
+        uint64_t distance = byte & 0x7f;
+        while (byte & 0x80) {
+            byte = next();
+            distance = ((distance + 1) << 7) | (byte & 0x7f);
+        }
+        if (distance == 0 || distance > entryOffset) {
+            GENERATE_EXCEPTION("Corrupted delta base offset in {}",
+                               m_indexPath.string());
+        }
+        header.baseOffset = entryOffset - distance;
+    }
+    else if (header.type == PackObjectType::REF_DELTA) {
+        if (offset + BinaryHash::SIZE > packEnd) {
+            GENERATE_EXCEPTION("Truncated packfile: {}", m_indexPath.string());
+        }
+        auto baseHash = GitHash::fromBytes(pack + offset);
+        offset += BinaryHash::SIZE;
+        auto baseOffset = find(baseHash);
+        if (!baseOffset) {
+            GENERATE_EXCEPTION("Delta base {} is missing from {}",
+                               baseHash.data(), m_indexPath.string());
+        }
+        header.baseOffset = *baseOffset;
+    }
+    else if (header.type != PackObjectType::COMMIT &&
+             header.type != PackObjectType::TREE &&
+             header.type != PackObjectType::BLOB &&
+             header.type != PackObjectType::TAG) {
+        GENERATE_EXCEPTION("Unknown object type {} in {}",
+                           static_cast<int>(header.type),
+                           m_indexPath.string());
+    }
+
+    header.dataOffset = offset;
+    return header;
+}
+
+std::string_view GitPack::entryData(uint64_t dataOffset) const
+{
+    std::call_once(m_sortedOffsetsFlag, [this]() {
+        m_sortedOffsets.reserve(m_numberOfObjects);
+        for (uint32_t position = 0; position < m_numberOfObjects; ++position) {
+            m_sortedOffsets.push_back(offsetAt(position));
+        }
+        std::sort(m_sortedOffsets.begin(), m_sortedOffsets.end());
+    });
+
+    uint64_t end = m_pack.size() - BinaryHash::SIZE;
+    auto next = std::upper_bound(m_sortedOffsets.begin(),
+                                 m_sortedOffsets.end(), dataOffset);
+    if (next != m_sortedOffsets.end()) {
+        end = std::min(end, *next);
+    }
+    if (dataOffset > end) {
+        GENERATE_EXCEPTION("Truncated packfile: {}", m_indexPath.string());
+    }
+    return m_pack.view().substr(dataOffset, end - dataOffset);
+}
+
+void GitPack::checkChainLength(size_t length) const
+{
+    if (length >= m_numberOfObjects) {
+        GENERATE_EXCEPTION("Delta chain loops in {}", m_indexPath.string());
+    }
+}
+
+std::string GitPack::inflateEntry(const EntryHeader& header) const
+{
+    return Zlib::decompress(entryData(header.dataOffset), header.size);
+}
+
+RawObject GitPack::read(uint64_t offset) const
+{
+    auto& cache = deltaBaseCache();
+    if (auto cached = cache.get({this, offset})) {
+        return *cached;
+    }
+
+    // walk down the chain until a plain object or a cached base is found
+    std::vector<std::pair<uint64_t, EntryHeader>> deltas;
+    std::shared_ptr<const RawObject> base;
+    auto current = offset;
+    while (true) {
+        if (!deltas.empty()) {
+            if (base = cache.get({this, current}); base) {
+                break;
+            }
+        }
+        auto header = readEntryHeader(current);
+        if (header.type == PackObjectType::OFS_DELTA ||
+            header.type == PackObjectType::REF_DELTA) {
+            deltas.emplace_back(current, header);
+            checkChainLength(deltas.size());
+            current = header.baseOffset;
+            continue;
+        }
+
+        auto object = RawObject{.format = formatOf(header.type),
+                                .data = inflateEntry(header)};
+        if (deltas.empty()) {
+            return object;
+        }
+        base = std::make_shared<const RawObject>(std::move(object));
+        break;
+    }
+
+    // apply deltas from the base up, everything but the requested object is
+    // a base for the next delta
+    auto baseOffset = current;
+    for (auto it = deltas.rbegin(); it != deltas.rend(); ++it) {
+        cache.put({this, baseOffset}, base);
+
+        const auto& [deltaOffset, header] = *it;
+        auto delta = inflateEntry(header);
+        auto result =
+            RawObject{.format = base->format,
+                      .data = GitDelta::apply(base->data, delta)};
+        if (std::next(it) == deltas.rend()) {
+            return result;
+        }
+        base = std::make_shared<const RawObject>(std::move(result));
+        baseOffset = deltaOffset;
+    }
+    return *base;
+}
+
+ObjectHeader GitPack::readHeader(uint64_t offset) const
+{
+    auto header = readEntryHeader(offset);
+    if (header.type != PackObjectType::OFS_DELTA &&
+        header.type != PackObjectType::REF_DELTA) {
+        return {.format = formatOf(header.type), .size = header.size};
+    }
+
+    // two varints of at most 10 bytes each
+    char deltaHeader[20];
+    Zlib::Inflater inflater;
+    inflater.setInput(entryData(header.dataOffset));
+    auto inflated = inflater.inflate(deltaHeader,
+                                     std::min(header.size, sizeof deltaHeader));
+    auto size = GitDelta::resultSize({deltaHeader, inflated});
+
+    auto base = readEntryHeader(header.baseOffset);
+    for (size_t length = 2; base.type == PackObjectType::OFS_DELTA ||
+                            base.type == PackObjectType::REF_DELTA;
+         ++length) {
+        checkChainLength(length);
+        base = readEntryHeader(base.baseOffset);
+    }
+    return {.format = formatOf(base.type), .size = size};
+}
+
+std::optional<RawObject> GitPackStore::read(const GitHash& hash)
+{
+    std::optional<RawObject> object;
+    visitPacks([&](const GitPack& pack) {
+        if (auto offset = pack.find(hash)) {
+            object = pack.read(*offset);
+            return true;
+        }
+        return false;
+    });
+    return object;
+}
+
+std::optional<ObjectHeader> GitPackStore::readHeader(const GitHash& hash)
+{
+    std::optional<ObjectHeader> header;
+    visitPacks([&](const GitPack& pack) {
+        if (auto offset = pack.find(hash)) {
+            header = pack.readHeader(*offset);
+            return true;
+        }
+        return false;
+    });
+    return header;
+}
+
+bool GitPackStore::contains(const GitHash& hash)
+{
+    return visitPacks(
+        [&](const GitPack& pack) { return pack.find(hash).has_value(); });
+}
+
+std::vector<GitHash> GitPackStore::findByPrefix(const std::string& hexPrefix)
+{
+    std::vector<GitHash> candidates;
+    for (const auto& pack : packs(true)) {
+        pack->findByPrefix(hexPrefix, candidates);
+    }
+    return candidates;
+}
+}; // namespace Git
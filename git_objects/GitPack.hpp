@@ -0,0 +1,113 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../utilities/MappedFile.hpp"
+#include "GitHash.hpp"
+
+namespace Git {
+
+// Object content as stored in the database, before it is turned into a
+// GitObject.
+struct RawObject {
+    std::string format;
+    std::string data;
+};
+
+// Type and size of an object, known without inflating all of its content.
+struct ObjectHeader {
+    std::string format;
+    size_t size;
+};
+
+enum class PackObjectType : uint8_t {
+    COMMIT = 1,
+    TREE = 2,
+    BLOB = 3,
+    TAG = 4,
+    OFS_DELTA = 6,
+    REF_DELTA = 7
+};
+
+/*
+    A packfile together with its version 2 index, both memory mapped.
+    Index layout:
+        |ff 74 4f 63||version = 2|
+        |fanout: 256 x 4 bytes, number of objects with first byte <= i|
+        |sorted 20 bytes hashes||crc32 of entries||4 bytes offsets|
+        |8 bytes offsets for packs larger than 2GB|
+        |pack checksum||index checksum|
+*/
+class GitPack {
+  public:
+    explicit GitPack(const std::filesystem::path& indexPath);
+
+    std::optional<uint64_t> find(const GitHash& hash) const;
+    void findByPrefix(const std::string& hexPrefix,
+                      std::vector<GitHash>& candidates) const;
+
+    // Reads the object that starts at offset, resolving delta chains.
+    RawObject read(uint64_t offset) const;
+    // Follows delta chains down to the base for the type, the size comes
+    // from the first bytes of the delta.
+    ObjectHeader readHeader(uint64_t offset) const;
+
+    uint32_t numberOfObjects() const;
+    // Hash of the object at position in the index, in hash order.
+    GitHash hash(uint32_t position) const;
+    const std::filesystem::path& indexPath() const;
+
+  private:
+    struct EntryHeader {
+        PackObjectType type;
+        size_t size;
+        uint64_t dataOffset;
+        uint64_t baseOffset;
+    };
+
+    EntryHeader readEntryHeader(uint64_t offset) const;
+    std::string inflateEntry(const EntryHeader& header) const;
+    // Compressed data of the entry whose data starts at dataOffset, bounded by
+    // the offset of the entry that follows it.
+    std::string_view entryData(uint64_t dataOffset) const;
+    // Entries a delta chain can go through before it has to repeat one.
+    void checkChainLength(size_t length) const;
+    std::pair<uint32_t, uint32_t> fanoutRange(uint8_t firstByte) const;
+    const unsigned char* hashAt(uint32_t position) const;
+    uint64_t offsetAt(uint32_t position) const;
+
+  private:
+    std::filesystem::path m_indexPath;
+    Utilities::MappedFile m_index;
+    Utilities::MappedFile m_pack;
+    uint32_t m_numberOfObjects;
+    // offsets of all entries in pack order, built on first use
+    mutable std::once_flag m_sortedOffsetsFlag;
+    mutable std::vector<uint64_t> m_sortedOffsets;
+};
+
+// All packs under objects/pack. Packs are loaded lazily and the directory is
+// rescanned when a lookup misses, so packs written by another process are
+// picked up.
+class GitPackStore {
+  public:
+    static std::optional<RawObject> read(const GitHash& hash);
+    static std::optional<ObjectHeader> readHeader(const GitHash& hash);
+    static bool contains(const GitHash& hash);
+    static std::vector<GitHash> findByPrefix(const std::string& hexPrefix);
+
+  private:
+    GitPackStore() = delete;
+};
+}; // namespace Git
+
+using RawObject = Git::RawObject;
+using ObjectHeader = Git::ObjectHeader;
+using GitPack = Git::GitPack;
+using GitPackStore = Git::GitPackStore;
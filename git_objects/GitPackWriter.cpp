@@ -0,0 +1,345 @@
+#include "GitPackWriter.hpp"
+#include "../utilities/SHA1.hpp"
+#include "../utilities/TemporaryFile.hpp"
+#include "../utilities/Zlib.hpp"
+#include "GitDelta.hpp"
+#include "GitObjectsFactory.hpp"
+#include "GitPack.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <deque>
+#include <numeric>
+#include <zlib.h>
+
+namespace {
+constexpr uint32_t INDEX_SIGNATURE = 0xff744f63;
+constexpr uint32_t INDEX_VERSION = 2;
+constexpr uint32_t PACK_VERSION = 2;
+constexpr uint64_t LARGE_OFFSET = 0x80000000;
+constexpr size_t WRITE_BUFFER_SIZE = 64 * 1024;
+
+struct Candidate {
+    GitHash hash;
+    Git::PackObjectType type;
+    uint32_t nameHash;
+    size_t size;
+    // index of the delta base in the sorted candidates, -1 for whole objects
+    int base = -1;
+    int depth = 0;
+    uint64_t offset = 0;
+    uint32_t crc = 0;
+};
+
+void writeBigEndian32(std::string& out, uint32_t value)
+{
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+void writeBigEndian64(std::string& out, uint64_t value)
+{
+    writeBigEndian32(out, static_cast<uint32_t>(value >> 32));
+    writeBigEndian32(out, static_cast<uint32_t>(value));
+}
+
+// Same as git's pack_name_hash, the last characters of the name weigh the
+// most, so files with the same extension end up next to each other.
+uint32_t nameHash(std::string_view name)
+{
+    uint32_t hash = 0;
+    for (unsigned char c : name) {
+        if (std::isspace(c)) {
+            continue;
+        }
+        hash = (hash >> 2) + (uint32_t(c) << 24);
+    }
+    return hash;
+}
+
+Git::PackObjectType typeOf(const std::string& format)
+{
+    if (format == "commit") {
+        return Git::PackObjectType::COMMIT;
+    }
+    else if (format == "tree") {
+        return Git::PackObjectType::TREE;
+    }
+    else if (format == "blob") {
+        return Git::PackObjectType::BLOB;
+    }
+    else if (format == "tag") {
+        return Git::PackObjectType::TAG;
+    }
+    GENERATE_EXCEPTION("Wrong Git Object format: {}", format);
+}
+
+std::string entryHeader(Git::PackObjectType type, size_t size)
+{
+    std::string header;
+    uint8_t byte = (static_cast<uint8_t>(type) << 4) | (size & 0x0f);
+    size >>= 4;
+    while (size != 0) {
+        header.push_back(static_cast<char>(byte | 0x80));
+        byte = size & 0x7f;
+        size >>= 7;
+    }
+    header.push_back(static_cast<char>(byte));
+    return header;
+}
+
+// Distance to the delta base, big endian with one added to every byte but
+// the last, see GitPack::readEntryHeader.
+std::string encodeBaseDistance(uint64_t distance)
+{
+    std::string encoded(1, static_cast<char>(distance & 0x7f));
+    while (distance >>= 7) {
+        --distance;
+        encoded.insert(encoded.begin(),
+                       static_cast<char>(0x80 | (distance & 0x7f)));
+    }
+    return encoded;
+}
+
+// The packfile as it is written, hashed on the way and buffered, so small
+// entries don't cost a write each.
+class PackStream {
+  public:
+    explicit PackStream(const std::filesystem::path& directory)
+        : m_file(directory)
+    {
+    }
+
+    void write(std::string_view data)
+    {
+        m_hasher.update(data);
+        m_crc = crc32_z(m_crc, reinterpret_cast<const Bytef*>(data.data()),
+                        data.size());
+        m_size += data.size();
+        if (m_buffer.size() + data.size() > WRITE_BUFFER_SIZE) {
+            flush();
+        }
+        if (data.size() >= WRITE_BUFFER_SIZE) {
+            m_file.write(data);
+        }
+        else {
+            m_buffer += data;
+        }
+    }
+
+    // Starts the crc32 the index keeps for every entry.
+    void beginEntry() { m_crc = crc32_z(0, nullptr, 0); }
+    uint32_t entryCrc() const { return static_cast<uint32_t>(m_crc); }
+    uint64_t size() const { return m_size; }
+
+    // Appends the checksum of everything written before it.
+    GitHash finish()
+    {
+        auto checksum = m_hasher.finalize();
+        write(checksum.bytes());
+        flush();
+        return checksum;
+    }
+
+    void commit(const std::filesystem::path& packPath)
+    {
+        m_file.commit(packPath, true);
+    }
+
+  private:
+    void flush()
+    {
+        m_file.write(m_buffer);
+        m_buffer.clear();
+    }
+
+  private:
+    Utilities::TemporaryFile m_file;
+    SHA1::Hasher m_hasher;
+    std::string m_buffer;
+    uLong m_crc = 0;
+    uint64_t m_size = 0;
+};
+
+void writeEntry(Candidate& candidate, uint64_t baseOffset,
+                std::string_view content, PackStream& pack)
+{
+    candidate.offset = pack.size();
+    pack.beginEntry();
+    if (candidate.base != -1) {
+        pack.write(entryHeader(Git::PackObjectType::OFS_DELTA, content.size()));
+        pack.write(encodeBaseDistance(candidate.offset - baseOffset));
+    }
+    else {
+        pack.write(entryHeader(candidate.type, content.size()));
+    }
+    Zlib::Deflater deflater;
+    auto sink = [&](std::string_view compressed) { pack.write(compressed); };
+    deflater.write(content, sink);
+    deflater.finish(sink);
+    candidate.crc = pack.entryCrc();
+}
+
+// Writes every candidate, as a delta of one of the previous `window` ones
+// when that is less than half of its size. Only the window is kept in memory,
+// delta bases always precede their deltas in the sorted order. Returns the
+// number of deltas.
+size_t writeEntries(std::vector<Candidate>& candidates, int window, int depth,
+                    PackStream& pack)
+{
+    size_t numberOfDeltas = 0;
+    std::deque<std::pair<int, std::string>> recent;
+    for (int i = 0; i < static_cast<int>(candidates.size()); ++i) {
+        auto& candidate = candidates[i];
+        auto data = Git::GitObjectFactory::readRaw(candidate.hash).data;
+
+        std::string bestDelta;
+        for (auto it = recent.rbegin(); it != recent.rend(); ++it) {
+            const auto& [baseIndex, baseData] = *it;
+            const auto& base = candidates[baseIndex];
+            if (base.type != candidate.type || base.depth >= depth) {
+                continue;
+            }
+            auto maxSize =
+                bestDelta.empty() ? data.size() / 2 : bestDelta.size() - 1;
+            // a much smaller base can't produce a small enough delta
+            if (baseData.size() + maxSize < data.size()) {
+                continue;
+            }
+            auto delta = GitDelta::create(baseData, data, maxSize);
+            if (!delta.empty()) {
+                bestDelta = std::move(delta);
+                candidate.base = baseIndex;
+            }
+        }
+
+        if (candidate.base != -1) {
+            const auto& base = candidates[candidate.base];
+            candidate.depth = base.depth + 1;
+            writeEntry(candidate, base.offset, bestDelta, pack);
+            ++numberOfDeltas;
+        }
+        else {
+            writeEntry(candidate, 0, data, pack);
+        }
+
+        recent.emplace_back(i, std::move(data));
+        if (static_cast<int>(recent.size()) > window) {
+            recent.pop_front();
+        }
+    }
+    return numberOfDeltas;
+}
+
+std::string buildIndex(const std::vector<Candidate>& candidates,
+                       std::string_view packChecksum)
+{
+    std::vector<size_t> sorted(candidates.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::sort(sorted.begin(), sorted.end(), [&](size_t lhs, size_t rhs) {
+        return candidates[lhs].hash < candidates[rhs].hash;
+    });
+
+    std::string index;
+    writeBigEndian32(index, INDEX_SIGNATURE);
+    writeBigEndian32(index, INDEX_VERSION);
+
+    std::array<uint32_t, 256> fanout{};
+    for (const auto& candidate : candidates) {
+        ++fanout[static_cast<uint8_t>(candidate.hash.bytes()[0])];
+    }
+    uint32_t total = 0;
+    for (auto count : fanout) {
+        total += count;
+        writeBigEndian32(index, total);
+    }
+
+    for (auto position : sorted) {
+        index += candidates[position].hash.bytes();
+    }
+    for (auto position : sorted) {
+        writeBigEndian32(index, candidates[position].crc);
+    }
+    std::vector<uint64_t> largeOffsets;
+    for (auto position : sorted) {
+        auto offset = candidates[position].offset;
+        if (offset < LARGE_OFFSET) {
+            writeBigEndian32(index, static_cast<uint32_t>(offset));
+        }
+        else {
+            writeBigEndian32(index, LARGE_OFFSET | largeOffsets.size());
+            largeOffsets.push_back(offset);
+        }
+    }
+    for (auto offset : largeOffsets) {
+        writeBigEndian64(index, offset);
+    }
+
+    index += packChecksum;
+    index += SHA1::computeHash(index).bytes();
+    return index;
+}
+}; // namespace
+
+namespace Git {
+
+PackSummary GitPackWriter::write(const std::vector<PackEntry>& objects,
+                                 const std::filesystem::path& packDirectory,
+                                 int window, int depth)
+{
+    std::vector<Candidate> candidates;
+    candidates.reserve(objects.size());
+    for (const auto& object : objects) {
+        // content is only needed once deltas are searched
+        auto header = GitObjectFactory::readHeader(object.hash);
+        candidates.push_back({.hash = object.hash,
+                              .type = typeOf(header.format),
+                              .nameHash = nameHash(object.name),
+                              .size = header.size,
+                              .base = -1,
+                              .depth = 0,
+                              .offset = 0,
+                              .crc = 0});
+    }
+
+    // bigger objects first, so deltas mostly remove data, which makes them
+    // smaller than deltas that add data
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Candidate& lhs, const Candidate& rhs) {
+                         if (lhs.type != rhs.type) {
+                             return lhs.type < rhs.type;
+                         }
+                         if (lhs.nameHash != rhs.nameHash) {
+                             return lhs.nameHash < rhs.nameHash;
+                         }
+                         return lhs.size > rhs.size;
+                     });
+
+    std::filesystem::create_directories(packDirectory);
+    PackStream pack(packDirectory);
+    std::string packHeader = "PACK";
+    writeBigEndian32(packHeader, PACK_VERSION);
+    writeBigEndian32(packHeader, candidates.size());
+    pack.write(packHeader);
+    auto numberOfDeltas = writeEntries(candidates, window, depth, pack);
+    auto packHash = pack.finish();
+    auto packChecksum = packHash.bytes();
+
+    auto baseName = packDirectory / fmt::format("pack-{}", packHash);
+    auto packPath = std::filesystem::path(baseName).replace_extension(".pack");
+    auto indexPath = std::filesystem::path(baseName).replace_extension(".idx");
+
+    // the index is what makes the pack visible, so it goes last
+    pack.commit(packPath);
+    Utilities::writeFileAtomically(
+        indexPath, buildIndex(candidates, packChecksum), true);
+
+    return {.packPath = packPath,
+            .indexPath = indexPath,
+            .numberOfObjects = candidates.size(),
+            .numberOfDeltas = numberOfDeltas};
+}
+}; // namespace Git
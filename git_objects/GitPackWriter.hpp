@@ -0,0 +1,41 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "GitHash.hpp"
+
+namespace Git {
+
+struct PackEntry {
+    GitHash hash;
+    // Path the object was reached by. Objects with similar names are tried
+    // as delta bases for each other.
+    std::string name;
+};
+
+struct PackSummary {
+    std::filesystem::path packPath;
+    std::filesystem::path indexPath;
+    size_t numberOfObjects;
+    size_t numberOfDeltas;
+};
+
+// Writes a version 2 packfile and its index. Every object is compared with
+// the previous `window` objects of the same type, sorted by name and size,
+// and stored as OFS_DELTA when a delta is less than half of its size.
+class GitPackWriter {
+  public:
+    static PackSummary write(const std::vector<PackEntry>& objects,
+                             const std::filesystem::path& packDirectory,
+                             int window = 10, int depth = 50);
+
+  private:
+    GitPackWriter() = delete;
+};
+}; // namespace Git
+
+using PackEntry = Git::PackEntry;
+using PackSummary = Git::PackSummary;
+using GitPackWriter = Git::GitPackWriter;
@@ -1,9 +1,11 @@
 #include "GitRepository.hpp"
 #include "GitObject.hpp"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <charconv>
 #include <iostream>
 
 namespace Git {
@@ -25,7 +27,33 @@ void writeDefaultConfiguration(const GitRepository::Fpath& configFilePath)
     }
 }
 
-GitRepository GitRepository::findRoot(const GitRepository::Fpath& path)
+bool equalsIgnoreCase(std::string_view lhs, std::string_view rhs)
+{
+    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                      [](unsigned char l, unsigned char r) {
+                          return std::tolower(l) == std::tolower(r);
+                      });
+}
+
+const GitRepository& GitRepository::findRoot(const GitRepository::Fpath& path)
+{
+    if (path != ".") {
+        return searchRoot(path);
+    }
+
+    // every object path is built from the root, resolving the working
+    // directory each time costs more than reading a small object
+    thread_local Fpath lastWorkingDirectory;
+    thread_local const GitRepository* lastRoot = nullptr;
+    auto workingDirectory = Fs::current_path();
+    if (lastRoot == nullptr || workingDirectory != lastWorkingDirectory) {
+        lastRoot = &searchRoot(path);
+        lastWorkingDirectory = std::move(workingDirectory);
+    }
+    return *lastRoot;
+}
+
+const GitRepository& GitRepository::searchRoot(const GitRepository::Fpath& path)
 {
     auto currentDir = Fs::canonical(path);
     if (auto gitDir = currentDir / ".git"; Fs::exists(gitDir)) {
@@ -38,7 +66,7 @@ GitRepository GitRepository::findRoot(const GitRepository::Fpath& path)
         GENERATE_EXCEPTION("Couldn't find .git directory {}",
                            Fs::absolute(parentDir).string());
     }
-    return findRoot(parentDir);
+    return searchRoot(parentDir);
 }
 
 GitRepository GitRepository::create(const Fpath& path,
@@ -90,6 +118,144 @@ GitRepository::GitRepository(const Fpath& workTree, const Fpath& gitDir)
 {
 }
 
+std::optional<std::string> GitRepository::config(const std::string& key)
+{
+    auto dot = key.find('.');
+    if (dot == std::string::npos) {
+        GENERATE_EXCEPTION("Configuration key has no section: {}", key);
+    }
+
+    ConfigurationParser::ptree configuration;
+    try {
+        ConfigurationParser::read_ini(repoPath("config").string(),
+                                      configuration);
+    }
+    catch (const ConfigurationParser::ini_parser_error&) {
+        return std::nullopt;
+    }
+
+    auto section = std::string_view(key).substr(0, dot);
+    auto name = std::string_view(key).substr(dot + 1);
+    for (const auto& [sectionName, options] : configuration) {
+        if (!equalsIgnoreCase(sectionName, section)) {
+            continue;
+        }
+        for (const auto& [optionName, value] : options) {
+            if (equalsIgnoreCase(optionName, name)) {
+                return value.data();
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+bool GitRepository::configBool(const std::string& key, bool defaultValue)
+{
+    auto value = config(key);
+    if (!value) {
+        return defaultValue;
+    }
+    for (auto truth : {"true", "yes", "on", "1"}) {
+        if (equalsIgnoreCase(*value, truth)) {
+            return true;
+        }
+    }
+    for (auto falsehood : {"false", "no", "off", "0", ""}) {
+        if (equalsIgnoreCase(*value, falsehood)) {
+            return false;
+        }
+    }
+    GENERATE_EXCEPTION("Bad boolean config value '{}' for {}", *value, key);
+}
+
+// Integer with an optional k, m or g suffix, throws if there is anything
+// else.
+template <class Number>
+Number parseConfigNumber(const std::string& value, const std::string& key)
+{
+    Number number = 0;
+    auto [end, error] =
+        std::from_chars(value.data(), value.data() + value.size(), number);
+    auto suffix = std::string_view(end, value.data() + value.size());
+    if (error != std::errc() || suffix.size() > 1) {
+        GENERATE_EXCEPTION("Bad numeric config value '{}' for {}", value, key);
+    }
+    if (!suffix.empty()) {
+        switch (std::tolower(suffix[0])) {
+        case 'g':
+            number *= 1024;
+            [[fallthrough]];
+        case 'm':
+            number *= 1024;
+            [[fallthrough]];
+        case 'k':
+            number *= 1024;
+            break;
+        default:
+            GENERATE_EXCEPTION("Bad numeric config value '{}' for {}", value,
+                               key);
+        }
+    }
+    return number;
+}
+
+size_t GitRepository::configNumber(const std::string& key,
+                                   size_t defaultValue)
+{
+    auto value = config(key);
+    if (!value) {
+        return defaultValue;
+    }
+    return parseConfigNumber<size_t>(*value, key);
+}
+
+int GitRepository::configInt(const std::string& key, int defaultValue)
+{
+    auto value = config(key);
+    if (!value) {
+        return defaultValue;
+    }
+    return parseConfigNumber<int>(*value, key);
+}
+
+/*
+    packed-refs holds one ref per line, tags are followed by the object they
+    point to, which the ref isn't resolved to here:
+        # pack-refs with: peeled fully-peeled sorted
+        |40 hex hash|| ||refs/heads/main|
+        |^|40 hex hash of the object the tag points to|
+*/
+std::map<std::string, std::string> GitRepository::packedRefs()
+{
+    std::map<std::string, std::string> refs;
+    auto packedRefsPath = repoPath("packed-refs");
+    if (!Fs::exists(packedRefsPath)) {
+        return refs;
+    }
+
+    auto content = Utilities::readFile(packedRefsPath);
+    std::string_view lines(content);
+    while (!lines.empty()) {
+        auto lineEnds = std::min(lines.find('\n'), lines.size());
+        auto line = lines.substr(0, lineEnds);
+        lines.remove_prefix(std::min(lineEnds + 1, lines.size()));
+        if (line.empty() || line.starts_with('#') || line.starts_with('^')) {
+            continue;
+        }
+        auto space = line.find(' ');
+        if (space == std::string_view::npos) {
+            GENERATE_EXCEPTION("Corrupted packed-refs line: {}", line);
+        }
+        refs.emplace(line.substr(space + 1), line.substr(0, space));
+    }
+    return refs;
+}
+
+bool GitRepository::hasReference(const std::string& name)
+{
+    return Fs::is_regular_file(repoPath(name)) || packedRefs().contains(name);
+}
+
 GitRepository::Fpath GitRepository::pathToHead()
 {
     static Fpath pathToHead = repoPath("HEAD");
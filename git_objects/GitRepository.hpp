@@ -2,6 +2,8 @@
 
 #include <assert.h>
 #include <fstream>
+#include <map>
+#include <optional>
 #include <variant>
 
 #include "../utilities/Common.hpp"
@@ -20,7 +22,7 @@ class GitRepository {
 
   public:
     static GitRepository create(const Fpath& path, bool initializeRepository = true);
-    static GitRepository findRoot(const Fpath& path = ".");
+    static const GitRepository& findRoot(const Fpath& path = ".");
 
     static void setHEAD(const std::string& value);
     static void setHEAD(const GitHash& hash);
@@ -31,11 +33,27 @@ class GitRepository {
 
     static Fpath pathToHead();
 
+    // Refs that git gc moved to packed-refs, by full name, e.g.
+    // refs/heads/main. A loose file of the same ref takes precedence.
+    static std::map<std::string, std::string> packedRefs();
+    // True when the ref, e.g. refs/heads/main, is a loose file or packed.
+    static bool hasReference(const std::string& name);
+
+    // Value of a "section.key" option from .git/config, keys are case
+    // insensitive like in git.
+    static std::optional<std::string> config(const std::string& key);
+    // Numeric option, k, m and g suffixes scale it by 1024 like in git.
+    static size_t configNumber(const std::string& key, size_t defaultValue);
+    // Same as configNumber, but the value may be negative.
+    static int configInt(const std::string& key, int defaultValue);
+    // Boolean option: true, yes, on, 1 or false, no, off, 0.
+    static bool configBool(const std::string& key, bool defaultValue);
+
   public:
     template <class... T>
     static Fpath repoPath(T&&... path)
     {
-        auto root = GitRepository::findRoot();
+        const auto& root = GitRepository::findRoot();
         Fpath repoPath = (root.gitDir() / ... / path);
         return repoPath;
     }
@@ -95,6 +113,7 @@ class GitRepository {
     
   private:
     static void initialize(const GitRepository& repository);
+    static const GitRepository& searchRoot(const Fpath& path);
 
   private:
     Fpath m_workTree;
@@ -33,10 +33,18 @@ int main(int argc, char* argv[])
     catFileCommand.add_description("Provide content of repository objects.");
     catFileCommand.add_argument("type")
                   .help("Specify the type.")
-                  .metavar("type");
+                  .metavar("type")
+                  .nargs(argparse::nargs_pattern::optional);
     catFileCommand.add_argument("object")
                   .help("The object to display.")
-                  .metavar("object");
+                  .metavar("object")
+                  .nargs(argparse::nargs_pattern::optional);
+    catFileCommand.add_argument("--batch")
+                  .help("Print type, size and content of objects named on stdin, one per line.")
+                  .flag();
+    catFileCommand.add_argument("--batch-check")
+                  .help("Print type and size of objects named on stdin, one per line.")
+                  .flag();
 
     argparse::ArgumentParser hashObjectCommand("hash-object");
     hashObjectCommand.add_description("Compute object ID and optionally creates a blob from a file");
@@ -90,11 +98,36 @@ int main(int argc, char* argv[])
     argparse::ArgumentParser lsFilesCommand("ls-files");
     lsFilesCommand.add_description("List all the stage files.");
 
+    argparse::ArgumentParser addCommand("add");
+    addCommand.add_description("Add file contents to the index.");
+    addCommand.add_argument("paths")
+              .help("Files to add, directories add all the files inside of them.")
+              .metavar("path")
+              .nargs(argparse::nargs_pattern::at_least_one);
+    addCommand.add_argument("-j", "--jobs")
+              .help("Number of threads hashing files, by default core.threads or one per core.")
+              .metavar("n")
+              .default_value(0)
+              .scan<'i', int>();
+
+    argparse::ArgumentParser statusCommand("status");
+    statusCommand.add_description("Show the working tree status.");
+    statusCommand.add_argument("-j", "--jobs")
+                 .help("Number of threads checking files, by default core.threads or one per core.")
+                 .metavar("n")
+                 .default_value(0)
+                 .scan<'i', int>();
+
     argparse::ArgumentParser commitCommand("commit");
     commitCommand.add_description("Record changes to the repository.");
     commitCommand.add_argument("-m")
                  .help("Message to associate with this commit.")
                  .metavar("message");
+    commitCommand.add_argument("-j", "--jobs")
+                 .help("Number of threads writing objects, by default core.threads or one per core.")
+                 .metavar("n")
+                 .default_value(0)
+                 .scan<'i', int>();
     
     argparse::ArgumentParser branchCommand("branch");
     branchCommand.add_description("List, create branches.");
@@ -106,6 +139,67 @@ int main(int argc, char* argv[])
     checkoutCommand.add_description("Checkout a commit inside of a directory.");
     checkoutCommand.add_argument("commit")
                    .help("Commit to checkout to.");
+    checkoutCommand.add_argument("-f", "--force")
+                   .help("Overwrite local changes of the files that differ.")
+                   .flag();
+    checkoutCommand.add_argument("-j", "--jobs")
+                   .help("Number of threads writing files, by default checkout.workers, core.threads or one per core.")
+                   .metavar("n")
+                   .default_value(0)
+                   .scan<'i', int>();
+
+    argparse::ArgumentParser diffCommand("diff");
+    diffCommand.add_description("Show changes between two commits or trees.");
+    diffCommand.add_argument("from")
+               .help("Commit or tree to compare from.");
+    diffCommand.add_argument("to")
+               .help("Commit or tree to compare to.");
+    diffCommand.add_argument("--stat")
+               .help("Show the number of changed lines of each file instead of a patch.")
+               .flag();
+    diffCommand.add_argument("--name-only")
+               .help("Show only the names of the changed files.")
+               .flag();
+
+    argparse::ArgumentParser mergeCommand("merge");
+    mergeCommand.add_description("Join the history of a commit into the current branch, or into another branch without checking it out.");
+    mergeCommand.add_argument("commit")
+                .help("Branch or commit to merge.");
+    mergeCommand.add_argument("-m")
+                .help("Message of the merge commit.")
+                .metavar("message")
+                .default_value(std::string());
+    mergeCommand.add_argument("--into")
+                .help("Branch to merge into, only the objects are written and conflicts are refused.")
+                .metavar("branch")
+                .default_value(std::string());
+    mergeCommand.add_argument("-j", "--jobs")
+                .help("Number of threads writing files, by default checkout.workers, core.threads or one per core.")
+                .metavar("n")
+                .default_value(0)
+                .scan<'i', int>();
+
+    argparse::ArgumentParser fsmonitorCommand("fsmonitor");
+    fsmonitorCommand.add_description("Watch the worktree, so status and commit only look at changed files (needs core.fsmonitor).");
+    fsmonitorCommand.add_argument("action")
+                    .help("start, stop, run (in the foreground) or status.")
+                    .metavar("action");
+
+    argparse::ArgumentParser repackCommand("repack");
+    repackCommand.add_description("Pack all reachable objects into a single packfile.");
+    repackCommand.add_argument("-d")
+                 .help("Remove loose objects and packs made redundant by the new pack.")
+                 .flag();
+    repackCommand.add_argument("--window")
+                 .help("Number of objects to try as a delta base for each object.")
+                 .metavar("n")
+                 .default_value(10)
+                 .scan<'i', int>();
+    repackCommand.add_argument("--depth")
+                 .help("Maximum length of a delta chain.")
+                 .metavar("n")
+                 .default_value(50)
+                 .scan<'i', int>();
 
     program.add_subparser(initCommand);
     program.add_subparser(catFileCommand);
@@ -116,9 +210,15 @@ int main(int argc, char* argv[])
     program.add_subparser(tagCommand);
     program.add_subparser(revParseCommand);
     program.add_subparser(lsFilesCommand);
+    program.add_subparser(addCommand);
+    program.add_subparser(statusCommand);
     program.add_subparser(commitCommand);
     program.add_subparser(branchCommand);
     program.add_subparser(checkoutCommand);
+    program.add_subparser(diffCommand);
+    program.add_subparser(mergeCommand);
+    program.add_subparser(fsmonitorCommand);
+    program.add_subparser(repackCommand);
 
     try {
         program.parse_args(argc, argv);
@@ -139,11 +239,23 @@ int main(int argc, char* argv[])
         else if (program.is_subcommand_used("cat-file")) {
             auto& catFileSubParser =
                 program.at<argparse::ArgumentParser>("cat-file");
-            auto objectFormat =
-                verifyType(catFileSubParser.get<std::string>("type"));
+            auto batch = catFileSubParser.get<bool>("--batch");
+            if (batch || catFileSubParser.get<bool>("--batch-check")) {
+                std::ios::sync_with_stdio(false);
+                GitCommands::catFileBatch(std::cin, std::cout, batch);
+            }
+            else if (catFileSubParser.present("type") &&
+                     catFileSubParser.present("object")) {
+                auto objectFormat =
+                    verifyType(catFileSubParser.get<std::string>("type"));
 
-            auto objectToDisplay = catFileSubParser.get<std::string>("object");
-            GitCommands::catFile(objectFormat, objectToDisplay);
+                auto objectToDisplay =
+                    catFileSubParser.get<std::string>("object");
+                GitCommands::catFile(objectFormat, objectToDisplay);
+            }
+            else {
+                GENERATE_EXCEPTION("{}", catFileSubParser.usage());
+            }
         }
         else if (program.is_subcommand_used("hash-object")) {
             auto& hashObjectSubParser =
@@ -212,6 +324,18 @@ int main(int argc, char* argv[])
         else if (program.is_subcommand_used("ls-files")) {
             GitCommands::listFiles();
         }
+        else if (program.is_subcommand_used("add")) {
+            auto& addSubParser = program.at<argparse::ArgumentParser>("add");
+            auto paths = addSubParser.get<std::vector<std::string>>("paths");
+            auto jobs = std::max(addSubParser.get<int>("--jobs"), 0);
+            GitCommands::add({paths.begin(), paths.end()}, jobs);
+        }
+        else if (program.is_subcommand_used("status")) {
+            auto& statusSubParser =
+                program.at<argparse::ArgumentParser>("status");
+            GitCommands::status(
+                std::max(statusSubParser.get<int>("--jobs"), 0));
+        }
         else if (program.is_subcommand_used("commit")) {
             auto& commitSubParser =
                 program.at<argparse::ArgumentParser>("commit");
@@ -219,7 +343,8 @@ int main(int argc, char* argv[])
                 commitSubParser.present("-m")
                     ? commitSubParser.get<std::string>("-m")
                     : "Auto generated commit message";
-            GitCommands::commit(commitMessage);
+            auto jobs = std::max(commitSubParser.get<int>("--jobs"), 0);
+            GitCommands::commit(commitMessage, jobs);
         }
         else if (program.is_subcommand_used("branch")) {
             auto& branchSubParser =
@@ -233,10 +358,64 @@ int main(int argc, char* argv[])
             }
         }
         else if (program.is_subcommand_used("checkout")) {
-            auto commitToCheckoutTo =
-                program.at<argparse::ArgumentParser>("checkout")
-                    .get<std::string>("commit");
-            GitCommands::checkout(commitToCheckoutTo);
+            auto& checkoutSubParser =
+                program.at<argparse::ArgumentParser>("checkout");
+            GitCommands::checkout(
+                checkoutSubParser.get<std::string>("commit"),
+                checkoutSubParser.get<bool>("--force"),
+                std::max(checkoutSubParser.get<int>("--jobs"), 0));
+        }
+        else if (program.is_subcommand_used("diff")) {
+            auto& diffSubParser = program.at<argparse::ArgumentParser>("diff");
+            auto stat = diffSubParser.get<bool>("--stat");
+            auto nameOnly = diffSubParser.get<bool>("--name-only");
+            if (stat && nameOnly) {
+                GENERATE_EXCEPTION("{}", "--stat and --name-only can't be "
+                                         "used together");
+            }
+            auto format = stat       ? GitCommands::DiffFormat::STAT
+                          : nameOnly ? GitCommands::DiffFormat::NAME_ONLY
+                                     : GitCommands::DiffFormat::PATCH;
+            std::ios::sync_with_stdio(false);
+            GitCommands::diff(diffSubParser.get<std::string>("from"),
+                              diffSubParser.get<std::string>("to"), format);
+        }
+        else if (program.is_subcommand_used("merge")) {
+            auto& mergeSubParser = program.at<argparse::ArgumentParser>("merge");
+            GitCommands::merge(mergeSubParser.get<std::string>("commit"),
+                               mergeSubParser.get<std::string>("-m"),
+                               mergeSubParser.get<std::string>("--into"),
+                               std::max(mergeSubParser.get<int>("--jobs"), 0));
+        }
+        else if (program.is_subcommand_used("fsmonitor")) {
+            auto action = program.at<argparse::ArgumentParser>("fsmonitor")
+                              .get<std::string>("action");
+            if (action == "start") {
+                GitFSMonitor::start();
+            }
+            else if (action == "stop") {
+                GitFSMonitor::stop();
+            }
+            else if (action == "run") {
+                GitFSMonitor::run();
+            }
+            else if (action == "status") {
+                std::cout << (GitFSMonitor::isRunning()
+                                  ? "The filesystem monitor is running\n"
+                                  : "The filesystem monitor is not running\n");
+            }
+            else {
+                GENERATE_EXCEPTION("Wrong action: {}, available actions: "
+                                   "[start, stop, run, status]",
+                                   action);
+            }
+        }
+        else if (program.is_subcommand_used("repack")) {
+            auto& repackSubParser =
+                program.at<argparse::ArgumentParser>("repack");
+            GitCommands::repack(repackSubParser.get<bool>("-d"),
+                                repackSubParser.get<int>("--window"),
+                                repackSubParser.get<int>("--depth"));
         }
         else {
             GENERATE_EXCEPTION("{}", program.help().str());
@@ -0,0 +1,749 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <tuple>
+
+#include "../GitCommands.hpp"
+#include "../utilities/SHA1.hpp"
+
+std::filesystem::path BENCHMARK_REPO_PATH =
+    std::filesystem::current_path() / "gitBenchmark";
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void report(const std::string& name, size_t items, size_t bytes,
+            double seconds)
+{
+    std::cout << fmt::format(
+        "{:<32} {:>10} items {:>10.3f}s {:>12.0f} items/s {:>10.1f} MB/s\n",
+        name, items, seconds, items / seconds, bytes / seconds / 1e6);
+}
+
+void createRepository()
+{
+    std::filesystem::remove_all(BENCHMARK_REPO_PATH);
+    GitCommands::init(BENCHMARK_REPO_PATH);
+    std::filesystem::current_path(BENCHMARK_REPO_PATH);
+}
+
+// Source-code-like text, so compression ratios are realistic.
+std::string generateText(std::mt19937& random, size_t size)
+{
+    static const std::vector<std::string> words = {
+        "auto", "const", "return", "std::string", "if", "else", "for",
+        "while", "GitHash", "object", "data", "size", "{", "}", "(", ")",
+        ";", "=", "==", "+", "namespace", "class", "public:", "private:"};
+    std::string text;
+    text.reserve(size + 16);
+    while (text.size() < size) {
+        text += words[random() % words.size()];
+        text += random() % 8 == 0 ? '\n' : ' ';
+    }
+    text.resize(size);
+    return text;
+}
+
+// Changed files of a tree of modules, keyed by module, directory and file.
+using ChangedFiles = std::map<std::tuple<size_t, size_t, size_t>, GitHash>;
+
+// Commit of a tree of modules of directories of files, the way a big project
+// is laid out. File f of every directory is blobs[f], unless it changed.
+std::string writeModulesCommit(const std::vector<GitHash>& blobs,
+                               size_t numberOfModules,
+                               size_t directoriesPerModule,
+                               const ChangedFiles& changes,
+                               const std::vector<std::string>& parents,
+                               const std::string& message)
+{
+    std::vector<GitTreeLeaf> modules;
+    for (size_t m = 0; m < numberOfModules; ++m) {
+        std::vector<GitTreeLeaf> directories;
+        for (size_t d = 0; d < directoriesPerModule; ++d) {
+            std::vector<GitTreeLeaf> files;
+            for (size_t f = 0; f < blobs.size(); ++f) {
+                auto change = changes.find({m, d, f});
+                files.push_back(
+                    {.fileMode = "100644",
+                     .filePath = fmt::format("file{:02}.cpp", f),
+                     .hash = change == changes.end() ? blobs[f]
+                                                     : change->second});
+            }
+            GitTree tree(files);
+            directories.push_back({.fileMode = "40000",
+                                   .filePath = fmt::format("dir{:02}", d),
+                                   .hash = GitObject::write(&tree)});
+        }
+        GitTree tree(directories);
+        modules.push_back({.fileMode = "40000",
+                           .filePath = fmt::format("module{}", m),
+                           .hash = GitObject::write(&tree)});
+    }
+    GitTree root(modules);
+    GitCommit commit({.tree = GitObject::write(&root).data(),
+                      .parents = parents,
+                      .author = "Joe Doe <joedoe@email.com>",
+                      .committer = "Joe Doe <joedoe@email.com>",
+                      .gpgsig = "",
+                      .message = message});
+    return GitObject::write(&commit).data();
+}
+
+// Text with every line whose number is offset modulo every replaced.
+std::string changeLines(std::string_view text, size_t every, size_t offset,
+                        std::string_view replacement)
+{
+    auto lines = GitDiff::lines(text);
+    std::string changed;
+    for (size_t line = 0; line < lines.size(); ++line) {
+        changed += line % every == offset ? replacement : lines[line];
+    }
+    return changed;
+}
+
+std::vector<GitHash> writeBlobs(size_t count, size_t size)
+{
+    std::mt19937 random(42);
+    std::vector<GitHash> hashes;
+    hashes.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        auto blob = GitObjectFactory::create(
+            "blob", ObjectData(generateText(random, size)));
+        hashes.push_back(GitObject::write(blob.get()));
+    }
+    return hashes;
+}
+
+void readLooseObjects()
+{
+    constexpr size_t NUMBER_OF_OBJECTS = 100000;
+    constexpr size_t OBJECT_SIZE = 1024;
+
+    createRepository();
+    auto hashes = writeBlobs(NUMBER_OF_OBJECTS, OBJECT_SIZE);
+
+    auto start = Clock::now();
+    size_t bytes = 0;
+    for (const auto& hash : hashes) {
+        bytes += GitObjectFactory::readRaw(hash).data.size();
+    }
+    report("read loose objects", hashes.size(), bytes, secondsSince(start));
+}
+// Lookups served by a single long running cat-file, the way tooling uses it.
+void catFileBatch()
+{
+    constexpr size_t NUMBER_OF_OBJECTS = 20000;
+    constexpr size_t OBJECT_SIZE = 1024;
+
+    createRepository();
+    auto hashes = writeBlobs(NUMBER_OF_OBJECTS, OBJECT_SIZE);
+    std::string names;
+    for (const auto& hash : hashes) {
+        names += hash.data() + '\n';
+    }
+
+    for (bool withContent : {false, true}) {
+        std::istringstream input(names);
+        std::ostringstream output;
+        auto start = Clock::now();
+        GitCommands::catFileBatch(input, output, withContent);
+        report(withContent ? "cat-file --batch" : "cat-file --batch-check",
+               hashes.size(), output.str().size(), secondsSince(start));
+    }
+}
+
+// Snapshot of a fresh worktree, with one thread and with one per core. Every
+// run starts from an empty object store, so all objects are written.
+void createTree()
+{
+    constexpr size_t NUMBER_OF_DIRECTORIES = 100;
+    constexpr size_t FILES_PER_DIRECTORY = 50;
+    constexpr size_t FILE_SIZE = 4096;
+
+    createRepository();
+    std::mt19937 random(42);
+    auto worktree = BENCHMARK_REPO_PATH / "worktree";
+    for (size_t i = 0; i < NUMBER_OF_DIRECTORIES; ++i) {
+        auto directory = worktree / fmt::format("dir{:03}", i);
+        std::filesystem::create_directories(directory);
+        for (size_t j = 0; j < FILES_PER_DIRECTORY; ++j) {
+            Utilities::writeToFile(directory / fmt::format("file{:02}", j),
+                                   generateText(random, FILE_SIZE));
+        }
+    }
+
+    auto objects = GitRepository::repoDir("objects");
+    std::vector<size_t> jobCounts = {1, 4};
+    if (auto cores = Utilities::ThreadPool::hardwareThreads(); cores > 4) {
+        jobCounts.push_back(cores);
+    }
+    for (auto jobs : jobCounts) {
+        for (const auto& entry : std::filesystem::directory_iterator(objects)) {
+            if (entry.path().filename().string().size() == 2) {
+                std::filesystem::remove_all(entry.path());
+            }
+        }
+        auto start = Clock::now();
+        GitCommands::createTree(worktree, jobs);
+        report(fmt::format("create tree -j{}", jobs),
+               NUMBER_OF_DIRECTORIES * FILES_PER_DIRECTORY,
+               NUMBER_OF_DIRECTORIES * FILES_PER_DIRECTORY * FILE_SIZE,
+               secondsSince(start));
+    }
+}
+
+// A first commit of a fresh worktree, then commits that change one file each,
+// which only write the trees leading to that file.
+void commit()
+{
+    constexpr size_t NUMBER_OF_DIRECTORIES = 100;
+    constexpr size_t FILES_PER_DIRECTORY = 100;
+    constexpr size_t FILE_SIZE = 1024;
+    constexpr size_t NUMBER_OF_CHANGES = 10;
+
+    createRepository();
+    std::mt19937 random(42);
+    for (size_t i = 0; i < NUMBER_OF_DIRECTORIES; ++i) {
+        auto directory = fmt::format("module{:02}/dir{:03}", i / 10, i);
+        std::filesystem::create_directories(directory);
+        for (size_t j = 0; j < FILES_PER_DIRECTORY; ++j) {
+            Utilities::writeToFile(fmt::format("{}/file{:02}", directory, j),
+                                   generateText(random, FILE_SIZE));
+        }
+    }
+    constexpr size_t NUMBER_OF_FILES =
+        NUMBER_OF_DIRECTORIES * FILES_PER_DIRECTORY;
+
+    auto start = Clock::now();
+    GitCommands::commit("first");
+    report("first commit", NUMBER_OF_FILES, NUMBER_OF_FILES * FILE_SIZE,
+           secondsSince(start));
+
+    start = Clock::now();
+    for (size_t i = 0; i < NUMBER_OF_CHANGES; ++i) {
+        Utilities::writeToFile(
+            fmt::format("module{:02}/dir{:03}/file00", i, i * 10),
+            generateText(random, FILE_SIZE));
+        GitCommands::commit(fmt::format("change {}", i));
+    }
+    auto seconds = secondsSince(start);
+    report("commit one changed file", NUMBER_OF_CHANGES,
+           NUMBER_OF_CHANGES * FILE_SIZE, seconds);
+    std::cout << fmt::format("{:<32} {:>10.1f} ms per commit\n",
+                             "commit one changed file",
+                             seconds * 1000 / NUMBER_OF_CHANGES);
+}
+
+// Switching between two branches of a big worktree that differ in a few
+// files, only those are written.
+void checkout()
+{
+    constexpr size_t NUMBER_OF_DIRECTORIES = 100;
+    constexpr size_t FILES_PER_DIRECTORY = 100;
+    constexpr size_t FILE_SIZE = 1024;
+    constexpr size_t NUMBER_OF_CHANGES = 3;
+    constexpr size_t NUMBER_OF_SWITCHES = 10;
+
+    createRepository();
+    std::mt19937 random(42);
+    for (size_t i = 0; i < NUMBER_OF_DIRECTORIES; ++i) {
+        auto directory = fmt::format("module{:02}/dir{:03}", i / 10, i);
+        std::filesystem::create_directories(directory);
+        for (size_t j = 0; j < FILES_PER_DIRECTORY; ++j) {
+            Utilities::writeToFile(fmt::format("{}/file{:02}", directory, j),
+                                   generateText(random, FILE_SIZE));
+        }
+    }
+    GitCommands::commit("first");
+    GitCommands::createBranch("other");
+    GitCommands::checkout("other");
+    for (size_t i = 0; i < NUMBER_OF_CHANGES; ++i) {
+        Utilities::writeToFile(
+            fmt::format("module{:02}/dir{:03}/file00", i, i * 10),
+            generateText(random, FILE_SIZE));
+    }
+    GitCommands::commit("other");
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < NUMBER_OF_SWITCHES; ++i) {
+        GitCommands::checkout(i % 2 == 0 ? "master" : "other");
+    }
+    auto seconds = secondsSince(start);
+    report("checkout", NUMBER_OF_SWITCHES * NUMBER_OF_CHANGES,
+           NUMBER_OF_SWITCHES * NUMBER_OF_CHANGES * FILE_SIZE, seconds);
+    std::cout << fmt::format("{:<32} {:>10.1f} ms per checkout\n",
+                             "checkout", seconds * 1000 / NUMBER_OF_SWITCHES);
+
+    // a fresh checkout, every file is written
+    GitTree empty(std::vector<GitTreeLeaf>{});
+    auto emptyTree = GitObject::write(&empty).data();
+    constexpr size_t NUMBER_OF_FILES =
+        NUMBER_OF_DIRECTORIES * FILES_PER_DIRECTORY;
+    std::vector<size_t> jobCounts = {1, 4};
+    if (auto cores = Utilities::ThreadPool::hardwareThreads(); cores > 4) {
+        jobCounts.push_back(cores);
+    }
+    for (auto jobs : jobCounts) {
+        GitCommands::checkout(emptyTree);
+        auto start = Clock::now();
+        GitCommands::checkout("other", false, jobs);
+        report(fmt::format("fresh checkout -j{}", jobs), NUMBER_OF_FILES,
+               NUMBER_OF_FILES * FILE_SIZE, secondsSince(start));
+    }
+}
+
+// A commit that changes a few lines of 10 files of a 100k files tree. Only
+// the trees leading to them are read, walking both trees whole is shown for
+// comparison. The object cache is cleared before every diff, like a new
+// command starts with an empty one.
+void diff()
+{
+    constexpr size_t NUMBER_OF_MODULES = 10;
+    constexpr size_t DIRECTORIES_PER_MODULE = 100;
+    constexpr size_t FILES_PER_DIRECTORY = 100;
+    constexpr size_t FILE_SIZE = 4096;
+    constexpr size_t NUMBER_OF_CHANGES = 10;
+    constexpr size_t NUMBER_OF_DIFFS = 20;
+
+    createRepository();
+    std::mt19937 random(42);
+    // files of every directory share the same blobs, unchanged files are
+    // never read anyway
+    std::vector<std::string> texts;
+    std::vector<GitHash> blobs;
+    for (size_t i = 0; i < FILES_PER_DIRECTORY; ++i) {
+        texts.push_back(generateText(random, FILE_SIZE));
+        auto blob = GitObjectFactory::create("blob", ObjectData(texts.back()));
+        blobs.push_back(GitObject::write(blob.get()));
+    }
+    auto writeCommit = [&](const ChangedFiles& changes,
+                           const std::vector<std::string>& parents) {
+        return writeModulesCommit(blobs, NUMBER_OF_MODULES,
+                                  DIRECTORIES_PER_MODULE, changes, parents,
+                                  "diff");
+    };
+    auto first = writeCommit({}, {});
+    ChangedFiles changes;
+    for (size_t i = 0; i < NUMBER_OF_CHANGES; ++i) {
+        auto blob = GitObjectFactory::create(
+            "blob",
+            ObjectData(changeLines(texts[i], 20, 5, "changed line\n")));
+        changes[{i, i * 7 % DIRECTORIES_PER_MODULE, i}] =
+            GitObject::write(blob.get());
+    }
+    auto second = writeCommit(changes, {first});
+
+    constexpr size_t NUMBER_OF_FILES =
+        NUMBER_OF_MODULES * DIRECTORIES_PER_MODULE * FILES_PER_DIRECTORY;
+    auto run = [&](const std::string& name, size_t items,
+                   const std::function<void()>& body) {
+        double seconds = 0;
+        for (size_t i = 0; i < NUMBER_OF_DIFFS; ++i) {
+            GitObjectCache::clear();
+            auto start = Clock::now();
+            body();
+            seconds += secondsSince(start);
+        }
+        report(name, items * NUMBER_OF_DIFFS, 0, seconds);
+        std::cout << fmt::format("{:<32} {:>10.2f} ms per diff\n", name,
+                                 seconds * 1000 / NUMBER_OF_DIFFS);
+    };
+    for (auto [name, format] :
+         {std::pair{"diff --name-only", GitCommands::DiffFormat::NAME_ONLY},
+          std::pair{"diff --stat", GitCommands::DiffFormat::STAT},
+          std::pair{"diff", GitCommands::DiffFormat::PATCH}}) {
+        run(name, NUMBER_OF_CHANGES, [&] {
+            std::ostringstream output;
+            GitCommands::diff(first, second, format, output);
+        });
+    }
+    run("walk both trees", 2 * NUMBER_OF_FILES, [&] {
+        std::vector<GitCommands::TrackedFile> files;
+        for (const auto& commit : {first, second}) {
+            GitCommands::flattenTree(GitCommands::treeOf(GitHash(commit)), "",
+                                     files);
+        }
+    });
+}
+
+// Bots bringing their branches up to date with main in a 100k files tree:
+// main changed 10 files, every bot changed a file of its own, half of them
+// one that main changed too, in other lines. Branches are merged into
+// without being checked out, so only the trees leading to changed files are
+// read and written, and only the files both sides changed are merged line
+// by line. The object cache is cleared before every merge.
+void merge()
+{
+    constexpr size_t NUMBER_OF_MODULES = 10;
+    constexpr size_t DIRECTORIES_PER_MODULE = 100;
+    constexpr size_t FILES_PER_DIRECTORY = 100;
+    constexpr size_t FILE_SIZE = 4096;
+    constexpr size_t NUMBER_OF_CHANGES = 10;
+    constexpr size_t NUMBER_OF_BRANCHES = 200;
+
+    createRepository();
+    std::mt19937 random(42);
+    std::vector<std::string> texts;
+    std::vector<GitHash> blobs;
+    for (size_t i = 0; i < FILES_PER_DIRECTORY; ++i) {
+        texts.push_back(generateText(random, FILE_SIZE));
+        auto blob = GitObjectFactory::create("blob", ObjectData(texts.back()));
+        blobs.push_back(GitObject::write(blob.get()));
+    }
+    auto writeCommit = [&](const ChangedFiles& changes,
+                           const std::vector<std::string>& parents) {
+        return writeModulesCommit(blobs, NUMBER_OF_MODULES,
+                                  DIRECTORIES_PER_MODULE, changes, parents,
+                                  "merge");
+    };
+    auto writeBlob = [](const std::string& text) {
+        auto blob = GitObjectFactory::create("blob", ObjectData(text));
+        return GitObject::write(blob.get());
+    };
+    auto setBranch = [](const std::string& name, const std::string& commit) {
+        Utilities::writeToFile(GitRepository::repoFile("refs", "heads", name),
+                               commit, true);
+    };
+
+    auto base = writeCommit({}, {});
+    ChangedFiles mainChanges;
+    for (size_t i = 0; i < NUMBER_OF_CHANGES; ++i) {
+        mainChanges[{i, i * 7 % DIRECTORIES_PER_MODULE, i}] =
+            writeBlob(changeLines(texts[i], 20, 5, "main line\n"));
+    }
+    setBranch("main", writeCommit(mainChanges, {base}));
+    for (size_t b = 0; b < NUMBER_OF_BRANCHES; ++b) {
+        auto module = b % NUMBER_OF_MODULES;
+        auto directory = b % 2 == 0 ? module * 7 % DIRECTORIES_PER_MODULE
+                                    : random() % DIRECTORIES_PER_MODULE;
+        auto file = b % 2 == 0 ? module : random() % FILES_PER_DIRECTORY;
+        auto text = changeLines(texts[file], 20, 15,
+                                fmt::format("bot {} line\n", b));
+        setBranch(fmt::format("bot{}", b),
+                  writeCommit({{{module, directory, file}, writeBlob(text)}},
+                              {base}));
+    }
+
+    // merges report on every branch, only the totals are shown
+    std::ostringstream messages;
+    auto* output = std::cout.rdbuf(messages.rdbuf());
+    double seconds = 0;
+    for (size_t b = 0; b < NUMBER_OF_BRANCHES; ++b) {
+        GitObjectCache::clear();
+        auto start = Clock::now();
+        GitCommands::merge("main", "", fmt::format("bot{}", b));
+        seconds += secondsSince(start);
+    }
+    std::cout.rdbuf(output);
+    report("merge --into", NUMBER_OF_BRANCHES, 0, seconds);
+    std::cout << fmt::format("{:<32} {:>10.2f} ms per merge\n",
+                             "merge --into",
+                             seconds * 1000 / NUMBER_OF_BRANCHES);
+}
+
+// A version 2 index of a big worktree, written the way git does, then with
+// an entry offset table, so it is decoded on several threads.
+void loadIndex()
+{
+    constexpr size_t NUMBER_OF_ENTRIES = 1000000;
+    constexpr size_t NUMBER_OF_LOADS = 5;
+
+    createRepository();
+    auto bigEndian32 = [](std::string& data, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            data += static_cast<char>(value >> shift);
+        }
+    };
+    std::string data = "DIRC";
+    bigEndian32(data, 2);
+    bigEndian32(data, NUMBER_OF_ENTRIES);
+    auto hash = SHA1::computeHash("content");
+    for (size_t i = 0; i < NUMBER_OF_ENTRIES; ++i) {
+        auto path = fmt::format("src/module{:03}/component{:02}/file{:05}.cpp",
+                                i / 5000, i / 100 % 50, i);
+        auto start = data.size();
+        for (uint32_t field = 0; field < 10; ++field) {
+            bigEndian32(data, field == 6 ? 0100644 : i);
+        }
+        data += hash.bytes();
+        data += static_cast<char>(path.size() >> 8);
+        data += static_cast<char>(path.size());
+        data += path;
+        do {
+            data += '\0';
+        } while ((data.size() - start) % 8 != 0);
+    }
+    data += SHA1::computeHash(data).bytes();
+    auto indexFile = GitRepository::repoFile("index");
+    Utilities::writeToFile(indexFile, data);
+
+    auto load = [&](const std::string& name, size_t threads) {
+        auto size = std::filesystem::file_size(indexFile);
+        auto start = Clock::now();
+        size_t entries = 0;
+        for (size_t load = 0; load < NUMBER_OF_LOADS; ++load) {
+            entries += GitIndex::read(indexFile, threads).size();
+        }
+        auto seconds = secondsSince(start);
+        report(name, entries, size * NUMBER_OF_LOADS, seconds);
+        std::cout << fmt::format("{:<32} {:>10.1f} ms per load\n", name,
+                                 seconds * 1000 / NUMBER_OF_LOADS);
+    };
+    load("load index", 1);
+
+    GitIndex::read(indexFile).write(indexFile);
+    std::vector<size_t> threadCounts = {1, 4};
+    if (auto cores = Utilities::ThreadPool::hardwareThreads(); cores > 4) {
+        threadCounts.push_back(cores);
+    }
+    for (auto threads : threadCounts) {
+        load(fmt::format("load index with table -j{}", threads), threads);
+    }
+}
+
+// Status of a big worktree where nothing changed, every file is only
+// stat'ed. The index is built in memory, so no objects have to be written.
+void status()
+{
+    constexpr size_t NUMBER_OF_DIRECTORIES = 2000;
+    constexpr size_t FILES_PER_DIRECTORY = 100;
+    constexpr size_t NUMBER_OF_RUNS = 3;
+
+    createRepository();
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < NUMBER_OF_DIRECTORIES; ++i) {
+        auto directory = fmt::format("src/module{:02}/dir{:04}", i / 100, i);
+        std::filesystem::create_directories(directory);
+        for (size_t j = 0; j < FILES_PER_DIRECTORY; ++j) {
+            auto& path = paths.emplace_back(
+                fmt::format("{}/file{:03}.cpp", directory, j));
+            Utilities::writeToFile(path, path);
+        }
+    }
+    // the files must be older than the index, or they would be racy
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::vector<IndexEntry> entries;
+    for (const auto& path : paths) {
+        entries.push_back({.stat = GitIndex::statOf(path),
+                           .hash = GitObject::writeBlob(path, false),
+                           .flags = 0,
+                           .extendedFlags = 0,
+                           .path = path});
+    }
+    GitIndex index;
+    index.add(std::move(entries));
+    index.write(GitRepository::repoPath("index"));
+
+    std::vector<size_t> jobCounts = {1, 4};
+    if (auto cores = Utilities::ThreadPool::hardwareThreads(); cores > 4) {
+        jobCounts.push_back(cores);
+    }
+    for (auto jobs : jobCounts) {
+        auto start = Clock::now();
+        for (size_t run = 0; run < NUMBER_OF_RUNS; ++run) {
+            auto result = GitCommands::collectStatus(jobs);
+            if (!result.unstaged.empty() || !result.untracked.empty()) {
+                GENERATE_EXCEPTION("{}", "the worktree isn't clean");
+            }
+        }
+        auto seconds = secondsSince(start);
+        report(fmt::format("status -j{}", jobs), paths.size() * NUMBER_OF_RUNS,
+               0, seconds);
+        std::cout << fmt::format("{:<32} {:>10.1f} ms per status\n",
+                                 fmt::format("status -j{}", jobs),
+                                 seconds * 1000 / NUMBER_OF_RUNS);
+    }
+
+    // the entries are only stat'ed by the first status, which gets a token
+    Utilities::writeToFile(".git/config", "[core]\n\tfsmonitor = true\n");
+    std::thread monitor(GitFSMonitor::run);
+    while (!GitFSMonitor::isRunning()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    GitCommands::collectStatus();
+    auto start = Clock::now();
+    for (size_t run = 0; run < NUMBER_OF_RUNS; ++run) {
+        GitCommands::collectStatus();
+    }
+    auto seconds = secondsSince(start);
+    report("status with fsmonitor", paths.size() * NUMBER_OF_RUNS, 0,
+           seconds);
+    std::cout << fmt::format("{:<32} {:>10.1f} ms per status\n",
+                             "status with fsmonitor",
+                             seconds * 1000 / NUMBER_OF_RUNS);
+    GitFSMonitor::stop();
+    monitor.join();
+}
+
+// One wide tree walked entry by entry, straight from its data and through
+// the vector of leaves.
+void iterateTree()
+{
+    constexpr size_t NUMBER_OF_ENTRIES = 10000;
+    constexpr size_t NUMBER_OF_WALKS = 100;
+
+    createRepository();
+    auto blobs = writeBlobs(1, 16);
+    std::vector<GitTreeLeaf> leaves;
+    for (size_t i = 0; i < NUMBER_OF_ENTRIES; ++i) {
+        leaves.push_back({.fileMode = "100644",
+                          .filePath = fmt::format("source_file_{:05}.cpp", i),
+                          .hash = blobs[0]});
+    }
+    auto data = GitTree(leaves).serialize();
+
+    auto start = Clock::now();
+    size_t nameBytes = 0;
+    for (size_t walk = 0; walk < NUMBER_OF_WALKS; ++walk) {
+        auto tree = GitObjectFactory::create("tree", data);
+        for (const auto& entry : static_cast<GitTree*>(tree.get())->entries()) {
+            nameBytes += entry.name.size();
+        }
+    }
+    report("iterate tree entries", NUMBER_OF_ENTRIES * NUMBER_OF_WALKS,
+           data.data().size() * NUMBER_OF_WALKS, secondsSince(start));
+
+    start = Clock::now();
+    for (size_t walk = 0; walk < NUMBER_OF_WALKS; ++walk) {
+        auto tree = GitObjectFactory::create("tree", data);
+        for (const auto& leaf : static_cast<GitTree*>(tree.get())->tree()) {
+            nameBytes += leaf.filePath.native().size();
+        }
+    }
+    report("iterate tree leaves", NUMBER_OF_ENTRIES * NUMBER_OF_WALKS,
+           data.data().size() * NUMBER_OF_WALKS, secondsSince(start));
+}
+
+// A linear history where every commit changes one file of a flat tree.
+// The history is walked several times, like log followed by ls-tree of each
+// commit would, so most reads after the first walk come from the cache.
+void walkHistory()
+{
+    constexpr size_t NUMBER_OF_COMMITS = 2000;
+    constexpr size_t FILES_PER_TREE = 50;
+    constexpr size_t NUMBER_OF_WALKS = 3;
+
+    createRepository();
+    std::mt19937 random(42);
+    auto blobs = writeBlobs(FILES_PER_TREE, 256);
+    std::vector<GitTreeLeaf> leaves;
+    for (size_t i = 0; i < FILES_PER_TREE; ++i) {
+        leaves.push_back({.fileMode = "100644",
+                          .filePath = fmt::format("file{:02}.txt", i),
+                          .hash = blobs[i]});
+    }
+
+    std::string parent;
+    for (size_t i = 0; i < NUMBER_OF_COMMITS; ++i) {
+        auto blob = GitObjectFactory::create(
+            "blob", ObjectData(generateText(random, 256)));
+        leaves[i % FILES_PER_TREE].hash = GitObject::write(blob.get());
+        GitTree tree(leaves);
+        GitCommit commit({.tree = GitObject::write(&tree).data(),
+                          .parents = parent.empty()
+                                         ? std::vector<std::string>{}
+                                         : std::vector<std::string>{parent},
+                          .author = "Joe Doe <joedoe@email.com>",
+                          .committer = "Joe Doe <joedoe@email.com>",
+                          .gpgsig = "",
+                          .message = fmt::format("commit {}", i)});
+        parent = GitObject::write(&commit).data();
+    }
+
+    GitObjectCache::clear();
+    auto start = Clock::now();
+    size_t reads = 0;
+    for (size_t walk = 0; walk < NUMBER_OF_WALKS; ++walk) {
+        for (auto hash = parent; !hash.empty();) {
+            auto object = GitObjectCache::read(GitHash(hash));
+            auto commit = static_cast<const GitCommit*>(object.get());
+            GitObjectCache::read(GitHash(commit->commitMessage().tree));
+            const auto& parents = commit->commitMessage().parents;
+            hash = parents.empty() ? "" : parents.front();
+            reads += 2;
+        }
+    }
+    report("walk history", reads, 0, secondsSince(start));
+
+    auto statistics = GitObjectCache::statistics();
+    std::cout << fmt::format("{:<32} {:>10} hits {:>10} misses {:>8.1f}%\n",
+                             "object cache", statistics.hits,
+                             statistics.misses,
+                             100.0 * statistics.hits /
+                                 (statistics.hits + statistics.misses));
+}
+// Raw hashing speed of every backend the CPU supports.
+void sha1()
+{
+    constexpr size_t DATA_SIZE = 256 * 1024 * 1024;
+    constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    std::mt19937 random(42);
+    std::string data(CHUNK_SIZE, '\0');
+    for (auto& byte : data) {
+        byte = static_cast<char>(random());
+    }
+
+    for (auto backend : SHA1::supportedBackends()) {
+        auto start = Clock::now();
+        SHA1::Hasher hasher(backend);
+        for (size_t hashed = 0; hashed < DATA_SIZE; hashed += CHUNK_SIZE) {
+            hasher.update(data);
+        }
+        hasher.finalize();
+        auto seconds = secondsSince(start);
+        std::cout << fmt::format("{:<32} {:>10.2f} GB/s\n",
+                                 fmt::format("sha1 {}",
+                                             SHA1::backendName(backend)),
+                                 DATA_SIZE / seconds / 1e9);
+    }
+}
+}; // namespace
+
+// Usage: wyagitBenchmark [benchmark...], runs all benchmarks by default.
+int main(int argc, char* argv[])
+{
+    std::map<std::string, std::function<void()>> benchmarks = {
+        {"cat-file-batch", catFileBatch},
+        {"checkout", checkout},
+        {"commit", commit},
+        {"create-tree", createTree},
+        {"diff", diff},
+        {"iterate-tree", iterateTree},
+        {"load-index", loadIndex},
+        {"merge", merge},
+        {"read-loose", readLooseObjects},
+        {"sha1", sha1},
+        {"status", status},
+        {"walk-history", walkHistory},
+    };
+
+    std::vector<std::string> selected(argv + 1, argv + argc);
+    if (selected.empty()) {
+        for (const auto& [name, _] : benchmarks) {
+            selected.push_back(name);
+        }
+    }
+
+    auto workingDirectory = std::filesystem::current_path();
+    for (const auto& name : selected) {
+        auto benchmark = benchmarks.find(name);
+        if (benchmark == benchmarks.end()) {
+            std::cerr << "Unknown benchmark: " << name << std::endl;
+            return EXIT_FAILURE;
+        }
+        benchmark->second();
+        std::filesystem::current_path(workingDirectory);
+    }
+    std::filesystem::remove_all(BENCHMARK_REPO_PATH);
+    return EXIT_SUCCESS;
+}
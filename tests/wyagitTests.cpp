@@ -1,8 +1,14 @@
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <gtest/gtest.h>
+#include <random>
+#include <unordered_set>
 
 #include "../GitCommands.hpp"
+#include "../git_objects/GitDelta.hpp"
+#include "../utilities/SHA1.hpp"
+#include "../utilities/ThreadPool.hpp"
+#include "../utilities/Zlib.hpp"
 
 std::filesystem::path REPO_PATH = std::filesystem::current_path() / "gitTest";
 
@@ -87,6 +93,544 @@ TEST_F(GitCommandsTest, CreateTree)
     ASSERT_EQ((*dirOneTree).fileMode, treeFileMode);
 }
 
+TEST_F(GitCommandsTest, ParallelCreateTree)
+{
+    for (int directory = 0; directory < 8; ++directory) {
+        auto path = REPO_PATH / fmt::format("dir{}", directory) / "nested";
+        std::filesystem::create_directories(path);
+        for (int file = 0; file < 20; ++file) {
+            Utilities::writeToFile(path / fmt::format("file{}", file),
+                                   fmt::format("{} {}", directory, file));
+        }
+        Utilities::writeToFile(path.parent_path() / "top", "top");
+    }
+
+    auto serialHash = GitCommands::createTree(REPO_PATH, 1);
+    for (size_t jobs : {2, 8}) {
+        ASSERT_EQ(GitCommands::createTree(REPO_PATH, jobs), serialHash);
+    }
+    auto tree = GitObjectCache::read(serialHash);
+    ASSERT_EQ(static_cast<const GitTree*>(tree.get())->tree().size(), 8);
+}
+
+// Index file as git writes it, with distinct values in every field.
+std::string indexBytes(uint32_t version, const std::vector<std::string>& paths,
+                       const std::string& extension = "TREE")
+{
+    auto bigEndian32 = [](std::string& data, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            data += static_cast<char>(value >> shift);
+        }
+    };
+    std::string data = "DIRC";
+    bigEndian32(data, version);
+    bigEndian32(data, paths.size());
+
+    std::string previous;
+    for (uint32_t i = 0; i < paths.size(); ++i) {
+        const auto& path = paths[i];
+        auto start = data.size();
+        for (uint32_t field = 0; field < 10; ++field) {
+            bigEndian32(data, i * 10 + field);
+        }
+        data += SHA1::computeHash(path).bytes();
+        // odd entries are intent-to-add, which needs the extended flags
+        bool extended = version >= 3 && i % 2 == 1;
+        uint16_t flags = std::min<size_t>(path.size(), 0xfff) |
+                         (extended ? GitIndex::FLAG_EXTENDED : 0);
+        data += static_cast<char>(flags >> 8);
+        data += static_cast<char>(flags);
+        if (extended) {
+            data += '\x20';
+            data += '\0';
+        }
+
+        if (version == 4) {
+            size_t common = 0;
+            while (common < previous.size() && common < path.size() &&
+                   previous[common] == path[common]) {
+                ++common;
+            }
+            size_t removed = previous.size() - common;
+            std::string varint(1, static_cast<char>(removed & 0x7f));
+            while (removed >>= 7) {
+                varint.insert(varint.begin(),
+                              static_cast<char>(0x80 | (--removed & 0x7f)));
+            }
+            data += varint + path.substr(common) + '\0';
+        }
+        else {
+            data += path;
+            do {
+                data += '\0';
+            } while ((data.size() - start) % 8 != 0);
+        }
+        previous = path;
+    }
+    data += extension;
+    bigEndian32(data, 3);
+    data += "abc";
+    data += SHA1::computeHash(data).bytes();
+    return data;
+}
+
+TEST_F(GitCommandsTest, ReadIndex)
+{
+    std::vector<std::string> paths = {"README.md", "src/main.cpp",
+                                      "src/main.hpp", std::string(300, 'x'),
+                                      "y", "z/" + std::string(5000, 'z')};
+    for (uint32_t version : {2, 3, 4}) {
+        SCOPED_TRACE(version);
+        Utilities::writeToFile("index", indexBytes(version, paths));
+        auto index = GitIndex::read("index");
+        ASSERT_EQ(index.version(), version);
+        ASSERT_EQ(index.size(), paths.size());
+        for (size_t i = 0; i < paths.size(); ++i) {
+            ASSERT_EQ(index.path(i), paths[i]);
+            ASSERT_EQ(index.hash(i), SHA1::computeHash(paths[i]));
+            ASSERT_EQ(index.stat(i).ctimeSeconds, i * 10);
+            ASSERT_EQ(index.stat(i).mode, i * 10 + 6);
+            ASSERT_EQ(index.stat(i).size, i * 10 + 9);
+            ASSERT_EQ(index.stage(i), 0);
+            ASSERT_EQ(index.extendedFlags(i),
+                      version >= 3 && i % 2 == 1 ? 0x2000 : 0);
+        }
+        ASSERT_EQ(index.extensions().size(), 1);
+        ASSERT_EQ(index.extensions()[0].signature, "TREE");
+        ASSERT_EQ(index.extensions()[0].data, "abc");
+
+        auto corrupted = indexBytes(version, paths);
+        corrupted[40] ^= 1;
+        Utilities::writeToFile("index", corrupted);
+        ASSERT_THROW(GitIndex::read("index"), std::runtime_error);
+    }
+
+    // a truncated index with a valid checksum
+    auto truncated = indexBytes(2, paths).substr(0, 100);
+    truncated += SHA1::computeHash(truncated).bytes();
+    Utilities::writeToFile("index", truncated);
+    ASSERT_THROW(GitIndex::read("index"), std::runtime_error);
+
+    // an unknown extension is kept when its signature starts with an upper
+    // case letter, otherwise the index can't be used without understanding it
+    Utilities::writeToFile("index", indexBytes(2, paths, "UNTR"));
+    auto index = GitIndex::read("index");
+    ASSERT_EQ(index.extensions().size(), 1);
+    ASSERT_EQ(index.extensions()[0].signature, "UNTR");
+    Utilities::writeToFile("index", indexBytes(2, paths, "link"));
+    ASSERT_THROW(GitIndex::read("index"), std::runtime_error);
+}
+
+TEST_F(GitCommandsTest, WriteIndex)
+{
+    std::vector<std::string> paths = {"README.md", "src/main.cpp",
+                                      "src/main.hpp", std::string(300, 'x'),
+                                      "y", "z/" + std::string(5000, 'z')};
+    for (uint32_t version : {2, 3, 4}) {
+        SCOPED_TRACE(version);
+        auto data = indexBytes(version, paths);
+        Utilities::writeToFile("index", data);
+        auto index = GitIndex::read("index");
+        ASSERT_EQ(index.serialize(), data);
+
+        index.write("index");
+        ASSERT_FALSE(std::filesystem::exists("index.lock"));
+        ASSERT_EQ(GitIndex::read("index").serialize(), data);
+    }
+
+    // a lock left by another writer is never overwritten
+    Utilities::writeToFile("index.lock", "");
+    ASSERT_THROW(GitIndex().write("index"), std::runtime_error);
+    ASSERT_TRUE(std::filesystem::exists("index"));
+}
+
+TEST_F(GitCommandsTest, ParallelReadIndex)
+{
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < 25000; ++i) {
+        paths.push_back(fmt::format("dir{:02}/file{:05}", i / 1000, i));
+    }
+    std::string data;
+    for (uint32_t version : {2, 3, 4}) {
+        SCOPED_TRACE(version);
+        Utilities::writeToFile("index", indexBytes(version, paths));
+        data = GitIndex::read("index", 1).serialize();
+        ASSERT_NE(data.find("IEOT"), std::string::npos);
+        ASSERT_EQ(data.substr(data.size() - 52, 4), "EOIE");
+        Utilities::writeToFile("index", data);
+
+        auto index = GitIndex::read("index", 4);
+        ASSERT_EQ(index.size(), paths.size());
+        for (size_t i = 0; i < paths.size(); ++i) {
+            ASSERT_EQ(index.path(i), paths[i]);
+            ASSERT_EQ(index.hash(i), SHA1::computeHash(paths[i]));
+        }
+        ASSERT_EQ(index.extensions().size(), 1);
+        ASSERT_EQ(index.serialize(), data);
+
+        auto corrupted = data;
+        corrupted[40] ^= 1;
+        Utilities::writeToFile("index", corrupted);
+        ASSERT_THROW(GitIndex::read("index", 4), std::runtime_error);
+    }
+
+    // the second block starts 8 bytes later than the table says
+    auto table = data.find("IEOT") + 8 + 4 + 8;
+    data[table + 3] = static_cast<char>(data[table + 3] + 8);
+    data.replace(data.size() - 20, 20,
+                 SHA1::computeHash(data.substr(0, data.size() - 20)).bytes());
+    Utilities::writeToFile("index", data);
+    ASSERT_THROW(GitIndex::read("index", 4), std::runtime_error);
+    // without threads the table isn't used
+    ASSERT_EQ(GitIndex::read("index", 1).size(), paths.size());
+}
+
+TEST_F(GitCommandsTest, AddFiles)
+{
+    using namespace std::chrono_literals;
+    std::filesystem::create_directories("src/nested");
+    Utilities::writeToFile("README.md", "readme");
+    Utilities::writeToFile("src/main.cpp", "int main() {}");
+    Utilities::writeToFile("src/nested/lib.cpp", "lib");
+    std::filesystem::create_symlink("README.md", "link");
+    // files modified right before the index is written are never trusted
+    for (auto file : {"README.md", "src/main.cpp", "src/nested/lib.cpp"}) {
+        std::filesystem::last_write_time(
+            file, std::filesystem::last_write_time(file) - 10s);
+    }
+
+    GitCommands::add({"."});
+    auto index = GitCommands::readIndex();
+    std::vector<std::string> expected = {"README.md", "link", "src/main.cpp",
+                                         "src/nested/lib.cpp"};
+    ASSERT_EQ(index.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQ(index.path(i), expected[i]);
+    }
+    ASSERT_EQ(index.hash(0), GitObject::writeBlob("README.md", false));
+    ASSERT_EQ(GitIndex::modeOf(index.stat(1)), 0120000);
+    ASSERT_EQ(index.hash(1),
+              SHA1::computeHash(std::string("blob 9\0README.md", 16)));
+
+    // nothing changed, the index isn't rewritten
+    auto lastWrite = std::filesystem::last_write_time(".git/index");
+    std::this_thread::sleep_for(10ms);
+    GitCommands::add({"src"});
+    ASSERT_EQ(std::filesystem::last_write_time(".git/index"), lastWrite);
+
+    // modified and deleted files under the path are updated
+    Utilities::writeToFile("src/main.cpp", "int main() { return 1; }");
+    std::filesystem::remove("src/nested/lib.cpp");
+    GitCommands::add({"src"});
+    index = GitCommands::readIndex();
+    ASSERT_EQ(index.size(), 3);
+    ASSERT_EQ(index.path(2), "src/main.cpp");
+    ASSERT_EQ(index.hash(2), GitObject::writeBlob("src/main.cpp", false));
+
+    ASSERT_THROW(GitCommands::add({"missing"}), std::runtime_error);
+
+    // the index is locked from before it is read, another add fails instead
+    // of writing over what the holder of the lock stages
+    Utilities::writeToFile("src/main.cpp", "int main() { return 2; }");
+    {
+        auto lock = GitCommands::lockIndex();
+        ASSERT_THROW(GitCommands::add({"src"}), std::runtime_error);
+        ASSERT_THROW(GitCommands::commit("locked"), std::runtime_error);
+    }
+    ASSERT_EQ(GitCommands::readIndex().hash(2), index.hash(2));
+    GitCommands::add({"src"});
+    ASSERT_EQ(GitCommands::readIndex().hash(2),
+              GitObject::writeBlob("src/main.cpp", false));
+}
+
+TEST_F(GitCommandsTest, Status)
+{
+    using namespace std::chrono_literals;
+    using Changes = std::vector<GitCommands::FileStatus>;
+
+    std::filesystem::create_directories("dir");
+    Utilities::writeToFile("a.txt", "a");
+    Utilities::writeToFile("dir/b.txt", "b");
+    Utilities::writeToFile("dir/c.txt", "c");
+    for (auto file : {"a.txt", "dir/b.txt", "dir/c.txt"}) {
+        std::filesystem::last_write_time(
+            file, std::filesystem::last_write_time(file) - 10s);
+    }
+
+    // HEAD has a.txt and dir/b.txt
+    GitTree directory({{"100644", "b.txt", GitObject::writeBlob("dir/b.txt")}});
+    GitTree root({{"100644", "a.txt", GitObject::writeBlob("a.txt")},
+                  {"40000", "dir", GitObject::write(&directory)}});
+    GitCommit commit({.tree = GitObject::write(&root).data(),
+                      .parents = {},
+                      .author = "Joe Doe <joedoe@email.com>",
+                      .committer = "Joe Doe <joedoe@email.com>",
+                      .gpgsig = "",
+                      .message = "initial"});
+    GitRepository::commitToBranch(GitObject::write(&commit));
+
+    GitCommands::add({"."});
+    auto status = GitCommands::collectStatus();
+    ASSERT_EQ(status.staged, Changes({{'A', "dir/c.txt"}}));
+    ASSERT_TRUE(status.unstaged.empty());
+    ASSERT_TRUE(status.untracked.empty());
+
+    // same size and a new mtime, only the content tells it changed
+    Utilities::writeToFile("a.txt", "A");
+    std::filesystem::remove("dir/b.txt");
+    std::filesystem::create_directories("new/empty");
+    std::filesystem::create_directories("empty");
+    Utilities::writeToFile("new/x.txt", "x");
+    Utilities::writeToFile("y.txt", "y");
+    // touched but not changed, its stat data is refreshed
+    std::filesystem::last_write_time(
+        "dir/c.txt", std::filesystem::last_write_time("dir/c.txt") + 5s);
+
+    status = GitCommands::collectStatus(2);
+    ASSERT_EQ(status.staged, Changes({{'A', "dir/c.txt"}}));
+    ASSERT_EQ(status.unstaged, Changes({{'M', "a.txt"}, {'D', "dir/b.txt"}}));
+    ASSERT_EQ(status.untracked, std::vector<std::string>({"new/", "y.txt"}));
+    auto index = GitCommands::readIndex();
+    auto refreshed = index.find("dir/c.txt");
+    ASSERT_TRUE(refreshed);
+    ASSERT_TRUE(index.isUpToDate(*refreshed, GitIndex::statOf("dir/c.txt")));
+}
+
+TEST_F(GitCommandsTest, IgnoreFiles)
+{
+    GitIgnore patterns(REPO_PATH);
+    patterns.addPatterns("*.o\nbuild/\n/TODO\nlib*\ndoc/**/*.pdf\n"
+                         "a?c.[ch]\n\\#hash\n!keep.o\n",
+                         "");
+    // the fast paths and the glob matcher
+    ASSERT_TRUE(patterns.isIgnored("main.o", false));
+    ASSERT_TRUE(patterns.isIgnored("src/main.o", false));
+    ASSERT_FALSE(patterns.isIgnored("main.oo", false));
+    ASSERT_FALSE(patterns.isIgnored("keep.o", false));
+    ASSERT_TRUE(patterns.isIgnored("build", true));
+    ASSERT_FALSE(patterns.isIgnored("build", false));
+    ASSERT_TRUE(patterns.isIgnored("build/out", false));
+    ASSERT_TRUE(patterns.isIgnored("TODO", false));
+    ASSERT_FALSE(patterns.isIgnored("src/TODO", false));
+    ASSERT_TRUE(patterns.isIgnored("src/libz.a", false));
+    ASSERT_TRUE(patterns.isIgnored("doc/a.pdf", false));
+    ASSERT_TRUE(patterns.isIgnored("doc/x/y/a.pdf", false));
+    ASSERT_FALSE(patterns.isIgnored("src/doc/a.pdf", false));
+    ASSERT_TRUE(patterns.isIgnored("abc.h", false));
+    ASSERT_FALSE(patterns.isIgnored("abc.o.x", false));
+    ASSERT_FALSE(patterns.isIgnored("ac.c", false));
+    ASSERT_TRUE(patterns.isIgnored("#hash", false));
+
+    // a deeper .gitignore wins, info/exclude comes last
+    std::filesystem::create_directories("src/gen");
+    std::filesystem::create_directories("logs");
+    std::filesystem::create_directories(".git/info");
+    Utilities::writeToFile(".gitignore", "*.log\nlogs/\n");
+    Utilities::writeToFile("src/.gitignore", "!debug.log\ngen/\n");
+    Utilities::writeToFile(".git/info/exclude", "*.tmp\n!a.log\n");
+    Utilities::writeToFile("a.log", "a");
+    Utilities::writeToFile("b.tmp", "b");
+    Utilities::writeToFile("main.c", "main");
+    Utilities::writeToFile("src/debug.log", "debug");
+    Utilities::writeToFile("src/other.log", "other");
+    Utilities::writeToFile("src/gen/code.c", "code");
+    Utilities::writeToFile("logs/today", "today");
+    GitIgnore ignore(REPO_PATH);
+    ASSERT_TRUE(ignore.isIgnored("a.log", false));
+    ASSERT_TRUE(ignore.isIgnored("b.tmp", false));
+    ASSERT_FALSE(ignore.isIgnored("src/debug.log", false));
+    ASSERT_TRUE(ignore.isIgnored("src/other.log", false));
+    // no file can be included again in an ignored directory
+    Utilities::writeToFile("logs/.gitignore", "!today\n");
+    ASSERT_TRUE(GitIgnore(REPO_PATH).isIgnored("logs/today", false));
+
+    // ignored directories aren't entered
+    std::vector<std::string> walked;
+    ignore.walk("", [&](const std::string& path, bool isDirectory) {
+        walked.push_back(path);
+        return isDirectory;
+    });
+    std::sort(walked.begin(), walked.end());
+    ASSERT_EQ(walked, std::vector<std::string>({".gitignore", "main.c", "src",
+                                                "src/.gitignore",
+                                                "src/debug.log"}));
+
+    // tracked files are kept even if they are ignored, an explicitly named
+    // file is added anyway
+    GitCommands::add({"."});
+    GitCommands::add({"src/other.log"});
+    auto index = GitCommands::readIndex();
+    ASSERT_EQ(index.size(), 5);
+    ASSERT_TRUE(index.find("src/other.log"));
+    ASSERT_FALSE(index.find("a.log"));
+    Utilities::writeToFile("src/other.log", "changed");
+    auto status = GitCommands::collectStatus();
+    ASSERT_EQ(status.unstaged,
+              std::vector<GitCommands::FileStatus>({{'M', "src/other.log"}}));
+    ASSERT_TRUE(status.untracked.empty());
+    GitCommands::commit("ignored");
+    ASSERT_TRUE(GitCommands::collectStatus().unstaged.empty());
+}
+
+TEST_F(GitCommandsTest, CacheTree)
+{
+    std::filesystem::create_directories("a/nested");
+    std::filesystem::create_directories("b");
+    Utilities::writeToFile("a/nested/x", "x");
+    Utilities::writeToFile("b/y", "y");
+    Utilities::writeToFile("top", "top");
+    GitCommands::commit("first");
+
+    auto index = GitCommands::readIndex();
+    const auto& root = index.cacheTree();
+    ASSERT_TRUE(root.isValid());
+    ASSERT_EQ(root.entryCount(), 3);
+    ASSERT_EQ(root.subtrees().size(), 2);
+    auto commit = GitObjectCache::read(GitObject::findObject("HEAD"));
+    auto commitMessage =
+        static_cast<const GitCommit*>(commit.get())->commitMessage();
+    ASSERT_EQ(root.hash(), GitHash(commitMessage.tree));
+    auto data = root.serialize();
+    ASSERT_EQ(GitCacheTree::parse(data).serialize(), data);
+
+    auto treeFile = [](const GitHash& hash) {
+        auto hex = hash.data();
+        return GitRepository::repoPath("objects", hex.substr(0, 2),
+                                       hex.substr(2));
+    };
+    auto treeOf = [&](const std::string& name) {
+        auto index = GitCommands::readIndex();
+        for (const auto& subtree : index.cacheTree().subtrees()) {
+            if (subtree.name() == name) {
+                return subtree;
+            }
+        }
+        return GitCacheTree();
+    };
+
+    // only the trees leading to the changed file are written again
+    auto unchanged = treeOf("b");
+    ASSERT_TRUE(unchanged.isValid());
+    std::filesystem::remove(treeFile(unchanged.hash()));
+    Utilities::writeToFile("a/nested/x", "changed");
+    GitCommands::add({"a"});
+    ASSERT_FALSE(GitCommands::readIndex().cacheTree().isValid());
+    ASSERT_FALSE(treeOf("a").isValid());
+    ASSERT_TRUE(treeOf("b").isValid());
+
+    GitCommands::commit("second");
+    ASSERT_FALSE(std::filesystem::exists(treeFile(unchanged.hash())));
+    ASSERT_TRUE(std::filesystem::exists(treeFile(treeOf("a").hash())));
+    ASSERT_EQ(treeOf("b").hash(), unchanged.hash());
+    ASSERT_EQ(GitCommands::readIndex().cacheTree().entryCount(), 3);
+
+    // a removed directory leaves the tree
+    std::filesystem::remove_all("b");
+    GitCommands::commit("third");
+    ASSERT_EQ(GitCommands::readIndex().cacheTree().entryCount(), 2);
+    ASSERT_EQ(GitCommands::readIndex().cacheTree().subtrees().size(), 1);
+}
+
+TEST_F(GitCommandsTest, FSMonitor)
+{
+    using namespace std::chrono_literals;
+    using Changes = std::vector<GitCommands::FileStatus>;
+
+    boost::property_tree::ptree config;
+    config.put("core.fsmonitor", "true");
+    boost::property_tree::write_ini(".git/config", config);
+    std::filesystem::create_directories("dir");
+    Utilities::writeToFile("a.txt", "a");
+    Utilities::writeToFile("dir/b.txt", "b");
+    for (auto file : {"a.txt", "dir/b.txt"}) {
+        std::filesystem::last_write_time(
+            file, std::filesystem::last_write_time(file) - 10s);
+    }
+    GitCommands::add({"."});
+
+    std::thread monitor(GitFSMonitor::run);
+    while (!GitFSMonitor::isRunning()) {
+        std::this_thread::sleep_for(10ms);
+    }
+    // the index wasn't checked with the monitor yet
+    auto changes = GitFSMonitor::query("");
+    ASSERT_TRUE(changes && changes->everything);
+    GitCommands::collectStatus();
+    auto token = GitCommands::readIndex().fsmonitorToken();
+    ASSERT_FALSE(token.empty());
+
+    // an entry the monitor vouches for isn't stat'ed, its wrong stat data
+    // would be refreshed otherwise
+    auto index = GitCommands::readIndex();
+    auto stat = index.stat(*index.find("a.txt"));
+    ++stat.ino;
+    index.setStat(*index.find("a.txt"), stat);
+    index.write(".git/index");
+    Utilities::writeToFile("dir/b.txt", "B");
+    Utilities::writeToFile("dir/new.txt", "new");
+    changes = GitFSMonitor::query(token);
+    ASSERT_TRUE(changes && !changes->everything);
+    ASSERT_TRUE(changes->contains("dir/b.txt"));
+    ASSERT_TRUE(changes->contains("dir/new.txt"));
+    ASSERT_FALSE(changes->contains("a.txt"));
+
+    auto status = GitCommands::collectStatus();
+    ASSERT_EQ(status.unstaged, Changes({{'M', "dir/b.txt"}}));
+    ASSERT_EQ(status.untracked, std::vector<std::string>({"dir/new.txt"}));
+    index = GitCommands::readIndex();
+    ASSERT_EQ(index.stat(*index.find("a.txt")).ino, stat.ino);
+    ASSERT_TRUE(index.isFSMonitorDirty(*index.find("dir/b.txt")));
+    // a modified file stays modified without new events
+    status = GitCommands::collectStatus();
+    ASSERT_EQ(status.unstaged, Changes({{'M', "dir/b.txt"}}));
+
+    GitCommands::add({"."});
+    index = GitCommands::readIndex();
+    ASSERT_EQ(index.size(), 3);
+    for (size_t position = 0; position < index.size(); ++position) {
+        ASSERT_FALSE(index.isFSMonitorDirty(position));
+    }
+    std::filesystem::remove("dir/new.txt");
+    GitCommands::add({"."});
+    ASSERT_EQ(GitCommands::readIndex().size(), 2);
+
+    // without the monitor every entry is checked again
+    GitFSMonitor::stop();
+    monitor.join();
+    ASSERT_FALSE(GitFSMonitor::query(token));
+    status = GitCommands::collectStatus();
+    ASSERT_TRUE(status.unstaged.empty());
+    index = GitCommands::readIndex();
+    ASSERT_NE(index.stat(*index.find("a.txt")).ino, stat.ino);
+
+    // the dirty flags survive a round trip through the EWAH bitmap
+    std::vector<IndexEntry> entries;
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < 300; ++i) {
+        paths.push_back(fmt::format("file{:03}", i));
+    }
+    for (const auto& path : paths) {
+        entries.push_back({.stat = {},
+                           .hash = GitHash(),
+                           .flags = 0,
+                           .extendedFlags = 0,
+                           .path = path});
+    }
+    GitIndex big;
+    big.add(entries);
+    std::vector<bool> dirty(paths.size());
+    for (auto position : {3, 64, 65, 130, 299}) {
+        dirty[position] = true;
+    }
+    big.setFSMonitor("token", dirty);
+    big.write("big");
+    auto read = GitIndex::read("big");
+    ASSERT_EQ(read.fsmonitorToken(), "token");
+    for (size_t position = 0; position < paths.size(); ++position) {
+        ASSERT_EQ(read.isFSMonitorDirty(position), dirty[position]);
+    }
+}
+
 TEST_F(GitCommandsTest, HashFileBlob)
 {
     auto textFile = REPO_PATH / "test.txt";
@@ -96,6 +640,117 @@ TEST_F(GitCommandsTest, HashFileBlob)
     EXPECT_EQ(fileHash, fileHashFromFS);
 }
 
+TEST_F(GitCommandsTest, CatFileBatch)
+{
+    Utilities::writeToFile("packed.txt", "packed content");
+    auto packed = GitCommands::hashObject("packed.txt", "blob");
+    GitCommands::commit("packed");
+    GitCommands::repack(true, 10, 50);
+    auto objectsDir = REPO_PATH / ".git" / "objects";
+    ASSERT_FALSE(std::filesystem::exists(
+        objectsDir / Utilities::getObjectDirectory(packed)));
+    Utilities::writeToFile("loose.txt", "loose content");
+    auto loose = GitCommands::hashObject("loose.txt", "blob");
+
+    auto batch = [](const std::string& names, bool withContent) {
+        std::istringstream input(names);
+        std::ostringstream output;
+        GitCommands::catFileBatch(input, output, withContent);
+        return output.str();
+    };
+    auto names = fmt::format("{}\nnothing\n{}\n", packed, loose);
+    ASSERT_EQ(batch(names, true),
+              fmt::format("{} blob 14\npacked content\n"
+                          "nothing missing\n"
+                          "{} blob 13\nloose content\n",
+                          packed, loose));
+    ASSERT_EQ(batch(names, false), fmt::format("{} blob 14\n"
+                                               "nothing missing\n"
+                                               "{} blob 13\n",
+                                               packed, loose));
+}
+
+TEST_F(GitCommandsTest, StreamingHashObject)
+{
+    // same hash as `git hash-object`, the trailing new line is kept
+    Utilities::writeToFile("hello.txt", "hello\n");
+    auto helloHash = GitCommands::hashObject("hello.txt", "blob");
+    ASSERT_EQ(helloHash, GitHash("ce013625030ba8dba906f756967f9e9ca394464a"));
+    ASSERT_EQ(GitObjectFactory::readRaw(helloHash).data, "hello\n");
+
+    // spans many chunks of the stream
+    std::string content;
+    for (int i = 0; content.size() < 1024 * 1024; ++i) {
+        content += fmt::format("{}\n", i);
+    }
+    Utilities::writeToFile("big.txt", content);
+    auto header = fmt::format("blob {}", content.size()) + '\0';
+    auto expectedHash = SHA1::computeHash(header + content);
+    ASSERT_EQ(GitCommands::hashObject("big.txt", "blob", false), expectedHash);
+    ASSERT_FALSE(std::filesystem::exists(
+        REPO_PATH / ".git" / "objects" /
+        Utilities::getObjectDirectory(expectedHash)));
+    ASSERT_EQ(GitCommands::hashObject("big.txt", "blob"), expectedHash);
+    ASSERT_EQ(GitObjectFactory::readRaw(expectedHash).data, content);
+}
+
+TEST_F(GitCommandsTest, WriteObjectInPieces)
+{
+    // the loose file holds header and content as one zlib stream
+    std::string content = "tree 4b825dc642cb6eb9a060e54bf8d69288fbee4904\n"
+                          "author Joe Doe <joedoe@email.com> 0 +0000\n"
+                          "committer Joe Doe <joedoe@email.com> 0 +0000\n"
+                          "\nmessage\n";
+    auto commit = GitObjectFactory::create("commit", ObjectData(content));
+    auto commitHash = GitObject::write(commit.get());
+
+    auto header = fmt::format("commit {}", content.size()) + '\0';
+    ASSERT_EQ(commitHash, SHA1::computeHash(header + content));
+    auto objectFile = REPO_PATH / ".git" / "objects" /
+                      Utilities::getObjectDirectory(commitHash) /
+                      Utilities::getObjectFileName(commitHash);
+    ASSERT_EQ(Zlib::decompressFile(objectFile), header + content);
+
+    SHA1::Hasher hasher;
+    hasher.update(header);
+    hasher.update(content);
+    ASSERT_EQ(hasher.finalize(), commitHash);
+}
+
+TEST_F(GitCommandsTest, WriteExistingObject)
+{
+    auto blob = GitObjectFactory::create("blob", ObjectData("some content"));
+    auto hash = GitObject::write(blob.get());
+    auto objectFile = REPO_PATH / ".git" / "objects" /
+                      Utilities::getObjectDirectory(hash) /
+                      Utilities::getObjectFileName(hash);
+    // nothing but the object is left in its directory
+    auto objectDirectory = objectFile.parent_path();
+    ASSERT_EQ(
+        std::distance(std::filesystem::directory_iterator(objectDirectory),
+                      std::filesystem::directory_iterator{}),
+        1);
+    ASSERT_EQ(std::filesystem::status(objectFile).permissions() &
+                  std::filesystem::perms::owner_write,
+              std::filesystem::perms::none);
+
+    // an existing object is left as is
+    auto writeTime = std::filesystem::last_write_time(objectFile);
+    std::filesystem::last_write_time(objectFile,
+                                     writeTime - std::chrono::hours(1));
+    ASSERT_EQ(GitObject::write(blob.get()), hash);
+    ASSERT_EQ(std::filesystem::last_write_time(objectFile),
+              writeTime - std::chrono::hours(1));
+
+    // same for objects that are only in a pack
+    Utilities::writeToFile("file.txt", "some content");
+    GitCommands::commit("packed");
+    GitCommands::repack(true, 10, 50);
+    ASSERT_FALSE(std::filesystem::exists(objectFile));
+    ASSERT_EQ(GitObject::write(blob.get()), hash);
+    ASSERT_FALSE(std::filesystem::exists(objectFile));
+}
+
 TEST_F(GitCommandsTest, GitCommitTest)
 {
     auto fileOne = "file1.txt";
@@ -147,6 +802,353 @@ TEST_F(GitCommandsTest, GitCheckout)
     }
 }
 
+TEST_F(GitCommandsTest, IncrementalCheckout)
+{
+    std::filesystem::create_directories("a");
+    std::filesystem::create_directories("b");
+    Utilities::writeToFile("a/x", "x");
+    Utilities::writeToFile("a/y", "y");
+    Utilities::writeToFile("b/z", "z");
+    Utilities::writeToFile("c", "c");
+    Utilities::writeToFile("keep.txt", "keep");
+    GitCommands::commit("master");
+    GitCommands::createBranch("other");
+    GitCommands::checkout("other");
+
+    Utilities::writeToFile("b/z", "z on other");
+    std::filesystem::remove("a/y");
+    std::filesystem::remove("c");
+    std::filesystem::create_directories("c");
+    std::filesystem::create_directories("d");
+    Utilities::writeToFile("c/inner", "inner");
+    Utilities::writeToFile("d/new", "new");
+    GitCommands::commit("other");
+
+    // files that are the same on both branches aren't written again
+    auto unchanged = GitIndex::statOf("a/x");
+    Utilities::writeToFile("notes.txt", "untracked");
+    GitCommands::checkout("master");
+    ASSERT_EQ(Utilities::readFile("a/y"), "y");
+    ASSERT_EQ(Utilities::readFile("b/z"), "z");
+    ASSERT_EQ(Utilities::readFile("c"), "c");
+    ASSERT_FALSE(std::filesystem::exists("d"));
+    ASSERT_EQ(Utilities::readFile("notes.txt"), "untracked");
+    auto stat = GitIndex::statOf("a/x");
+    ASSERT_EQ(stat.ino, unchanged.ino);
+    ASSERT_EQ(stat.mtimeNanoseconds, unchanged.mtimeNanoseconds);
+    auto status = GitCommands::collectStatus();
+    ASSERT_TRUE(status.staged.empty());
+    ASSERT_TRUE(status.unstaged.empty());
+    ASSERT_EQ(status.untracked, std::vector<std::string>{"notes.txt"});
+
+    // a local change of a file that differs is never lost
+    auto master = GitRepository::HEAD();
+    Utilities::writeToFile("b/z", "local change");
+    ASSERT_THROW(GitCommands::checkout("other"), std::runtime_error);
+    ASSERT_EQ(GitRepository::HEAD(), master);
+    ASSERT_EQ(Utilities::readFile("b/z"), "local change");
+    Utilities::writeToFile("b/z", "z");
+
+    // neither is an untracked file in the way
+    std::filesystem::create_directories("d");
+    Utilities::writeToFile("d/new", "untracked new");
+    ASSERT_THROW(GitCommands::checkout("other"), std::runtime_error);
+    GitCommands::checkout("other", true);
+    ASSERT_EQ(Utilities::readFile("d/new"), "new");
+    ASSERT_EQ(Utilities::readFile("c/inner"), "inner");
+    ASSERT_EQ(Utilities::readFile("b/z"), "z on other");
+    ASSERT_FALSE(std::filesystem::exists("a/y"));
+}
+
+TEST_F(GitCommandsTest, ParallelCheckout)
+{
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < 300; ++i) {
+        auto directory = fmt::format("dir{}/sub{}", i % 7, i % 3);
+        std::filesystem::create_directories(directory);
+        paths.push_back(fmt::format("{}/file{:03}", directory, i));
+        Utilities::writeToFile(paths.back(), std::string(i * 10, 'a' + i % 26));
+    }
+    Utilities::writeToFile("run.sh", "#!/bin/sh");
+    std::filesystem::permissions("run.sh", std::filesystem::perms::owner_exec,
+                                 std::filesystem::perm_options::add);
+    GitCommands::commit("files");
+
+    // from an empty tree every file is written, as in a fresh checkout
+    GitTree empty(std::vector<GitTreeLeaf>{});
+    for (size_t threads : {1, 4}) {
+        SCOPED_TRACE(threads);
+        GitCommands::checkout(GitObject::write(&empty).data());
+        ASSERT_EQ(std::distance(std::filesystem::directory_iterator("."),
+                                std::filesystem::directory_iterator()),
+                  1);
+        GitCommands::checkout("master", false, threads);
+        for (size_t i = 0; i < paths.size(); ++i) {
+            ASSERT_EQ(Utilities::readFile(paths[i]),
+                      std::string(i * 10, 'a' + i % 26));
+        }
+        ASSERT_EQ(GitIndex::statOf("run.sh").mode, 0100755);
+        auto status = GitCommands::collectStatus();
+        ASSERT_TRUE(status.staged.empty());
+        ASSERT_TRUE(status.unstaged.empty());
+        ASSERT_TRUE(status.untracked.empty());
+    }
+}
+
+TEST_F(GitCommandsTest, LineDiff)
+{
+    // the shortest edit script has as many changes as the longest common
+    // subsequence leaves
+    auto lcs = [](const std::vector<std::string_view>& a,
+                  const std::vector<std::string_view>& b) {
+        std::vector<std::vector<size_t>> lengths(
+            a.size() + 1, std::vector<size_t>(b.size() + 1));
+        for (size_t i = a.size(); i-- > 0;) {
+            for (size_t j = b.size(); j-- > 0;) {
+                lengths[i][j] = a[i] == b[j]
+                                    ? lengths[i + 1][j + 1] + 1
+                                    : std::max(lengths[i + 1][j],
+                                               lengths[i][j + 1]);
+            }
+        }
+        return lengths[0][0];
+    };
+    std::mt19937 random(3);
+    for (int round = 0; round < 200; ++round) {
+        std::string before, after;
+        for (size_t i = random() % 40; i > 0; --i) {
+            before += fmt::format("{}\n", random() % 6);
+        }
+        for (size_t i = random() % 40; i > 0; --i) {
+            after += fmt::format("{}\n", random() % 8);
+        }
+        auto beforeLines = GitDiff::lines(before);
+        auto afterLines = GitDiff::lines(after);
+        auto changes = GitDiff::compare(beforeLines, afterLines);
+        auto removed =
+            std::count(changes.removed.begin(), changes.removed.end(), true);
+        auto added =
+            std::count(changes.added.begin(), changes.added.end(), true);
+        auto common = lcs(beforeLines, afterLines);
+        ASSERT_EQ(removed, beforeLines.size() - common);
+        ASSERT_EQ(added, afterLines.size() - common);
+        // the lines left are the same in both
+        std::vector<std::string_view> keptBefore, keptAfter;
+        for (size_t i = 0; i < beforeLines.size(); ++i) {
+            if (!changes.removed[i]) {
+                keptBefore.push_back(beforeLines[i]);
+            }
+        }
+        for (size_t i = 0; i < afterLines.size(); ++i) {
+            if (!changes.added[i]) {
+                keptAfter.push_back(afterLines[i]);
+            }
+        }
+        ASSERT_EQ(keptBefore, keptAfter);
+    }
+
+    std::string text;
+    for (int i = 1; i <= 12; ++i) {
+        text += fmt::format("line {}\n", i);
+    }
+    auto changed = text;
+    changed.replace(changed.find("line 2\n"), 7, "two\n");
+    changed += "last";
+    ASSERT_EQ(GitDiff::unified(text, text), "");
+    ASSERT_EQ(GitDiff::unified(text, changed),
+              "@@ -1,5 +1,5 @@\n"
+              " line 1\n-line 2\n+two\n line 3\n line 4\n line 5\n"
+              "@@ -10,3 +10,4 @@ line 9\n"
+              " line 10\n line 11\n line 12\n+last\n"
+              "\\ No newline at end of file\n");
+    ASSERT_EQ(GitDiff::unified("", "a\n"), "@@ -0,0 +1 @@\n+a\n");
+}
+
+TEST_F(GitCommandsTest, Diff)
+{
+    std::filesystem::create_directories("dir");
+    std::filesystem::create_directories("same");
+    Utilities::writeToFile("a.txt", "one\ntwo\nthree\n");
+    Utilities::writeToFile("dir/b.txt", "b\n");
+    Utilities::writeToFile("same/c.txt", "c\n");
+    Utilities::writeToFile("dir.txt", "removed\n");
+    GitCommands::commit("first");
+    auto first = GitRepository::HEAD();
+
+    Utilities::writeToFile("a.txt", "one\n2\nthree\n");
+    Utilities::writeToFile("dir/new.txt", "new\n");
+    Utilities::writeToFile("data.bin", std::string("\0\1", 2));
+    std::filesystem::remove("dir.txt");
+    GitCommands::commit("second");
+    auto second = GitRepository::HEAD();
+
+    auto diff = [&](GitCommands::DiffFormat format) {
+        std::ostringstream output;
+        GitCommands::diff(first, second, format, output);
+        return output.str();
+    };
+    // paths are in git's order, "dir.txt" before "dir/new.txt"
+    ASSERT_EQ(diff(GitCommands::DiffFormat::NAME_ONLY),
+              "a.txt\ndata.bin\ndir.txt\ndir/new.txt\n");
+    ASSERT_EQ(diff(GitCommands::DiffFormat::STAT),
+              " a.txt       |   2 +-\n"
+              " data.bin    | Bin 0 -> 2 bytes\n"
+              " dir.txt     |   1 -\n"
+              " dir/new.txt |   1 +\n"
+              " 4 files changed, 2 insertions(+), 2 deletions(-)\n");
+    auto hash = [](const std::string& content) {
+        auto blob = GitObjectFactory::create("blob", ObjectData(content));
+        return GitObject::write(blob.get(), false).data().substr(0, 7);
+    };
+    ASSERT_EQ(diff(GitCommands::DiffFormat::PATCH),
+              fmt::format("diff --git a/a.txt b/a.txt\n"
+                          "index {}..{} 100644\n"
+                          "--- a/a.txt\n+++ b/a.txt\n"
+                          "@@ -1,3 +1,3 @@\n one\n-two\n+2\n three\n"
+                          "diff --git a/data.bin b/data.bin\n"
+                          "new file mode 100644\n"
+                          "index 0000000..{}\n"
+                          "Binary files /dev/null and b/data.bin differ\n"
+                          "diff --git a/dir.txt b/dir.txt\n"
+                          "deleted file mode 100644\n"
+                          "index {}..0000000\n"
+                          "--- a/dir.txt\n+++ /dev/null\n"
+                          "@@ -1 +0,0 @@\n-removed\n"
+                          "diff --git a/dir/new.txt b/dir/new.txt\n"
+                          "new file mode 100644\n"
+                          "index 0000000..{}\n"
+                          "--- /dev/null\n+++ b/dir/new.txt\n"
+                          "@@ -0,0 +1 @@\n+new\n",
+                          hash("one\ntwo\nthree\n"), hash("one\n2\nthree\n"),
+                          hash(std::string("\0\1", 2)), hash("removed\n"),
+                          hash("new\n")));
+
+    // a tree compared with itself has nothing to show
+    std::ostringstream output;
+    GitCommands::diff(second, second, GitCommands::DiffFormat::PATCH, output);
+    ASSERT_TRUE(output.str().empty());
+}
+
+TEST_F(GitCommandsTest, Merge)
+{
+    // lines changed apart are merged, changed in different ways they conflict
+    auto merged = GitDiff::merge("a\nb\nc\nd\ne\n", "a\nB\nc\nd\ne\n",
+                                 "a\nb\nc\nd\nE\n", "ours", "theirs");
+    ASSERT_EQ(merged.text, "a\nB\nc\nd\nE\n");
+    ASSERT_EQ(merged.numberOfConflicts, 0);
+    merged = GitDiff::merge("a\nb\nc\n", "a\nB\nx\nc\n", "a\nB\ny\nc\n",
+                            "ours", "theirs");
+    ASSERT_EQ(merged.text,
+              "a\nB\n<<<<<<< ours\nx\n=======\ny\n>>>>>>> theirs\nc\n");
+    ASSERT_EQ(merged.numberOfConflicts, 1);
+
+    Utilities::writeToFile("a.txt", "1\n2\n3\n4\n5\n6\n7\n8\n");
+    Utilities::writeToFile("b.txt", "b\n");
+    std::filesystem::create_directories("dir");
+    Utilities::writeToFile("dir/c.txt", "c\n");
+    GitCommands::commit("base");
+    auto base = GitHash(GitRepository::HEAD());
+    GitCommands::createBranch("topic");
+    GitCommands::createBranch("bot");
+
+    Utilities::writeToFile("a.txt", "one\n2\n3\n4\n5\n6\n7\n8\n");
+    GitCommands::commit("ours");
+    auto ours = GitHash(GitRepository::HEAD());
+    GitCommands::checkout("topic");
+    Utilities::writeToFile("a.txt", "1\n2\n3\n4\n5\n6\n7\neight\n");
+    std::filesystem::remove("dir/c.txt");
+    Utilities::writeToFile("dir/d.txt", "d\n");
+    GitCommands::commit("theirs");
+    auto theirs = GitHash(GitRepository::HEAD());
+    GitCommands::checkout("master");
+
+    ASSERT_EQ(GitCommands::mergeBases(ours, theirs), std::vector{base});
+    auto parentsOf = [](const GitHash& commit) {
+        auto object = GitObjectCache::read(commit);
+        return static_cast<const GitCommit*>(object.get())
+            ->commitMessage()
+            .parents;
+    };
+
+    // a branch that isn't checked out gets the merge, the worktree doesn't
+    GitCommands::createBranch("other");
+    GitCommands::merge("topic", "", "other");
+    auto mergedInto = GitHash(GitObject::findObject("other"));
+    ASSERT_EQ(parentsOf(mergedInto),
+              (std::vector{ours.data(), theirs.data()}));
+    ASSERT_EQ(Utilities::readFile("a.txt"), "one\n2\n3\n4\n5\n6\n7\n8");
+    ASSERT_TRUE(std::filesystem::exists("dir/c.txt"));
+    // the first one was fast-forwarded
+    GitCommands::merge("topic", "", "bot");
+    ASSERT_EQ(GitObject::findObject("bot"), theirs);
+
+    GitCommands::merge("topic");
+    auto head = GitHash(GitRepository::HEAD());
+    ASSERT_EQ(GitCommands::treeOf(head), GitCommands::treeOf(mergedInto));
+    ASSERT_EQ(parentsOf(head), (std::vector{ours.data(), theirs.data()}));
+    ASSERT_EQ(Utilities::readFile("a.txt"), "one\n2\n3\n4\n5\n6\n7\neight");
+    ASSERT_FALSE(std::filesystem::exists("dir/c.txt"));
+    ASSERT_EQ(Utilities::readFile("dir/d.txt"), "d");
+    ASSERT_TRUE(GitCommands::collectStatus().unstaged.empty());
+    GitCommands::merge("topic");
+    ASSERT_EQ(GitRepository::HEAD(), head.data());
+
+    // two branches that merged each other have two best common ancestors
+    GitCommands::merge(ours.data(), "", "topic");
+    auto crossed = GitHash(GitObject::findObject("topic"));
+    ASSERT_EQ(parentsOf(crossed), (std::vector{theirs.data(), ours.data()}));
+    auto bases = GitCommands::mergeBases(head, crossed);
+    std::sort(bases.begin(), bases.end());
+    auto expected = std::vector{ours, theirs};
+    std::sort(expected.begin(), expected.end());
+    ASSERT_EQ(bases, expected);
+
+    // a conflict refuses to merge into another branch, and stops a merge
+    // into the current one until it is resolved with add and committed
+    Utilities::writeToFile("b.txt", "ours\n");
+    GitCommands::commit("ours b");
+    ours = GitHash(GitRepository::HEAD());
+    GitCommands::createBranch("conflicting");
+    GitCommands::checkout("topic");
+    Utilities::writeToFile("b.txt", "theirs\n");
+    GitCommands::commit("theirs b");
+    theirs = GitHash(GitRepository::HEAD());
+    GitCommands::checkout("master");
+    ASSERT_THROW(GitCommands::merge("topic", "", "conflicting"),
+                 std::runtime_error);
+    ASSERT_EQ(GitObject::findObject("conflicting"), ours);
+
+    GitCommands::merge("topic");
+    ASSERT_EQ(GitRepository::HEAD(), ours.data());
+    ASSERT_EQ(Utilities::readFile("b.txt"),
+              "<<<<<<< HEAD\nours\n=======\ntheirs\n>>>>>>> topic");
+    auto index = GitCommands::readIndex();
+    ASSERT_FALSE(index.find("b.txt"));
+    ASSERT_TRUE(index.find("b.txt", 1) && index.find("b.txt", 2) &&
+                index.find("b.txt", 3));
+    auto status = GitCommands::collectStatus();
+    ASSERT_TRUE(status.staged.empty());
+    ASSERT_EQ(status.unstaged,
+              (std::vector<GitCommands::FileStatus>{{'U', "b.txt"}}));
+    ASSERT_TRUE(status.untracked.empty());
+    ASSERT_THROW(GitCommands::merge("topic"), std::runtime_error);
+
+    Utilities::writeToFile("b.txt", "both\n");
+    ASSERT_THROW(GitCommands::commit("resolved"), std::runtime_error);
+    ASSERT_EQ(GitRepository::HEAD(), ours.data());
+    GitCommands::add({"b.txt"});
+    index = GitCommands::readIndex();
+    ASSERT_TRUE(index.find("b.txt"));
+    ASSERT_FALSE(index.find("b.txt", 1) || index.find("b.txt", 2) ||
+                 index.find("b.txt", 3));
+    GitCommands::commit("resolved");
+    ASSERT_EQ(parentsOf(GitHash(GitRepository::HEAD())),
+              (std::vector{ours.data(), theirs.data()}));
+    ASSERT_FALSE(
+        std::filesystem::exists(GitRepository::repoPath("MERGE_HEAD")));
+    ASSERT_TRUE(GitCommands::collectStatus().unstaged.empty());
+}
+
 TEST_F(GitCommandsTest, GitCreateBranch)
 {
     std::string fileOne = "file1.txt";
@@ -172,6 +1174,210 @@ TEST_F(GitCommandsTest, GitCreateBranch)
     ASSERT_EQ(fileOneContent, firstCommitFileOneContent);
 }
 
+TEST_F(GitCommandsTest, PackedRefs)
+{
+    Utilities::writeToFile("file.txt", "first");
+    GitCommands::commit("first");
+    GitCommands::createBranch("topic");
+    auto first = GitRepository::HEAD();
+    Utilities::writeToFile("file.txt", "second");
+    GitCommands::commit("second");
+    auto second = GitRepository::HEAD();
+
+    // gc moves every ref to packed-refs
+    ASSERT_EQ(std::system("git gc -q"), 0);
+    ASSERT_FALSE(std::filesystem::exists(
+        GitRepository::repoPath("refs", "heads", "master")));
+    ASSERT_TRUE(GitRepository::hasReference("refs/heads/topic"));
+
+    ASSERT_EQ(GitRepository::HEAD(), second);
+    ASSERT_EQ(GitObject::findObject("master"), GitHash(second));
+    ASSERT_EQ(GitObject::findObject("topic"), GitHash(first));
+    auto refs = GitCommands::getAll(GitRepository::repoDir("refs"));
+    ASSERT_EQ(refs[first],
+              std::vector{GitRepository::repoPath("refs", "heads", "topic")});
+
+    // a new commit has the packed one as its parent, and its loose ref takes
+    // over from the packed one
+    Utilities::writeToFile("file.txt", "third");
+    GitCommands::commit("third");
+    auto third = GitHash(GitRepository::HEAD());
+    auto object = GitObjectCache::read(third);
+    ASSERT_EQ(static_cast<const GitCommit*>(object.get())
+                  ->commitMessage()
+                  .parents,
+              std::vector{second});
+    ASSERT_EQ(GitObject::findObject("master"), third);
+
+    GitCommands::checkout("topic");
+    ASSERT_EQ(GitRepository::HEAD(HeadType::REF), "ref: refs/heads/topic");
+    ASSERT_EQ(Utilities::readFile("file.txt"), "first");
+}
+
+TEST_F(GitCommandsTest, Repack)
+{
+    std::string fileOne = "file1.txt";
+    std::string content;
+    for (int i = 0; i < 200; ++i) {
+        content += fmt::format("line {}\n", i);
+    }
+    Utilities::writeToFile(fileOne, content);
+    GitCommands::commit("first version");
+    auto firstCommit = GitRepository::HEAD();
+
+    Utilities::writeToFile(fileOne, content + "one more line\n");
+    GitCommands::commit("second version");
+    auto secondCommit = GitRepository::HEAD();
+
+    GitCommands::repack(true, 10, 50);
+
+    auto objectsDir = REPO_PATH / ".git" / "objects";
+    for (const auto& dirEntry :
+         std::filesystem::directory_iterator(objectsDir)) {
+        auto name = dirEntry.path().filename();
+        EXPECT_TRUE(name == "pack" || name == "info") << name;
+    }
+
+    // both versions of file1.txt are read back from the pack, one of them
+    // through a delta
+    GitCommands::checkout(firstCommit);
+    ASSERT_EQ(Utilities::readFile(fileOne) + '\n', content);
+    GitCommands::checkout(secondCommit);
+    ASSERT_EQ(Utilities::readFile(fileOne) + '\n',
+              content + "one more line\n");
+    ASSERT_EQ(GitObject::findObject(secondCommit.substr(0, 8)),
+              GitHash(secondCommit));
+}
+
+TEST_F(GitCommandsTest, RepackKeepsObjects)
+{
+    Utilities::writeToFile("file.txt", "committed");
+    GitCommands::commit("first");
+    Utilities::writeToFile("staged.txt", "only staged");
+    auto staged = GitCommands::hashObject("staged.txt", "blob", false);
+    GitCommands::add({"staged.txt"});
+    Utilities::writeToFile("unreachable.txt", "not referenced");
+    auto unreachable = GitCommands::hashObject("unreachable.txt", "blob");
+
+    // the staged blob is only in git's pack, the unreachable one only in a
+    // pack of its own
+    ASSERT_EQ(std::system("git repack -adq"), 0);
+    ASSERT_EQ(std::system(fmt::format("echo {} | git pack-objects -q "
+                                      ".git/objects/pack/pack >/dev/null",
+                                      unreachable)
+                              .c_str()),
+              0);
+    std::filesystem::remove(REPO_PATH / ".git" / "objects" /
+                            Utilities::getObjectDirectory(unreachable) /
+                            Utilities::getObjectFileName(unreachable));
+
+    GitCommands::repack(true, 10, 50);
+    ASSERT_EQ(GitObjectFactory::readRaw(staged).data, "only staged");
+    ASSERT_EQ(GitObjectFactory::readRaw(unreachable).data, "not referenced");
+    // git's pack had nothing the new one doesn't have
+    size_t numberOfPacks = 0;
+    for (const auto& dirEntry : std::filesystem::directory_iterator(
+             REPO_PATH / ".git" / "objects" / "pack")) {
+        numberOfPacks += dirEntry.path().extension() == ".idx";
+    }
+    ASSERT_EQ(numberOfPacks, 2);
+}
+
+TEST_F(GitCommandsTest, ReadHeader)
+{
+    std::string bigFile = "big.bin";
+    std::string content;
+    for (int i = 0; i < 100000; ++i) {
+        content += fmt::format("{} ", i * 7919 % 100003);
+    }
+    Utilities::writeToFile(bigFile, content);
+    auto firstBlob = GitCommands::hashObject(bigFile, "blob");
+    GitCommands::commit("big file");
+    Utilities::writeToFile(bigFile, "changed " + content);
+    auto secondBlob = GitCommands::hashObject(bigFile, "blob");
+    GitCommands::commit("changed big file");
+    auto commit = GitHash(GitRepository::HEAD());
+
+    auto checkHeaders = [&]() {
+        for (const auto& hash : {firstBlob, secondBlob, commit}) {
+            auto raw = GitObjectFactory::readRaw(hash);
+            auto header = GitObjectFactory::readHeader(hash);
+            ASSERT_EQ(header.format, raw.format);
+            ASSERT_EQ(header.size, raw.data.size());
+        }
+    };
+    checkHeaders();
+    // one of the blobs is stored as a delta of the other
+    GitCommands::repack(true, 10, 50);
+    checkHeaders();
+}
+
+TEST_F(GitCommandsTest, ReadGitPack)
+{
+    std::string fileOne = "file1.txt";
+    std::string content;
+    std::vector<std::pair<GitHash, std::string>> blobs;
+    for (int i = 0; i < 20; ++i) {
+        content += fmt::format("line {} of the file\n", i);
+        Utilities::writeToFile(fileOne, content);
+        blobs.emplace_back(GitCommands::hashObject(fileOne, "blob"), content);
+        GitCommands::commit(fmt::format("version {}", i));
+    }
+
+    auto checkBlobs = [&]() {
+        for (const auto& [hash, data] : blobs) {
+            auto raw = GitObjectFactory::readRaw(hash);
+            ASSERT_EQ(raw.format, "blob");
+            ASSERT_EQ(raw.data, data);
+            auto header = GitObjectFactory::readHeader(hash);
+            ASSERT_EQ(header.format, "blob");
+            ASSERT_EQ(header.size, data.size());
+        }
+    };
+    // packs written by git itself, first with deltas referring to their bases
+    // by hash, then by offset
+    ASSERT_EQ(std::system("git -c repack.useDeltaBaseOffset=false "
+                          "repack -adfq"),
+              0);
+    checkBlobs();
+    ASSERT_EQ(std::system("git repack -adfq"), 0);
+    checkBlobs();
+}
+
+TEST_F(GitCommandsTest, ObjectCache)
+{
+    std::vector<GitHash> commits;
+    for (int i = 0; i < 3; ++i) {
+        Utilities::writeToFile("file.txt", fmt::format("version {}", i));
+        GitCommands::commit(fmt::format("commit {}", i));
+        commits.emplace_back(GitRepository::HEAD());
+    }
+
+    boost::property_tree::ptree config;
+    config.put("core.objectCacheLimit", "1k");
+    boost::property_tree::write_ini(".git/config", config);
+    GitObjectCache::clear();
+
+    for (const auto& commit : commits) {
+        GitObjectCache::read(commit);
+    }
+    // the oldest commit didn't fit into the limit along with the others
+    auto statistics = GitObjectCache::statistics();
+    ASSERT_EQ(statistics.limit, 1024);
+    ASSERT_EQ(statistics.misses, 3);
+    ASSERT_EQ(statistics.evictions, 1);
+    ASSERT_LE(statistics.size, statistics.limit);
+
+    auto newest = GitObjectCache::read(commits.back());
+    ASSERT_EQ(GitObjectCache::read(commits.back()), newest);
+    GitObjectCache::read(commits.front());
+    statistics = GitObjectCache::statistics();
+    ASSERT_EQ(statistics.hits, 2);
+    ASSERT_EQ(statistics.misses, 4);
+
+    GitObjectCache::clear();
+}
+
 // TODO: move to separate file
 TEST(GitUtility, FileMode)
 {
@@ -236,6 +1442,218 @@ TEST(GitUtility, FileMode)
     }
 }
 
+TEST(GitUtility, SharedObjectData)
+{
+    auto data = ObjectData(std::string(1024, 'x'));
+    auto blob = GitObjectFactory::create("blob", data);
+    // the blob keeps the same buffer, no copy is made on the way
+    ASSERT_EQ(blob->serialize().data().data(), data.data().data());
+
+    auto commit = GitObjectFactory::create(
+        "commit", ObjectData("tree 29ff16c9c14e2652b22f8b78bb08a5a07930c147\n"
+                             "author Joe Doe <joedoe@email.com>\n"
+                             "committer Joe Doe <joedoe@email.com>\n"
+                             "\n"
+                             "message\n"));
+    auto& commitMessage =
+        static_cast<GitCommit*>(commit.get())->commitMessage();
+    ASSERT_EQ(commitMessage.tree, "29ff16c9c14e2652b22f8b78bb08a5a07930c147");
+    ASSERT_EQ(commitMessage.message, "message\n");
+}
+
+TEST(GitUtility, TreeView)
+{
+    auto blobHash = GitHash("0cfbf08886fca9a91cb753ec8734c84fcbe52c9f");
+    auto treeHash = GitHash("2d3d9eb895e326014beef1b73a3824fd5f23e03c");
+    GitTree tree({{.fileMode = "40000", .filePath = "a", .hash = treeHash},
+                  {.fileMode = "100755", .filePath = "y", .hash = blobHash}});
+    auto parsed = GitObjectFactory::create("tree", tree.serialize());
+    auto entries = static_cast<GitTree*>(parsed.get())->entries();
+
+    auto entry = entries.begin();
+    ASSERT_EQ(entry->mode, 040000);
+    ASSERT_EQ(entry->name, "a");
+    ASSERT_EQ(entry->objectHash(), treeHash);
+    ASSERT_EQ(GitTree::formatOf(entry->mode), "tree");
+    ++entry;
+    ASSERT_EQ(entry->mode, 0100755);
+    ASSERT_EQ(entry->name, "y");
+    ASSERT_EQ(entry->objectHash(), blobHash);
+    ASSERT_EQ(GitTree::formatOf(entry->mode), "blob");
+    ASSERT_EQ(++entry, entries.end());
+
+    // the vector of leaves is built from the same entries
+    const auto& leaves = static_cast<GitTree*>(parsed.get())->tree();
+    ASSERT_EQ(leaves.size(), 2);
+    ASSERT_EQ(leaves[0].fileMode, "040000");
+    ASSERT_EQ(leaves[1].filePath, "y");
+
+    auto truncated = tree.serialize().data();
+    truncated.remove_suffix(1);
+    ASSERT_THROW((void)std::distance(GitTreeView(truncated).begin(),
+                                     GitTreeView(truncated).end()),
+                 std::runtime_error);
+}
+
+TEST(GitUtility, ApplyDelta)
+{
+    using namespace std::string_literals;
+    std::string base = "The quick brown fox jumps over the lazy dog";
+    // base size 43, result size 28, copy 16 bytes from offset 0,
+    // insert "cat", copy 9 bytes from offset 34
+    std::string delta = "\x2b\x1c"
+                        "\x91\x00\x10"
+                        "\x03"
+                        "cat"
+                        "\x91\x22\x09"s;
+    ASSERT_EQ(GitDelta::resultSize(delta), 28);
+    ASSERT_EQ(GitDelta::apply(base, delta), "The quick brown cat lazy dog");
+
+    EXPECT_THROW(GitDelta::apply("too short", delta), std::runtime_error);
+}
+
+TEST(GitUtility, ZlibStreaming)
+{
+    std::string original;
+    for (int i = 0; i < 100000; ++i) {
+        original += std::to_string(i * 7919 % 1000);
+    }
+
+    // compress in uneven pieces, decompress into a small buffer
+    std::string compressed;
+    Zlib::Deflater deflater;
+    auto sink = [&](std::string_view chunk) { compressed += chunk; };
+    for (size_t position = 0; position < original.size(); position += 1000) {
+        deflater.write(std::string_view(original).substr(position, 1000),
+                       sink);
+    }
+    deflater.finish(sink);
+    ASSERT_EQ(Zlib::decompress(compressed), original);
+
+    std::string decompressed;
+    Zlib::Inflater inflater;
+    inflater.setInput(compressed);
+    char buffer[333];
+    while (!inflater.finished()) {
+        auto produced = inflater.inflate(buffer, sizeof(buffer));
+        decompressed.append(buffer, produced);
+        ASSERT_FALSE(inflater.needsInput());
+    }
+    ASSERT_EQ(decompressed, original);
+    ASSERT_EQ(Zlib::decompress(compressed, original.size()), original);
+    EXPECT_THROW(Zlib::decompress(compressed, original.size() - 1),
+                 std::runtime_error);
+}
+
+TEST(GitUtility, SHA1Backends)
+{
+    auto hash = [](SHA1::Backend backend, std::string_view data) {
+        SHA1::Hasher hasher(backend);
+        hasher.update(data);
+        return hasher.finalize().data();
+    };
+    std::mt19937 random(7);
+    auto randomData = [&](size_t size) {
+        std::string data(size, '\0');
+        for (auto& byte : data) {
+            byte = static_cast<char>(random());
+        }
+        return data;
+    };
+
+    for (auto backend : SHA1::supportedBackends()) {
+        SCOPED_TRACE(SHA1::backendName(backend));
+        ASSERT_EQ(hash(backend, ""),
+                  "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+        ASSERT_EQ(hash(backend, "abc"),
+                  "a9993e364706816aba3e25717850c26c9cd0d89d");
+
+        // every padding case and odd and even numbers of whole blocks
+        std::vector<size_t> sizes;
+        for (size_t size = 0; size <= 300; ++size) {
+            sizes.push_back(size);
+        }
+        sizes.insert(sizes.end(), {4096, 65536 + 55, 1000003});
+        for (auto size : sizes) {
+            auto data = randomData(size);
+            auto expected = hash(SHA1::Backend::SCALAR, data);
+            ASSERT_EQ(hash(backend, data), expected) << size;
+
+            // the same data, fed in random pieces
+            SHA1::Hasher hasher(backend);
+            for (size_t position = 0; position < data.size();) {
+                auto piece = std::min<size_t>(random() % 150,
+                                              data.size() - position);
+                hasher.update(std::string_view(data).substr(position, piece));
+                position += piece;
+            }
+            ASSERT_EQ(hasher.finalize().data(), expected) << size;
+        }
+    }
+}
+
+TEST(GitUtility, GitHash)
+{
+    static_assert(std::is_trivially_copyable_v<GitHash>);
+    const std::string hex = "0123456789abcdef00ff7f80fedcba9876543210";
+    GitHash hash(hex);
+    ASSERT_EQ(hash.data(), hex);
+    ASSERT_EQ(fmt::format("{}", hash), hex);
+    ASSERT_EQ(hash.bytes()[1], '\x23');
+    ASSERT_EQ(GitHash::fromBytes(hash.bytes().data()), hash);
+    ASSERT_EQ(GitHash(GitHash::convertToBinary(hash)), hash);
+
+    // upper case names refer to the same object
+    ASSERT_EQ(GitHash("0123456789ABCDEF00FF7F80FEDCBA9876543210"), hash);
+    ASSERT_FALSE(GitHash::fromHex("0123456789abcdef00ff7f80fedcba987654321"));
+    ASSERT_FALSE(GitHash::fromHex("0123456789abcdef00ff7f80fedcba987654321g"));
+    ASSERT_THROW(GitHash("HEAD"), std::runtime_error);
+
+    // ordered like their hexadecimal representation, as in pack indexes
+    std::mt19937 random(3);
+    std::vector<GitHash> hashes;
+    for (int i = 0; i < 100; ++i) {
+        std::string bytes(Git::BinaryHash::SIZE, '\0');
+        for (auto& byte : bytes) {
+            byte = static_cast<char>(random());
+        }
+        hashes.push_back(GitHash::fromBytes(bytes.data()));
+    }
+    for (size_t i = 1; i < hashes.size(); ++i) {
+        ASSERT_EQ(hashes[i - 1] < hashes[i],
+                  hashes[i - 1].data() < hashes[i].data());
+    }
+    std::unordered_set<GitHash> unique(hashes.begin(), hashes.end());
+    unique.insert(hashes.begin(), hashes.end());
+    ASSERT_EQ(unique.size(), hashes.size());
+    ASSERT_TRUE(unique.contains(hashes[42]));
+}
+
+TEST(GitUtility, ThreadPool)
+{
+    // every task waits for the tasks it submitted, deeper than the number
+    // of threads
+    for (size_t threads : {0, 1, 4}) {
+        Utilities::ThreadPool pool(threads);
+        std::function<size_t(size_t)> countLeaves = [&](size_t depth) {
+            if (depth == 0) {
+                return size_t(1);
+            }
+            auto left =
+                pool.submit([&, depth] { return countLeaves(depth - 1); });
+            auto right = countLeaves(depth - 1);
+            return pool.wait(left) + right;
+        };
+        auto total = pool.submit([&] { return countLeaves(10); });
+        ASSERT_EQ(pool.wait(total), 1024);
+
+        auto failing = pool.submit([]() -> int {
+            throw std::runtime_error("task failed");
+        });
+        ASSERT_THROW(pool.wait(failing), std::runtime_error);
+    }
+}
+
 int main(int argc, char* argv[])
 {
     ::testing::InitGoogleTest(&argc, argv);
@@ -1,23 +1,60 @@
 #include "Common.hpp"
 
+#include <cerrno>
+#include <fcntl.h>
 #include <fstream>
-#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace Utilities {
 std::string readFile(const std::filesystem::path& filePath)
 {
-    std::ifstream ifs(filePath.string(), std::ios::in | std::ios::binary);
+    std::ifstream ifs(filePath.string(),
+                      std::ios::in | std::ios::binary | std::ios::ate);
     if (!ifs.is_open()) {
         GENERATE_EXCEPTION("No such file or directory: {}", filePath.string());
     }
-    std::ostringstream data;
-    data << ifs.rdbuf();
-    // NOTE: probably there is more efficient way to do this
-    auto strData = data.str();
-    if (strData.back() == '\n') {
-        strData.pop_back();
+    std::string data(static_cast<size_t>(ifs.tellg()), '\0');
+    ifs.seekg(0);
+    ifs.read(data.data(), data.size());
+    if (!data.empty() && data.back() == '\n') {
+        data.pop_back();
     }
-    return strData;
+    return data;
+}
+
+bool tryReadFile(const std::filesystem::path& filePath, std::string& content)
+{
+    int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            return false;
+        }
+        GENERATE_EXCEPTION("Couldn't open {}", filePath.string());
+    }
+
+    struct stat fileStat;
+    if (::fstat(fd, &fileStat) != 0) {
+        ::close(fd);
+        GENERATE_EXCEPTION("Couldn't stat {}", filePath.string());
+    }
+    content.resize(fileStat.st_size);
+
+    size_t done = 0;
+    while (done < content.size()) {
+        auto bytesRead =
+            ::read(fd, content.data() + done, content.size() - done);
+        if (bytesRead <= 0) {
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            ::close(fd);
+            GENERATE_EXCEPTION("Couldn't read {}", filePath.string());
+        }
+        done += bytesRead;
+    }
+    ::close(fd);
+    return true;
 }
 
 void writeToFile(const std::filesystem::path& filePath, const std::string& data,
@@ -13,6 +13,9 @@ namespace Utilities {
 #define DEBUG(value) std::cout << #value << ": " << value << std::endl;
 
 std::string readFile(const std::filesystem::path& filePath);
+// Reads the file as is into content, reusing its memory. Returns false when
+// the file doesn't exist.
+bool tryReadFile(const std::filesystem::path& filePath, std::string& content);
 void writeToFile(const std::filesystem::path& filePath, const std::string& data,
                  bool newLine = false);
 void writeToFile(const std::filesystem::path& filePath, const GitHash& hash);
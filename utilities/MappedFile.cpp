@@ -0,0 +1,66 @@
+#include "MappedFile.hpp"
+#include "Common.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Utilities {
+MappedFile::MappedFile(const std::filesystem::path& filePath)
+{
+    int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        GENERATE_EXCEPTION("No such file or directory: {}", filePath.string());
+    }
+
+    struct stat fileStat;
+    if (::fstat(fd, &fileStat) != 0) {
+        ::close(fd);
+        GENERATE_EXCEPTION("Couldn't stat {}", filePath.string());
+    }
+
+    m_size = fileStat.st_size;
+    if (m_size != 0) {
+        void* mapping = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            GENERATE_EXCEPTION("Couldn't map {} into memory",
+                               filePath.string());
+        }
+        m_data = static_cast<const unsigned char*>(mapping);
+    }
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() { unmap(); }
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : m_data(other.m_data), m_size(other.m_size)
+{
+    other.m_data = nullptr;
+    other.m_size = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other) {
+        unmap();
+        m_data = other.m_data;
+        m_size = other.m_size;
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+void MappedFile::unmap()
+{
+    if (m_data != nullptr) {
+        ::munmap(const_cast<unsigned char*>(m_data), m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
+}; // namespace Utilities
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+namespace Utilities {
+// Read-only memory mapping of a whole file. The mapping lives as long as the
+// object, so views returned by data() must not outlive it.
+class MappedFile {
+  public:
+    MappedFile() = default;
+    explicit MappedFile(const std::filesystem::path& filePath);
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    std::string_view view() const
+    {
+        return {reinterpret_cast<const char*>(m_data), m_size};
+    }
+
+  private:
+    void unmap();
+
+  private:
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+};
+}; // namespace Utilities
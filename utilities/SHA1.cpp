@@ -1,43 +1,116 @@
 #include "SHA1.hpp"
+#include "SHA1Backends.hpp"
 
-#include <boost/uuid/detail/sha1.hpp>
-#include <sstream>
+#include <algorithm>
+#include <cstring>
 
 namespace Utilities {
-GitHash SHA1::computeHash(const std::string& data)
+GitHash SHA1::computeHash(std::string_view data)
 {
-    return GitHash(makeHashReadable(generateHash(data)));
+    Hasher hasher;
+    hasher.update(data);
+    return hasher.finalize();
 }
 
-std::string SHA1::generateHash(const std::string& data)
+std::vector<SHA1::Backend> SHA1::supportedBackends()
 {
-    static constexpr uint8_t HASH_SIZE_BYTES = 20;
-    static constexpr uint8_t DIGEST_SIZE_WORD = 5;
-
-    boost::uuids::detail::sha1 s;
-    s.process_bytes(data.c_str(), data.size());
-    unsigned int digest[DIGEST_SIZE_WORD];
-    s.get_digest(digest);
-
-    std::string hash(HASH_SIZE_BYTES, '\0');
-    for (int i = 0; i < DIGEST_SIZE_WORD; ++i) {
-        const char* tmp = reinterpret_cast<char*>(digest);
-        hash[i * 4] = tmp[i * 4 + 3];
-        hash[i * 4 + 1] = tmp[i * 4 + 2];
-        hash[i * 4 + 2] = tmp[i * 4 + 1];
-        hash[i * 4 + 3] = tmp[i * 4];
-    }
-    return hash;
+    std::vector<Backend> backends{Backend::SCALAR};
+    if (SHA1Backends::cpuSupportsAvx2()) {
+        backends.push_back(Backend::AVX2);
+    }
+    if (SHA1Backends::cpuSupportsShaNi()) {
+        backends.push_back(Backend::SHA_NI);
+    }
+    return backends;
+}
+
+SHA1::Backend SHA1::defaultBackend()
+{
+    // ordered from the slowest to the fastest
+    static const auto backend = supportedBackends().back();
+    return backend;
+}
+
+std::string_view SHA1::backendName(Backend backend)
+{
+    switch (backend) {
+    case Backend::SCALAR:
+        return "scalar";
+    case Backend::AVX2:
+        return "avx2";
+    case Backend::SHA_NI:
+        return "sha-ni";
+    }
+    return "unknown";
 }
 
-std::string SHA1::makeHashReadable(const std::string& hash)
+SHA1::Hasher::Hasher() : Hasher(defaultBackend()) {}
+
+SHA1::Hasher::Hasher(Backend backend)
+    : m_state{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0}
 {
-    std::string res(hash.size() * 2, '\0');
-    std::string_view hexDigits = "0123456789abcdef";
-    for (size_t i = 0; i < hash.size(); ++i) {
-        res[i * 2] = hexDigits[(hash[i] >> 4) & 0xf];
-        res[i * 2 + 1] = hexDigits[hash[i] & 0xf];
+    switch (backend) {
+    case Backend::SCALAR:
+        m_compress = SHA1Backends::compressScalar;
+        break;
+    case Backend::AVX2:
+        m_compress = SHA1Backends::compressAvx2;
+        break;
+    case Backend::SHA_NI:
+        m_compress = SHA1Backends::compressShaNi;
+        break;
+    }
+}
+
+void SHA1::Hasher::update(std::string_view data)
+{
+    m_length += data.size();
+    auto bytes = reinterpret_cast<const unsigned char*>(data.data());
+    auto size = data.size();
+
+    if (m_blockSize > 0) {
+        auto toCopy = std::min(size, BLOCK_SIZE - m_blockSize);
+        std::memcpy(m_block + m_blockSize, bytes, toCopy);
+        m_blockSize += toCopy;
+        bytes += toCopy;
+        size -= toCopy;
+        if (m_blockSize < BLOCK_SIZE) {
+            return;
+        }
+        m_compress(m_state, m_block, 1);
+        m_blockSize = 0;
+    }
+
+    // whole blocks go straight from the input, without copying
+    if (auto blocks = size / BLOCK_SIZE; blocks > 0) {
+        m_compress(m_state, bytes, blocks);
+        bytes += blocks * BLOCK_SIZE;
+        size -= blocks * BLOCK_SIZE;
+    }
+    std::memcpy(m_block, bytes, size);
+    m_blockSize = size;
+}
+
+GitHash SHA1::Hasher::finalize()
+{
+    // 0x80, zeros up to 56 bytes modulo 64, then the length in bits
+    auto lengthInBits = m_length * 8;
+    unsigned char padding[BLOCK_SIZE + 8] = {0x80};
+    auto paddingSize = (m_blockSize < 56 ? 56 : 120) - m_blockSize;
+    for (int i = 0; i < 8; ++i) {
+        padding[paddingSize + i] =
+            static_cast<unsigned char>(lengthInBits >> (56 - i * 8));
+    }
+    update(std::string_view(reinterpret_cast<const char*>(padding),
+                            paddingSize + 8));
+
+    unsigned char digest[20];
+    for (int i = 0; i < 5; ++i) {
+        digest[i * 4] = static_cast<unsigned char>(m_state[i] >> 24);
+        digest[i * 4 + 1] = static_cast<unsigned char>(m_state[i] >> 16);
+        digest[i * 4 + 2] = static_cast<unsigned char>(m_state[i] >> 8);
+        digest[i * 4 + 3] = static_cast<unsigned char>(m_state[i]);
     }
-    return res;
+    return GitHash::fromBytes(digest);
 }
-}; // namespace Utilities
\ No newline at end of file
+}; // namespace Utilities
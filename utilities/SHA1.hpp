@@ -1,21 +1,49 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "../git_objects/GitHash.hpp"
 
 namespace Utilities {
 class SHA1 {
   public:
-    static GitHash computeHash(const std::string& data);
+    // Implementations of the compression function, the fastest one the CPU
+    // supports is picked at runtime. SCALAR works everywhere and serves as
+    // the reference for the others.
+    enum class Backend { SCALAR, AVX2, SHA_NI };
+
+    // Hashes data that arrives in pieces, e.g. a file read chunk by chunk.
+    class Hasher {
+      public:
+        Hasher();
+        explicit Hasher(Backend backend);
+
+        void update(std::string_view data);
+        GitHash finalize();
+
+      private:
+        static constexpr size_t BLOCK_SIZE = 64;
+
+        void (*m_compress)(uint32_t*, const unsigned char*, size_t);
+        uint32_t m_state[5];
+        unsigned char m_block[BLOCK_SIZE];
+        size_t m_blockSize = 0;
+        uint64_t m_length = 0;
+    };
+
+    static GitHash computeHash(std::string_view data);
+
+    static std::vector<Backend> supportedBackends();
+    static Backend defaultBackend();
+    static std::string_view backendName(Backend backend);
 
   private:
     SHA1() = delete;
-
-    static std::string generateHash(const std::string& data);
-    static std::string makeHashReadable(const std::string& hash);
 };
 
 };
 
-using SHA1 = Utilities::SHA1;
\ No newline at end of file
+using SHA1 = Utilities::SHA1;
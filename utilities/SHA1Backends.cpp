@@ -0,0 +1,288 @@
+#include "SHA1Backends.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WYAGIT_SHA1_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+constexpr uint32_t ROUND_CONSTANTS[4] = {0x5a827999, 0x6ed9eba1, 0x8f1bbcdc,
+                                         0xca62c1d6};
+
+inline uint32_t rotateLeft(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+inline uint32_t loadBigEndian(const unsigned char* bytes)
+{
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+           (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+// The 80 rounds of a block, with the constant already added to the schedule.
+inline void runRounds(uint32_t state[5], const uint32_t* scheduleWithK)
+{
+    auto a = state[0], b = state[1], c = state[2], d = state[3],
+         e = state[4];
+    auto round = [&](uint32_t f, uint32_t wk) {
+        auto temp = rotateLeft(a, 5) + f + e + wk;
+        e = d;
+        d = c;
+        c = rotateLeft(b, 30);
+        b = a;
+        a = temp;
+    };
+    for (int t = 0; t < 20; ++t) {
+        round((b & c) | (~b & d), scheduleWithK[t]);
+    }
+    for (int t = 20; t < 40; ++t) {
+        round(b ^ c ^ d, scheduleWithK[t]);
+    }
+    for (int t = 40; t < 60; ++t) {
+        round((b & c) | (b & d) | (c & d), scheduleWithK[t]);
+    }
+    for (int t = 60; t < 80; ++t) {
+        round(b ^ c ^ d, scheduleWithK[t]);
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+}; // namespace
+
+namespace Utilities::SHA1Backends {
+void compressScalar(uint32_t state[5], const unsigned char* blocks,
+                    size_t numberOfBlocks)
+{
+    uint32_t schedule[80];
+    for (size_t block = 0; block < numberOfBlocks; ++block, blocks += 64) {
+        for (int t = 0; t < 16; ++t) {
+            schedule[t] = loadBigEndian(blocks + t * 4);
+        }
+        for (int t = 16; t < 80; ++t) {
+            schedule[t] = rotateLeft(schedule[t - 3] ^ schedule[t - 8] ^
+                                         schedule[t - 14] ^ schedule[t - 16],
+                                     1);
+        }
+        for (int t = 0; t < 80; ++t) {
+            schedule[t] += ROUND_CONSTANTS[t / 20];
+        }
+        runRounds(state, schedule);
+    }
+}
+}; // namespace Utilities::SHA1Backends
+
+#ifdef WYAGIT_SHA1_X86
+namespace {
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define SHA_NI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+AVX2_TARGET inline __m256i rotateLeft256(__m256i value, int bits)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(value, bits),
+                           _mm256_srli_epi32(value, 32 - bits));
+}
+
+// Fills the schedule (plus constants) of two blocks, one per 128 bits lane.
+// Four words are computed at once: words 16 to 31 use the recurrence as is,
+// where the last word depends on the first one of the same group, later
+// words use the equivalent W[t] = rol2(W[t-6] ^ W[t-16] ^ W[t-28] ^ W[t-32])
+// which has no such dependency.
+AVX2_TARGET void scheduleTwoBlocks(const unsigned char* first,
+                                   const unsigned char* second,
+                                   uint32_t* firstSchedule,
+                                   uint32_t* secondSchedule)
+{
+    const auto byteSwap = _mm256_set_epi8(
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15,
+        8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i words[20];
+    for (int i = 0; i < 4; ++i) {
+        auto low = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(first + i * 16));
+        auto high = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(second + i * 16));
+        words[i] = _mm256_shuffle_epi8(
+            _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1),
+            byteSwap);
+    }
+    for (int i = 4; i < 8; ++i) {
+        auto value = _mm256_xor_si256(
+            _mm256_xor_si256(words[i - 4],
+                             _mm256_alignr_epi8(words[i - 3], words[i - 4], 8)),
+            _mm256_xor_si256(words[i - 2], _mm256_srli_si256(words[i - 1], 4)));
+        auto result = rotateLeft256(value, 1);
+        // the last word needs W[t-3], the first word of this group
+        words[i] = _mm256_xor_si256(
+            result, rotateLeft256(_mm256_slli_si256(value, 12), 2));
+    }
+    for (int i = 8; i < 20; ++i) {
+        auto sixBack = _mm256_alignr_epi8(words[i - 1], words[i - 2], 8);
+        auto value = _mm256_xor_si256(
+            _mm256_xor_si256(words[i - 8], words[i - 7]),
+            _mm256_xor_si256(words[i - 4], sixBack));
+        words[i] = rotateLeft256(value, 2);
+    }
+    for (int i = 0; i < 20; ++i) {
+        auto withK = _mm256_add_epi32(
+            words[i], _mm256_set1_epi32(int(ROUND_CONSTANTS[i / 5])));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(firstSchedule + i * 4),
+                         _mm256_castsi256_si128(withK));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(secondSchedule + i * 4),
+                         _mm256_extracti128_si256(withK, 1));
+    }
+}
+
+// Four rounds per step, the schedule is computed three steps ahead with
+// msg1, xor and msg2 on the rotating message registers.
+template <int STEP>
+SHA_NI_TARGET inline void shaNiSteps(__m128i& abcd, __m128i (&e)[2],
+                                     __m128i (&messages)[4])
+{
+    auto& current = e[STEP % 2];
+    auto& next = e[(STEP + 1) % 2];
+    if constexpr (STEP == 0) {
+        current = _mm_add_epi32(current, messages[0]);
+    } else {
+        current = _mm_sha1nexte_epu32(current, messages[STEP % 4]);
+    }
+    next = abcd;
+    if constexpr (STEP >= 3 && STEP <= 18) {
+        messages[(STEP + 1) % 4] =
+            _mm_sha1msg2_epu32(messages[(STEP + 1) % 4], messages[STEP % 4]);
+    }
+    abcd = _mm_sha1rnds4_epu32(abcd, current, STEP / 5);
+    if constexpr (STEP >= 1 && STEP <= 16) {
+        messages[(STEP + 3) % 4] =
+            _mm_sha1msg1_epu32(messages[(STEP + 3) % 4], messages[STEP % 4]);
+    }
+    if constexpr (STEP >= 2 && STEP <= 17) {
+        messages[(STEP + 2) % 4] =
+            _mm_xor_si128(messages[(STEP + 2) % 4], messages[STEP % 4]);
+    }
+    if constexpr (STEP < 19) {
+        shaNiSteps<STEP + 1>(abcd, e, messages);
+    }
+}
+
+void cpuid(unsigned leaf, unsigned subleaf, unsigned& eax, unsigned& ebx,
+           unsigned& ecx, unsigned& edx)
+{
+    eax = ebx = ecx = edx = 0;
+    __cpuid_count(leaf, subleaf, eax, ebx, ecx, edx);
+}
+
+unsigned maximumLeaf() { return __get_cpuid_max(0, nullptr); }
+
+// AVX registers are only usable if the OS saves them on context switches.
+bool osSavesAvxState()
+{
+    unsigned eax, ebx, ecx, edx;
+    cpuid(1, 0, eax, ebx, ecx, edx);
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) {
+        return false;
+    }
+    uint32_t low, high;
+    __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return (low & 0x6) == 0x6;
+}
+}; // namespace
+
+namespace Utilities::SHA1Backends {
+AVX2_TARGET void compressAvx2(uint32_t state[5], const unsigned char* blocks,
+                              size_t numberOfBlocks)
+{
+    uint32_t first[80], second[80];
+    while (numberOfBlocks > 0) {
+        // an odd block is scheduled twice rather than handled separately
+        auto pair = numberOfBlocks >= 2 ? blocks + 64 : blocks;
+        scheduleTwoBlocks(blocks, pair, first, second);
+        runRounds(state, first);
+        if (numberOfBlocks == 1) {
+            break;
+        }
+        runRounds(state, second);
+        blocks += 128;
+        numberOfBlocks -= 2;
+    }
+}
+
+SHA_NI_TARGET void compressShaNi(uint32_t state[5],
+                                 const unsigned char* blocks,
+                                 size_t numberOfBlocks)
+{
+    const auto byteSwap =
+        _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    auto abcd = _mm_shuffle_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+    __m128i e[2] = {_mm_set_epi32(int(state[4]), 0, 0, 0), _mm_setzero_si128()};
+
+    for (; numberOfBlocks > 0; --numberOfBlocks, blocks += 64) {
+        auto savedAbcd = abcd;
+        auto savedE = e[0];
+        __m128i messages[4];
+        for (int i = 0; i < 4; ++i) {
+            messages[i] = _mm_shuffle_epi8(
+                _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(blocks + i * 16)),
+                byteSwap);
+        }
+        shaNiSteps<0>(abcd, e, messages);
+        e[0] = _mm_sha1nexte_epu32(e[0], savedE);
+        abcd = _mm_add_epi32(abcd, savedAbcd);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state),
+                     _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = uint32_t(_mm_extract_epi32(e[0], 3));
+}
+
+bool cpuSupportsAvx2()
+{
+    if (maximumLeaf() < 7 || !osSavesAvxState()) {
+        return false;
+    }
+    unsigned eax, ebx, ecx, edx;
+    cpuid(7, 0, eax, ebx, ecx, edx);
+    return ebx & bit_AVX2;
+}
+
+bool cpuSupportsShaNi()
+{
+    if (maximumLeaf() < 7) {
+        return false;
+    }
+    unsigned eax, ebx, ecx, edx;
+    cpuid(1, 0, eax, ebx, ecx, edx);
+    if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return false;
+    }
+    cpuid(7, 0, eax, ebx, ecx, edx);
+    return ebx & bit_SHA;
+}
+}; // namespace Utilities::SHA1Backends
+#else
+namespace Utilities::SHA1Backends {
+// Never selected, as the CPU checks fail, but keeps the table of backends the
+// same on every architecture.
+void compressAvx2(uint32_t state[5], const unsigned char* blocks,
+                  size_t numberOfBlocks)
+{
+    compressScalar(state, blocks, numberOfBlocks);
+}
+
+void compressShaNi(uint32_t state[5], const unsigned char* blocks,
+                   size_t numberOfBlocks)
+{
+    compressScalar(state, blocks, numberOfBlocks);
+}
+
+bool cpuSupportsAvx2() { return false; }
+
+bool cpuSupportsShaNi() { return false; }
+}; // namespace Utilities::SHA1Backends
+#endif
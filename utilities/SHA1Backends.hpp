@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// SHA-1 compression functions behind Utilities::SHA1. Each one runs the
+// compression over whole 64 bytes blocks and updates the state in place.
+namespace Utilities::SHA1Backends {
+using Compress = void (*)(uint32_t state[5], const unsigned char* blocks,
+                          size_t numberOfBlocks);
+
+// Portable reference implementation.
+void compressScalar(uint32_t state[5], const unsigned char* blocks,
+                    size_t numberOfBlocks);
+
+// Rounds stay scalar, the message schedule of two blocks is computed at
+// once in 256 bits registers.
+void compressAvx2(uint32_t state[5], const unsigned char* blocks,
+                  size_t numberOfBlocks);
+
+// Intel SHA extensions, four rounds per instruction.
+void compressShaNi(uint32_t state[5], const unsigned char* blocks,
+                   size_t numberOfBlocks);
+
+bool cpuSupportsAvx2();
+bool cpuSupportsShaNi();
+}; // namespace Utilities::SHA1Backends
@@ -0,0 +1,99 @@
+#include "TemporaryFile.hpp"
+#include "Common.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Utilities {
+TemporaryFile::TemporaryFile(const std::filesystem::path& directory)
+{
+    auto pattern = (directory / "tmp_XXXXXX").string();
+    m_fd = ::mkstemp(pattern.data());
+    if (m_fd < 0) {
+        GENERATE_EXCEPTION("Couldn't create temporary file in {}",
+                           directory.string());
+    }
+    m_path = pattern;
+}
+
+TemporaryFile::TemporaryFile(std::filesystem::path path, int fd)
+    : m_path(std::move(path)), m_fd(fd)
+{
+}
+
+TemporaryFile::~TemporaryFile()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        ::unlink(m_path.c_str());
+    }
+}
+
+void TemporaryFile::write(std::string_view data)
+{
+    while (!data.empty()) {
+        auto written = ::write(m_fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            GENERATE_EXCEPTION("Couldn't write to {}", m_path.string());
+        }
+        data.remove_prefix(written);
+    }
+}
+
+void TemporaryFile::commit(const std::filesystem::path& destination,
+                           bool readOnly)
+{
+    // mkstemp creates files that only the owner can read
+    ::fchmod(m_fd, readOnly ? 0444 : 0644);
+    if (::close(m_fd) != 0) {
+        m_fd = -1;
+        ::unlink(m_path.c_str());
+        GENERATE_EXCEPTION("Couldn't write to {}", m_path.string());
+    }
+    m_fd = -1;
+    if (::rename(m_path.c_str(), destination.c_str()) != 0) {
+        ::unlink(m_path.c_str());
+        GENERATE_EXCEPTION("Couldn't move {} to {}", m_path.string(),
+                           destination.string());
+    }
+}
+
+namespace {
+int createLock(const std::filesystem::path& lockPath)
+{
+    int fd = ::open(lockPath.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                    0666);
+    if (fd < 0) {
+        if (errno == EEXIST) {
+            GENERATE_EXCEPTION("Unable to create '{}': File exists, another "
+                               "process seems to be running",
+                               lockPath.string());
+        }
+        GENERATE_EXCEPTION("Unable to create '{}'", lockPath.string());
+    }
+    return fd;
+}
+}; // namespace
+
+LockFile::LockFile(const std::filesystem::path& filePath)
+    : TemporaryFile(filePath.string() + ".lock",
+                    createLock(filePath.string() + ".lock")),
+      m_destination(filePath)
+{
+}
+
+void LockFile::commit() { TemporaryFile::commit(m_destination); }
+
+void writeFileAtomically(const std::filesystem::path& filePath,
+                         std::string_view data, bool readOnly)
+{
+    TemporaryFile file(filePath.parent_path());
+    file.write(data);
+    file.commit(filePath, readOnly);
+}
+}; // namespace Utilities
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+
+namespace Utilities {
+// File with a unique name, renamed into place once it's complete, so readers
+// never see it partially written. The file is removed if it is destroyed
+// before that. The destination is given at the end, so it can depend on the
+// content, e.g. the hash of an object.
+class TemporaryFile {
+  public:
+    // The directory has to be on the same filesystem as the destination.
+    explicit TemporaryFile(const std::filesystem::path& directory);
+    ~TemporaryFile();
+    TemporaryFile(const TemporaryFile&) = delete;
+    TemporaryFile& operator=(const TemporaryFile&) = delete;
+
+    void write(std::string_view data);
+    // Read-only files can't be changed by accident later, git does the same
+    // for objects.
+    void commit(const std::filesystem::path& destination,
+                bool readOnly = false);
+
+  protected:
+    TemporaryFile(std::filesystem::path path, int fd);
+
+  private:
+    std::filesystem::path m_path;
+    int m_fd = -1;
+};
+
+// Takes the lock on a file the way git does, by creating "<file>.lock",
+// which fails while someone else holds it. The new content is written to the
+// lock file and replaces the file on commit, the lock is released either way.
+class LockFile : public TemporaryFile {
+  public:
+    explicit LockFile(const std::filesystem::path& filePath);
+
+    void commit();
+
+  private:
+    std::filesystem::path m_destination;
+};
+
+void writeFileAtomically(const std::filesystem::path& filePath,
+                         std::string_view data, bool readOnly = false);
+}; // namespace Utilities
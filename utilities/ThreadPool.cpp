@@ -0,0 +1,107 @@
+#include "ThreadPool.hpp"
+
+namespace {
+// Queue of the current thread, threads outside of the pool share the last
+// one.
+thread_local const Utilities::ThreadPool* currentPool = nullptr;
+thread_local size_t currentQueue = 0;
+}; // namespace
+
+namespace Utilities {
+ThreadPool::ThreadPool(size_t numberOfThreads)
+{
+    for (size_t i = 0; i <= numberOfThreads; ++i) {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < numberOfThreads; ++i) {
+        m_threads.emplace_back([this, i] { work(i); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(m_sleepMutex);
+        m_stopping = true;
+    }
+    m_wakeUp.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::size() const { return m_threads.size(); }
+
+size_t ThreadPool::hardwareThreads()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void ThreadPool::push(Task task)
+{
+    auto index = currentPool == this ? currentQueue : m_threads.size();
+    ++m_pending;
+    {
+        std::lock_guard lock(m_queues[index]->mutex);
+        m_queues[index]->tasks.push_back(std::move(task));
+    }
+    // taking the lock orders this with a worker about to sleep, so the
+    // wake up can't be missed
+    {
+        std::lock_guard lock(m_sleepMutex);
+    }
+    m_wakeUp.notify_one();
+}
+
+bool ThreadPool::popTask(Task& task)
+{
+    auto own = currentPool == this ? currentQueue : m_threads.size();
+    {
+        auto& queue = *m_queues[own];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+    // steal the oldest task, usually the biggest piece of work left
+    for (size_t offset = 1; offset < m_queues.size(); ++offset) {
+        auto& queue = *m_queues[(own + offset) % m_queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::runPendingTask()
+{
+    Task task;
+    if (!popTask(task)) {
+        return false;
+    }
+    --m_pending;
+    task();
+    return true;
+}
+
+void ThreadPool::work(size_t index)
+{
+    currentPool = this;
+    currentQueue = index;
+    while (true) {
+        if (runPendingTask()) {
+            continue;
+        }
+        std::unique_lock lock(m_sleepMutex);
+        m_wakeUp.wait(lock, [this] { return m_stopping || m_pending > 0; });
+        if (m_stopping && m_pending == 0) {
+            return;
+        }
+    }
+}
+}; // namespace Utilities
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Utilities {
+// Every worker has its own queue, it runs its newest task first and takes the
+// oldest tasks of other workers when it runs out. Tasks may submit tasks and
+// wait for them: waiting runs other tasks meanwhile, so a recursive walk
+// can't use up all the threads by waiting.
+class ThreadPool {
+  public:
+    // The thread that waits for the results works too, so a pool of zero
+    // threads runs every task on it, one after another.
+    explicit ThreadPool(size_t numberOfThreads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template <typename Task>
+    auto submit(Task&& task) -> std::future<std::invoke_result_t<Task>>
+    {
+        using Result = std::invoke_result_t<Task>;
+        // std::function has to be copyable, a packaged_task isn't
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(
+            std::forward<Task>(task));
+        auto future = packaged->get_future();
+        push([packaged] { (*packaged)(); });
+        return future;
+    }
+
+    // Exceptions thrown by the task are rethrown here.
+    template <typename Result>
+    Result wait(std::future<Result>& future)
+    {
+        using namespace std::chrono_literals;
+        while (future.wait_for(0s) != std::future_status::ready) {
+            // the task may be running on another thread, which may submit
+            // new tasks, so the wait is short
+            if (!runPendingTask()) {
+                future.wait_for(100us);
+            }
+        }
+        return future.get();
+    }
+
+    size_t size() const;
+
+    // Number of threads the hardware runs at once, at least one.
+    static size_t hardwareThreads();
+
+  private:
+    using Task = std::function<void()>;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void push(Task task);
+    bool runPendingTask();
+    bool popTask(Task& task);
+    void work(size_t index);
+
+  private:
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_pending = 0;
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeUp;
+    bool m_stopping = false;
+};
+}; // namespace Utilities
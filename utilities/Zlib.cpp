@@ -1,49 +1,185 @@
 #include "Zlib.hpp"
 
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/filter/zlib.hpp>
-#include <boost/iostreams/filtering_stream.hpp>
-#include <fstream>
+#include <climits>
+#include <zlib.h>
 
 #include "../utilities/Common.hpp"
+#include "MappedFile.hpp"
+
+namespace {
+constexpr size_t CHUNK_SIZE = 64 * 1024;
+// zlib counts input and output in uInt, bigger buffers go in slices
+constexpr size_t MAX_SLICE = UINT_MAX;
+
+static_assert(Zlib::DEFAULT_COMPRESSION == Z_DEFAULT_COMPRESSION);
+static_assert(Zlib::BEST_SPEED == Z_BEST_SPEED);
+static_assert(Zlib::BEST_COMPRESSION == Z_BEST_COMPRESSION);
+}; // namespace
 
 namespace Zlib {
-namespace bio = boost::iostreams;
 
-std::string compress(const std::string& data)
+Inflater::Inflater() : m_stream(std::make_unique<z_stream>())
+{
+    if (inflateInit(m_stream.get()) != Z_OK) {
+        GENERATE_EXCEPTION("{}", "Couldn't initialize zlib stream");
+    }
+}
+
+Inflater::~Inflater() { inflateEnd(m_stream.get()); }
+
+void Inflater::reset()
+{
+    inflateReset(m_stream.get());
+    m_input = {};
+    m_finished = false;
+    m_needsInput = false;
+}
+
+void Inflater::setInput(std::string_view compressed)
+{
+    m_stream->avail_in = 0;
+    m_input = compressed;
+    m_needsInput = false;
+}
+
+size_t Inflater::inflate(char* output, size_t size)
+{
+    size_t produced = 0;
+    while (!m_finished && produced < size) {
+        if (m_stream->avail_in == 0 && !m_input.empty()) {
+            auto slice = std::min(m_input.size(), MAX_SLICE);
+            m_stream->next_in =
+                reinterpret_cast<Bytef*>(const_cast<char*>(m_input.data()));
+            m_stream->avail_in = static_cast<uInt>(slice);
+            m_input.remove_prefix(slice);
+        }
+        auto slice = std::min(size - produced, MAX_SLICE);
+        m_stream->next_out = reinterpret_cast<Bytef*>(output + produced);
+        m_stream->avail_out = static_cast<uInt>(slice);
+        auto status = ::inflate(m_stream.get(), Z_NO_FLUSH);
+        produced += slice - m_stream->avail_out;
+        if (status == Z_STREAM_END) {
+            m_finished = true;
+        }
+        else if (status == Z_BUF_ERROR) {
+            // nothing left to inflate until more input arrives
+            m_needsInput = true;
+            break;
+        }
+        else if (status != Z_OK) {
+            GENERATE_EXCEPTION("Corrupted zlib stream: {}",
+                               m_stream->msg ? m_stream->msg : "");
+        }
+    }
+    return produced;
+}
+
+bool Inflater::finished() const { return m_finished; }
+
+bool Inflater::needsInput() const { return m_needsInput; }
+
+Deflater::Deflater(int level) : m_stream(std::make_unique<z_stream>())
 {
-    std::istringstream origin(data);
+    if (deflateInit(m_stream.get(), level) != Z_OK) {
+        GENERATE_EXCEPTION("{}", "Couldn't initialize zlib stream");
+    }
+}
 
-    bio::filtering_istreambuf in;
-    in.push(bio::zlib_compressor(bio::zlib::best_compression));
-    in.push(origin);
+Deflater::~Deflater() { deflateEnd(m_stream.get()); }
 
-    std::ostringstream compressed;
-    bio::copy(in, compressed);
-    return compressed.str();
+void Deflater::write(std::string_view data, const Sink& sink)
+{
+    while (!data.empty()) {
+        auto slice = std::min(data.size(), MAX_SLICE);
+        m_stream->next_in =
+            reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        m_stream->avail_in = static_cast<uInt>(slice);
+        deflate(Z_NO_FLUSH, sink);
+        data.remove_prefix(slice);
+    }
 }
 
-void compress(const std::filesystem::path& filePath, const std::string& data)
+void Deflater::finish(const Sink& sink) { deflate(Z_FINISH, sink); }
+
+void Deflater::deflate(int flush, const Sink& sink)
 {
-    Utilities::writeToFile(filePath, compress(data));
+    char chunk[CHUNK_SIZE];
+    int status;
+    do {
+        m_stream->next_out = reinterpret_cast<Bytef*>(chunk);
+        m_stream->avail_out = CHUNK_SIZE;
+        status = ::deflate(m_stream.get(), flush);
+        if (status == Z_STREAM_ERROR) {
+            GENERATE_EXCEPTION("{}", "Couldn't compress data");
+        }
+        if (auto produced = CHUNK_SIZE - m_stream->avail_out; produced != 0) {
+            sink({chunk, produced});
+        }
+        // without new input the stream is done once deflate stops filling
+        // the whole chunk
+    } while (flush == Z_FINISH ? status != Z_STREAM_END
+                               : m_stream->avail_out == 0);
 }
 
-std::string decompress(const std::string& data)
+std::string compress(std::string_view data, int level)
 {
-    std::istringstream compressed(data);
+    auto compressedSize = compressBound(data.size());
+    std::string compressed(compressedSize, '\0');
+    if (compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressedSize,
+                  reinterpret_cast<const Bytef*>(data.data()), data.size(),
+                  level) != Z_OK) {
+        GENERATE_EXCEPTION("{}", "Couldn't compress data");
+    }
+    compressed.resize(compressedSize);
+    return compressed;
+}
 
-    bio::filtering_istreambuf in;
-    in.push(bio::zlib_decompressor());
-    in.push(compressed);
+std::string decompress(std::string_view data)
+{
+    Inflater inflater;
+    inflater.setInput(data);
 
-    std::ostringstream origin;
-    bio::copy(in, origin);
-    return origin.str();
+    // compressed text is usually a few times smaller than the original
+    std::string origin(std::max(data.size() * 4, CHUNK_SIZE), '\0');
+    size_t produced = 0;
+    while (true) {
+        produced += inflater.inflate(origin.data() + produced,
+                                     origin.size() - produced);
+        if (inflater.finished()) {
+            break;
+        }
+        if (inflater.needsInput()) {
+            GENERATE_EXCEPTION("{}", "Truncated zlib stream");
+        }
+        origin.resize(origin.size() * 2);
+    }
+    origin.resize(produced);
+    return origin;
 }
 
 std::string decompressFile(const std::filesystem::path& filePath)
 {
-    return decompress(Utilities::readFile(filePath));
+    Utilities::MappedFile file(filePath);
+    return decompress(file.view());
 }
 
-}; // namespace Zlib
\ No newline at end of file
+std::string decompress(std::string_view compressed, size_t decompressedSize)
+{
+    Inflater inflater;
+    inflater.setInput(compressed);
+
+    std::string origin(decompressedSize, '\0');
+    auto produced = inflater.inflate(origin.data(), origin.size());
+
+    // the end of the stream is only seen once there is room for more output
+    char sink;
+    if (!inflater.finished()) {
+        produced += inflater.inflate(&sink, 1);
+    }
+    if (!inflater.finished() || produced != decompressedSize) {
+        GENERATE_EXCEPTION("Corrupted zlib stream, expected {} bytes, got {}",
+                           decompressedSize, produced);
+    }
+    return origin;
+}
+}; // namespace Zlib
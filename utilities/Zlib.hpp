@@ -1,13 +1,77 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
+
+struct z_stream_s;
 
 namespace Zlib {
+constexpr int DEFAULT_COMPRESSION = -1;
+constexpr int BEST_SPEED = 1;
+constexpr int BEST_COMPRESSION = 9;
+
+// Receives compressed data chunk by chunk, so it can be written out without
+// keeping all of it in memory.
+using Sink = std::function<void(std::string_view)>;
+
+// Incremental decompression into buffers owned by the caller, so the output
+// can go straight to its final place.
+class Inflater {
+  public:
+    Inflater();
+    ~Inflater();
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+
+    // Starts a new stream, reusing the memory of the previous one.
+    void reset();
+
+    // The input has to stay alive until it is consumed.
+    void setInput(std::string_view compressed);
+
+    // Inflates until the output is full, the input runs out or the stream
+    // ends. Returns the number of bytes written to the output.
+    size_t inflate(char* output, size_t size);
+
+    bool finished() const;
+    // True when the stream can't go on without more input.
+    bool needsInput() const;
 
-std::string compress(const std::string& data);
-void compress(const std::filesystem::path& filePath, const std::string& data);
+  private:
+    std::unique_ptr<z_stream_s> m_stream;
+    // input not handed to zlib yet
+    std::string_view m_input;
+    bool m_finished = false;
+    bool m_needsInput = false;
+};
 
-std::string decompress(const std::string& data);
+class Deflater {
+  public:
+    explicit Deflater(int level = BEST_COMPRESSION);
+    ~Deflater();
+    Deflater(const Deflater&) = delete;
+    Deflater& operator=(const Deflater&) = delete;
+
+    void write(std::string_view data, const Sink& sink);
+    // Flushes what is left and ends the stream.
+    void finish(const Sink& sink);
+
+  private:
+    void deflate(int flush, const Sink& sink);
+
+  private:
+    std::unique_ptr<z_stream_s> m_stream;
+};
+
+std::string compress(std::string_view data, int level = BEST_COMPRESSION);
+
+std::string decompress(std::string_view data);
 std::string decompressFile(const std::filesystem::path& filePath);
-}; // namespace Zlib
\ No newline at end of file
+
+// Inflate a zlib stream whose decompressed size is known up front, e.g. a
+// packfile entry. Bytes after the end of the stream are ignored.
+std::string decompress(std::string_view compressed, size_t decompressedSize);
+}; // namespace Zlib